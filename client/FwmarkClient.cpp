@@ -64,7 +64,18 @@ FwmarkClient::~FwmarkClient() {
 }
 
 int FwmarkClient::send(FwmarkCommand* data, int fd, FwmarkConnectInfo* connectInfo) {
-    mChannel = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    return sendMessage(data, fd, connectInfo, false);
+}
+
+int FwmarkClient::sendOneway(FwmarkCommand* data, int fd, FwmarkConnectInfo* connectInfo) {
+    return sendMessage(data, fd, connectInfo, true);
+}
+
+int FwmarkClient::sendMessage(FwmarkCommand* data, int fd, FwmarkConnectInfo* connectInfo,
+                              bool oneway) {
+    // A oneway message never blocks: if the server's listen backlog or the socket buffer is full,
+    // connect() or sendmsg() fail with EAGAIN and the message is dropped.
+    mChannel = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | (oneway ? SOCK_NONBLOCK : 0), 0);
     if (mChannel == -1) {
         return -errno;
     }
@@ -102,8 +113,15 @@ int FwmarkClient::send(FwmarkCommand* data, int fd, FwmarkConnectInfo* connectIn
         memcpy(CMSG_DATA(cmsgh), &fd, sizeof(fd));
     }
 
-    if (TEMP_FAILURE_RETRY(sendmsg(mChannel, &message, 0)) == -1) {
-        return -errno;
+    // Oneway messages use MSG_NOSIGNAL: the app might not ignore SIGPIPE, and losing a report is
+    // not worth crashing it for.
+    if (TEMP_FAILURE_RETRY(sendmsg(mChannel, &message, oneway ? MSG_NOSIGNAL : 0)) == -1) {
+        return (oneway && errno == EAGAIN) ? 0 : -errno;
+    }
+
+    if (oneway) {
+        // The server does not reply to oneway commands.
+        return 0;
     }
 
     int error = 0;
@@ -40,6 +40,12 @@ public:
     // Returns 0 on success or a negative errno value on failure.
     int send(FwmarkCommand* data, int fd, FwmarkConnectInfo* connectInfo);
 
+    // Like send(), but does not wait for the fwmark server to process |data|, and drops it instead
+    // of blocking if the server is not keeping up. For commands whose result the caller ignores,
+    // i.e., ON_CONNECT_COMPLETE. Returns 0 if |data| was sent or dropped, or a negative errno
+    // value on failure.
+    int sendOneway(FwmarkCommand* data, int fd, FwmarkConnectInfo* connectInfo);
+
     // Env flag to control whether FwmarkClient sends any information at all about network events
     // back to the system server through FwmarkServer.
     static constexpr const char* ANDROID_NO_USE_FWMARK_CLIENT = "ANDROID_NO_USE_FWMARK_CLIENT";
@@ -50,6 +56,8 @@ public:
     static constexpr const char* ANDROID_FWMARK_METRICS_ONLY = "ANDROID_FWMARK_METRICS_ONLY";
 
 private:
+    int sendMessage(FwmarkCommand* data, int fd, FwmarkConnectInfo* connectInfo, bool oneway);
+
     int mChannel;
 };
 
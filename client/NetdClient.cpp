@@ -97,8 +97,9 @@ int netdClientConnect(int sockfd, const sockaddr* addr, socklen_t addrlen) {
         // TODO: get the netId from the socket mark once we have continuous benchmark runs
         FwmarkCommand command = {FwmarkCommand::ON_CONNECT_COMPLETE, /* netId (ignored) */ 0,
                 /* uid (filled in by the server) */ 0};
-        // Ignore return value since it's only used for logging
-        FwmarkClient().send(&command, sockfd, &connectInfo);
+        // Ignore return value since it's only used for logging. Don't wait for the server to
+        // process the report, so that this does not add a second round trip to every connect().
+        FwmarkClient().sendOneway(&command, sockfd, &connectInfo);
     }
     errno = connectErrno;
     return ret;
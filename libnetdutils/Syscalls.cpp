@@ -146,6 +146,14 @@ class RealSyscalls final : public Syscalls {
         return take(dst, rv);
     }
 
+    StatusOr<int> recvmmsg(Fd sock, mmsghdr* msgs, unsigned int vlen, int flags) const override {
+        auto rv = syscallRetry(::recvmmsg, sock.get(), msgs, vlen, flags, nullptr);
+        if (rv == -1) {
+            return statusFromErrno(errno, "recvmmsg() failed");
+        }
+        return rv;
+    }
+
     Status shutdown(Fd fd, int how) const override {
         auto rv = ::shutdown(fd.get(), how);
         if (rv == -1) {
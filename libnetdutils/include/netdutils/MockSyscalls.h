@@ -52,6 +52,8 @@ class MockSyscalls : public Syscalls {
                                                 const sockaddr* dst, socklen_t dstlen));
     MOCK_CONST_METHOD5(recvfrom, StatusOr<Slice>(Fd sock, const Slice dst, int flags, sockaddr* src,
                                                  socklen_t* srclen));
+    MOCK_CONST_METHOD4(recvmmsg, StatusOr<int>(Fd sock, mmsghdr* msgs, unsigned int vlen,
+                                               int flags));
     MOCK_CONST_METHOD2(shutdown, Status(Fd fd, int how));
     MOCK_CONST_METHOD1(close, Status(Fd fd));
 
@@ -67,6 +67,10 @@ class Syscalls {
     virtual StatusOr<Slice> recvfrom(Fd sock, const Slice dst, int flags, sockaddr* src,
                                      socklen_t* srclen) const = 0;
 
+    // Receive up to |vlen| datagrams in a single system call. Returns the number of datagrams
+    // received; the length and flags of each are written back to |msgs|.
+    virtual StatusOr<int> recvmmsg(Fd sock, mmsghdr* msgs, unsigned int vlen, int flags) const = 0;
+
     virtual Status shutdown(Fd fd, int how) const = 0;
 
     virtual Status close(Fd fd) const = 0;
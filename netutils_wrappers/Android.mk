@@ -14,6 +14,18 @@
 
 LOCAL_PATH := $(call my-dir)
 
+###
+### Build-time compiler for the expected command DFA.
+###
+include $(CLEAR_VARS)
+
+LOCAL_CFLAGS := -Wall -Werror
+LOCAL_CLANG := true
+LOCAL_MODULE := netutils-wrapper-matcher-gen
+LOCAL_SRC_FILES := CommandMatcherCompiler.cpp CommandMatcherGen.cpp ExpectedCommands.cpp
+
+include $(BUILD_HOST_EXECUTABLE)
+
 ###
 ### Wrapper binary.
 ###
@@ -23,8 +35,9 @@ LOCAL_CFLAGS := -Wall -Werror
 LOCAL_CLANG := true
 LOCAL_MODULE := netutils-wrapper-1.0
 LOCAL_SHARED_LIBRARIES := libc libbase liblog
-LOCAL_SRC_FILES := NetUtilsWrapper-1.0.cpp main.cpp
+LOCAL_SRC_FILES := CommandMatcher.cpp NetUtilsWrapper-1.0.cpp main.cpp
 LOCAL_MODULE_CLASS := EXECUTABLES
+include $(LOCAL_PATH)/CommandMatcherTable.mk
 
 LOCAL_POST_INSTALL_CMD := $(hide) mkdir -p $(TARGET_OUT)/bin; \
     ln -sf netutils-wrapper-1.0 $(TARGET_OUT)/bin/iptables-wrapper-1.0; \
@@ -44,7 +57,25 @@ LOCAL_CFLAGS := -Wall -Werror
 LOCAL_CLANG := true
 LOCAL_MODULE := netutils_wrapper_test
 LOCAL_SHARED_LIBRARIES := libc libbase liblog
-LOCAL_SRC_FILES := NetUtilsWrapper-1.0.cpp NetUtilsWrapperTest-1.0.cpp
+LOCAL_SRC_FILES := CommandMatcher.cpp CommandMatcherCompiler.cpp ExpectedCommands.cpp \
+                   NetUtilsWrapper-1.0.cpp NetUtilsWrapperTest-1.0.cpp
 LOCAL_MODULE_CLASS := NATIVE_TESTS
+include $(LOCAL_PATH)/CommandMatcherTable.mk
 
 include $(BUILD_NATIVE_TEST)
+
+###
+### Wrapper benchmarks.
+###
+include $(CLEAR_VARS)
+
+LOCAL_CFLAGS := -Wall -Werror
+LOCAL_CLANG := true
+LOCAL_MODULE := netutils_wrapper_benchmark
+LOCAL_SHARED_LIBRARIES := libc libbase liblog
+LOCAL_SRC_FILES := CommandMatcher.cpp ExpectedCommands.cpp NetUtilsWrapper-1.0.cpp \
+                   NetUtilsWrapperBenchmark-1.0.cpp
+LOCAL_MODULE_CLASS := EXECUTABLES
+include $(LOCAL_PATH)/CommandMatcherTable.mk
+
+include $(BUILD_NATIVE_BENCHMARK)
@@ -0,0 +1,28 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "CommandMatcher.h"
+
+bool CommandMatcherTable::matches(const char* str, size_t len) const {
+    uint16_t state = 0;
+    for (size_t i = 0; i < len; i++) {
+        const uint8_t flags = stateFlags[state];
+        if (flags & MATCH) return true;
+        if (flags & DEAD) return false;
+        state = transitions[state * numClasses + byteClasses[static_cast<uint8_t>(str[i])]];
+    }
+    return stateFlags[state] & MATCH_AT_END;
+}
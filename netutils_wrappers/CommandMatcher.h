@@ -0,0 +1,47 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NETUTILS_WRAPPERS_COMMAND_MATCHER_H
+#define NETUTILS_WRAPPERS_COMMAND_MATCHER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// A DFA that decides whether any of a list of regular expressions matches somewhere in a string.
+//
+// Bytes are first mapped to equivalence classes, so each state only has one transition per class.
+// State 0 is the start state. Walking the DFA stops as soon as it reaches a state that is known to
+// match, or one from which no match is possible.
+struct CommandMatcherTable {
+    enum StateFlags : uint8_t {
+        MATCH = 1 << 0,         // Some expression matches a prefix of the input read so far.
+        MATCH_AT_END = 1 << 1,  // Some expression matches if the input ends here. Set if MATCH is.
+        DEAD = 1 << 2,          // No expression can match, whatever input follows.
+    };
+
+    const uint8_t* byteClasses;    // 256 entries.
+    size_t numClasses;
+    const uint16_t* transitions;   // numStates * numClasses entries, indexed by state then class.
+    const uint8_t* stateFlags;     // numStates entries.
+    size_t numStates;
+
+    bool matches(const char* str, size_t len) const;
+};
+
+// The DFA for EXPECTED_REGEXPS, generated at build time by netutils-wrapper-matcher-gen.
+extern const CommandMatcherTable kExpectedCommandTable;
+
+#endif  // NETUTILS_WRAPPERS_COMMAND_MATCHER_H
@@ -0,0 +1,426 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <bitset>
+#include <map>
+
+#include "CommandMatcherCompiler.h"
+
+namespace {
+
+typedef std::bitset<256> CharSet;
+
+// A Thompson NFA node. Each node has at most one labelled transition, to |out|, and any number of
+// epsilon transitions.
+struct NfaNode {
+    enum Label { NONE, CHARS, LINE_START, LINE_END };
+
+    Label label = NONE;
+    CharSet chars;  // Only used if label is CHARS.
+    int out = -1;
+    std::vector<int> epsilons;
+};
+
+// Part of the NFA with a single entry and a single exit. Nothing leaves |end| yet.
+struct Fragment {
+    int start;
+    int end;
+};
+
+class Parser {
+public:
+    Parser(std::vector<NfaNode>* nodes, const char* regexp)
+        : mNodes(*nodes), mRegexp(regexp), mPos(regexp) {}
+
+    bool parse(Fragment* fragment, std::string* error) {
+        if (parseAlternation(fragment) && *mPos != '\0') {
+            fail("unmatched ')'");
+        }
+        if (!mError.empty()) {
+            *error = mError + " at offset " + std::to_string(mPos - mRegexp) + " in \"" +
+                    mRegexp + "\"";
+            return false;
+        }
+        return true;
+    }
+
+private:
+    bool fail(const char* message) {
+        if (mError.empty()) mError = message;
+        return false;
+    }
+
+    int newNode() {
+        mNodes.push_back(NfaNode());
+        return mNodes.size() - 1;
+    }
+
+    Fragment empty() {
+        const int node = newNode();
+        return { node, node };
+    }
+
+    Fragment labelled(NfaNode::Label label, const CharSet& chars) {
+        const Fragment fragment = { newNode(), newNode() };
+        mNodes[fragment.start].label = label;
+        mNodes[fragment.start].chars = chars;
+        mNodes[fragment.start].out = fragment.end;
+        return fragment;
+    }
+
+    Fragment concatenate(const Fragment& first, const Fragment& second) {
+        mNodes[first.end].epsilons.push_back(second.start);
+        return { first.start, second.end };
+    }
+
+    Fragment alternate(const Fragment& first, const Fragment& second) {
+        const Fragment fragment = { newNode(), newNode() };
+        mNodes[fragment.start].epsilons = { first.start, second.start };
+        mNodes[first.end].epsilons.push_back(fragment.end);
+        mNodes[second.end].epsilons.push_back(fragment.end);
+        return fragment;
+    }
+
+    Fragment repeat(const Fragment& body, char op) {
+        const Fragment fragment = { newNode(), newNode() };
+        // '+' must go through the body once, '?' at most once, and '*' any number of times.
+        mNodes[fragment.start].epsilons.push_back(body.start);
+        if (op != '+') mNodes[fragment.start].epsilons.push_back(fragment.end);
+        mNodes[body.end].epsilons.push_back(fragment.end);
+        if (op != '?') mNodes[body.end].epsilons.push_back(body.start);
+        return fragment;
+    }
+
+    bool parseAlternation(Fragment* fragment) {
+        if (!parseConcatenation(fragment)) return false;
+        while (*mPos == '|') {
+            mPos++;
+            Fragment alternative;
+            if (!parseConcatenation(&alternative)) return false;
+            *fragment = alternate(*fragment, alternative);
+        }
+        return true;
+    }
+
+    bool parseConcatenation(Fragment* fragment) {
+        *fragment = empty();
+        while (*mPos != '\0' && *mPos != '|' && *mPos != ')') {
+            Fragment piece;
+            if (!parseRepetition(&piece)) return false;
+            *fragment = concatenate(*fragment, piece);
+        }
+        return true;
+    }
+
+    bool parseRepetition(Fragment* fragment) {
+        if (!parseAtom(fragment)) return false;
+        while (*mPos == '*' || *mPos == '+' || *mPos == '?') {
+            *fragment = repeat(*fragment, *mPos++);
+        }
+        if (*mPos == '{') return fail("interval expressions are not supported");
+        return true;
+    }
+
+    bool parseAtom(Fragment* fragment) {
+        CharSet chars;
+        const char c = *mPos;
+        switch (c) {
+            case '(':
+                mPos++;
+                if (!parseAlternation(fragment)) return false;
+                if (*mPos != ')') return fail("unmatched '('");
+                mPos++;
+                return true;
+            case '[':
+                mPos++;
+                if (!parseBracket(&chars)) return false;
+                *fragment = labelled(NfaNode::CHARS, chars);
+                return true;
+            case '.':
+                mPos++;
+                *fragment = labelled(NfaNode::CHARS, chars.set());
+                return true;
+            case '^':
+                mPos++;
+                *fragment = labelled(NfaNode::LINE_START, chars);
+                return true;
+            case '$':
+                mPos++;
+                *fragment = labelled(NfaNode::LINE_END, chars);
+                return true;
+            case '\\':
+                mPos++;
+                if (*mPos == '\0') return fail("trailing backslash");
+                if (*mPos >= '1' && *mPos <= '9') return fail("back references are not supported");
+                break;
+            case '*':
+            case '+':
+            case '?':
+                return fail("repetition operator with nothing to repeat");
+            case '{':
+                return fail("interval expressions are not supported");
+        }
+        chars.set(static_cast<uint8_t>(*mPos++));
+        *fragment = labelled(NfaNode::CHARS, chars);
+        return true;
+    }
+
+    bool parseBracket(CharSet* chars) {
+        const bool negate = (*mPos == '^');
+        if (negate) mPos++;
+        // A ']' at the start of the list is a literal.
+        for (bool first = true; first || *mPos != ']'; first = false) {
+            if (*mPos == '\0') return fail("unmatched '['");
+            if (mPos[0] == '[' && (mPos[1] == ':' || mPos[1] == '=' || mPos[1] == '.')) {
+                return fail("character classes and collating elements are not supported");
+            }
+            const uint8_t low = *mPos++;
+            uint8_t high = low;
+            if (mPos[0] == '-' && mPos[1] != ']' && mPos[1] != '\0') {
+                high = mPos[1];
+                mPos += 2;
+                if (high < low) return fail("invalid range in bracket expression");
+            }
+            for (unsigned c = low; c <= high; c++) {
+                chars->set(c);
+            }
+        }
+        mPos++;
+        if (negate) chars->flip();
+        return true;
+    }
+
+    std::vector<NfaNode>& mNodes;
+    const char* const mRegexp;
+    const char* mPos;
+    std::string mError;
+};
+
+// Returns the sorted set of nodes reachable from |nodes| without consuming any input. '^' only
+// matches at the start of the input and '$' only at the end.
+std::vector<int> closure(const std::vector<NfaNode>& nfa, std::vector<int> nodes, bool atStart,
+                         bool atEnd) {
+    std::vector<bool> seen(nfa.size());
+    std::vector<int> result;
+    while (!nodes.empty()) {
+        const int node = nodes.back();
+        nodes.pop_back();
+        if (seen[node]) continue;
+        seen[node] = true;
+        result.push_back(node);
+        const NfaNode& n = nfa[node];
+        nodes.insert(nodes.end(), n.epsilons.begin(), n.epsilons.end());
+        if ((n.label == NfaNode::LINE_START && atStart) ||
+                (n.label == NfaNode::LINE_END && atEnd)) {
+            nodes.push_back(n.out);
+        }
+    }
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
+bool contains(const std::vector<int>& nodes, int node) {
+    return std::binary_search(nodes.begin(), nodes.end(), node);
+}
+
+}  // namespace
+
+bool CommandMatcherCompiler::compile(const char* const* regexps, size_t count,
+                                     std::string* error) {
+    // Build one NFA for all the expressions, with a single accepting node.
+    std::vector<NfaNode> nfa(2);
+    const int root = 0;
+    const int accept = 1;
+    for (size_t i = 0; i < count; i++) {
+        Parser parser(&nfa, regexps[i]);
+        Fragment fragment;
+        if (!parser.parse(&fragment, error)) {
+            return false;
+        }
+        nfa[root].epsilons.push_back(fragment.start);
+        nfa[fragment.end].epsilons.push_back(accept);
+    }
+
+    // Bytes that every transition treats alike share a class.
+    std::vector<CharSet> charSets;
+    for (const NfaNode& node : nfa) {
+        if (node.label == NfaNode::CHARS &&
+                std::find(charSets.begin(), charSets.end(), node.chars) == charSets.end()) {
+            charSets.push_back(node.chars);
+        }
+    }
+    std::map<std::vector<bool>, uint8_t> classIds;
+    std::vector<uint8_t> representatives;
+    mByteClasses.assign(256, 0);
+    for (unsigned c = 0; c < 256; c++) {
+        std::vector<bool> signature;
+        for (const CharSet& chars : charSets) {
+            signature.push_back(chars[c]);
+        }
+        auto inserted = classIds.insert({signature, classIds.size()});
+        if (inserted.second) {
+            representatives.push_back(c);
+        }
+        mByteClasses[c] = inserted.first->second;
+    }
+    const size_t numClasses = representatives.size();
+
+    // Subset construction. regex_search() may find a match starting anywhere, so every state past
+    // the first also includes the start of every expression. States that match are never left.
+    struct DfaState {
+        std::vector<int> nodes;
+        uint8_t flags;
+        std::vector<size_t> next;
+    };
+    std::vector<DfaState> states;
+    std::map<std::vector<int>, size_t> stateIds;
+    const std::vector<int> restart = closure(nfa, { root }, false, false);
+    states.push_back({ closure(nfa, { root }, true, false), 0, {} });
+    for (size_t i = 0; i < states.size(); i++) {
+        const std::vector<int> nodes = states[i].nodes;
+        uint8_t flags = 0;
+        if (contains(nodes, accept)) {
+            flags = CommandMatcherTable::MATCH | CommandMatcherTable::MATCH_AT_END;
+        } else if (contains(closure(nfa, nodes, i == 0, true), accept)) {
+            flags = CommandMatcherTable::MATCH_AT_END;
+        }
+        std::vector<size_t> next(numClasses, i);
+        if (!(flags & CommandMatcherTable::MATCH)) {
+            for (size_t c = 0; c < numClasses; c++) {
+                std::vector<int> moved = restart;
+                for (int node : nodes) {
+                    if (nfa[node].label == NfaNode::CHARS && nfa[node].chars[representatives[c]]) {
+                        moved.push_back(nfa[node].out);
+                    }
+                }
+                auto inserted = stateIds.insert({closure(nfa, moved, false, false), states.size()});
+                if (inserted.second) {
+                    states.push_back({ inserted.first->first, 0, {} });
+                }
+                next[c] = inserted.first->second;
+            }
+        }
+        states[i].flags = flags;
+        states[i].next = next;
+    }
+
+    // Mark the states from which no match can be reached.
+    std::vector<std::vector<size_t>> previous(states.size());
+    std::vector<size_t> live;
+    std::vector<bool> isLive(states.size());
+    for (size_t i = 0; i < states.size(); i++) {
+        for (size_t next : states[i].next) {
+            previous[next].push_back(i);
+        }
+        if (states[i].flags & CommandMatcherTable::MATCH_AT_END) {
+            live.push_back(i);
+            isLive[i] = true;
+        }
+    }
+    while (!live.empty()) {
+        const size_t state = live.back();
+        live.pop_back();
+        for (size_t prev : previous[state]) {
+            if (!isLive[prev]) {
+                isLive[prev] = true;
+                live.push_back(prev);
+            }
+        }
+    }
+    for (size_t i = 0; i < states.size(); i++) {
+        if (!isLive[i]) {
+            states[i].flags = CommandMatcherTable::DEAD;
+            states[i].next.assign(numClasses, i);
+        }
+    }
+
+    // Minimize by splitting states into blocks with the same flags, then repeatedly splitting the
+    // blocks whose states have transitions into different blocks.
+    std::vector<size_t> block(states.size());
+    size_t numBlocks = 0;
+    for (;;) {
+        std::map<std::vector<size_t>, size_t> blockIds;
+        std::vector<size_t> newBlock(states.size());
+        for (size_t i = 0; i < states.size(); i++) {
+            std::vector<size_t> signature = { states[i].flags };
+            if (numBlocks) {
+                signature.push_back(block[i]);
+                for (size_t next : states[i].next) {
+                    signature.push_back(block[next]);
+                }
+            }
+            newBlock[i] = blockIds.insert({signature, blockIds.size()}).first->second;
+        }
+        block.swap(newBlock);
+        if (blockIds.size() == numBlocks) break;
+        numBlocks = blockIds.size();
+    }
+    if (numBlocks > UINT16_MAX) {
+        *error = "too many states: " + std::to_string(numBlocks);
+        return false;
+    }
+
+    // The first state is always in block 0, because blocks are numbered in order of appearance.
+    mNumClasses = numClasses;
+    mTransitions.assign(numBlocks * numClasses, 0);
+    mStateFlags.assign(numBlocks, 0);
+    for (size_t i = 0; i < states.size(); i++) {
+        mStateFlags[block[i]] = states[i].flags;
+        for (size_t c = 0; c < numClasses; c++) {
+            mTransitions[block[i] * numClasses + c] = block[states[i].next[c]];
+        }
+    }
+    return true;
+}
+
+CommandMatcherTable CommandMatcherCompiler::table() const {
+    return { mByteClasses.data(), mNumClasses, mTransitions.data(), mStateFlags.data(),
+             mStateFlags.size() };
+}
+
+void CommandMatcherCompiler::writeSource(FILE* out, const char* name) const {
+    fprintf(out, "// Generated by netutils-wrapper-matcher-gen. Do not edit.\n\n");
+    fprintf(out, "#include \"CommandMatcher.h\"\n\n");
+    fprintf(out, "namespace {\n\n");
+
+    fprintf(out, "const uint8_t kByteClasses[256] = {");
+    for (size_t i = 0; i < mByteClasses.size(); i++) {
+        fprintf(out, "%s%u,", (i % 16) ? " " : "\n    ", mByteClasses[i]);
+    }
+    fprintf(out, "\n};\n\n");
+
+    fprintf(out, "const uint16_t kTransitions[] = {");
+    for (size_t state = 0; state < mStateFlags.size(); state++) {
+        fprintf(out, "\n    // State %zu", state);
+        for (size_t c = 0; c < mNumClasses; c++) {
+            fprintf(out, "%s%u,", (c % 16) ? " " : "\n    ", mTransitions[state * mNumClasses + c]);
+        }
+    }
+    fprintf(out, "\n};\n\n");
+
+    fprintf(out, "const uint8_t kStateFlags[] = {");
+    for (size_t i = 0; i < mStateFlags.size(); i++) {
+        fprintf(out, "%s%u,", (i % 16) ? " " : "\n    ", mStateFlags[i]);
+    }
+    fprintf(out, "\n};\n\n");
+
+    fprintf(out, "}  // namespace\n\n");
+    fprintf(out, "const CommandMatcherTable %s = {\n", name);
+    fprintf(out, "    kByteClasses, %zu, kTransitions, kStateFlags, %zu,\n", mNumClasses,
+            mStateFlags.size());
+    fprintf(out, "};\n");
+}
@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NETUTILS_WRAPPERS_COMMAND_MATCHER_COMPILER_H
+#define NETUTILS_WRAPPERS_COMMAND_MATCHER_COMPILER_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+#include "CommandMatcher.h"
+
+// Compiles a list of POSIX extended regular expressions into one minimal CommandMatcherTable, such
+// that the table matches a string if and only if std::regex_search() finds any of the expressions
+// in it.
+//
+// Only the parts of ERE syntax that the allowlist needs are supported: literals, backslash escapes,
+// '.', bracket expressions without character classes, grouping, alternation, '*', '+', '?', '^' and
+// '$'. Interval expressions, back references and collating elements are rejected.
+class CommandMatcherCompiler {
+public:
+    // Returns false and describes the problem in |error| if any of the expressions can't be
+    // compiled.
+    bool compile(const char* const* regexps, size_t count, std::string* error);
+
+    // Only valid after compile() has succeeded, and for as long as this object is not modified.
+    CommandMatcherTable table() const;
+
+    // Writes a C++ source file that defines |name| as the compiled table.
+    void writeSource(FILE* out, const char* name) const;
+
+private:
+    std::vector<uint8_t> mByteClasses;
+    size_t mNumClasses = 0;
+    std::vector<uint16_t> mTransitions;
+    std::vector<uint8_t> mStateFlags;
+};
+
+#endif  // NETUTILS_WRAPPERS_COMMAND_MATCHER_COMPILER_H
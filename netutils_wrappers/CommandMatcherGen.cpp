@@ -0,0 +1,37 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Build-time tool that compiles EXPECTED_REGEXPS into the DFA used by checkExpectedCommand(), and
+// writes it to stdout as C++ source.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <string>
+
+#include "CommandMatcherCompiler.h"
+#include "ExpectedCommands.h"
+
+int main() {
+    CommandMatcherCompiler compiler;
+    std::string error;
+    if (!compiler.compile(EXPECTED_REGEXPS, NUM_EXPECTED_REGEXPS, &error)) {
+        fprintf(stderr, "netutils-wrapper-matcher-gen: %s\n", error.c_str());
+        return EXIT_FAILURE;
+    }
+    compiler.writeSource(stdout, "kExpectedCommandTable");
+    return ferror(stdout) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,28 @@
+# Copyright (C) 2017 The Android Open Source Project
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+# Adds the DFA compiled from EXPECTED_REGEXPS to the sources of the current module.
+# LOCAL_MODULE_CLASS must be set before including this file.
+
+matcher_gen := $(HOST_OUT_EXECUTABLES)/netutils-wrapper-matcher-gen$(HOST_EXECUTABLE_SUFFIX)
+matcher_table := $(call local-generated-sources-dir)/CommandMatcherTable.cpp
+
+$(matcher_table): PRIVATE_CUSTOM_TOOL = $(matcher_gen) > $@
+$(matcher_table): $(matcher_gen)
+	$(transform-generated-source)
+
+LOCAL_GENERATED_SOURCES += $(matcher_table)
+
+matcher_gen :=
+matcher_table :=
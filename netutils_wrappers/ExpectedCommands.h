@@ -0,0 +1,33 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NETUTILS_WRAPPERS_EXPECTED_COMMANDS_H
+#define NETUTILS_WRAPPERS_EXPECTED_COMMANDS_H
+
+#include <stddef.h>
+
+#define SYSTEM_DIRNAME  "/system/bin/"
+
+// POSIX extended regular expressions matching the commands that vendor code may run. A command is
+// allowed if any of them matches somewhere in its arguments, joined with spaces.
+//
+// These are not used at runtime: at build time, netutils-wrapper-matcher-gen compiles them into the
+// single DFA that checkExpectedCommand() walks. Only the subset of ERE syntax that
+// CommandMatcherCompiler understands may be used.
+extern const char* const EXPECTED_REGEXPS[];
+extern const size_t NUM_EXPECTED_REGEXPS;
+
+#endif  // NETUTILS_WRAPPERS_EXPECTED_COMMANDS_H
@@ -14,7 +14,6 @@
  * limitations under the License.
  */
 
-#include <regex>
 #include <string>
 
 #include <libgen.h>
@@ -28,15 +27,10 @@
 #define LOG_TAG "NetUtilsWrapper"
 #include <cutils/log.h>
 
+#include "CommandMatcher.h"
+#include "ExpectedCommands.h"
 #include "NetUtilsWrapper.h"
 
-#define SYSTEM_DIRNAME  "/system/bin/"
-
-#define OEM_IFACE "[^ ]*oem[0-9]+"
-#define RMNET_IFACE "(r_)?rmnet_(data)?[0-9]+"
-#define VENDOR_IFACE "(" OEM_IFACE "|" RMNET_IFACE ")"
-#define VENDOR_CHAIN "(oem_.*|nm_.*|qcom_.*)"
-
 // List of net utils wrapped by this program
 // The list MUST be in descending order of string length
 const char *netcmds[] = {
@@ -48,38 +42,6 @@ const char *netcmds[] = {
     NULL,
 };
 
-// List of regular expressions of expected commands.
-const char *EXPECTED_REGEXPS[] = {
-#define CMD "^" SYSTEM_DIRNAME
-    // Create, delete, and manage OEM networks.
-    CMD "ndc network (create|destroy) (oem|handle)[0-9]+( |$)",
-    CMD "ndc network interface (add|remove) (oem|handle)[0-9]+ " VENDOR_IFACE,
-    CMD "ndc network route (add|remove) (oem|handle)[0-9]+ ",
-    CMD "ndc ipfwd (enable|disable) ",
-    CMD "ndc ipfwd (add|remove) .*" VENDOR_IFACE,
-
-    // Manage vendor iptables rules.
-    CMD "ip(6)?tables -w.* (-A|-D|-F|-I|-N|-X) " VENDOR_CHAIN,
-    CMD "ip(6)?tables -w.* (-i|-o) " VENDOR_IFACE,
-
-    // Manage IPsec state.
-    CMD "ip xfrm .*",
-
-    // Manage vendor interfaces.
-    CMD "tc .* dev " VENDOR_IFACE,
-    CMD "ip( -4| -6)? (addr|address) (add|del|delete|flush).* dev " VENDOR_IFACE,
-
-    // Other activities observed on current devices. In future releases, these should be supported
-    // in a way that is less likely to interfere with general Android networking behaviour.
-    CMD "tc qdisc del dev root",
-    CMD "ip( -4| -6)? rule .* goto 13000 prio 11999",
-    CMD "ip( -4| -6)? rule .* prio 25000",
-    CMD "ip(6)?tables -w .* -j " VENDOR_CHAIN,
-    CMD "iptables -w -t mangle -[AD] PREROUTING -m socket --nowildcard --restore-skmark -j ACCEPT",
-    CMD "ndc network interface (add|remove) oem[0-9]+$",  // Invalid command: no interface removed.
-#undef CMD
-};
-
 bool checkExpectedCommand(int argc, char **argv) {
     static bool loggedError = false;
     std::vector<const char*> allArgs(argc);
@@ -87,11 +49,8 @@ bool checkExpectedCommand(int argc, char **argv) {
         allArgs[i] = argv[i];
     }
     std::string fullCmd = android::base::Join(allArgs, ' ');
-    for (size_t i = 0; i < ARRAY_SIZE(EXPECTED_REGEXPS); i++) {
-        const std::regex expectedRegexp(EXPECTED_REGEXPS[i], std::regex_constants::extended);
-        if (std::regex_search(fullCmd, expectedRegexp)) {
-            return true;
-        }
+    if (kExpectedCommandTable.matches(fullCmd.c_str(), fullCmd.size())) {
+        return true;
     }
     if (!loggedError) {
         ALOGI("Unexpected command: %s", fullCmd.c_str());
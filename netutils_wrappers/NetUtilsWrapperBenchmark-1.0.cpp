@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Measures how long checkExpectedCommand() takes to decide whether to allow a command. Each vendor
+ * invocation of a wrapper is a new process, so nothing is cached between calls.
+ *
+ *  - regexp_list_per_invocation
+ *
+ *      The control case. Compiles each of EXPECTED_REGEXPS with std::regex and searches the
+ *      command with them in turn, as checkExpectedCommand() used to.
+ *
+ *  - command_matcher_per_invocation
+ *
+ *      Walks the DFA that was compiled from EXPECTED_REGEXPS at build time.
+ *
+ *  - check_expected_command
+ *
+ *      Calls checkExpectedCommand() itself, including joining the arguments.
+ *
+ * The commands are a mix of allowed and rejected ones, some of which only fail near the end.
+ */
+
+#include <regex>
+#include <string>
+#include <vector>
+
+#include <android-base/strings.h>
+#include <benchmark/benchmark.h>
+
+#include "CommandMatcher.h"
+#include "ExpectedCommands.h"
+#include "NetUtilsWrapper.h"
+
+namespace {
+
+const std::vector<std::string> kCommands = {
+    "/system/bin/ndc network create oem10",
+    "/system/bin/ndc network interface add handle42966108894 r_rmnet_data0",
+    "/system/bin/ip6tables -w -A INPUT -i rmnet_data9 -j routectrl_MANGLE_INPUT",
+    "/system/bin/ip6tables -w -A INPUT -j routectrl_MANGLE_INPUT",
+    "/system/bin/ip -6 addr add dev r_rmnet_data6 2001:db8::/64",
+    "/system/bin/ip -6 addr add dev wlan2 2001:db8::/64",
+    "/system/bin/iptables -w -t mangle -A PREROUTING -m socket --nowildcard --restore-skmark -j "
+            "ACCEPT",
+    "/system/bin/tc qdisc add dev wlan0 root handle 1: htb default 10",
+};
+
+}  // namespace
+
+static void regexp_list_per_invocation(benchmark::State& state) {
+    size_t i = 0;
+    while (state.KeepRunning()) {
+        const std::string& command = kCommands[i++ % kCommands.size()];
+        bool matched = false;
+        for (size_t j = 0; j < NUM_EXPECTED_REGEXPS && !matched; j++) {
+            const std::regex regexp(EXPECTED_REGEXPS[j], std::regex_constants::extended);
+            matched = std::regex_search(command, regexp);
+        }
+        benchmark::DoNotOptimize(matched);
+    }
+}
+BENCHMARK(regexp_list_per_invocation);
+
+static void command_matcher_per_invocation(benchmark::State& state) {
+    size_t i = 0;
+    while (state.KeepRunning()) {
+        const std::string& command = kCommands[i++ % kCommands.size()];
+        benchmark::DoNotOptimize(kExpectedCommandTable.matches(command.c_str(), command.size()));
+    }
+}
+BENCHMARK(command_matcher_per_invocation);
+
+static void check_expected_command(benchmark::State& state) {
+    std::vector<std::vector<std::string>> pieces;
+    for (const std::string& command : kCommands) {
+        pieces.push_back(android::base::Split(command, " "));
+    }
+    std::vector<std::vector<char*>> argvs;
+    for (auto& words : pieces) {
+        std::vector<char*> argv;
+        for (std::string& word : words) {
+            argv.push_back(&word[0]);
+        }
+        argvs.push_back(argv);
+    }
+
+    size_t i = 0;
+    while (state.KeepRunning()) {
+        std::vector<char*>& argv = argvs[i++ % argvs.size()];
+        benchmark::DoNotOptimize(checkExpectedCommand(argv.size(), argv.data()));
+    }
+}
+BENCHMARK(check_expected_command);
+
+BENCHMARK_MAIN();
@@ -14,13 +14,20 @@
  * limitations under the License.
  */
 
+#include <regex>
 #include <string>
 #include <vector>
 
+#include <stdlib.h>
+#include <string.h>
+
 #include <gtest/gtest.h>
 
 #include <android-base/strings.h>
 
+#include "CommandMatcher.h"
+#include "CommandMatcherCompiler.h"
+#include "ExpectedCommands.h"
 #include "NetUtilsWrapper.h"
 
 #define MAX_ARGS 128
@@ -49,7 +56,7 @@ std::vector<Command> COMMANDS = {
     {VALID,   "/system/bin/ndc network interface add oem10 r_rmnet_data0"},
     {VALID,   "/system/bin/ndc network interface add handle42966108894 v_oem9"},
     {VALID,   "/system/bin/ndc network interface add handle42966108894 oem9"},
-    {VALID,   "/system/bin/ndc network interface add handle42966108894 r_rmnet_data0"}
+    {VALID,   "/system/bin/ndc network interface add handle42966108894 r_rmnet_data0"},
     {INVALID, "/system/bin/ndc network interface add handle42966108894"},
     {VALID,   "/system/bin/ip xfrm state"},
 };
@@ -70,3 +77,174 @@ TEST(NetUtilsWrapperTest10, TestCommands) {
             (cmd.valid ? "invalid" : "valid") << ": '" << cmd.cmdString << "'";
     }
 }
+
+namespace {
+
+// How checkExpectedCommand() used to decide whether a command is expected.
+class RegexpMatcher {
+public:
+    RegexpMatcher(const char* const* regexps, size_t count) {
+        for (size_t i = 0; i < count; i++) {
+            mRegexps.push_back(std::regex(regexps[i], std::regex_constants::extended));
+        }
+    }
+
+    bool matches(const std::string& str) const {
+        for (const std::regex& regexp : mRegexps) {
+            if (std::regex_search(str, regexp)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    std::vector<std::regex> mRegexps;
+};
+
+bool tableMatches(const CommandMatcherTable& table, const std::string& str) {
+    return table.matches(str.c_str(), str.size());
+}
+
+// Commands made of words that appear in EXPECTED_REGEXPS, or nearly do, so that they get deep into
+// the DFA before matching or failing. Half are made from scratch, and half by replacing or
+// inserting words in the test commands.
+std::vector<std::string> randomCommands(size_t count) {
+    static const std::vector<std::string> kPrefixes = {
+        "/system/bin/", "/system/bin/", "/system/bin/", "", "/vendor/bin/", "/system/bin",
+    };
+    static const std::vector<std::string> kTools = {
+        "ndc", "ip", "ip6tables", "iptables", "tc", "ipx", "ip6", "ndcx",
+    };
+    static const std::vector<std::string> kWords = {
+        "", "network", "create", "destroy", "interface", "add", "remove", "route", "ipfwd",
+        "enable", "disable", "-w", "-A", "-D", "-F", "-I", "-N", "-X", "-i", "-o", "-j", "-t",
+        "mangle", "PREROUTING", "-m", "socket", "--nowildcard", "--restore-skmark", "ACCEPT",
+        "xfrm", "state", "dev", "qdisc", "del", "root", "rule", "goto", "13000", "prio", "11999",
+        "25000", "-4", "-6", "addr", "address", "delete", "flush", "oem", "oem0", "oem12", "oem_",
+        "handle", "handle42966108894", "v_oem9", "rmnet0", "r_rmnet_data3", "rmnet_data",
+        "rmnet_", "r_", "oem_foo", "nm_x", "qcom_", "wlan0", "INPUT", "2001:db8::/64",
+    };
+    unsigned seed = 1;
+    auto pick = [&seed](const std::vector<std::string>& words) -> const std::string& {
+        return words[rand_r(&seed) % words.size()];
+    };
+
+    std::vector<std::string> commands;
+    for (size_t i = 0; i < count; i++) {
+        if (i % 2) {
+            std::vector<std::string> words = android::base::Split(
+                    COMMANDS[rand_r(&seed) % COMMANDS.size()].cmdString, " ");
+            const int numChanges = 1 + rand_r(&seed) % 2;
+            for (int j = 0; j < numChanges; j++) {
+                const size_t pos = rand_r(&seed) % (words.size() + 1);
+                if (pos < words.size() && rand_r(&seed) % 2) {
+                    words[pos] = pick(kWords);
+                } else {
+                    words.insert(words.begin() + pos, pick(kWords));
+                }
+            }
+            commands.push_back(android::base::Join(words, ' '));
+            continue;
+        }
+        std::string command = pick(kPrefixes) + pick(kTools);
+        const int numWords = rand_r(&seed) % 10;
+        for (int j = 0; j < numWords; j++) {
+            command += " " + pick(kWords);
+        }
+        commands.push_back(command);
+    }
+    return commands;
+}
+
+}  // namespace
+
+TEST(NetUtilsWrapperTest10, TestCompilerSyntax) {
+    const char* const regexps[] = {
+        "^ab+c$", "x[0-9]?y", "(foo|bar)*baz", "[^ ]z", "[]a-]q", "^$", "a\\.b", "c.d",
+    };
+    CommandMatcherCompiler compiler;
+    std::string error;
+    ASSERT_TRUE(compiler.compile(regexps, ARRAY_SIZE(regexps), &error)) << error;
+    const CommandMatcherTable table = compiler.table();
+
+    const std::vector<std::pair<std::string, bool>> cases = {
+        {"", true},
+        {"abc", true},
+        {"abbbc", true},
+        {"abcd", false},
+        {" abc", false},
+        {"__xy", true},
+        {"x1y", true},
+        {"x12y", false},
+        {"baz", true},
+        {"foobarfoobaz", true},
+        {"fooba", false},
+        {"z", false},
+        {" z", false},
+        {"az", true},
+        {"]q", true},
+        {"-q", true},
+        {"bq", false},
+        {"a.b", true},
+        {"axb", false},
+        {"cxd", true},
+        {"cd", false},
+    };
+    const RegexpMatcher regexpMatcher(regexps, ARRAY_SIZE(regexps));
+    for (const auto& c : cases) {
+        EXPECT_EQ(c.second, tableMatches(table, c.first)) << "'" << c.first << "'";
+        EXPECT_EQ(c.second, regexpMatcher.matches(c.first)) << "'" << c.first << "'";
+    }
+
+    for (const char* invalid : { "a{2}", "(a", "a)", "[a", "*a", "[[:digit:]]", "a\\1", "b-a" }) {
+        const char* invalidRegexps[] = { invalid };
+        if (!strcmp(invalid, "b-a")) {
+            // Not an error outside a bracket expression.
+            EXPECT_TRUE(compiler.compile(invalidRegexps, 1, &error)) << error;
+            continue;
+        }
+        EXPECT_FALSE(compiler.compile(invalidRegexps, 1, &error)) << invalid;
+    }
+}
+
+TEST(NetUtilsWrapperTest10, TestGeneratedTableIsUpToDate) {
+    CommandMatcherCompiler compiler;
+    std::string error;
+    ASSERT_TRUE(compiler.compile(EXPECTED_REGEXPS, NUM_EXPECTED_REGEXPS, &error)) << error;
+    const CommandMatcherTable table = compiler.table();
+    const CommandMatcherTable& generated = kExpectedCommandTable;
+
+    ASSERT_EQ(table.numClasses, generated.numClasses);
+    ASSERT_EQ(table.numStates, generated.numStates);
+    EXPECT_EQ(0, memcmp(table.byteClasses, generated.byteClasses, 256));
+    EXPECT_EQ(0, memcmp(table.transitions, generated.transitions,
+                        table.numStates * table.numClasses * sizeof(table.transitions[0])));
+    EXPECT_EQ(0, memcmp(table.stateFlags, generated.stateFlags, table.numStates));
+}
+
+TEST(NetUtilsWrapperTest10, TestMatcherAgreesWithRegexps) {
+    const RegexpMatcher regexpMatcher(EXPECTED_REGEXPS, NUM_EXPECTED_REGEXPS);
+
+    std::vector<std::string> commands = randomCommands(20000);
+    // Every prefix of each test command, and each test command with one character removed, to
+    // catch differences in how the end of a command and '$' are handled.
+    for (const Command& cmd : COMMANDS) {
+        for (size_t i = 0; i <= cmd.cmdString.size(); i++) {
+            commands.push_back(cmd.cmdString.substr(0, i));
+            if (i < cmd.cmdString.size()) {
+                commands.push_back(cmd.cmdString.substr(0, i) + cmd.cmdString.substr(i + 1));
+            }
+        }
+    }
+
+    size_t matched = 0;
+    for (const std::string& command : commands) {
+        const bool expected = regexpMatcher.matches(command);
+        ASSERT_EQ(expected, tableMatches(kExpectedCommandTable, command)) << "'" << command << "'";
+        if (expected) matched++;
+    }
+    // Make sure that both outcomes were tested plenty of times.
+    EXPECT_LT(commands.size() / 20, matched);
+    EXPECT_LT(commands.size() / 20, commands.size() - matched);
+}
@@ -88,7 +88,9 @@ LOCAL_SRC_FILES := \
         ClatdController.cpp \
         CommandListener.cpp \
         Controllers.cpp \
+        DnsCache.cpp \
         DnsProxyListener.cpp \
+        DnsWorkerPool.cpp \
         DummyNetwork.cpp \
         DumpWriter.cpp \
         EventReporter.cpp \
@@ -96,8 +98,12 @@ LOCAL_SRC_FILES := \
         FwmarkServer.cpp \
         IdletimerController.cpp \
         InterfaceController.cpp \
+        InterfaceRegistry.cpp \
+        IptablesCounters.cpp \
+        IptablesMirror.cpp \
         IptablesRestoreController.cpp \
         LocalNetwork.cpp \
+        LockStats.cpp \
         MDnsSdListener.cpp \
         NatController.cpp \
         NetdCommand.cpp \
@@ -118,15 +124,21 @@ LOCAL_SRC_FILES := \
         SockDiag.cpp \
         StrictController.cpp \
         TetherController.cpp \
+        UidRangeIndex.cpp \
         UidRanges.cpp \
         VirtualNetwork.cpp \
+        WakeupAggregator.cpp \
         WakeupController.cpp \
         XfrmController.cpp \
         main.cpp \
         oem_iptables_hook.cpp \
         binder/android/net/UidRange.cpp \
         binder/android/net/metrics/INetdEventListener.aidl \
+        dns/DnsTlsDispatcher.cpp \
+        dns/DnsTlsSessionCache.cpp \
+        dns/DnsTlsSocket.cpp \
         dns/DnsTlsTransport.cpp \
+        dns/DnsTlsValidationScheduler.cpp \
 
 LOCAL_AIDL_INCLUDES := $(LOCAL_PATH)/binder
 
@@ -168,19 +180,31 @@ LOCAL_C_INCLUDES := \
 
 LOCAL_SRC_FILES := \
         InterfaceController.cpp InterfaceControllerTest.cpp \
+        InterfaceRegistry.cpp InterfaceRegistryTest.cpp \
         Controllers.cpp ControllersTest.cpp \
+        DnsCache.cpp DnsCacheTest.cpp \
+        DnsWorkerPool.cpp DnsWorkerPoolTest.cpp DumpWriter.cpp \
+        EventReporter.cpp EventReporterTest.cpp EventRingTest.cpp \
+        dns/DnsTlsValidationScheduler.cpp DnsTlsValidationSchedulerTest.cpp \
+        dns/DnsTlsSessionCache.cpp DnsTlsSessionCacheTest.cpp dns/DnsTlsSocket.cpp \
+        dns/DnsTlsTransport.cpp DnsTlsTransportTest.cpp \
         NetdConstants.cpp IptablesBaseTest.cpp \
         IptablesRestoreController.cpp IptablesRestoreControllerTest.cpp \
-        BandwidthController.cpp BandwidthControllerTest.cpp \
+        BandwidthController.cpp BandwidthControllerTest.cpp IptablesCounters.cpp \
         FirewallControllerTest.cpp FirewallController.cpp \
+        IptablesMirror.cpp IptablesMirrorTest.cpp \
         IdletimerController.cpp IdletimerControllerTest.cpp \
+        LockStats.cpp LockStatsTest.cpp \
         NatControllerTest.cpp NatController.cpp \
-        NetlinkCommands.cpp NetlinkManager.cpp \
+        NetlinkCommands.cpp NetlinkCommandsTest.cpp NetlinkManager.cpp \
         RouteController.cpp RouteControllerTest.cpp \
+        SnapshotPublisherTest.cpp \
         SockDiagTest.cpp SockDiag.cpp \
         StrictController.cpp StrictControllerTest.cpp \
+        UidRangeIndex.cpp UidRangeIndexTest.cpp \
         UidRanges.cpp \
-        NetlinkListener.cpp \
+        NetlinkListener.cpp NetlinkListenerTest.cpp \
+        WakeupAggregator.cpp WakeupAggregatorTest.cpp \
         WakeupController.cpp WakeupControllerTest.cpp \
         NFLogListener.cpp NFLogListenerTest.cpp \
         binder/android/net/UidRange.cpp \
@@ -188,7 +212,7 @@ LOCAL_SRC_FILES := \
         ../tests/tun_interface.cpp \
 
 LOCAL_MODULE_TAGS := tests
-LOCAL_STATIC_LIBRARIES := libgmock libpcap
+LOCAL_STATIC_LIBRARIES := libgmock libnetd_test_dnsresponder libpcap
 LOCAL_SHARED_LIBRARIES := \
         libnetdaidl \
         libbase \
@@ -67,6 +67,7 @@ const char BandwidthController::LOCAL_MANGLE_POSTROUTING[] = "bw_mangle_POSTROUT
 auto BandwidthController::execFunction = android_fork_execvp;
 auto BandwidthController::popenFunction = popen;
 auto BandwidthController::iptablesRestoreFunction = execIptablesRestoreWithOutput;
+auto BandwidthController::getChainCountersFunction = getIptablesChainCounters;
 
 using android::base::StringAppendF;
 using android::base::StringPrintf;
@@ -78,12 +79,7 @@ namespace {
 const char ALERT_GLOBAL_NAME[] = "globalAlert";
 const int  MAX_CMD_ARGS = 32;
 const int  MAX_CMD_LEN = 1024;
-const int  MAX_IPT_OUTPUT_LINE_LEN = 256;
 const std::string NEW_CHAIN_COMMAND = "-N ";
-const std::string GET_TETHER_STATS_COMMAND = StringPrintf(
-    "*filter\n"
-    "-nvx -L %s\n"
-    "COMMIT\n", NatController::LOCAL_TETHER_COUNTERS_CHAIN);
 
 const char NAUGHTY_CHAIN[] = "bw_penalty_box";
 const char NICE_CHAIN[] = "bw_happy_box";
@@ -894,140 +890,115 @@ int BandwidthController::removeCostlyAlert(const std::string& costName, int64_t*
     return res;
 }
 
-void BandwidthController::addStats(TetherStatsList& statsList, const TetherStats& stats) {
-    for (TetherStats& existing : statsList) {
-        if (existing.addStatsIfMatch(stats)) {
-            return;
-        }
+std::string BandwidthController::getPairKey(const std::string& intIface,
+                                            const std::string& extIface) {
+    // Interface names never contain spaces.
+    return intIface + " " + extIface;
+}
+
+void BandwidthController::addStats(TetherStatsList& statsList, TetherStatsIndex& index,
+                                   const TetherStats& stats) {
+    const auto it = index.find(getPairKey(stats.intIface, stats.extIface));
+    if (it != index.end()) {
+        statsList[it->second].addStatsIfMatch(stats);
+        return;
     }
     // No match. Insert a new interface pair.
+    index[getPairKey(stats.intIface, stats.extIface)] = statsList.size();
     statsList.push_back(stats);
 }
 
 /*
- * Parse the ptks and bytes out of:
- *   Chain natctrl_tether_counters (4 references)
- *       pkts      bytes target     prot opt in     out     source               destination
- *         26     2373 RETURN     all  --  wlan0  rmnet0  0.0.0.0/0            0.0.0.0/0
- *         27     2002 RETURN     all  --  rmnet0 wlan0   0.0.0.0/0            0.0.0.0/0
- *       1040   107471 RETURN     all  --  bt-pan rmnet0  0.0.0.0/0            0.0.0.0/0
- *       1450  1708806 RETURN     all  --  rmnet0 bt-pan  0.0.0.0/0            0.0.0.0/0
- * or:
- *   Chain natctrl_tether_counters (0 references)
- *       pkts      bytes target     prot opt in     out     source               destination
- *          0        0 RETURN     all      wlan0  rmnet_data0  ::/0                 ::/0
- *          0        0 RETURN     all      rmnet_data0 wlan0   ::/0                 ::/0
- *
- * It results in an error if invoked and no tethering counter rules exist. The constraint
- * helps detect complete parsing failure.
+ * Pairs up the rules of natctrl_tether_counters, e.g.:
+ *   in      out     pkts   bytes
+ *   wlan0   rmnet0    26    2373
+ *   rmnet0  wlan0     27    2002
+ *   bt-pan  rmnet0  1040  107471
+ *   rmnet0  bt-pan  1450 1708806
+ * The in:intIface rule counts the received traffic, and the in:extIface rule the transmitted
+ * traffic. Without a filter, the first rule seen of each pair is taken to be the rx side, which is
+ * what NatController sets up.
  */
 int BandwidthController::addForwardChainStats(const TetherStats& filter,
                                               TetherStatsList& statsList,
-                                              const std::string& statsOutput,
+                                              TetherStatsIndex& index,
+                                              const std::vector<IptablesRuleCounters>& counters,
                                               std::string &extraProcessingInfo) {
-    int res;
-    std::string statsLine;
-    char iface0[MAX_IPT_OUTPUT_LINE_LEN];
-    char iface1[MAX_IPT_OUTPUT_LINE_LEN];
-    char rest[MAX_IPT_OUTPUT_LINE_LEN];
-
-    TetherStats stats;
-    const char *buffPtr;
-    int64_t packets, bytes;
+    // Pairs for which only one rule has been seen so far, keyed by getPairKey().
+    std::unordered_map<std::string, TetherStats> pending;
     int statsFound = 0;
 
-    bool filterPair = filter.intIface[0] && filter.extIface[0];
+    const bool filterPair = !filter.intIface.empty() && !filter.extIface.empty();
+    const bool filterOne = !filterPair && (!filter.intIface.empty() || !filter.extIface.empty());
 
     ALOGV("filter: %s",  filter.getStatsLine().c_str());
 
-    stats = filter;
-
-    std::stringstream stream(statsOutput);
-    while (std::getline(stream, statsLine, '\n')) {
-        buffPtr = statsLine.c_str();
+    for (const IptablesRuleCounters& rule : counters) {
+        StringAppendF(&extraProcessingInfo, "%s %s %" PRIu64 " %" PRIu64 "\n",
+                      rule.inIface.c_str(), rule.outIface.c_str(), rule.packets, rule.bytes);
+        // Not one of ours: every tether counter rule matches both interfaces.
+        if (rule.inIface.empty() || rule.outIface.empty()) {
+            continue;
+        }
 
-        /* Clean up, so a failed parse can still print info */
-        iface0[0] = iface1[0] = rest[0] = packets = bytes = 0;
-        if (strstr(buffPtr, "0.0.0.0")) {
-            // IPv4 has -- indicating what to do with fragments...
-            //       26     2373 RETURN     all  --  wlan0  rmnet0  0.0.0.0/0            0.0.0.0/0
-            res = sscanf(buffPtr, "%" SCNd64" %" SCNd64" RETURN all -- %s %s 0.%s",
-                    &packets, &bytes, iface0, iface1, rest);
+        bool rx;
+        if (filterPair) {
+            if (filter.intIface == rule.inIface && filter.extIface == rule.outIface) {
+                rx = true;
+            } else if (filter.intIface == rule.outIface && filter.extIface == rule.inIface) {
+                rx = false;
+            } else {
+                continue;
+            }
+        } else if (filterOne) {
+            if (filter.intIface == rule.inIface || filter.extIface == rule.outIface) {
+                rx = true;
+            } else if (filter.intIface == rule.outIface || filter.extIface == rule.inIface) {
+                rx = false;
+            } else {
+                continue;
+            }
         } else {
-            // ... but IPv6 does not.
-            //       26     2373 RETURN     all      wlan0  rmnet0  ::/0                 ::/0
-            res = sscanf(buffPtr, "%" SCNd64" %" SCNd64" RETURN all %s %s ::/%s",
-                    &packets, &bytes, iface0, iface1, rest);
+            // The tx side if the rx side has been seen already.
+            rx = (pending.find(getPairKey(rule.outIface, rule.inIface)) == pending.end());
         }
-        ALOGV("parse res=%d iface0=<%s> iface1=<%s> pkts=%" PRId64" bytes=%" PRId64" rest=<%s> orig line=<%s>", res,
-             iface0, iface1, packets, bytes, rest, buffPtr);
-        extraProcessingInfo += buffPtr;
-        extraProcessingInfo += "\n";
 
-        if (res != 5) {
-            continue;
+        const std::string& intIface = rx ? rule.inIface : rule.outIface;
+        const std::string& extIface = rx ? rule.outIface : rule.inIface;
+        const std::string key = getPairKey(intIface, extIface);
+        auto it = pending.find(key);
+        if (it == pending.end()) {
+            it = pending.emplace(key, TetherStats(intIface, extIface, -1, -1, -1, -1)).first;
         }
-        /*
-         * The following assumes that the 1st rule has in:extIface out:intIface,
-         * which is what NatController sets up.
-         * If not filtering, the 1st match rx, and sets up the pair for the tx side.
-         */
-        if (filter.intIface[0] && filter.extIface[0]) {
-            if (filter.intIface == iface0 && filter.extIface == iface1) {
-                ALOGV("2Filter RX iface_in=%s iface_out=%s rx_bytes=%" PRId64" rx_packets=%" PRId64" ", iface0, iface1, bytes, packets);
-                stats.rxPackets = packets;
-                stats.rxBytes = bytes;
-            } else if (filter.intIface == iface1 && filter.extIface == iface0) {
-                ALOGV("2Filter TX iface_in=%s iface_out=%s rx_bytes=%" PRId64" rx_packets=%" PRId64" ", iface0, iface1, bytes, packets);
-                stats.txPackets = packets;
-                stats.txBytes = bytes;
-            }
-        } else if (filter.intIface[0] || filter.extIface[0]) {
-            if (filter.intIface == iface0 || filter.extIface == iface1) {
-                ALOGV("1Filter RX iface_in=%s iface_out=%s rx_bytes=%" PRId64" rx_packets=%" PRId64" ", iface0, iface1, bytes, packets);
-                stats.intIface = iface0;
-                stats.extIface = iface1;
-                stats.rxPackets = packets;
-                stats.rxBytes = bytes;
-            } else if (filter.intIface == iface1 || filter.extIface == iface0) {
-                ALOGV("1Filter TX iface_in=%s iface_out=%s rx_bytes=%" PRId64" rx_packets=%" PRId64" ", iface0, iface1, bytes, packets);
-                stats.intIface = iface1;
-                stats.extIface = iface0;
-                stats.txPackets = packets;
-                stats.txBytes = bytes;
-            }
-        } else /* if (!filter.intFace[0] && !filter.extIface[0]) */ {
-            if (!stats.intIface[0]) {
-                ALOGV("0Filter RX iface_in=%s iface_out=%s rx_bytes=%" PRId64" rx_packets=%" PRId64" ", iface0, iface1, bytes, packets);
-                stats.intIface = iface0;
-                stats.extIface = iface1;
-                stats.rxPackets = packets;
-                stats.rxBytes = bytes;
-            } else if (stats.intIface == iface1 && stats.extIface == iface0) {
-                ALOGV("0Filter TX iface_in=%s iface_out=%s rx_bytes=%" PRId64" rx_packets=%" PRId64" ", iface0, iface1, bytes, packets);
-                stats.txPackets = packets;
-                stats.txBytes = bytes;
-            }
+        TetherStats& stats = it->second;
+        ALOGV("%s iface_in=%s iface_out=%s bytes=%" PRIu64 " packets=%" PRIu64,
+              rx ? "RX" : "TX", rule.inIface.c_str(), rule.outIface.c_str(), rule.bytes,
+              rule.packets);
+        if (rx) {
+            stats.rxPackets = rule.packets;
+            stats.rxBytes = rule.bytes;
+        } else {
+            stats.txPackets = rule.packets;
+            stats.txBytes = rule.bytes;
         }
+
         if (stats.rxBytes != -1 && stats.txBytes != -1) {
-            ALOGV("rx_bytes=%" PRId64" tx_bytes=%" PRId64" filterPair=%d", stats.rxBytes, stats.txBytes, filterPair);
-            addStats(statsList, stats);
+            ALOGV("rx_bytes=%" PRId64" tx_bytes=%" PRId64" filterPair=%d", stats.rxBytes,
+                  stats.txBytes, filterPair);
+            addStats(statsList, index, stats);
+            pending.erase(it);
+            statsFound++;
             if (filterPair) {
-                return 0;
-            } else {
-                statsFound++;
-                stats = filter;
+                return statsFound;
             }
         }
     }
 
     /* It is always an error to find only one side of the stats. */
-    /* It is an error to find nothing when not filtering. */
-    if (((stats.rxBytes == -1) != (stats.txBytes == -1)) ||
-        (!statsFound && !filterPair)) {
+    if (!pending.empty()) {
         return -1;
     }
-    return 0;
+    return statsFound;
 }
 
 std::string BandwidthController::TetherStats::getStatsLine() const {
@@ -1037,27 +1008,56 @@ std::string BandwidthController::TetherStats::getStatsLine() const {
     return msg;
 }
 
+int BandwidthController::getTetherStatsForTarget(IptablesTarget target,
+                                                 const TetherStats& filter,
+                                                 TetherStatsList* statsList,
+                                                 TetherStatsIndex& index,
+                                                 std::string& extraProcessingInfo) {
+    std::vector<IptablesRuleCounters> counters;
+    const int res = getChainCountersFunction(target, "filter",
+                                             NatController::LOCAL_TETHER_COUNTERS_CHAIN,
+                                             &counters);
+    if (res != 0) {
+        ALOGE("Failed to read %s counters for target %d: %s",
+              NatController::LOCAL_TETHER_COUNTERS_CHAIN, target, strerror(-res));
+        return -1;
+    }
+    return addForwardChainStats(filter, *statsList, index, counters, extraProcessingInfo);
+}
+
+int BandwidthController::getTetherStats(const TetherStats& filter, TetherStatsList* statsList,
+                                        std::string& extraProcessingInfo) {
+    TetherStatsIndex index;
+    statsList->clear();
+    for (const IptablesTarget target : {V4, V6}) {
+        const int res = getTetherStatsForTarget(target, filter, statsList, index,
+                                                extraProcessingInfo);
+        if (res < 0) {
+            return res;
+        }
+    }
+    return 0;
+}
+
 int BandwidthController::getTetherStats(SocketClient *cli, TetherStats& filter,
                                         std::string &extraProcessingInfo) {
-    int res = 0;
-
+    const bool filterPair = filter.intIface[0] && filter.extIface[0];
     TetherStatsList statsList;
+    TetherStatsIndex index;
 
     for (const IptablesTarget target : {V4, V6}) {
-        std::string statsString;
-        res = iptablesRestoreFunction(target, GET_TETHER_STATS_COMMAND, &statsString);
-        if (res != 0) {
-            ALOGE("Failed to run %s err=%d", GET_TETHER_STATS_COMMAND.c_str(), res);
-            return -1;
-        }
-
-        res = addForwardChainStats(filter, statsList, statsString, extraProcessingInfo);
-        if (res != 0) {
+        const int res = getTetherStatsForTarget(target, filter, &statsList, index,
+                                                extraProcessingInfo);
+        if (res < 0) {
             return res;
         }
+        /* It is an error to find nothing when not filtering. */
+        if (res == 0 && !filterPair) {
+            return -1;
+        }
     }
 
-    if (filter.intIface[0] && filter.extIface[0] && statsList.size() == 1) {
+    if (filterPair && statsList.size() == 1) {
         cli->sendMsg(ResponseCode::TetheringStatsResult,
                      statsList[0].getStatsLine().c_str(), false);
     } else {
@@ -1065,12 +1065,10 @@ int BandwidthController::getTetherStats(SocketClient *cli, TetherStats& filter,
             cli->sendMsg(ResponseCode::TetheringStatsListResult,
                          stats.getStatsLine().c_str(), false);
         }
-        if (res == 0) {
-            cli->sendMsg(ResponseCode::CommandOkay, "Tethering stats list completed", false);
-        }
+        cli->sendMsg(ResponseCode::CommandOkay, "Tethering stats list completed", false);
     }
 
-    return res;
+    return 0;
 }
 
 void BandwidthController::flushExistingCostlyTables(bool doClean) {
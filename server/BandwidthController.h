@@ -19,12 +19,14 @@
 #include <map>
 #include <set>
 #include <string>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
 #include <sysutils/SocketClient.h>
 #include <utils/RWLock.h>
 
+#include "IptablesCounters.h"
 #include "NetdConstants.h"
 
 class BandwidthController {
@@ -108,6 +110,12 @@ public:
      * It results in an error if invoked and no tethering counter rules exist.
      */
     int getTetherStats(SocketClient *cli, TetherStats &stats, std::string &extraProcessingInfo);
+    /*
+     * Same as above, but returns the stats instead of sending them, with the IPv4 and IPv6
+     * counters of each interface pair added together. Finding no interface pairs is not an error.
+     */
+    int getTetherStats(const TetherStats& filter, std::vector<TetherStats>* statsList,
+                       std::string& extraProcessingInfo);
 
     static const char LOCAL_INPUT[];
     static const char LOCAL_FORWARD[];
@@ -159,22 +167,33 @@ public:
     int removeCostlyAlert(const std::string& costName, int64_t* alertBytes);
 
     typedef std::vector<TetherStats> TetherStatsList;
+    // Position of each interface pair in a TetherStatsList, keyed by getPairKey().
+    typedef std::unordered_map<std::string, size_t> TetherStatsIndex;
 
-    static void addStats(TetherStatsList& statsList, const TetherStats& stats);
+    static std::string getPairKey(const std::string& intIface, const std::string& extIface);
+    static void addStats(TetherStatsList& statsList, TetherStatsIndex& index,
+                         const TetherStats& stats);
 
     /*
      * stats should never have only intIface initialized. Other 3 combos are ok.
-     * fp should be a file to the apropriate FORWARD chain of iptables rules.
-     * extraProcessingInfo: contains raw parsed data, and error info.
-     * This strongly requires that setup of the rules is in a specific order:
+     * counters should be the rules of one family's tether counters chain.
+     * extraProcessingInfo: contains the rules that were read, and error info.
+     * Each tethered interface pair has two rules:
      *  in:intIface out:extIface
      *  in:extIface out:intIface
-     * and the rules are grouped in pairs when more that one tethering was setup.
+     * which may appear in either order and need not be adjacent.
+     * Returns the number of interface pairs found, or -1 if a pair only has one rule.
      */
     static int addForwardChainStats(const TetherStats& filter,
-                                    TetherStatsList& statsList, const std::string& iptOutput,
+                                    TetherStatsList& statsList, TetherStatsIndex& index,
+                                    const std::vector<IptablesRuleCounters>& counters,
                                     std::string &extraProcessingInfo);
 
+    // Reads one family's tether counters and adds them to statsList.
+    int getTetherStatsForTarget(IptablesTarget target, const TetherStats& filter,
+                                TetherStatsList* statsList, TetherStatsIndex& index,
+                                std::string& extraProcessingInfo);
+
     /*
      * Attempt to find the bw_costly_* tables that need flushing,
      * and flush them.
@@ -196,6 +215,8 @@ public:
     static int (*execFunction)(int, char **, int *, bool, bool);
     static FILE *(*popenFunction)(const char *, const char *);
     static int (*iptablesRestoreFunction)(IptablesTarget, const std::string&, std::string *);
+    static int (*getChainCountersFunction)(IptablesTarget, const char*, const char*,
+                                           std::vector<IptablesRuleCounters>*);
 
     static const char *opToString(IptOp op);
     static const char *jumpToString(IptJumpOp jumpHandling);
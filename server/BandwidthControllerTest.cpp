@@ -16,6 +16,7 @@
  * BandwidthControllerTest.cpp - unit tests for BandwidthController.cpp
  */
 
+#include <deque>
 #include <string>
 #include <vector>
 
@@ -53,6 +54,7 @@ protected:
         BandwidthController::execFunction = fake_android_fork_exec;
         BandwidthController::popenFunction = fake_popen;
         BandwidthController::iptablesRestoreFunction = fakeExecIptablesRestoreWithOutput;
+        BandwidthController::getChainCountersFunction = fakeGetChainCounters;
     }
     BandwidthController mBw;
     TunInterface mTun;
@@ -63,6 +65,7 @@ protected:
 
     void TearDown() {
         mTun.destroy();
+        clearTetherCounters();
     }
 
     void addIptablesRestoreOutput(std::string contents) {
@@ -78,6 +81,41 @@ protected:
         sIptablesRestoreOutput.clear();
     }
 
+    static std::deque<std::vector<IptablesRuleCounters>> sChainCounters;
+    static std::deque<int> sChainCountersResults;
+
+    static int fakeGetChainCounters(IptablesTarget, const char* table, const char* chain,
+                                    std::vector<IptablesRuleCounters>* counters) {
+        EXPECT_STREQ("filter", table);
+        EXPECT_STREQ("natctrl_tether_counters", chain);
+        counters->clear();
+        if (sChainCounters.size()) {
+            *counters = sChainCounters.front();
+            sChainCounters.pop_front();
+        }
+        int res = 0;
+        if (sChainCountersResults.size()) {
+            res = sChainCountersResults.front();
+            sChainCountersResults.pop_front();
+        }
+        return res;
+    }
+
+    void addTetherCounters(const std::vector<IptablesRuleCounters>& counters) {
+        sChainCounters.push_back(counters);
+    }
+
+    void addTetherCounters(const std::vector<IptablesRuleCounters>& counters1,
+                           const std::vector<IptablesRuleCounters>& counters2) {
+        sChainCounters.push_back(counters1);
+        sChainCounters.push_back(counters2);
+    }
+
+    void clearTetherCounters() {
+        sChainCounters.clear();
+        sChainCountersResults.clear();
+    }
+
     void expectSetupCommands(const std::string& expectedClean, std::string expectedAccounting) {
         std::string expectedList =
             "*filter\n"
@@ -230,21 +268,20 @@ TEST_F(BandwidthControllerTest, TestEnableDataSaver) {
     expectIptablesRestoreCommands(expected);
 }
 
-std::string kIPv4TetherCounters = android::base::Join(std::vector<std::string> {
-    "Chain natctrl_tether_counters (4 references)",
-    "    pkts      bytes target     prot opt in     out     source               destination",
-    "      26     2373 RETURN     all  --  wlan0  rmnet0  0.0.0.0/0            0.0.0.0/0",
-    "      27     2002 RETURN     all  --  rmnet0 wlan0   0.0.0.0/0            0.0.0.0/0",
-    "    1040   107471 RETURN     all  --  bt-pan rmnet0  0.0.0.0/0            0.0.0.0/0",
-    "    1450  1708806 RETURN     all  --  rmnet0 bt-pan  0.0.0.0/0            0.0.0.0/0",
-}, '\n');
-
-std::string kIPv6TetherCounters = android::base::Join(std::vector<std::string> {
-    "Chain natctrl_tether_counters (2 references)",
-    "    pkts      bytes target     prot opt in     out     source               destination",
-    "   10000 10000000 RETURN     all      wlan0  rmnet0  ::/0                 ::/0",
-    "   20000 20000000 RETURN     all      rmnet0 wlan0   ::/0                 ::/0",
-}, '\n');
+std::deque<std::vector<IptablesRuleCounters>> BandwidthControllerTest::sChainCounters;
+std::deque<int> BandwidthControllerTest::sChainCountersResults;
+
+const std::vector<IptablesRuleCounters> kIPv4TetherCounters = {
+    { "wlan0",  "rmnet0",   26,    2373 },
+    { "rmnet0", "wlan0",    27,    2002 },
+    { "bt-pan", "rmnet0", 1040,  107471 },
+    { "rmnet0", "bt-pan", 1450, 1708806 },
+};
+
+const std::vector<IptablesRuleCounters> kIPv6TetherCounters = {
+    { "wlan0",  "rmnet0", 10000, 10000000 },
+    { "rmnet0", "wlan0",  20000, 20000000 },
+};
 
 std::string readSocketClientResponse(int fd) {
     char buf[32768];
@@ -274,17 +311,17 @@ TEST_F(BandwidthControllerTest, TestGetTetherStats) {
     BandwidthController::TetherStats filter;
 
     // If no filter is specified, both IPv4 and IPv6 counters must have at least one interface pair.
-    addIptablesRestoreOutput(kIPv4TetherCounters);
+    addTetherCounters(kIPv4TetherCounters);
     ASSERT_EQ(-1, mBw.getTetherStats(&cli, filter, err));
     expectNoSocketClientResponse(socketPair[1]);
-    clearIptablesRestoreOutput();
+    clearTetherCounters();
 
-    addIptablesRestoreOutput(kIPv6TetherCounters);
+    addTetherCounters({}, kIPv6TetherCounters);
     ASSERT_EQ(-1, mBw.getTetherStats(&cli, filter, err));
-    clearIptablesRestoreOutput();
+    clearTetherCounters();
 
     // IPv4 and IPv6 counters are properly added together.
-    addIptablesRestoreOutput(kIPv4TetherCounters, kIPv6TetherCounters);
+    addTetherCounters(kIPv4TetherCounters, kIPv6TetherCounters);
     filter = BandwidthController::TetherStats();
     std::string expected =
             "114 wlan0 rmnet0 10002373 10026 20002002 20027\n"
@@ -293,91 +330,136 @@ TEST_F(BandwidthControllerTest, TestGetTetherStats) {
     ASSERT_EQ(0, mBw.getTetherStats(&cli, filter, err));
     ASSERT_EQ(expected, readSocketClientResponse(socketPair[1]));
     expectNoSocketClientResponse(socketPair[1]);
-    clearIptablesRestoreOutput();
+    clearTetherCounters();
 
     // Test filtering.
-    addIptablesRestoreOutput(kIPv4TetherCounters, kIPv6TetherCounters);
+    addTetherCounters(kIPv4TetherCounters, kIPv6TetherCounters);
     filter = BandwidthController::TetherStats("bt-pan", "rmnet0", -1, -1, -1, -1);
     expected = "221 bt-pan rmnet0 107471 1040 1708806 1450\n";
     ASSERT_EQ(0, mBw.getTetherStats(&cli, filter, err));
     ASSERT_EQ(expected, readSocketClientResponse(socketPair[1]));
     expectNoSocketClientResponse(socketPair[1]);
-    clearIptablesRestoreOutput();
+    clearTetherCounters();
 
-    addIptablesRestoreOutput(kIPv4TetherCounters, kIPv6TetherCounters);
+    addTetherCounters(kIPv4TetherCounters, kIPv6TetherCounters);
     filter = BandwidthController::TetherStats("wlan0", "rmnet0", -1, -1, -1, -1);
     expected = "221 wlan0 rmnet0 10002373 10026 20002002 20027\n";
     ASSERT_EQ(0, mBw.getTetherStats(&cli, filter, err));
     ASSERT_EQ(expected, readSocketClientResponse(socketPair[1]));
-    clearIptablesRestoreOutput();
+    clearTetherCounters();
+
+    // Filtering on one interface.
+    addTetherCounters(kIPv4TetherCounters, kIPv6TetherCounters);
+    filter = BandwidthController::TetherStats("", "rmnet0", -1, -1, -1, -1);
+    expected =
+            "114 wlan0 rmnet0 10002373 10026 20002002 20027\n"
+            "114 bt-pan rmnet0 107471 1040 1708806 1450\n"
+            "200 Tethering stats list completed\n";
+    ASSERT_EQ(0, mBw.getTetherStats(&cli, filter, err));
+    ASSERT_EQ(expected, readSocketClientResponse(socketPair[1]));
+    clearTetherCounters();
 
     // Select nonexistent interfaces.
-    addIptablesRestoreOutput(kIPv4TetherCounters, kIPv6TetherCounters);
+    addTetherCounters(kIPv4TetherCounters, kIPv6TetherCounters);
     filter = BandwidthController::TetherStats("rmnet0", "foo0", -1, -1, -1, -1);
     expected = "200 Tethering stats list completed\n";
     ASSERT_EQ(0, mBw.getTetherStats(&cli, filter, err));
     ASSERT_EQ(expected, readSocketClientResponse(socketPair[1]));
-    clearIptablesRestoreOutput();
+    clearTetherCounters();
 
     // No stats with a filter: no error.
-    addIptablesRestoreOutput("", "");
+    addTetherCounters({}, {});
     ASSERT_EQ(0, mBw.getTetherStats(&cli, filter, err));
     ASSERT_EQ("200 Tethering stats list completed\n", readSocketClientResponse(socketPair[1]));
-    clearIptablesRestoreOutput();
+    clearTetherCounters();
 
-    addIptablesRestoreOutput("foo", "foo");
+    // Rules that do not match both interfaces are not tether counters, and are ignored.
+    const std::vector<IptablesRuleCounters> unrelatedCounters = {{ "", "", 1, 100 }};
+    addTetherCounters(unrelatedCounters, unrelatedCounters);
     ASSERT_EQ(0, mBw.getTetherStats(&cli, filter, err));
     ASSERT_EQ("200 Tethering stats list completed\n", readSocketClientResponse(socketPair[1]));
-    clearIptablesRestoreOutput();
+    clearTetherCounters();
 
     // No stats and empty filter: error.
     filter = BandwidthController::TetherStats();
-    addIptablesRestoreOutput("", kIPv6TetherCounters);
+    addTetherCounters({}, kIPv6TetherCounters);
     ASSERT_EQ(-1, mBw.getTetherStats(&cli, filter, err));
     expectNoSocketClientResponse(socketPair[1]);
-    clearIptablesRestoreOutput();
+    clearTetherCounters();
 
-    addIptablesRestoreOutput(kIPv4TetherCounters, "");
+    addTetherCounters(kIPv4TetherCounters, {});
     ASSERT_EQ(-1, mBw.getTetherStats(&cli, filter, err));
     expectNoSocketClientResponse(socketPair[1]);
-    clearIptablesRestoreOutput();
+    clearTetherCounters();
 
     // Include only one pair of interfaces and things are fine.
-    std::vector<std::string> counterLines = android::base::Split(kIPv4TetherCounters, "\n");
-    std::vector<std::string> brokenCounterLines = counterLines;
-    counterLines.resize(4);
-    std::string counters = android::base::Join(counterLines, "\n") + "\n";
-    addIptablesRestoreOutput(counters, counters);
+    std::vector<IptablesRuleCounters> counters(kIPv4TetherCounters.begin(),
+                                               kIPv4TetherCounters.begin() + 2);
+    addTetherCounters(counters, counters);
     expected =
             "114 wlan0 rmnet0 4746 52 4004 54\n"
             "200 Tethering stats list completed\n";
     ASSERT_EQ(0, mBw.getTetherStats(&cli, filter, err));
     ASSERT_EQ(expected, readSocketClientResponse(socketPair[1]));
-    clearIptablesRestoreOutput();
+    clearTetherCounters();
+
+    // The two rules of a pair do not need to be adjacent.
+    counters = {
+        kIPv4TetherCounters[0], kIPv4TetherCounters[2], kIPv4TetherCounters[3],
+        kIPv4TetherCounters[1],
+    };
+    addTetherCounters(counters, kIPv6TetherCounters);
+    expected =
+            "114 bt-pan rmnet0 107471 1040 1708806 1450\n"
+            "114 wlan0 rmnet0 10002373 10026 20002002 20027\n"
+            "200 Tethering stats list completed\n";
+    ASSERT_EQ(0, mBw.getTetherStats(&cli, filter, err));
+    ASSERT_EQ(expected, readSocketClientResponse(socketPair[1]));
+    clearTetherCounters();
 
     // But if interfaces aren't paired, it's always an error.
     err = "";
-    counterLines.resize(3);
-    counters = android::base::Join(counterLines, "\n") + "\n";
-    addIptablesRestoreOutput(counters, counters);
+    counters.resize(1);
+    addTetherCounters(counters, counters);
     ASSERT_EQ(-1, mBw.getTetherStats(&cli, filter, err));
     expectNoSocketClientResponse(socketPair[1]);
-    clearIptablesRestoreOutput();
+    clearTetherCounters();
 
     // Token unit test of the fact that we return the stats in the error message which the caller
     // ignores.
-    std::string expectedError = counters;
+    std::string expectedError = "wlan0 rmnet0 26 2373\n";
     EXPECT_EQ(expectedError, err);
 
-    // popen() failing is always an error.
-    addIptablesRestoreOutput(kIPv4TetherCounters);
+    // Failing to read the counters is always an error.
+    addTetherCounters(kIPv4TetherCounters, kIPv6TetherCounters);
+    sChainCountersResults = { -ENOENT };
     ASSERT_EQ(-1, mBw.getTetherStats(&cli, filter, err));
     expectNoSocketClientResponse(socketPair[1]);
-    clearIptablesRestoreOutput();
-    addIptablesRestoreOutput(kIPv6TetherCounters);
+    clearTetherCounters();
+    addTetherCounters(kIPv4TetherCounters, kIPv6TetherCounters);
+    sChainCountersResults = { 0, -EPERM };
     ASSERT_EQ(-1, mBw.getTetherStats(&cli, filter, err));
     expectNoSocketClientResponse(socketPair[1]);
-    clearIptablesRestoreOutput();
+    clearTetherCounters();
+}
+
+TEST_F(BandwidthControllerTest, TestGetTetherStatsList) {
+    std::vector<BandwidthController::TetherStats> statsList;
+    BandwidthController::TetherStats filter;
+    std::string err;
+
+    addTetherCounters(kIPv4TetherCounters, kIPv6TetherCounters);
+    ASSERT_EQ(0, mBw.getTetherStats(filter, &statsList, err));
+    ASSERT_EQ(2U, statsList.size());
+    EXPECT_EQ("wlan0 rmnet0 10002373 10026 20002002 20027", statsList[0].getStatsLine());
+    EXPECT_EQ("bt-pan rmnet0 107471 1040 1708806 1450", statsList[1].getStatsLine());
+    clearTetherCounters();
+
+    // Unlike the socket command, no tethering is not an error.
+    addTetherCounters({}, {});
+    ASSERT_EQ(0, mBw.getTetherStats(filter, &statsList, err));
+    EXPECT_EQ(0U, statsList.size());
+    clearTetherCounters();
 }
 
 const std::vector<std::string> makeInterfaceQuotaCommands(const std::string& iface, int ruleIndex,
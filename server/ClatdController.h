@@ -19,6 +19,8 @@
 
 #include <map>
 
+#include <utils/RWLock.h>
+
 namespace android {
 namespace net {
 
@@ -29,6 +31,8 @@ public:
     explicit ClatdController(NetworkController* controller);
     virtual ~ClatdController();
 
+    android::RWLock lock;
+
     int startClatd(char *interface);
     int stopClatd(char* interface);
     bool isClatdStarted(char* interface);
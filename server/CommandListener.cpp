@@ -45,9 +45,11 @@
 #include "InterfaceController.h"
 #include "NetdConstants.h"
 #include "FirewallController.h"
+#include "LockStats.h"
 #include "RouteController.h"
 #include "UidRanges.h"
 
+#include <algorithm>
 #include <string>
 #include <vector>
 
@@ -82,42 +84,68 @@ unsigned stringToNetId(const char* arg) {
 
 class LockingFrameworkCommand : public FrameworkCommand {
 public:
-    LockingFrameworkCommand(FrameworkCommand *wrappedCmd, android::RWLock& lock) :
+    LockingFrameworkCommand(FrameworkCommand *wrappedCmd, android::RWLock* lock,
+                            const std::vector<std::vector<std::string>>& readOnlyArgs) :
             FrameworkCommand(wrappedCmd->getCommand()),
             mWrappedCmd(wrappedCmd),
-            mLock(lock) {}
+            mLock(lock),
+            mReadOnlyArgs(readOnlyArgs) {}
 
     int runCommand(SocketClient *c, int argc, char **argv) {
-        android::RWLock::AutoWLock lock(mLock);
+        TimedLock lock(mLock, isReadOnly(argc, argv) ? TimedLock::SHARED : TimedLock::EXCLUSIVE,
+                       getCommand());
         return mWrappedCmd->runCommand(c, argc, argv);
     }
 
 private:
+    bool isReadOnly(int argc, char **argv) const {
+        for (const auto& args : mReadOnlyArgs) {
+            if (static_cast<int>(args.size()) < argc &&
+                    std::equal(args.begin(), args.end(), argv + 1)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
     FrameworkCommand *mWrappedCmd;
-    android::RWLock& mLock;
+    android::RWLock* const mLock;
+    const std::vector<std::vector<std::string>> mReadOnlyArgs;
 };
 
 
 }  // namespace
 
-void CommandListener::registerLockingCmd(FrameworkCommand *cmd, android::RWLock& lock) {
-    registerCmd(new LockingFrameworkCommand(cmd, lock));
+void CommandListener::registerLockingCmd(FrameworkCommand *cmd, android::RWLock& lock,
+                                         const std::vector<std::vector<std::string>>& readOnlyArgs) {
+    registerCmd(new LockingFrameworkCommand(cmd, &lock, readOnlyArgs));
+}
+
+void CommandListener::registerTimedCmd(FrameworkCommand *cmd) {
+    registerCmd(new LockingFrameworkCommand(cmd, nullptr, {}));
 }
 
 CommandListener::CommandListener() : FrameworkListener(SOCKET_NAME, true) {
-    registerLockingCmd(new InterfaceCmd());
-    registerLockingCmd(new IpFwdCmd());
-    registerLockingCmd(new TetherCmd());
-    registerLockingCmd(new NatCmd());
-    registerLockingCmd(new ListTtysCmd());
-    registerLockingCmd(new PppdCmd());
-    registerLockingCmd(new BandwidthControlCmd(), gCtls->bandwidthCtrl.lock);
-    registerLockingCmd(new IdletimerControlCmd());
-    registerLockingCmd(new ResolverCmd());
-    registerLockingCmd(new FirewallCmd(), gCtls->firewallCtrl.lock);
-    registerLockingCmd(new ClatdCmd());
-    registerLockingCmd(new NetworkCommand());
-    registerLockingCmd(new StrictCmd());
+    // InterfaceController keeps no state, and NetworkController and ResolverController lock
+    // internally.
+    registerTimedCmd(new InterfaceCmd());
+    registerLockingCmd(new IpFwdCmd(), gCtls->tetherCtrl.lock, {{"status"}});
+    registerLockingCmd(new TetherCmd(), gCtls->tetherCtrl.lock,
+                       {{"status"}, {"interface", "list"}, {"dns", "list"}});
+    // NatCmd also updates the bandwidth controller's forward chain alert, so it takes the bandwidth
+    // lock first and then, inside the command, the NAT lock.
+    registerLockingCmd(new NatCmd(), gCtls->bandwidthCtrl.lock);
+    registerLockingCmd(new ListTtysCmd(), gCtls->pppCtrl.lock);
+    registerLockingCmd(new PppdCmd(), gCtls->pppCtrl.lock);
+    registerLockingCmd(new BandwidthControlCmd(), gCtls->bandwidthCtrl.lock,
+                       {{"gettetherstats"}, {"gts"}, {"getquota"}, {"gq"}, {"getiquota"}, {"giq"}});
+    registerLockingCmd(new IdletimerControlCmd(), gCtls->idletimerCtrl.lock);
+    registerTimedCmd(new ResolverCmd());
+    registerLockingCmd(new FirewallCmd(), gCtls->firewallCtrl.lock, {{"is_enabled"}});
+    // "clatd status" and "list_ttys" look read-only, but update their controllers' state.
+    registerLockingCmd(new ClatdCmd(), gCtls->clatdCtrl.lock);
+    registerTimedCmd(new NetworkCommand());
+    registerLockingCmd(new StrictCmd(), gCtls->strictCtrl.lock);
 }
 
 CommandListener::InterfaceCmd::InterfaceCmd() :
@@ -542,6 +570,8 @@ int CommandListener::NatCmd::runCommand(SocketClient *cli,
         return 0;
     }
 
+    TimedLock natLock(&gCtls->natCtrl.lock, TimedLock::EXCLUSIVE, "nat (NAT lock)");
+
     //  0     1       2        3
     // nat  enable intiface extiface
     // nat disable intiface extiface
@@ -981,7 +1011,12 @@ int CommandListener::BandwidthControlCmd::runCommand(SocketClient *cli, int argc
         tetherStats.intIface = argc > 2 ? argv[2] : "";
         tetherStats.extIface = argc > 3 ? argv[3] : "";
         // No filtering requested and there are no interface pairs to lookup.
-        if (argc <= 2 && gCtls->natCtrl.ifacePairList.empty()) {
+        bool noIfacePairs;
+        {
+            TimedLock natLock(&gCtls->natCtrl.lock, TimedLock::SHARED, "bandwidth gettetherstats");
+            noIfacePairs = gCtls->natCtrl.ifacePairList.empty();
+        }
+        if (argc <= 2 && noIfacePairs) {
             cli->sendMsg(ResponseCode::CommandOkay, "Tethering stats list completed", false);
             return 0;
         }
@@ -17,6 +17,9 @@
 #ifndef _COMMANDLISTENER_H__
 #define _COMMANDLISTENER_H__
 
+#include <string>
+#include <vector>
+
 #include <sysutils/FrameworkListener.h>
 #include "utils/RWLock.h"
 
@@ -45,10 +48,13 @@ public:
     static constexpr const char* SOCKET_NAME = "netd";
 
 private:
-    void registerLockingCmd(FrameworkCommand *cmd, android::RWLock& lock);
-    void registerLockingCmd(FrameworkCommand *cmd) {
-        registerLockingCmd(cmd, android::net::gBigNetdLock);
-    }
+    // Runs |cmd| holding |lock|. The lock is shared if the command's arguments start with one of
+    // |readOnlyArgs|, and exclusive otherwise. See Controllers.h for the locking order.
+    void registerLockingCmd(FrameworkCommand *cmd, android::RWLock& lock,
+                            const std::vector<std::vector<std::string>>& readOnlyArgs = {});
+    // Runs |cmd| without a lock, for commands whose controllers do their own locking or keep no
+    // state. The time they take is still recorded alongside the locking commands.
+    void registerTimedCmd(FrameworkCommand *cmd);
 
     class InterfaceCmd : public NetdCommand {
     public:
@@ -26,6 +26,7 @@
 
 #include "Controllers.h"
 #include "IdletimerController.h"
+#include "InterfaceRegistry.h"
 #include "NetworkController.h"
 #include "RouteController.h"
 #include "Stopwatch.h"
@@ -265,6 +266,11 @@ void Controllers::init() {
     bandwidthCtrl.enableBandwidthControl(false);
     ALOGI("Disabling bandwidth control: %.1fms", s.getTimeAndReset());
 
+    if (int ret = gInterfaceRegistry.load()) {
+        ALOGE("failed to load interfaces (%s)", strerror(-ret));
+    }
+    ALOGI("Loading interfaces: %.1fms", s.getTimeAndReset());
+
     if (int ret = RouteController::Init(NetworkController::LOCAL_NET_ID)) {
         ALOGE("failed to initialize RouteController (%s)", strerror(-ret));
     }
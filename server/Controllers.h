@@ -21,6 +21,7 @@
 
 #include "BandwidthController.h"
 #include "ClatdController.h"
+#include "DnsWorkerPool.h"
 #include "EventReporter.h"
 #include "FirewallController.h"
 #include "IdletimerController.h"
@@ -38,6 +39,25 @@
 namespace android {
 namespace net {
 
+/*
+ * Locking
+ *
+ * CommandListener commands and binder RPCs are serialized per controller, not globally. Each
+ * controller that keeps state and does not lock internally has a public |lock|, which callers take
+ * through TimedLock so that contention shows up in dumpsys. Read-only queries take it shared.
+ *
+ * Code that needs more than one of these locks must take them in this order:
+ *
+ *   1. bandwidthCtrl.lock
+ *   2. firewallCtrl.lock
+ *   3. tetherCtrl.lock
+ *   4. natCtrl.lock
+ *   5. pppCtrl.lock, idletimerCtrl.lock, clatdCtrl.lock or strictCtrl.lock, never more than one
+ *
+ * The internal locks of NetworkController, RouteController, ResolverController, XfrmController and
+ * InterfaceRegistry come last. They are only held within those classes' own methods, which never
+ * take any of the locks above, so they can be called with any of them held.
+ */
 class Controllers {
 public:
     Controllers();
@@ -53,6 +73,7 @@ public:
     ClatdController clatdCtrl;
     StrictController strictCtrl;
     EventReporter eventReporter;
+    DnsWorkerPool dnsWorkerPool;
     IptablesRestoreController iptablesRestoreCtrl;
     WakeupController wakeupCtrl;
     XfrmController xfrmCtrl;
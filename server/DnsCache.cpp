@@ -0,0 +1,259 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <inttypes.h>
+#include <netdb.h>
+
+#include <algorithm>
+#include <functional>
+
+#include "DnsCache.h"
+#include "DumpWriter.h"
+
+namespace android {
+namespace net {
+
+constexpr size_t DnsCache::kNumShards;
+constexpr size_t DnsCache::kDefaultMaxEntries;
+constexpr size_t DnsCache::kMaxAddresses;
+constexpr size_t DnsCache::kMaxHostLength;
+constexpr DnsCache::Clock::duration DnsCache::kPositiveLifetime;
+constexpr DnsCache::Clock::duration DnsCache::kNegativeLifetime;
+constexpr DnsCache::Clock::duration DnsCache::kMaxStale;
+constexpr DnsCache::Clock::duration DnsCache::kPrefetchWindow;
+constexpr unsigned DnsCache::kPrefetchMinHits;
+
+namespace {
+
+// NXDOMAIN and NODATA, as the resolver reports them.
+bool isNegative(int error) {
+    return error == EAI_NONAME || error == EAI_NODATA;
+}
+
+}  // namespace
+
+bool DnsCache::Key::operator==(const Key& other) const {
+    return netId == other.netId && dnsMark == other.dnsMark && appMark == other.appMark &&
+           uid == other.uid && host == other.host && hasService == other.hasService &&
+           service == other.service && hasHints == other.hasHints && flags == other.flags &&
+           family == other.family && socktype == other.socktype && protocol == other.protocol;
+}
+
+size_t DnsCache::KeyHash::operator()(const Key& key) const {
+    size_t hash = std::hash<std::string>()(key.host);
+    const auto mix = [&hash](size_t value) {
+        hash ^= value + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+    };
+    mix(key.netId);
+    mix(key.dnsMark);
+    mix(key.appMark);
+    mix(key.uid);
+    mix(key.hasService ? std::hash<std::string>()(key.service) : 0);
+    mix(key.hasHints);
+    mix(key.flags);
+    mix(key.family);
+    mix(key.socktype);
+    mix(key.protocol);
+    return hash;
+}
+
+DnsCache::Answer DnsCache::Answer::fromAddrinfo(int error, const addrinfo* result) {
+    Answer answer;
+    answer.error = error;
+    for (const addrinfo* ai = result; ai != nullptr; ai = ai->ai_next) {
+        Address address;
+        address.flags = ai->ai_flags;
+        address.family = ai->ai_family;
+        address.socktype = ai->ai_socktype;
+        address.protocol = ai->ai_protocol;
+        if (ai->ai_addr != nullptr) {
+            address.addr.assign(reinterpret_cast<const char*>(ai->ai_addr), ai->ai_addrlen);
+        }
+        address.hasCanonname = ai->ai_canonname != nullptr;
+        if (address.hasCanonname) {
+            address.canonname = ai->ai_canonname;
+        }
+        answer.addresses.push_back(std::move(address));
+    }
+    return answer;
+}
+
+DnsCache::DnsCache(size_t maxEntries)
+    : mMaxEntriesPerShard(std::max<size_t>(maxEntries / kNumShards, 1)) {}
+
+bool DnsCache::isUpstreamFailure(int error) {
+    return error == EAI_AGAIN || error == EAI_FAIL || error == EAI_SYSTEM;
+}
+
+DnsCache::Shard& DnsCache::shardFor(const Key& key) {
+    return mShards[KeyHash()(key) % kNumShards];
+}
+
+void DnsCache::eraseLocked(Shard& shard, std::unordered_map<Key, Entry, KeyHash>::iterator it) {
+    shard.stats[it->first.netId].entries--;
+    shard.lru.erase(it->second.lruPosition);
+    shard.entries.erase(it);
+}
+
+bool DnsCache::lookup(const Key& key, Clock::time_point now, Answer* answer, bool* prefetch) {
+    Shard& shard = shardFor(key);
+    std::lock_guard<std::mutex> guard(shard.lock);
+    Stats& stats = shard.stats[key.netId];
+    const auto it = shard.entries.find(key);
+    if (it == shard.entries.end() || it->second.expiry <= now) {
+        stats.misses++;
+        // Expired positive answers are kept a while longer, in case the upstream lookup fails.
+        if (it != shard.entries.end() &&
+                (it->second.answer.error != 0 || now - it->second.expiry > kMaxStale)) {
+            eraseLocked(shard, it);
+        }
+        return false;
+    }
+
+    Entry& entry = it->second;
+    entry.hits++;
+    stats.hits++;
+    if (entry.answer.error != 0) {
+        stats.negativeHits++;
+    }
+    shard.lru.splice(shard.lru.begin(), shard.lru, entry.lruPosition);
+    *answer = entry.answer;
+
+    *prefetch = entry.answer.error == 0 && !entry.prefetching &&
+            entry.hits >= kPrefetchMinHits && entry.expiry - now <= kPrefetchWindow;
+    if (*prefetch) {
+        entry.prefetching = true;
+        stats.prefetches++;
+    }
+    return true;
+}
+
+uint64_t DnsCache::getGeneration(unsigned netId) const {
+    std::lock_guard<std::mutex> guard(mGenerationsLock);
+    const auto it = mGenerations.find(netId);
+    return it == mGenerations.end() ? 0 : it->second;
+}
+
+void DnsCache::insert(const Key& key, Clock::time_point now, const Answer& answer,
+                      uint64_t generation) {
+    Shard& shard = shardFor(key);
+    std::lock_guard<std::mutex> guard(shard.lock);
+    // Checked under the shard lock: invalidate() advances the generation before it clears the
+    // shards, so either it is seen here, or the answer is inserted before this shard is cleared.
+    if (generation != getGeneration(key.netId)) {
+        shard.stats[key.netId].staleInserts++;
+        return;
+    }
+    auto it = shard.entries.find(key);
+    if (isUpstreamFailure(answer.error)) {
+        // Let a later lookup try to refresh the entry again.
+        if (it != shard.entries.end()) {
+            it->second.prefetching = false;
+        }
+        return;
+    }
+    // Other errors mean the query itself was bad, and are cheap to get again.
+    if ((answer.error != 0 && !isNegative(answer.error)) || key.host.size() > kMaxHostLength ||
+            answer.addresses.size() > kMaxAddresses) {
+        return;
+    }
+
+    if (it == shard.entries.end()) {
+        if (shard.entries.size() >= mMaxEntriesPerShard) {
+            const auto victim = shard.entries.find(*shard.lru.back());
+            shard.stats[victim->first.netId].evictions++;
+            eraseLocked(shard, victim);
+        }
+        it = shard.entries.emplace(key, Entry()).first;
+        shard.lru.push_front(&it->first);
+        it->second.lruPosition = shard.lru.begin();
+        shard.stats[key.netId].entries++;
+    } else {
+        shard.lru.splice(shard.lru.begin(), shard.lru, it->second.lruPosition);
+    }
+    Entry& entry = it->second;
+    entry.answer = answer;
+    entry.expiry = now + (answer.error == 0 ? kPositiveLifetime : kNegativeLifetime);
+    entry.hits = 0;
+    entry.prefetching = false;
+}
+
+bool DnsCache::lookupStale(const Key& key, Clock::time_point now, Answer* answer) {
+    Shard& shard = shardFor(key);
+    std::lock_guard<std::mutex> guard(shard.lock);
+    const auto it = shard.entries.find(key);
+    if (it == shard.entries.end() || it->second.answer.error != 0 ||
+            now - it->second.expiry > kMaxStale) {
+        return false;
+    }
+    shard.stats[key.netId].staleHits++;
+    shard.lru.splice(shard.lru.begin(), shard.lru, it->second.lruPosition);
+    *answer = it->second.answer;
+    return true;
+}
+
+void DnsCache::invalidate(unsigned netId) {
+    {
+        std::lock_guard<std::mutex> guard(mGenerationsLock);
+        mGenerations[netId]++;
+    }
+    for (Shard& shard : mShards) {
+        std::lock_guard<std::mutex> guard(shard.lock);
+        for (auto it = shard.entries.begin(); it != shard.entries.end();) {
+            const auto next = std::next(it);
+            if (it->first.netId == netId) {
+                eraseLocked(shard, it);
+            }
+            it = next;
+        }
+    }
+    // Counted once, in the shard of the netId itself.
+    Shard& shard = mShards[netId % kNumShards];
+    std::lock_guard<std::mutex> guard(shard.lock);
+    shard.stats[netId].invalidations++;
+}
+
+DnsCache::Stats DnsCache::getStats(unsigned netId) const {
+    Stats total;
+    for (const Shard& shard : mShards) {
+        std::lock_guard<std::mutex> guard(shard.lock);
+        const auto it = shard.stats.find(netId);
+        if (it == shard.stats.end()) continue;
+        const Stats& stats = it->second;
+        total.hits += stats.hits;
+        total.negativeHits += stats.negativeHits;
+        total.misses += stats.misses;
+        total.staleHits += stats.staleHits;
+        total.prefetches += stats.prefetches;
+        total.evictions += stats.evictions;
+        total.invalidations += stats.invalidations;
+        total.staleInserts += stats.staleInserts;
+        total.entries += stats.entries;
+    }
+    return total;
+}
+
+void DnsCache::dump(DumpWriter& dw, unsigned netId) const {
+    const Stats stats = getStats(netId);
+    dw.println("DNS cache: %zu entries, %" PRIu64 " hits (%" PRIu64 " negative), %" PRIu64
+               " misses, %" PRIu64 " stale answers served, %" PRIu64 " prefetches, %" PRIu64
+               " evictions, %" PRIu64 " flushes, %" PRIu64 " answers dropped by a flush",
+               stats.entries, stats.hits, stats.negativeHits, stats.misses, stats.staleHits,
+               stats.prefetches, stats.evictions, stats.invalidations, stats.staleInserts);
+}
+
+}  // namespace net
+}  // namespace android
@@ -0,0 +1,198 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NETD_SERVER_DNS_CACHE_H
+#define NETD_SERVER_DNS_CACHE_H
+
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#include <array>
+#include <chrono>
+#include <list>
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct addrinfo;
+
+namespace android {
+namespace net {
+
+class DumpWriter;
+
+// A cache of getaddrinfo() answers, kept by DnsProxyListener in front of the resolver.
+//
+// The resolver library does not return record TTLs through getaddrinfo(), so answers are kept for
+// a short, fixed lifetime instead: long enough to absorb the bursts of identical lookups that apps
+// make at startup, and short enough to stay well within the TTLs of nearly all records. The
+// resolver's own cache, which does honor TTLs, still sits behind this one.
+//
+//  - Answers that a name does not exist or has no addresses of the requested family are cached
+//    for a shorter time, as negative answers are in RFC 2308.
+//  - When the upstream servers fail or time out, an expired answer may be served instead, for a
+//    while after it expired ("serve-stale", as in RFC 8767).
+//  - A name that is looked up often is refreshed shortly before it expires: the lookup that finds
+//    it close to expiry is told to prefetch it, so that later lookups keep hitting the cache.
+//
+// Entries are spread over several independently locked shards, so that lookups on different
+// worker threads rarely contend. Each shard holds a bounded number of entries and evicts the least
+// recently used one when it is full, and answers with too many addresses are not cached at all.
+class DnsCache {
+  public:
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr size_t kNumShards = 16;
+    static constexpr size_t kDefaultMaxEntries = 1024;
+    static constexpr size_t kMaxAddresses = 32;
+    static constexpr size_t kMaxHostLength = 255;
+
+    static constexpr Clock::duration kPositiveLifetime = std::chrono::seconds(10);
+    static constexpr Clock::duration kNegativeLifetime = std::chrono::seconds(5);
+    static constexpr Clock::duration kMaxStale = std::chrono::minutes(10);
+    // An entry is prefetched when it is hit this close to expiry, if it has been hit often enough.
+    static constexpr Clock::duration kPrefetchWindow = std::chrono::seconds(2);
+    static constexpr unsigned kPrefetchMinHits = 3;
+
+    // Everything that getaddrinfo() is asked. The mark that queries are sent with is included, so
+    // that an app never gets an answer obtained with permissions it does not have. So are the app's
+    // own mark and UID, which decide how the addresses are filtered for AI_ADDRCONFIG and sorted,
+    // because the app may be routed differently from the network its queries go to (e.g., by a
+    // VPN that has no DNS servers of its own).
+    struct Key {
+        unsigned netId;
+        unsigned dnsMark;
+        unsigned appMark;
+        uid_t uid;
+        std::string host;
+        bool hasService;
+        std::string service;
+        bool hasHints;
+        int flags;
+        int family;
+        int socktype;
+        int protocol;
+
+        bool operator==(const Key& other) const;
+    };
+
+    // One addrinfo, with ai_addr and ai_canonname copied out.
+    struct Address {
+        int flags;
+        int family;
+        int socktype;
+        int protocol;
+        std::string addr;  // The raw sockaddr, ai_addrlen bytes long.
+        bool hasCanonname;
+        std::string canonname;
+    };
+
+    struct Answer {
+        int error = 0;  // The value getaddrinfo() returned: 0 or an EAI_* error.
+        std::vector<Address> addresses;
+
+        static Answer fromAddrinfo(int error, const addrinfo* result);
+    };
+
+    struct Stats {
+        uint64_t hits = 0;
+        uint64_t negativeHits = 0;  // Included in hits.
+        uint64_t misses = 0;
+        uint64_t staleHits = 0;     // Expired answers served because the upstream lookup failed.
+        uint64_t prefetches = 0;
+        uint64_t evictions = 0;
+        uint64_t invalidations = 0;
+        uint64_t staleInserts = 0;  // Answers dropped because they were resolved before a flush.
+        size_t entries = 0;
+    };
+
+    explicit DnsCache(size_t maxEntries = kDefaultMaxEntries);
+
+    DnsCache(const DnsCache&) = delete;
+    DnsCache& operator=(const DnsCache&) = delete;
+
+    // Looks up |key| at |now|. Returns true and fills in |answer| if an unexpired answer, positive
+    // or negative, is cached. In that case |prefetch| is set if the caller should look |key| up
+    // again and insert() the result; only one lookup is asked to do so per entry.
+    // Threadsafe.
+    bool lookup(const Key& key, Clock::time_point now, Answer* answer, bool* prefetch);
+
+    // Returns the generation of the cache of |netId|, which invalidate() advances. Callers read it
+    // before they start resolving, and pass it to insert() with the answer.
+    // Threadsafe.
+    uint64_t getGeneration(unsigned netId) const;
+
+    // Caches the answer the resolver gave for |key| at |now|. Answers that indicate that the
+    // upstream servers failed are not cached, and leave any previous answer in place. Answers
+    // resolved in an earlier |generation| than the current one, i.e. before the network's cache was
+    // last invalidated, are dropped, since they may have come from servers it no longer uses.
+    // Threadsafe.
+    void insert(const Key& key, Clock::time_point now, const Answer& answer, uint64_t generation);
+
+    // Called after the upstream lookup for |key| failed. Returns true and fills in |answer| with
+    // the last answer cached for |key| if it expired no more than kMaxStale ago.
+    // Threadsafe.
+    bool lookupStale(const Key& key, Clock::time_point now, Answer* answer);
+
+    // Drops every answer cached for |netId|, and every answer still being resolved for it.
+    // Threadsafe.
+    void invalidate(unsigned netId);
+
+    Stats getStats(unsigned netId) const;
+
+    void dump(DumpWriter& dw, unsigned netId) const;
+
+    // Whether |error| means that the upstream servers failed, rather than that they answered.
+    static bool isUpstreamFailure(int error);
+
+  private:
+    struct KeyHash {
+        size_t operator()(const Key& key) const;
+    };
+
+    struct Entry {
+        Answer answer;
+        Clock::time_point expiry;
+        unsigned hits;
+        bool prefetching;
+        std::list<const Key*>::iterator lruPosition;
+    };
+
+    struct Shard {
+        mutable std::mutex lock;
+        std::unordered_map<Key, Entry, KeyHash> entries;  // Guarded by lock.
+        std::list<const Key*> lru;                        // Most recently used first. Ditto.
+        std::map<unsigned, Stats> stats;                  // By netId. Ditto.
+    };
+
+    Shard& shardFor(const Key& key);
+    // Must be called with |shard.lock| held.
+    void eraseLocked(Shard& shard, std::unordered_map<Key, Entry, KeyHash>::iterator it);
+
+    const size_t mMaxEntriesPerShard;
+    std::array<Shard, kNumShards> mShards;
+    // Taken inside a shard's lock, never the other way around.
+    mutable std::mutex mGenerationsLock;
+    std::unordered_map<unsigned, uint64_t> mGenerations;  // By netId. Guarded by mGenerationsLock.
+};
+
+}  // namespace net
+}  // namespace android
+
+#endif  // NETD_SERVER_DNS_CACHE_H
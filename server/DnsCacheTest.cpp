@@ -0,0 +1,264 @@
+/*
+ * Copyright 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * DnsCacheTest.cpp - unit tests for DnsCache.cpp
+ */
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "DnsCache.h"
+
+namespace android {
+namespace net {
+
+namespace {
+
+using Clock = DnsCache::Clock;
+using std::chrono::seconds;
+
+DnsCache::Key makeKey(unsigned netId, const std::string& host) {
+    return {netId, 0, 0, 10000, host, false, "", true, AI_ADDRCONFIG, AF_UNSPEC, SOCK_STREAM, 0};
+}
+
+DnsCache::Answer makeAnswer(const char* ip) {
+    sockaddr_in sin = {};
+    sin.sin_family = AF_INET;
+    inet_pton(AF_INET, ip, &sin.sin_addr);
+    addrinfo ai = {};
+    ai.ai_family = AF_INET;
+    ai.ai_socktype = SOCK_STREAM;
+    ai.ai_protocol = IPPROTO_TCP;
+    ai.ai_addrlen = sizeof(sin);
+    ai.ai_addr = reinterpret_cast<sockaddr*>(&sin);
+    return DnsCache::Answer::fromAddrinfo(0, &ai);
+}
+
+DnsCache::Answer makeError(int error) {
+    return DnsCache::Answer::fromAddrinfo(error, nullptr);
+}
+
+std::string firstAddress(const DnsCache::Answer& answer) {
+    if (answer.addresses.empty()) return "";
+    const auto* sin = reinterpret_cast<const sockaddr_in*>(answer.addresses[0].addr.data());
+    char ip[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &sin->sin_addr, ip, sizeof(ip));
+    return ip;
+}
+
+}  // namespace
+
+class DnsCacheTest : public testing::Test {
+  protected:
+    bool lookup(const DnsCache::Key& key, Clock::time_point now, bool* prefetch = nullptr) {
+        bool unused;
+        return mCache.lookup(key, now, &mAnswer, prefetch ? prefetch : &unused);
+    }
+
+    void insert(const DnsCache::Key& key, Clock::time_point now, const DnsCache::Answer& answer) {
+        mCache.insert(key, now, answer, mCache.getGeneration(key.netId));
+    }
+
+    const Clock::time_point mStart = Clock::now();
+    DnsCache mCache;
+    DnsCache::Answer mAnswer;
+};
+
+TEST_F(DnsCacheTest, PositiveAnswersExpire) {
+    const auto key = makeKey(100, "www.example.com");
+    EXPECT_FALSE(lookup(key, mStart));
+    insert(key, mStart, makeAnswer("192.0.2.1"));
+
+    EXPECT_TRUE(lookup(key, mStart + seconds(1)));
+    EXPECT_EQ(0, mAnswer.error);
+    EXPECT_EQ("192.0.2.1", firstAddress(mAnswer));
+
+    // Other networks, other hints and other apps are separate entries.
+    EXPECT_FALSE(lookup(makeKey(101, "www.example.com"), mStart));
+    auto v6Key = key;
+    v6Key.family = AF_INET6;
+    EXPECT_FALSE(lookup(v6Key, mStart));
+    auto otherUidKey = key;
+    otherUidKey.uid = 10001;
+    EXPECT_FALSE(lookup(otherUidKey, mStart));
+    auto otherMarkKey = key;
+    otherMarkKey.appMark = 0x10064;
+    EXPECT_FALSE(lookup(otherMarkKey, mStart));
+
+    EXPECT_FALSE(lookup(key, mStart + DnsCache::kPositiveLifetime));
+
+    const auto stats = mCache.getStats(100);
+    EXPECT_EQ(1U, stats.hits);
+    EXPECT_EQ(5U, stats.misses);
+    EXPECT_EQ(1U, stats.entries);
+}
+
+TEST_F(DnsCacheTest, NegativeAnswersExpireSooner) {
+    const auto key = makeKey(100, "nonexistent.example.com");
+    insert(key, mStart, makeError(EAI_NODATA));
+    EXPECT_TRUE(lookup(key, mStart + seconds(1)));
+    EXPECT_EQ(EAI_NODATA, mAnswer.error);
+    EXPECT_FALSE(lookup(key, mStart + DnsCache::kNegativeLifetime));
+    EXPECT_EQ(1U, mCache.getStats(100).negativeHits);
+
+    // Expired negative answers are never served stale.
+    EXPECT_FALSE(mCache.lookupStale(key, mStart + DnsCache::kNegativeLifetime, &mAnswer));
+    EXPECT_EQ(0U, mCache.getStats(100).entries);
+}
+
+TEST_F(DnsCacheTest, FailuresAreNotCached) {
+    const auto key = makeKey(100, "www.example.com");
+    insert(key, mStart, makeError(EAI_AGAIN));
+    insert(key, mStart, makeError(EAI_SERVICE));
+    EXPECT_FALSE(lookup(key, mStart));
+
+    // A failure does not replace a good answer.
+    insert(key, mStart, makeAnswer("192.0.2.1"));
+    insert(key, mStart, makeError(EAI_FAIL));
+    EXPECT_TRUE(lookup(key, mStart));
+    EXPECT_EQ(0, mAnswer.error);
+}
+
+TEST_F(DnsCacheTest, ServesStaleAnswersWhenUpstreamFails) {
+    const auto key = makeKey(100, "www.example.com");
+    insert(key, mStart, makeAnswer("192.0.2.1"));
+
+    const auto expired = mStart + DnsCache::kPositiveLifetime + seconds(1);
+    EXPECT_FALSE(lookup(key, expired));
+    EXPECT_TRUE(mCache.lookupStale(key, expired, &mAnswer));
+    EXPECT_EQ("192.0.2.1", firstAddress(mAnswer));
+    EXPECT_EQ(1U, mCache.getStats(100).staleHits);
+
+    const auto tooOld = mStart + DnsCache::kPositiveLifetime + DnsCache::kMaxStale + seconds(1);
+    EXPECT_FALSE(mCache.lookupStale(key, tooOld, &mAnswer));
+}
+
+TEST_F(DnsCacheTest, PrefetchesPopularNamesOnce) {
+    const auto key = makeKey(100, "www.example.com");
+    insert(key, mStart, makeAnswer("192.0.2.1"));
+
+    bool prefetch = true;
+    const auto early = mStart + seconds(1);
+    for (unsigned i = 0; i < DnsCache::kPrefetchMinHits; i++) {
+        EXPECT_TRUE(lookup(key, early, &prefetch));
+        EXPECT_FALSE(prefetch);
+    }
+
+    const auto nearExpiry = mStart + DnsCache::kPositiveLifetime - seconds(1);
+    EXPECT_TRUE(lookup(key, nearExpiry, &prefetch));
+    EXPECT_TRUE(prefetch);
+    EXPECT_TRUE(lookup(key, nearExpiry, &prefetch));
+    EXPECT_FALSE(prefetch);
+    EXPECT_EQ(1U, mCache.getStats(100).prefetches);
+
+    // The prefetched answer replaces the old one and starts a new lifetime.
+    insert(key, nearExpiry, makeAnswer("192.0.2.2"));
+    EXPECT_TRUE(lookup(key, mStart + DnsCache::kPositiveLifetime + seconds(1), &prefetch));
+    EXPECT_EQ("192.0.2.2", firstAddress(mAnswer));
+    EXPECT_FALSE(prefetch);
+}
+
+TEST_F(DnsCacheTest, FailedPrefetchCanBeRetried) {
+    const auto key = makeKey(100, "www.example.com");
+    insert(key, mStart, makeAnswer("192.0.2.1"));
+    bool prefetch;
+    const auto nearExpiry = mStart + DnsCache::kPositiveLifetime - seconds(1);
+    for (unsigned i = 0; i < DnsCache::kPrefetchMinHits; i++) {
+        lookup(key, nearExpiry, &prefetch);
+    }
+    EXPECT_TRUE(prefetch);
+
+    insert(key, nearExpiry, makeError(EAI_AGAIN));
+    EXPECT_TRUE(lookup(key, nearExpiry, &prefetch));
+    EXPECT_TRUE(prefetch);
+}
+
+TEST_F(DnsCacheTest, InvalidatesOneNetwork) {
+    for (int i = 0; i < 50; i++) {
+        insert(makeKey(100, "host" + std::to_string(i)), mStart, makeAnswer("192.0.2.1"));
+        insert(makeKey(101, "host" + std::to_string(i)), mStart, makeAnswer("192.0.2.1"));
+    }
+    mCache.invalidate(100);
+
+    EXPECT_FALSE(lookup(makeKey(100, "host7"), mStart));
+    EXPECT_TRUE(lookup(makeKey(101, "host7"), mStart));
+    EXPECT_EQ(0U, mCache.getStats(100).entries);
+    EXPECT_EQ(1U, mCache.getStats(100).invalidations);
+    EXPECT_EQ(50U, mCache.getStats(101).entries);
+
+    // Nothing stale survives either.
+    mCache.invalidate(101);
+    EXPECT_FALSE(mCache.lookupStale(makeKey(101, "host7"), mStart, &mAnswer));
+}
+
+TEST_F(DnsCacheTest, DropsAnswersResolvedBeforeInvalidation) {
+    const auto key = makeKey(100, "www.example.com");
+    insert(key, mStart, makeAnswer("192.0.2.1"));
+
+    // A lookup, or a prefetch, starts resolving with the old servers...
+    const uint64_t generation = mCache.getGeneration(100);
+    const uint64_t otherGeneration = mCache.getGeneration(101);
+    // ... and the servers change before it finishes.
+    mCache.invalidate(100);
+    mCache.insert(key, mStart, makeAnswer("192.0.2.2"), generation);
+    EXPECT_FALSE(lookup(key, mStart));
+    EXPECT_FALSE(mCache.lookupStale(key, mStart + DnsCache::kPositiveLifetime, &mAnswer));
+    EXPECT_EQ(1U, mCache.getStats(100).staleInserts);
+
+    // Other networks are not affected, and new lookups are cached again.
+    mCache.insert(makeKey(101, "www.example.com"), mStart, makeAnswer("192.0.2.3"),
+                  otherGeneration);
+    EXPECT_TRUE(lookup(makeKey(101, "www.example.com"), mStart));
+    insert(key, mStart, makeAnswer("192.0.2.4"));
+    EXPECT_TRUE(lookup(key, mStart));
+    EXPECT_EQ("192.0.2.4", firstAddress(mAnswer));
+}
+
+TEST_F(DnsCacheTest, EvictsLeastRecentlyUsed) {
+    DnsCache cache(DnsCache::kNumShards * 4);
+    const int kNumHosts = 1000;
+    const auto keep = makeKey(100, "keep");
+    cache.insert(keep, mStart, makeAnswer("192.0.2.1"), 0);
+    bool prefetch;
+    for (int i = 0; i < kNumHosts; i++) {
+        cache.insert(makeKey(100, "host" + std::to_string(i)), mStart, makeAnswer("192.0.2.2"), 0);
+        EXPECT_TRUE(cache.lookup(keep, mStart, &mAnswer, &prefetch));
+    }
+
+    const auto stats = cache.getStats(100);
+    EXPECT_LE(stats.entries, DnsCache::kNumShards * 4);
+    EXPECT_EQ(kNumHosts + 1 - stats.entries, stats.evictions);
+    EXPECT_FALSE(cache.lookup(makeKey(100, "host0"), mStart, &mAnswer, &prefetch));
+}
+
+TEST_F(DnsCacheTest, DoesNotCacheHugeAnswers) {
+    const auto key = makeKey(100, "www.example.com");
+    auto answer = makeAnswer("192.0.2.1");
+    answer.addresses.resize(DnsCache::kMaxAddresses + 1, answer.addresses[0]);
+    insert(key, mStart, answer);
+    EXPECT_FALSE(lookup(key, mStart));
+
+    insert(makeKey(100, std::string(DnsCache::kMaxHostLength + 1, 'a')), mStart,
+                  makeAnswer("192.0.2.1"));
+    EXPECT_EQ(0U, mCache.getStats(100).entries);
+}
+
+}  // namespace net
+}  // namespace android
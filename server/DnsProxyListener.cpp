@@ -34,6 +34,7 @@
 #define VDBG 0
 
 #include <chrono>
+#include <memory>
 #include <vector>
 
 #include <cutils/log.h>
@@ -43,12 +44,11 @@
 #include "Controllers.h"
 #include "Fwmark.h"
 #include "DnsProxyListener.h"
-#include "dns/DnsTlsTransport.h"
+#include "dns/DnsTlsDispatcher.h"
 #include "NetdConstants.h"
 #include "NetworkController.h"
 #include "ResponseCode.h"
 #include "Stopwatch.h"
-#include "thread_util.h"
 #include "android/net/metrics/INetdEventListener.h"
 
 using android::String16;
@@ -60,10 +60,13 @@ namespace net {
 namespace {
 
 template<typename T>
-void tryThreadOrError(SocketClient* cli, T* handler) {
+void tryEnqueueOrError(DnsWorkerPool* pool, SocketClient* cli, unsigned netId, T* handler) {
     cli->incRef();
 
-    const int rval = threadLaunch(handler);
+    const int rval = pool->enqueue(netId, [handler] {
+        std::unique_ptr<T> owned(handler);
+        owned->run();
+    });
     if (rval == 0) {
         // SocketClient decRef() happens in the handler's run() method.
         return;
@@ -107,9 +110,9 @@ res_sendhookact qhook(sockaddr* const * nsap, const u_char** buf, int* buflen,
         if (DBG) {
             ALOGD("qhook using TLS");
         }
-        DnsTlsTransport xport(thread_netcontext.dns_mark, IPPROTO_TCP,
-                              secureResolver, fingerprints);
-        auto response = xport.doQuery(*buf, *buflen, ans, anssiz, resplen);
+        auto response = net::gCtls->resolverCtrl.getDnsTlsDispatcher().query(
+                thread_netcontext.dns_mark, secureResolver, fingerprints,
+                *buf, *buflen, ans, anssiz, resplen);
         if (response == DnsTlsTransport::Response::success) {
             if (DBG) {
                 ALOGD("qhook success");
@@ -133,10 +136,43 @@ res_sendhookact qhook(sockaddr* const * nsap, const u_char** buf, int* buflen,
     return res_goahead;
 }
 
+DnsCache::Answer resolveAddrInfo(const char* host, const char* service, const addrinfo* hints,
+                                 const android_net_context& netcontext) {
+    struct addrinfo* result = NULL;
+    thread_netcontext = netcontext;
+    const int rv = android_getaddrinfofornetcontext(host, service, hints, &netcontext, &result);
+    DnsCache::Answer answer = DnsCache::Answer::fromAddrinfo(rv, result);
+    if (result) {
+        freeaddrinfo(result);
+    }
+    return answer;
+}
+
+// Looks |key| up again in the background and caches the result. If the pool is too busy, the
+// cached answer simply expires and a later lookup gets a fresh one.
+void queuePrefetch(DnsWorkerPool* pool, DnsCache* cache, const DnsCache::Key& key,
+                   const android_net_context& netcontext) {
+    const uint64_t generation = cache->getGeneration(key.netId);
+    pool->enqueue(key.netId, [cache, key, netcontext, generation] {
+        struct addrinfo hints = {};
+        hints.ai_flags = key.flags;
+        hints.ai_family = key.family;
+        hints.ai_socktype = key.socktype;
+        hints.ai_protocol = key.protocol;
+        const DnsCache::Answer answer = resolveAddrInfo(key.host.c_str(),
+                key.hasService ? key.service.c_str() : NULL, key.hasHints ? &hints : NULL,
+                netcontext);
+        cache->insert(key, DnsCache::Clock::now(), answer, generation);
+    });
+}
+
 }  // namespace
 
-DnsProxyListener::DnsProxyListener(const NetworkController* netCtrl, EventReporter* eventReporter) :
-        FrameworkListener(SOCKET_NAME), mNetCtrl(netCtrl), mEventReporter(eventReporter) {
+DnsProxyListener::DnsProxyListener(const NetworkController* netCtrl, EventReporter* eventReporter,
+        DnsWorkerPool* workerPool, DnsCache* dnsCache) :
+        FrameworkListener(SOCKET_NAME), mNetCtrl(netCtrl), mEventReporter(eventReporter),
+        mWorkerPool(workerPool), mDnsCache(dnsCache) {
+    mWorkerPool->start();
     registerCmd(new GetAddrInfoCmd(this));
     registerCmd(new GetHostByAddrCmd(this));
     registerCmd(new GetHostByNameCmd(this));
@@ -145,14 +181,16 @@ DnsProxyListener::DnsProxyListener(const NetworkController* netCtrl, EventReport
 DnsProxyListener::GetAddrInfoHandler::GetAddrInfoHandler(
         SocketClient *c, char* host, char* service, struct addrinfo* hints,
         const android_net_context& netcontext, const int reportingLevel,
-        const android::sp<android::net::metrics::INetdEventListener>& netdEventListener)
+        EventReporter* eventReporter, DnsCache* dnsCache, DnsWorkerPool* workerPool)
         : mClient(c),
           mHost(host),
           mService(service),
           mHints(hints),
           mNetContext(netcontext),
           mReportingLevel(reportingLevel),
-          mNetdEventListener(netdEventListener) {
+          mEventReporter(eventReporter),
+          mDnsCache(dnsCache),
+          mWorkerPool(workerPool) {
 }
 
 DnsProxyListener::GetAddrInfoHandler::~GetAddrInfoHandler() {
@@ -200,7 +238,7 @@ static bool sendhostent(SocketClient *c, struct hostent *hp) {
     return success;
 }
 
-static bool sendaddrinfo(SocketClient* c, struct addrinfo* ai) {
+static bool sendaddrinfo(SocketClient* c, const DnsCache::Address& ai) {
     // struct addrinfo {
     //      int     ai_flags;       /* AI_PASSIVE, AI_CANONNAME, AI_NUMERICHOST */
     //      int     ai_family;      /* PF_xxx */
@@ -215,21 +253,21 @@ static bool sendaddrinfo(SocketClient* c, struct addrinfo* ai) {
     // Write the struct piece by piece because we might be a 64-bit netd
     // talking to a 32-bit process.
     bool success =
-            sendBE32(c, ai->ai_flags) &&
-            sendBE32(c, ai->ai_family) &&
-            sendBE32(c, ai->ai_socktype) &&
-            sendBE32(c, ai->ai_protocol);
+            sendBE32(c, ai.flags) &&
+            sendBE32(c, ai.family) &&
+            sendBE32(c, ai.socktype) &&
+            sendBE32(c, ai.protocol);
     if (!success) {
         return false;
     }
 
     // ai_addrlen and ai_addr.
-    if (!sendLenAndData(c, ai->ai_addrlen, ai->ai_addr)) {
+    if (!sendLenAndData(c, ai.addr.size(), ai.addr.data())) {
         return false;
     }
 
     // strlen(ai_canonname) and ai_canonname.
-    if (!sendLenAndData(c, ai->ai_canonname ? strlen(ai->ai_canonname) + 1 : 0, ai->ai_canonname)) {
+    if (!sendLenAndData(c, ai.hasCanonname ? ai.canonname.size() + 1 : 0, ai.canonname.c_str())) {
         return false;
     }
 
@@ -244,10 +282,27 @@ void DnsProxyListener::GetAddrInfoHandler::run() {
                 mNetContext.uid);
     }
 
-    struct addrinfo* result = NULL;
     Stopwatch s;
-    thread_netcontext = mNetContext;
-    uint32_t rv = android_getaddrinfofornetcontext(mHost, mService, mHints, &mNetContext, &result);
+    DnsCache::Answer answer;
+    const DnsCache::Key key = makeCacheKey();
+    // Lookups without a host name never leave the device, so there is nothing to gain by caching.
+    const bool cacheable = (mHost != NULL);
+    // Read before resolving, so that an answer from servers that a flush replaced isn't cached.
+    const uint64_t generation = mDnsCache->getGeneration(key.netId);
+    bool prefetch = false;
+    if (!cacheable || !mDnsCache->lookup(key, DnsCache::Clock::now(), &answer, &prefetch)) {
+        answer = resolveAddrInfo(mHost, mService, mHints, mNetContext);
+        if (cacheable) {
+            const auto now = DnsCache::Clock::now();
+            mDnsCache->insert(key, now, answer, generation);
+            if (DnsCache::isUpstreamFailure(answer.error)) {
+                mDnsCache->lookupStale(key, now, &answer);
+            }
+        }
+    } else if (prefetch) {
+        queuePrefetch(mWorkerPool, mDnsCache, key, mNetContext);
+    }
+    uint32_t rv = answer.error;
     const int latencyMs = lround(s.timeTaken());
 
     if (rv) {
@@ -255,10 +310,8 @@ void DnsProxyListener::GetAddrInfoHandler::run() {
         mClient->sendBinaryMsg(ResponseCode::DnsProxyOperationFailed, &rv, sizeof(rv));
     } else {
         bool success = !mClient->sendCode(ResponseCode::DnsProxyQueryResult);
-        struct addrinfo* ai = result;
-        while (ai && success) {
-            success = sendBE32(mClient, 1) && sendaddrinfo(mClient, ai);
-            ai = ai->ai_next;
+        for (size_t i = 0; i < answer.addresses.size() && success; i++) {
+            success = sendBE32(mClient, 1) && sendaddrinfo(mClient, answer.addresses[i]);
         }
         success = success && sendBE32(mClient, 0);
         if (!success) {
@@ -267,44 +320,50 @@ void DnsProxyListener::GetAddrInfoHandler::run() {
     }
     std::vector<String16> ip_addrs;
     int total_ip_addr_count = 0;
-    if (result) {
-        if (mNetdEventListener != nullptr
-                && mReportingLevel == INetdEventListener::REPORTING_LEVEL_FULL) {
-            for (addrinfo* ai = result; ai; ai = ai->ai_next) {
-                sockaddr* ai_addr = ai->ai_addr;
-                if (ai_addr) {
-                    addIpAddrWithinLimit(ip_addrs, ai_addr, ai->ai_addrlen);
-                    total_ip_addr_count++;
-                }
+    if (mReportingLevel == INetdEventListener::REPORTING_LEVEL_FULL) {
+        for (const auto& ai : answer.addresses) {
+            if (!ai.addr.empty()) {
+                addIpAddrWithinLimit(ip_addrs, reinterpret_cast<const sockaddr*>(ai.addr.data()),
+                        ai.addr.size());
+                total_ip_addr_count++;
             }
         }
-        freeaddrinfo(result);
     }
     mClient->decRef();
-    if (mNetdEventListener != nullptr) {
-        switch (mReportingLevel) {
-            case INetdEventListener::REPORTING_LEVEL_NONE:
-                // Skip reporting.
-                break;
-            case INetdEventListener::REPORTING_LEVEL_METRICS:
-                // Metrics reporting is on. Send metrics.
-                mNetdEventListener->onDnsEvent(mNetContext.dns_netid,
-                                               INetdEventListener::EVENT_GETADDRINFO, (int32_t) rv,
-                                               latencyMs, String16(""), {}, -1, -1);
-                break;
-            case INetdEventListener::REPORTING_LEVEL_FULL:
-                // Full event info reporting is on. Send full info.
-                mNetdEventListener->onDnsEvent(mNetContext.dns_netid,
-                                               INetdEventListener::EVENT_GETADDRINFO, (int32_t) rv,
-                                               latencyMs, String16(mHost), ip_addrs,
-                                               total_ip_addr_count, mNetContext.uid);
-                break;
-        }
-    } else {
-        ALOGW("Netd event listener is not available; skipping.");
+    // The event is delivered to the listener later, by the EventReporter thread.
+    switch (mReportingLevel) {
+        case INetdEventListener::REPORTING_LEVEL_NONE:
+            // Skip reporting.
+            break;
+        case INetdEventListener::REPORTING_LEVEL_METRICS:
+            // Metrics reporting is on. Send metrics.
+            mEventReporter->reportDnsEvent({
+                    (int32_t) mNetContext.dns_netid, INetdEventListener::EVENT_GETADDRINFO,
+                    (int32_t) rv, latencyMs, String16(""), {}, -1, -1 });
+            break;
+        case INetdEventListener::REPORTING_LEVEL_FULL:
+            // Full event info reporting is on. Send full info.
+            mEventReporter->reportDnsEvent({
+                    (int32_t) mNetContext.dns_netid, INetdEventListener::EVENT_GETADDRINFO,
+                    (int32_t) rv, latencyMs, String16(mHost), std::move(ip_addrs),
+                    total_ip_addr_count, (int32_t) mNetContext.uid });
+            break;
     }
 }
 
+DnsCache::Key DnsProxyListener::GetAddrInfoHandler::makeCacheKey() const {
+    DnsCache::Key key = {mNetContext.dns_netid, mNetContext.dns_mark, mNetContext.app_mark,
+            mNetContext.uid, mHost ? mHost : "", mService != NULL, mService ? mService : "",
+            mHints != NULL, 0, 0, 0, 0};
+    if (mHints) {
+        key.flags = mHints->ai_flags;
+        key.family = mHints->ai_family;
+        key.socktype = mHints->ai_socktype;
+        key.protocol = mHints->ai_protocol;
+    }
+    return key;
+}
+
 void DnsProxyListener::addIpAddrWithinLimit(std::vector<android::String16>& ip_addrs,
         const sockaddr* addr, socklen_t addrlen) {
     // ipAddresses array is limited to first INetdEventListener::DNS_REPORTED_IP_ADDRESSES_LIMIT
@@ -387,8 +446,9 @@ int DnsProxyListener::GetAddrInfoCmd::runCommand(SocketClient *cli,
 
     DnsProxyListener::GetAddrInfoHandler* handler =
             new DnsProxyListener::GetAddrInfoHandler(cli, name, service, hints, netcontext,
-                    metricsLevel, mDnsProxyListener->mEventReporter->getNetdEventListener());
-    tryThreadOrError(cli, handler);
+                    metricsLevel, mDnsProxyListener->mEventReporter,
+                    mDnsProxyListener->mDnsCache, mDnsProxyListener->mWorkerPool);
+    tryEnqueueOrError(mDnsProxyListener->mWorkerPool, cli, netcontext.dns_netid, handler);
     return 0;
 }
 
@@ -435,20 +495,20 @@ int DnsProxyListener::GetHostByNameCmd::runCommand(SocketClient *cli,
 
     DnsProxyListener::GetHostByNameHandler* handler =
             new DnsProxyListener::GetHostByNameHandler(cli, name, af, netcontext, metricsLevel,
-                    mDnsProxyListener->mEventReporter->getNetdEventListener());
-    tryThreadOrError(cli, handler);
+                    mDnsProxyListener->mEventReporter);
+    tryEnqueueOrError(mDnsProxyListener->mWorkerPool, cli, netcontext.dns_netid, handler);
     return 0;
 }
 
 DnsProxyListener::GetHostByNameHandler::GetHostByNameHandler(SocketClient* c, char* name, int af,
         const android_net_context& netcontext, const int metricsLevel,
-        const android::sp<android::net::metrics::INetdEventListener>& netdEventListener)
+        EventReporter* eventReporter)
         : mClient(c),
           mName(name),
           mAf(af),
           mNetContext(netcontext),
           mReportingLevel(metricsLevel),
-          mNetdEventListener(netdEventListener) {
+          mEventReporter(eventReporter) {
 }
 
 DnsProxyListener::GetHostByNameHandler::~GetHostByNameHandler() {
@@ -484,44 +544,43 @@ void DnsProxyListener::GetHostByNameHandler::run() {
         ALOGW("GetHostByNameHandler: Error writing DNS result to client\n");
     }
 
-    if (mNetdEventListener != nullptr) {
-        std::vector<String16> ip_addrs;
-        int total_ip_addr_count = 0;
-        if (mReportingLevel == INetdEventListener::REPORTING_LEVEL_FULL) {
-            if (hp != nullptr && hp->h_addrtype == AF_INET) {
-                in_addr** list = (in_addr**) hp->h_addr_list;
-                for (int i = 0; list[i] != NULL; i++) {
-                    sockaddr_in sin = { .sin_family = AF_INET, .sin_addr = *list[i] };
-                    addIpAddrWithinLimit(ip_addrs, (sockaddr*) &sin, sizeof(sin));
-                    total_ip_addr_count++;
-                }
-            } else if (hp != nullptr && hp->h_addrtype == AF_INET6) {
-                in6_addr** list = (in6_addr**) hp->h_addr_list;
-                for (int i = 0; list[i] != NULL; i++) {
-                    sockaddr_in6 sin6 = { .sin6_family = AF_INET6, .sin6_addr = *list[i] };
-                    addIpAddrWithinLimit(ip_addrs, (sockaddr*) &sin6, sizeof(sin6));
-                    total_ip_addr_count++;
-                }
+    std::vector<String16> ip_addrs;
+    int total_ip_addr_count = 0;
+    if (mReportingLevel == INetdEventListener::REPORTING_LEVEL_FULL) {
+        if (hp != nullptr && hp->h_addrtype == AF_INET) {
+            in_addr** list = (in_addr**) hp->h_addr_list;
+            for (int i = 0; list[i] != NULL; i++) {
+                sockaddr_in sin = { .sin_family = AF_INET, .sin_addr = *list[i] };
+                addIpAddrWithinLimit(ip_addrs, (sockaddr*) &sin, sizeof(sin));
+                total_ip_addr_count++;
+            }
+        } else if (hp != nullptr && hp->h_addrtype == AF_INET6) {
+            in6_addr** list = (in6_addr**) hp->h_addr_list;
+            for (int i = 0; list[i] != NULL; i++) {
+                sockaddr_in6 sin6 = { .sin6_family = AF_INET6, .sin6_addr = *list[i] };
+                addIpAddrWithinLimit(ip_addrs, (sockaddr*) &sin6, sizeof(sin6));
+                total_ip_addr_count++;
             }
         }
-        switch (mReportingLevel) {
-            case INetdEventListener::REPORTING_LEVEL_NONE:
-                // Reporting is off.
-                break;
-            case INetdEventListener::REPORTING_LEVEL_METRICS:
-                // Metrics reporting is on. Send metrics.
-                mNetdEventListener->onDnsEvent(mNetContext.dns_netid,
-                                               INetdEventListener::EVENT_GETHOSTBYNAME,
-                                               h_errno, latencyMs, String16(""), {}, -1, -1);
-                break;
-            case INetdEventListener::REPORTING_LEVEL_FULL:
-                // Full event info reporting is on. Send full info.
-                mNetdEventListener->onDnsEvent(mNetContext.dns_netid,
-                                               INetdEventListener::EVENT_GETHOSTBYNAME,
-                                               h_errno, latencyMs, String16(mName), ip_addrs,
-                                               total_ip_addr_count, mClient->getUid());
-                break;
-        }
+    }
+    // The event is delivered to the listener later, by the EventReporter thread.
+    switch (mReportingLevel) {
+        case INetdEventListener::REPORTING_LEVEL_NONE:
+            // Reporting is off.
+            break;
+        case INetdEventListener::REPORTING_LEVEL_METRICS:
+            // Metrics reporting is on. Send metrics.
+            mEventReporter->reportDnsEvent({
+                    (int32_t) mNetContext.dns_netid, INetdEventListener::EVENT_GETHOSTBYNAME,
+                    h_errno, latencyMs, String16(""), {}, -1, -1 });
+            break;
+        case INetdEventListener::REPORTING_LEVEL_FULL:
+            // Full event info reporting is on. Send full info.
+            mEventReporter->reportDnsEvent({
+                    (int32_t) mNetContext.dns_netid, INetdEventListener::EVENT_GETHOSTBYNAME,
+                    h_errno, latencyMs, String16(mName), std::move(ip_addrs),
+                    total_ip_addr_count, (int32_t) mClient->getUid() });
+            break;
     }
 
     mClient->decRef();
@@ -577,7 +636,7 @@ int DnsProxyListener::GetHostByAddrCmd::runCommand(SocketClient *cli,
 
     DnsProxyListener::GetHostByAddrHandler* handler =
             new DnsProxyListener::GetHostByAddrHandler(cli, addr, addrLen, addrFamily, netcontext);
-    tryThreadOrError(cli, handler);
+    tryEnqueueOrError(mDnsProxyListener->mWorkerPool, cli, netcontext.dns_netid, handler);
     return 0;
 }
 
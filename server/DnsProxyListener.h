@@ -22,6 +22,8 @@
 #include <sysutils/FrameworkListener.h>
 
 #include "android/net/metrics/INetdEventListener.h"
+#include "DnsCache.h"
+#include "DnsWorkerPool.h"
 #include "EventReporter.h"
 #include "NetdCommand.h"
 
@@ -32,7 +34,10 @@ class NetworkController;
 
 class DnsProxyListener : public FrameworkListener {
 public:
-    explicit DnsProxyListener(const NetworkController* netCtrl, EventReporter* eventReporter);
+    // Lookups are run on |workerPool|, which is started by the constructor. getaddrinfo answers
+    // are cached in |dnsCache|.
+    DnsProxyListener(const NetworkController* netCtrl, EventReporter* eventReporter,
+                     DnsWorkerPool* workerPool, DnsCache* dnsCache);
     virtual ~DnsProxyListener() {}
 
     static constexpr const char* SOCKET_NAME = "dnsproxyd";
@@ -40,6 +45,8 @@ public:
 private:
     const NetworkController *mNetCtrl;
     EventReporter *mEventReporter;
+    DnsWorkerPool *mWorkerPool;
+    DnsCache *mDnsCache;
     static void addIpAddrWithinLimit(std::vector<android::String16>& ip_addrs, const sockaddr* addr,
             socklen_t addrlen);
 
@@ -61,19 +68,25 @@ private:
                            struct addrinfo* hints,
                            const struct android_net_context& netcontext,
                            const int reportingLevel,
-                           const android::sp<android::net::metrics::INetdEventListener>& listener);
+                           EventReporter* eventReporter,
+                           DnsCache* dnsCache,
+                           DnsWorkerPool* workerPool);
         ~GetAddrInfoHandler();
 
         void run();
 
     private:
+        DnsCache::Key makeCacheKey() const;
+
         SocketClient* mClient;  // ref counted
         char* mHost;    // owned
         char* mService; // owned
         struct addrinfo* mHints;  // owned
         struct android_net_context mNetContext;
         const int mReportingLevel;
-        android::sp<android::net::metrics::INetdEventListener> mNetdEventListener;
+        EventReporter* mEventReporter;
+        DnsCache* mDnsCache;
+        DnsWorkerPool* mWorkerPool;  // Runs prefetches of cached answers.
     };
 
     /* ------ gethostbyname ------*/
@@ -93,7 +106,7 @@ private:
                             int af,
                             const android_net_context& netcontext,
                             int reportingLevel,
-                            const android::sp<android::net::metrics::INetdEventListener>& listener);
+                            EventReporter* eventReporter);
         ~GetHostByNameHandler();
 
         void run();
@@ -104,7 +117,7 @@ private:
         int mAf;
         android_net_context mNetContext;
         const int mReportingLevel;
-        android::sp<android::net::metrics::INetdEventListener> mNetdEventListener;
+        EventReporter* mEventReporter;
     };
 
     /* ------ gethostbyaddr ------*/
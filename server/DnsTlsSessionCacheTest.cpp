@@ -0,0 +1,170 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * DnsTlsSessionCacheTest.cpp - unit tests for dns/DnsTlsSessionCache.cpp
+ */
+
+#include <arpa/inet.h>
+#include <arpa/nameser.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <sys/socket.h>
+
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "dns/DnsTlsSessionCache.h"
+#include "dns/DnsTlsTransport.h"
+#include "dns_responder/dns_responder.h"
+#include "dns_responder/dns_tls_frontend.h"
+
+namespace android {
+namespace net {
+
+namespace {
+
+const char kLocalhost[] = "127.0.0.1";
+const char kBackendPort[] = "53053";
+const char kTlsPort[] = "8853";
+
+sockaddr_storage makeServer(in_port_t port) {
+    sockaddr_storage ss = {};
+    sockaddr_in* sin = reinterpret_cast<sockaddr_in*>(&ss);
+    sin->sin_family = AF_INET;
+    sin->sin_port = htons(port);
+    inet_pton(AF_INET, kLocalhost, &sin->sin_addr);
+    return ss;
+}
+
+// A query for the A record of example.com.
+const uint8_t kQuery[] = {
+    0x12, 0x34, 0x01, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x07, 'e', 'x', 'a', 'm', 'p', 'l', 'e', 0x03, 'c', 'o', 'm', 0x00,
+    0x00, 0x01, 0x00, 0x01,
+};
+
+}  // namespace
+
+class DnsTlsSessionCacheTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        // The server closes connections the transport may still be writing to.
+        signal(SIGPIPE, SIG_IGN);
+        mBackend.reset(new test::DNSResponder(kLocalhost, kBackendPort, 250,
+                ns_rcode::ns_r_servfail, 1.0));
+        mBackend->addMapping("example.com.", ns_type::ns_t_a, "1.2.3.4");
+        ASSERT_TRUE(mBackend->startServer());
+        mFrontend.reset(new test::DnsTlsFrontend(kLocalhost, kTlsPort, kLocalhost,
+                kBackendPort));
+        ASSERT_TRUE(mFrontend->startServer());
+    }
+
+    void TearDown() override {
+        mFrontend->stopServer();
+        mBackend->stopServer();
+    }
+
+    // Sends a query over a new connection.
+    void query() {
+        const int connections = mFrontend->connections();
+        DnsTlsTransport transport(0, IPPROTO_TCP, mServer, {}, &mCache);
+        uint8_t ans[512];
+        int len = 0;
+        EXPECT_EQ(DnsTlsTransport::Response::success,
+                transport.doQuery(kQuery, sizeof(kQuery), ans, sizeof(ans), &len));
+        EXPECT_EQ(connections + 1, mFrontend->connections());
+    }
+
+    DnsTlsSessionCache::Stats getStats() {
+        return mCache.getStats(DnsTlsSessionCache::makeKey(mServer, {}));
+    }
+
+    std::unique_ptr<test::DNSResponder> mBackend;
+    std::unique_ptr<test::DnsTlsFrontend> mFrontend;
+    const sockaddr_storage mServer = makeServer(std::stoi(kTlsPort));
+    DnsTlsSessionCache mCache;
+};
+
+TEST_F(DnsTlsSessionCacheTest, ResumesSessions) {
+    query();
+    DnsTlsSessionCache::Stats stats = getStats();
+    EXPECT_EQ(1U, stats.handshakes);
+    EXPECT_EQ(0U, stats.offered);
+    EXPECT_EQ(0U, stats.resumed);
+
+    // Each connection offers the session issued on the one before, and the server accepts it.
+    query();
+    query();
+    stats = getStats();
+    EXPECT_EQ(3U, stats.handshakes);
+    EXPECT_EQ(2U, stats.offered);
+    EXPECT_EQ(2U, stats.resumed);
+
+    // Pinning a fingerprint makes it a different server, for which there is no session yet.
+    const std::set<std::vector<uint8_t>> fingerprints = { mFrontend->fingerprint() };
+    stats = mCache.getStats(DnsTlsSessionCache::makeKey(mServer, fingerprints));
+    EXPECT_EQ(0U, stats.handshakes);
+}
+
+TEST_F(DnsTlsSessionCacheTest, OffersSingleUseSessionsOnce) {
+    query();
+    const DnsTlsSessionCache::Key key = DnsTlsSessionCache::makeKey(mServer, {});
+
+    // A TLS 1.3 session is dropped from the cache as soon as it is offered, so two connections
+    // that open before the server issues a new one do not both offer it.
+    bssl::UniquePtr<SSL> first(SSL_new(mCache.getSslCtx()));
+    mCache.prepareSsl(first.get(), key);
+    EXPECT_EQ(1U, getStats().offered);
+    EXPECT_NE(nullptr, SSL_get_session(first.get()));
+
+    bssl::UniquePtr<SSL> second(SSL_new(mCache.getSslCtx()));
+    mCache.prepareSsl(second.get(), key);
+    EXPECT_EQ(1U, getStats().offered);
+    EXPECT_EQ(nullptr, SSL_get_session(second.get()));
+}
+
+TEST_F(DnsTlsSessionCacheTest, EvictsLeastRecentlyUsed) {
+    // Entries are only created by verified handshakes. Their outcome does not matter here.
+    std::vector<DnsTlsSessionCache::Key> keys;
+    for (size_t i = 0; i <= DnsTlsSessionCache::kMaxEntries; i++) {
+        keys.push_back(DnsTlsSessionCache::makeKey(makeServer(1000 + i), {}));
+    }
+    std::vector<bssl::UniquePtr<SSL>> ssls;
+    auto handshake = [this, &ssls](const DnsTlsSessionCache::Key& key) {
+        ssls.emplace_back(SSL_new(mCache.getSslCtx()));
+        mCache.onHandshakeVerified(ssls.back().get(), key);
+    };
+
+    for (size_t i = 0; i < DnsTlsSessionCache::kMaxEntries; i++) {
+        handshake(keys[i]);
+    }
+    EXPECT_EQ(DnsTlsSessionCache::kMaxEntries, mCache.size());
+
+    // Using the oldest entry makes the second one the least recently used.
+    handshake(keys[0]);
+    handshake(keys[DnsTlsSessionCache::kMaxEntries]);
+    EXPECT_EQ(DnsTlsSessionCache::kMaxEntries, mCache.size());
+    EXPECT_EQ(2U, mCache.getStats(keys[0]).handshakes);
+    EXPECT_EQ(0U, mCache.getStats(keys[1]).handshakes);
+    EXPECT_EQ(1U, mCache.getStats(keys[2]).handshakes);
+    EXPECT_EQ(1U, mCache.getStats(keys[DnsTlsSessionCache::kMaxEntries]).handshakes);
+}
+
+}  // namespace net
+}  // namespace android
@@ -0,0 +1,219 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * DnsTlsTransportTest.cpp - unit tests for dns/DnsTlsTransport.cpp
+ */
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "NetdConstants.h"
+#include "dns/DnsTlsSessionCache.h"
+#include "dns/DnsTlsTransport.h"
+#include "dns_responder/dns_tls_frontend.h"
+
+namespace android {
+namespace net {
+
+namespace {
+
+const char kLocalhost[] = "127.0.0.1";
+const char kTlsPort[] = "8853";
+
+// Builds a query for an A record of |name|, which must be a single label.
+std::vector<uint8_t> makeQuery(uint16_t id, const std::string& name) {
+    std::vector<uint8_t> query = { static_cast<uint8_t>(id >> 8), static_cast<uint8_t>(id),
+            0x01, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 };
+    query.push_back(name.size());
+    query.insert(query.end(), name.begin(), name.end());
+    query.insert(query.end(), { 0x00, 0x00, 0x01, 0x00, 0x01 });
+    return query;
+}
+
+// The answer the echo backend gives to |query|.
+std::vector<uint8_t> makeAnswer(std::vector<uint8_t> query) {
+    query[2] |= 0x80;
+    return query;
+}
+
+// A UDP DNS backend that answers every query with the query itself, with the QR bit set.
+class EchoBackend {
+public:
+    bool start() {
+        mSocket = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        sockaddr_in sin = { .sin_family = AF_INET };
+        inet_pton(AF_INET, kLocalhost, &sin.sin_addr);
+        socklen_t len = sizeof(sin);
+        if (mSocket == -1 || bind(mSocket, reinterpret_cast<sockaddr*>(&sin), len) != 0 ||
+                getsockname(mSocket, reinterpret_cast<sockaddr*>(&sin), &len) != 0) {
+            return false;
+        }
+        mPort = std::to_string(ntohs(sin.sin_port));
+        mThread = std::thread(&EchoBackend::run, this);
+        return true;
+    }
+
+    void stop() {
+        mTerminate = true;
+        if (mThread.joinable()) {
+            mThread.join();
+        }
+        if (mSocket != -1) {
+            close(mSocket);
+            mSocket = -1;
+        }
+    }
+
+    const std::string& port() const { return mPort; }
+
+private:
+    void run() {
+        pollfd fds = { .fd = mSocket, .events = POLLIN };
+        while (!mTerminate) {
+            if (poll(&fds, 1, 10 /* ms */) <= 0) {
+                continue;
+            }
+            uint8_t buf[512];
+            sockaddr_storage from;
+            socklen_t len = sizeof(from);
+            const ssize_t n = recvfrom(mSocket, buf, sizeof(buf), 0,
+                    reinterpret_cast<sockaddr*>(&from), &len);
+            if (n >= 3) {
+                buf[2] |= 0x80;
+                sendto(mSocket, buf, n, 0, reinterpret_cast<sockaddr*>(&from), len);
+            }
+        }
+    }
+
+    int mSocket = -1;
+    std::string mPort;
+    std::atomic<bool> mTerminate{false};
+    std::thread mThread;
+};
+
+}  // namespace
+
+class DnsTlsTransportTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        // The server closes connections the transport may still be writing to.
+        blockSigpipe();
+        ASSERT_TRUE(mBackend.start());
+        mFrontend.reset(new test::DnsTlsFrontend(kLocalhost, kTlsPort, kLocalhost,
+                mBackend.port()));
+        ASSERT_TRUE(mFrontend->startServer());
+
+        sockaddr_storage ss = {};
+        sockaddr_in* sin = reinterpret_cast<sockaddr_in*>(&ss);
+        sin->sin_family = AF_INET;
+        sin->sin_port = htons(std::stoi(kTlsPort));
+        inet_pton(AF_INET, kLocalhost, &sin->sin_addr);
+        mTransport.reset(new DnsTlsTransport(0, IPPROTO_TCP, ss, {}, &mCache));
+    }
+
+    void TearDown() override {
+        // The frontend may be blocked reading from the transport's connection until it closes.
+        mTransport.reset();
+        if (mFrontend) {
+            mFrontend->stopServer();
+        }
+        mBackend.stop();
+    }
+
+    // Sends |query| and checks that the answer is |query|'s own.
+    void expectAnswered(const std::vector<uint8_t>& query) {
+        uint8_t ans[512];
+        int len = 0;
+        EXPECT_EQ(DnsTlsTransport::Response::success,
+                mTransport->doQuery(query.data(), query.size(), ans, sizeof(ans), &len));
+        EXPECT_EQ(makeAnswer(query), std::vector<uint8_t>(ans, ans + len));
+    }
+
+    // Sends the queries concurrently, one thread each, and checks that each gets its own answer.
+    void expectAllAnswered(const std::vector<std::vector<uint8_t>>& queries) {
+        std::vector<std::thread> threads;
+        for (const auto& query : queries) {
+            threads.emplace_back([this, &query] { expectAnswered(query); });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+
+    EchoBackend mBackend;
+    std::unique_ptr<test::DnsTlsFrontend> mFrontend;
+    DnsTlsSessionCache mCache;
+    std::unique_ptr<DnsTlsTransport> mTransport;
+};
+
+TEST_F(DnsTlsTransportTest, AnswersQuery) {
+    expectAnswered(makeQuery(0x1234, "a"));
+    EXPECT_EQ(1, mFrontend->connections());
+}
+
+TEST_F(DnsTlsTransportTest, PipelinesQueries) {
+    // The server reads all the queries before answering any, and answers them in reverse order.
+    // A transport that waited for each answer before sending the next query would never get one.
+    constexpr int kQueries = 8;
+    mFrontend->setQueriesPerConnection(kQueries);
+    mFrontend->setBatchSize(kQueries);
+
+    std::vector<std::vector<uint8_t>> queries;
+    for (int i = 0; i < kQueries; ++i) {
+        queries.push_back(makeQuery(i, std::string(1, 'a' + i)));
+    }
+    expectAllAnswered(queries);
+    EXPECT_EQ(1, mFrontend->connections());
+    EXPECT_TRUE(mFrontend->waitForQueries(kQueries, 5000));
+}
+
+TEST_F(DnsTlsTransportTest, RewritesDuplicateIds) {
+    // Callers choose their IDs independently, so concurrent queries can share one. Each must still
+    // get its own answer, under its own ID, even when the server answers out of order.
+    constexpr int kQueries = 4;
+    mFrontend->setQueriesPerConnection(kQueries);
+    mFrontend->setBatchSize(kQueries);
+
+    std::vector<std::vector<uint8_t>> queries;
+    for (int i = 0; i < kQueries; ++i) {
+        queries.push_back(makeQuery(0x1234, std::string(1, 'a' + i)));
+    }
+    expectAllAnswered(queries);
+    EXPECT_EQ(1, mFrontend->connections());
+}
+
+TEST_F(DnsTlsTransportTest, ReconnectsAfterServerCloses) {
+    // The server closes each connection after two queries, like one with a per-connection query
+    // limit. Queries sent on a connection that turns out to be closed are retried on a new one.
+    mFrontend->setQueriesPerConnection(2);
+    for (int i = 0; i < 5; ++i) {
+        expectAnswered(makeQuery(i, "a"));
+    }
+    EXPECT_EQ(3, mFrontend->connections());
+}
+
+}  // namespace net
+}  // namespace android
@@ -0,0 +1,281 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * DnsTlsValidationSchedulerTest.cpp - unit tests for dns/DnsTlsValidationScheduler.cpp
+ */
+
+#include <arpa/inet.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "dns/DnsTlsValidationScheduler.h"
+
+namespace android {
+namespace net {
+
+namespace {
+
+using std::chrono::milliseconds;
+
+constexpr milliseconds kTimeout(5000);
+
+sockaddr_storage makeServer(const char* addr) {
+    sockaddr_storage ss = {};
+    sockaddr_in* sin = reinterpret_cast<sockaddr_in*>(&ss);
+    sin->sin_family = AF_INET;
+    sin->sin_port = htons(853);
+    inet_pton(AF_INET, addr, &sin->sin_addr);
+    return ss;
+}
+
+std::string serverToString(const sockaddr_storage& ss) {
+    char buf[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &reinterpret_cast<const sockaddr_in&>(ss).sin_addr, buf, sizeof(buf));
+    return buf;
+}
+
+// A fake validator. Validations block until released, and fail until told to succeed.
+class FakeValidator {
+  public:
+    bool validate(unsigned netId, const sockaddr_storage& server) {
+        const std::string addr = serverToString(server);
+        std::unique_lock<std::mutex> lock(mLock);
+        ++mCalls[netId];
+        ++mRunning;
+        ++mRunningPerServer[addr];
+        mMaxRunning = std::max(mMaxRunning, mRunning);
+        mMaxRunningPerServer = std::max(mMaxRunningPerServer, mRunningPerServer[addr]);
+        mCv.notify_all();
+        mCv.wait(lock, [this] { return !mBlocked; });
+        --mRunning;
+        --mRunningPerServer[addr];
+        return mSucceed;
+    }
+
+    void setBlocked(bool blocked) {
+        std::lock_guard<std::mutex> guard(mLock);
+        mBlocked = blocked;
+        mCv.notify_all();
+    }
+
+    void setSucceed(bool succeed) {
+        std::lock_guard<std::mutex> guard(mLock);
+        mSucceed = succeed;
+    }
+
+    // Waits until |netId| has been validated at least |calls| times.
+    bool waitForCalls(unsigned netId, int calls) {
+        std::unique_lock<std::mutex> lock(mLock);
+        return mCv.wait_for(lock, kTimeout, [&] { return mCalls[netId] >= calls; });
+    }
+
+    // Waits until |count| validations are running at the same time.
+    bool waitForRunning(int count) {
+        std::unique_lock<std::mutex> lock(mLock);
+        return mCv.wait_for(lock, kTimeout, [&] { return mRunning >= count; });
+    }
+
+    int calls(unsigned netId) {
+        std::lock_guard<std::mutex> guard(mLock);
+        return mCalls[netId];
+    }
+
+    int maxRunning() {
+        std::lock_guard<std::mutex> guard(mLock);
+        return mMaxRunning;
+    }
+
+    int maxRunningPerServer() {
+        std::lock_guard<std::mutex> guard(mLock);
+        return mMaxRunningPerServer;
+    }
+
+  private:
+    std::mutex mLock;
+    std::condition_variable mCv;
+    bool mBlocked = false;
+    bool mSucceed = true;
+    std::map<unsigned, int> mCalls;
+    std::map<std::string, int> mRunningPerServer;
+    int mRunning = 0;
+    int mMaxRunning = 0;
+    int mMaxRunningPerServer = 0;
+};
+
+class DnsTlsValidationSchedulerTest : public ::testing::Test {
+  protected:
+    std::unique_ptr<DnsTlsValidationScheduler> makeScheduler(int maxConcurrent,
+            milliseconds initialBackoff) {
+        return std::make_unique<DnsTlsValidationScheduler>(
+                [this](unsigned netId, const sockaddr_storage& server,
+                        const std::set<std::vector<uint8_t>>&) {
+                    return mValidator.validate(netId, server);
+                },
+                [](unsigned, const sockaddr_storage&, bool) { return true; },
+                maxConcurrent, initialBackoff, 4 * initialBackoff);
+    }
+
+    // Waits for the scheduler to have no more validations, i.e. for all of them to succeed.
+    bool waitForIdle(DnsTlsValidationScheduler* scheduler) {
+        const auto deadline = std::chrono::steady_clock::now() + kTimeout;
+        while (scheduler->size() != 0) {
+            if (std::chrono::steady_clock::now() > deadline) return false;
+            std::this_thread::sleep_for(milliseconds(5));
+        }
+        return true;
+    }
+
+    FakeValidator mValidator;
+};
+
+}  // namespace
+
+TEST_F(DnsTlsValidationSchedulerTest, DeduplicatesRequests) {
+    auto scheduler = makeScheduler(4, milliseconds(10));
+    const sockaddr_storage server = makeServer("192.0.2.1");
+    mValidator.setBlocked(true);
+
+    scheduler->schedule(100, server, {});
+    ASSERT_TRUE(mValidator.waitForRunning(1));
+    for (int i = 0; i < 10; i++) {
+        scheduler->schedule(100, server, {});
+    }
+    EXPECT_EQ(1U, scheduler->size());
+
+    mValidator.setBlocked(false);
+    ASSERT_TRUE(waitForIdle(scheduler.get()));
+    EXPECT_EQ(1, mValidator.calls(100));
+}
+
+TEST_F(DnsTlsValidationSchedulerTest, SerializesValidationsOfSharedServer) {
+    auto scheduler = makeScheduler(4, milliseconds(10));
+    const sockaddr_storage server = makeServer("192.0.2.1");
+
+    for (unsigned netId = 100; netId < 110; netId++) {
+        scheduler->schedule(netId, server, {});
+    }
+    ASSERT_TRUE(waitForIdle(scheduler.get()));
+    for (unsigned netId = 100; netId < 110; netId++) {
+        EXPECT_EQ(1, mValidator.calls(netId));
+    }
+    EXPECT_EQ(1, mValidator.maxRunningPerServer());
+}
+
+TEST_F(DnsTlsValidationSchedulerTest, LimitsConcurrency) {
+    auto scheduler = makeScheduler(2, milliseconds(10));
+    mValidator.setBlocked(true);
+
+    for (unsigned i = 0; i < 6; i++) {
+        const std::string addr = "192.0.2." + std::to_string(i + 1);
+        scheduler->schedule(100 + i, makeServer(addr.c_str()), {});
+    }
+    ASSERT_TRUE(mValidator.waitForRunning(2));
+    std::this_thread::sleep_for(milliseconds(50));
+    EXPECT_EQ(2, mValidator.maxRunning());
+
+    mValidator.setBlocked(false);
+    ASSERT_TRUE(waitForIdle(scheduler.get()));
+    EXPECT_EQ(2, mValidator.maxRunning());
+}
+
+TEST_F(DnsTlsValidationSchedulerTest, RetriesWithBackoff) {
+    auto scheduler = makeScheduler(4, milliseconds(20));
+    mValidator.setSucceed(false);
+
+    const auto start = std::chrono::steady_clock::now();
+    scheduler->schedule(100, makeServer("192.0.2.1"), {});
+    // Attempts at 0, 20 and 20 + 40 ms.
+    ASSERT_TRUE(mValidator.waitForCalls(100, 3));
+    EXPECT_LE(milliseconds(60), std::chrono::steady_clock::now() - start);
+    EXPECT_EQ(1U, scheduler->size());
+
+    mValidator.setSucceed(true);
+    ASSERT_TRUE(waitForIdle(scheduler.get()));
+}
+
+TEST_F(DnsTlsValidationSchedulerTest, RevalidateSkipsBackoff) {
+    auto scheduler = makeScheduler(4, std::chrono::hours(1));
+    mValidator.setSucceed(false);
+
+    scheduler->schedule(100, makeServer("192.0.2.1"), {});
+    scheduler->schedule(200, makeServer("192.0.2.1"), {});
+    ASSERT_TRUE(mValidator.waitForCalls(100, 1));
+    ASSERT_TRUE(mValidator.waitForCalls(200, 1));
+
+    // Only the revalidated network is retried.
+    mValidator.setSucceed(true);
+    scheduler->revalidate(100);
+    ASSERT_TRUE(mValidator.waitForCalls(100, 2));
+    std::this_thread::sleep_for(milliseconds(50));
+    EXPECT_EQ(1, mValidator.calls(200));
+    EXPECT_EQ(1U, scheduler->size());
+}
+
+TEST_F(DnsTlsValidationSchedulerTest, CancelDropsRetries) {
+    auto scheduler = makeScheduler(4, std::chrono::hours(1));
+    mValidator.setSucceed(false);
+
+    scheduler->schedule(100, makeServer("192.0.2.1"), {});
+    scheduler->schedule(100, makeServer("192.0.2.2"), {});
+    scheduler->schedule(200, makeServer("192.0.2.1"), {});
+    ASSERT_TRUE(mValidator.waitForCalls(100, 2));
+    ASSERT_TRUE(mValidator.waitForCalls(200, 1));
+    // Let the failed validations be rescheduled, so that cancelling them takes effect at once.
+    std::this_thread::sleep_for(milliseconds(50));
+    EXPECT_EQ(3U, scheduler->size());
+
+    scheduler->cancelServer(makeServer("192.0.2.1"));
+    EXPECT_EQ(1U, scheduler->size());
+    scheduler->cancelNetwork(100);
+    EXPECT_EQ(0U, scheduler->size());
+}
+
+TEST_F(DnsTlsValidationSchedulerTest, CancelOneServerOnOneNetwork) {
+    auto scheduler = makeScheduler(4, std::chrono::hours(1));
+    mValidator.setSucceed(false);
+
+    scheduler->schedule(100, makeServer("192.0.2.1"), {});
+    scheduler->schedule(100, makeServer("192.0.2.2"), {});
+    scheduler->schedule(200, makeServer("192.0.2.1"), {});
+    ASSERT_TRUE(mValidator.waitForCalls(100, 2));
+    ASSERT_TRUE(mValidator.waitForCalls(200, 1));
+    std::this_thread::sleep_for(milliseconds(50));
+    EXPECT_EQ(3U, scheduler->size());
+
+    scheduler->cancel(100, makeServer("192.0.2.1"));
+    EXPECT_EQ(2U, scheduler->size());
+    // Cancelling a server that has no validation on the network is a no-op.
+    scheduler->cancel(200, makeServer("192.0.2.2"));
+    EXPECT_EQ(2U, scheduler->size());
+
+    // The cancelled validation can be scheduled again.
+    scheduler->schedule(100, makeServer("192.0.2.1"), {});
+    ASSERT_TRUE(mValidator.waitForCalls(100, 3));
+    std::this_thread::sleep_for(milliseconds(50));
+    EXPECT_EQ(3U, scheduler->size());
+}
+
+}  // namespace net
+}  // namespace android
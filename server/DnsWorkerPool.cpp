@@ -0,0 +1,176 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "DnsWorkerPool"
+
+#include <errno.h>
+
+#include <algorithm>
+
+#include <cutils/log.h>
+
+#include "DnsWorkerPool.h"
+#include "DumpWriter.h"
+
+namespace android {
+namespace net {
+
+constexpr unsigned DnsWorkerPool::kDefaultNumThreads;
+constexpr unsigned DnsWorkerPool::kDefaultMaxRunningPerNetId;
+constexpr size_t DnsWorkerPool::kDefaultMaxQueued;
+
+DnsWorkerPool::DnsWorkerPool(unsigned numThreads, unsigned maxRunningPerNetId, size_t maxQueued)
+    : mNumThreads(std::max(numThreads, 1U)),
+      mMaxRunningPerNetId(std::max(std::min(maxRunningPerNetId, mNumThreads), 1U)),
+      mMaxQueued(maxQueued) {}
+
+DnsWorkerPool::~DnsWorkerPool() {
+    std::vector<std::thread> threads;
+    {
+        std::lock_guard<std::mutex> guard(mLock);
+        mStopping = true;
+        threads.swap(mThreads);
+    }
+    mCv.notify_all();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+void DnsWorkerPool::start() {
+    std::lock_guard<std::mutex> guard(mLock);
+    if (!mThreads.empty()) {
+        return;
+    }
+    for (unsigned i = 0; i < mNumThreads; ++i) {
+        mThreads.emplace_back([this] { workerLoop(); });
+    }
+}
+
+int DnsWorkerPool::enqueue(unsigned netId, Task task) {
+    {
+        std::lock_guard<std::mutex> guard(mLock);
+        if (mStopping || mStats.queued >= mMaxQueued) {
+            mStats.rejected++;
+            return -EBUSY;
+        }
+        mQueues[netId].pending.push_back({std::move(task), clock::now()});
+        mStats.enqueued++;
+        mStats.queued++;
+        mStats.maxQueued = std::max(mStats.maxQueued, mStats.queued);
+    }
+    mCv.notify_one();
+    return 0;
+}
+
+bool DnsWorkerPool::popNextLocked(unsigned* netId, PendingTask* out) {
+    if (mQueues.empty()) {
+        return false;
+    }
+    // Start just after the netId that was served last, wrapping around once.
+    auto start = mQueues.upper_bound(mLastNetId);
+    if (start == mQueues.end()) {
+        start = mQueues.begin();
+    }
+    auto it = start;
+    do {
+        NetQueue& queue = it->second;
+        if (!queue.pending.empty() && queue.running < mMaxRunningPerNetId) {
+            *netId = it->first;
+            *out = std::move(queue.pending.front());
+            queue.pending.pop_front();
+            queue.running++;
+            mLastNetId = it->first;
+            return true;
+        }
+        if (++it == mQueues.end()) {
+            it = mQueues.begin();
+        }
+    } while (it != start);
+    return false;
+}
+
+void DnsWorkerPool::workerLoop() {
+    std::unique_lock<std::mutex> lock(mLock);
+    while (true) {
+        unsigned netId;
+        PendingTask next;
+        if (!popNextLocked(&netId, &next)) {
+            // Keep running until every queued task has been served, so that no SocketClient
+            // reference held by a task is ever leaked.
+            if (mStopping && mStats.queued == 0) {
+                return;
+            }
+            mCv.wait(lock);
+            continue;
+        }
+
+        const auto now = clock::now();
+        const uint64_t waitUs = std::chrono::duration_cast<std::chrono::microseconds>(
+                now - next.enqueueTime).count();
+        mStats.queued--;
+        mStats.running++;
+        mStats.totalWaitUs += waitUs;
+        mStats.maxWaitUs = std::max(mStats.maxWaitUs, waitUs);
+
+        lock.unlock();
+        next.task();
+        next.task = nullptr;
+        lock.lock();
+
+        mStats.running--;
+        mStats.completed++;
+        auto it = mQueues.find(netId);
+        if (it != mQueues.end()) {
+            it->second.running--;
+            if (it->second.running == 0 && it->second.pending.empty()) {
+                mQueues.erase(it);
+            }
+        }
+        // A task for this netId may have been held back by mMaxRunningPerNetId.
+        mCv.notify_one();
+    }
+}
+
+DnsWorkerPool::Stats DnsWorkerPool::getStats() const {
+    std::lock_guard<std::mutex> guard(mLock);
+    return mStats;
+}
+
+void DnsWorkerPool::dump(DumpWriter& dw) const {
+    std::lock_guard<std::mutex> guard(mLock);
+    dw.println("DNS worker pool: %zu threads, max %u running per netId, max %zu queued",
+            mThreads.size(), mMaxRunningPerNetId, mMaxQueued);
+    dw.incIndent();
+    const uint64_t started = mStats.completed + mStats.running;
+    dw.println("enqueued: %llu, completed: %llu, rejected: %llu",
+            static_cast<unsigned long long>(mStats.enqueued),
+            static_cast<unsigned long long>(mStats.completed),
+            static_cast<unsigned long long>(mStats.rejected));
+    dw.println("running: %u, queued: %zu, max queued: %zu",
+            mStats.running, mStats.queued, mStats.maxQueued);
+    dw.println("wait time: avg %llums, max %llums",
+            static_cast<unsigned long long>(started ? mStats.totalWaitUs / started / 1000 : 0),
+            static_cast<unsigned long long>(mStats.maxWaitUs / 1000));
+    for (const auto& queue : mQueues) {
+        dw.println("netId %u: running %u, queued %zu", queue.first, queue.second.running,
+                queue.second.pending.size());
+    }
+    dw.decIndent();
+}
+
+}  // namespace net
+}  // namespace android
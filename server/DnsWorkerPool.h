@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NETD_SERVER_DNS_WORKER_POOL_H
+#define NETD_SERVER_DNS_WORKER_POOL_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace android {
+namespace net {
+
+class DumpWriter;
+
+// A fixed-size pool of threads that runs DNS lookups on behalf of DnsProxyListener.
+//
+// Each lookup can block for seconds waiting for upstream servers, so instead of one FIFO the pool
+// keeps one queue per netId and hands work to idle threads round-robin across netIds. A netId is
+// never allowed to occupy more than maxRunningPerNetId threads at once, so a network whose
+// servers are blackholed cannot starve lookups on other networks.
+//
+// The total number of queued (not yet running) lookups is bounded. When the bound is reached,
+// enqueue() fails with -EBUSY and the caller is expected to fail the request immediately rather
+// than let it wait behind a backlog that the client will have given up on anyway.
+class DnsWorkerPool {
+  public:
+    using Task = std::function<void()>;
+
+    static constexpr unsigned kDefaultNumThreads = 64;
+    static constexpr unsigned kDefaultMaxRunningPerNetId = 48;
+    static constexpr size_t kDefaultMaxQueued = 1024;
+
+    struct Stats {
+        uint64_t enqueued = 0;
+        uint64_t completed = 0;
+        uint64_t rejected = 0;
+        size_t queued = 0;
+        size_t maxQueued = 0;
+        unsigned running = 0;
+        // Time spent between enqueue() and the start of the task.
+        uint64_t totalWaitUs = 0;
+        uint64_t maxWaitUs = 0;
+    };
+
+    DnsWorkerPool(unsigned numThreads = kDefaultNumThreads,
+                  unsigned maxRunningPerNetId = kDefaultMaxRunningPerNetId,
+                  size_t maxQueued = kDefaultMaxQueued);
+
+    // Waits for all queued tasks to finish.
+    ~DnsWorkerPool();
+
+    DnsWorkerPool(const DnsWorkerPool&) = delete;
+    DnsWorkerPool& operator=(const DnsWorkerPool&) = delete;
+
+    // Starts the worker threads. Calling start() more than once has no effect.
+    void start();
+
+    // Queues |task| to run on behalf of |netId|. Returns 0 on success, or -EBUSY if the pool is
+    // overloaded, in which case |task| has not been and will never be run.
+    // Threadsafe.
+    int enqueue(unsigned netId, Task task);
+
+    Stats getStats() const;
+
+    void dump(DumpWriter& dw) const;
+
+  private:
+    using clock = std::chrono::steady_clock;
+
+    struct PendingTask {
+        Task task;
+        clock::time_point enqueueTime;
+    };
+
+    struct NetQueue {
+        std::deque<PendingTask> pending;
+        unsigned running = 0;
+    };
+
+    void workerLoop();
+    // Picks the next runnable task, honouring round-robin order and per-netId limits.
+    // Returns false if no task is currently runnable. Must be called with mLock held.
+    bool popNextLocked(unsigned* netId, PendingTask* out);
+
+    const unsigned mNumThreads;
+    const unsigned mMaxRunningPerNetId;
+    const size_t mMaxQueued;
+
+    mutable std::mutex mLock;
+    std::condition_variable mCv;
+    bool mStopping = false;                     // guarded by mLock
+    std::map<unsigned, NetQueue> mQueues;       // guarded by mLock
+    unsigned mLastNetId = 0;                    // guarded by mLock
+    Stats mStats;                               // guarded by mLock
+    std::vector<std::thread> mThreads;          // guarded by mLock
+};
+
+}  // namespace net
+}  // namespace android
+
+#endif  // NETD_SERVER_DNS_WORKER_POOL_H
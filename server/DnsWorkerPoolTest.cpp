@@ -0,0 +1,192 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * DnsWorkerPoolTest.cpp - unit tests for DnsWorkerPool.cpp
+ */
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "DnsWorkerPool.h"
+
+namespace android {
+namespace net {
+
+namespace {
+
+// A one-shot latch used to hold worker threads inside a task until the test releases them.
+class Gate {
+  public:
+    void open() {
+        std::lock_guard<std::mutex> guard(mLock);
+        mOpen = true;
+        mCv.notify_all();
+    }
+
+    void wait() {
+        std::unique_lock<std::mutex> lock(mLock);
+        mCv.wait(lock, [this] { return mOpen; });
+    }
+
+  private:
+    std::mutex mLock;
+    std::condition_variable mCv;
+    bool mOpen = false;
+};
+
+// Counts down to zero and lets waiters block until it gets there.
+class Counter {
+  public:
+    explicit Counter(int count) : mCount(count) {}
+
+    void done() {
+        std::lock_guard<std::mutex> guard(mLock);
+        if (--mCount == 0) mCv.notify_all();
+    }
+
+    void waitForZero() {
+        std::unique_lock<std::mutex> lock(mLock);
+        mCv.wait(lock, [this] { return mCount <= 0; });
+    }
+
+  private:
+    std::mutex mLock;
+    std::condition_variable mCv;
+    int mCount;
+};
+
+}  // namespace
+
+TEST(DnsWorkerPoolTest, RunsAllTasks) {
+    DnsWorkerPool pool(4, 4, 100);
+    pool.start();
+
+    std::atomic<int> ran{0};
+    Counter counter(50);
+    for (int i = 0; i < 50; i++) {
+        EXPECT_EQ(0, pool.enqueue(i % 3, [&ran, &counter] {
+            ran++;
+            counter.done();
+        }));
+    }
+    counter.waitForZero();
+    EXPECT_EQ(50, ran);
+
+    const auto stats = pool.getStats();
+    EXPECT_EQ(50U, stats.enqueued);
+    EXPECT_EQ(0U, stats.rejected);
+    EXPECT_EQ(0U, stats.queued);
+}
+
+TEST(DnsWorkerPoolTest, RejectsWhenQueueFull) {
+    DnsWorkerPool pool(1, 1, 2);
+    pool.start();
+
+    Gate gate;
+    Counter started(1);
+    ASSERT_EQ(0, pool.enqueue(1, [&gate, &started] {
+        started.done();
+        gate.wait();
+    }));
+    started.waitForZero();
+
+    EXPECT_EQ(0, pool.enqueue(1, [] {}));
+    EXPECT_EQ(0, pool.enqueue(2, [] {}));
+    EXPECT_EQ(-EBUSY, pool.enqueue(3, [] {}));
+
+    const auto stats = pool.getStats();
+    EXPECT_EQ(2U, stats.queued);
+    EXPECT_EQ(2U, stats.maxQueued);
+    EXPECT_EQ(1U, stats.rejected);
+    EXPECT_EQ(1U, stats.running);
+
+    gate.open();
+}
+
+TEST(DnsWorkerPoolTest, ServesNetIdsRoundRobin) {
+    DnsWorkerPool pool(1, 1, 100);
+    pool.start();
+
+    Gate gate;
+    Counter started(1);
+    ASSERT_EQ(0, pool.enqueue(50, [&gate, &started] {
+        started.done();
+        gate.wait();
+    }));
+    started.waitForZero();
+
+    // Everything below is queued while the only worker is busy, so the run order is decided
+    // entirely by the pool's scheduling.
+    std::mutex orderLock;
+    std::vector<std::string> order;
+    Counter finished(4);
+    const auto record = [&](const char* name) {
+        return [&, name] {
+            {
+                std::lock_guard<std::mutex> guard(orderLock);
+                order.push_back(name);
+            }
+            finished.done();
+        };
+    };
+    ASSERT_EQ(0, pool.enqueue(100, record("a1")));
+    ASSERT_EQ(0, pool.enqueue(100, record("a2")));
+    ASSERT_EQ(0, pool.enqueue(100, record("a3")));
+    ASSERT_EQ(0, pool.enqueue(200, record("b1")));
+
+    gate.open();
+    finished.waitForZero();
+    EXPECT_EQ((std::vector<std::string>{"a1", "b1", "a2", "a3"}), order);
+}
+
+TEST(DnsWorkerPoolTest, LimitsRunningTasksPerNetId) {
+    DnsWorkerPool pool(4, 2, 100);
+    pool.start();
+
+    Gate gate;
+    std::atomic<int> running{0};
+    std::atomic<int> maxRunning{0};
+    Counter slowStarted(2);
+    Counter slowFinished(4);
+    for (int i = 0; i < 4; i++) {
+        ASSERT_EQ(0, pool.enqueue(1, [&] {
+            const int now = ++running;
+            int prev = maxRunning;
+            while (now > prev && !maxRunning.compare_exchange_weak(prev, now)) {}
+            slowStarted.done();
+            gate.wait();
+            running--;
+            slowFinished.done();
+        }));
+    }
+    slowStarted.waitForZero();
+
+    // netId 1 is capped at two workers, so a lookup on another network must still get through.
+    Counter otherFinished(1);
+    ASSERT_EQ(0, pool.enqueue(2, [&otherFinished] { otherFinished.done(); }));
+    otherFinished.waitForZero();
+
+    gate.open();
+    slowFinished.waitForZero();
+    EXPECT_EQ(2, maxRunning);
+}
+
+}  // namespace net
+}  // namespace android
@@ -16,12 +16,63 @@
 
 #define LOG_TAG "Netd"
 
+#include <inttypes.h>
+
+#include <algorithm>
+#include <memory>
+
 #include "EventReporter.h"
 #include "log/log.h"
 
 using android::interface_cast;
+using android::String16;
 using android::net::metrics::INetdEventListener;
 
+constexpr std::chrono::milliseconds EventReporter::kBatchDelay;
+constexpr std::chrono::milliseconds EventReporter::kMinFetchBackoff;
+constexpr std::chrono::milliseconds EventReporter::kMaxFetchBackoff;
+
+namespace {
+
+int64_t steadyClockMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+}  // namespace
+
+class EventReporter::ListenerDeathRecipient : public android::IBinder::DeathRecipient {
+public:
+    explicit ListenerDeathRecipient(EventReporter* reporter) : mReporter(reporter) {}
+
+    void binderDied(const android::wp<android::IBinder>& who) override {
+        mReporter->onNetdEventListenerDied(who);
+    }
+
+private:
+    EventReporter* const mReporter;
+};
+
+EventReporter::EventReporter()
+    : mNetdEventListener(std::make_unique<android::sp<INetdEventListener>>()),
+      mDeathRecipient(new ListenerDeathRecipient(this)) {}
+
+EventReporter::~EventReporter() {
+    {
+        std::lock_guard<std::mutex> guard(mWakeLock);
+        mStopping = true;
+    }
+    mWakeCondition.notify_one();
+    if (mReporterThread.joinable()) {
+        mReporterThread.join();
+    }
+
+    std::lock_guard<std::mutex> guard(mListenersLock);
+    if (mListener != nullptr) {
+        android::IInterface::asBinder(mListener)->unlinkToDeath(mDeathRecipient);
+    }
+}
+
 int EventReporter::setMetricsReportingLevel(const int level) {
     if (level < INetdEventListener::REPORTING_LEVEL_NONE
             || level > INetdEventListener::REPORTING_LEVEL_FULL) {
@@ -36,22 +87,233 @@ int EventReporter::getMetricsReportingLevel() const {
     return mReportingLevel;
 }
 
+void EventReporter::setNetdEventListener(const android::sp<INetdEventListener>& listener) {
+    publishNetdEventListener(listener);
+}
+
 android::sp<INetdEventListener> EventReporter::getNetdEventListener() {
-    std::lock_guard<std::mutex> lock(mutex);
-    if (mNetdEventListener == nullptr) {
-        // Use checkService instead of getService because getService waits for 5 seconds for the
-        // service to become available. The DNS resolver inside netd is started much earlier in the
-        // boot sequence than the framework DNS listener, and we don't want to delay all DNS lookups
-        // for 5 seconds until the DNS listener starts up.
-        android::sp<android::IBinder> b = android::defaultServiceManager()->checkService(
-                android::String16("netd_listener"));
-        if (b != nullptr) {
-            mNetdEventListener = interface_cast<INetdEventListener>(b);
-        }
-    }
     // If the netd listener service is dead, the binder call will just return an error, which should
     // be fine because the only impact is that we can't log netd events. In any case, this should
     // only happen if the system server is going down, which means it will shortly be taking us down
     // with it.
-    return mNetdEventListener;
+    android::sp<INetdEventListener> listener = *mNetdEventListener.read();
+    if (listener != nullptr) {
+        return listener;
+    }
+    return fetchNetdEventListener();
+}
+
+android::sp<INetdEventListener> EventReporter::fetchNetdEventListener() {
+    const int64_t now = steadyClockMs();
+    if (now < mNextFetchMs.load(std::memory_order_relaxed)) {
+        return nullptr;
+    }
+    // Let one thread fetch the listener, and let the others carry on without it.
+    if (mFetching.test_and_set(std::memory_order_acquire)) {
+        return nullptr;
+    }
+
+    // Use checkService instead of getService because getService waits for 5 seconds for the
+    // service to become available. The DNS resolver inside netd is started much earlier in the
+    // boot sequence than the framework DNS listener, and we don't want to delay all DNS lookups
+    // for 5 seconds until the DNS listener starts up.
+    mListenerFetches++;
+    android::sp<INetdEventListener> listener;
+    android::sp<android::IBinder> b = android::defaultServiceManager()->checkService(
+            android::String16("netd_listener"));
+    if (b != nullptr) {
+        listener = interface_cast<INetdEventListener>(b);
+        if (!publishNetdEventListener(listener)) {
+            listener = nullptr;
+        }
+    }
+    if (listener != nullptr) {
+        mFetchBackoff = kMinFetchBackoff;
+    } else {
+        mNextFetchMs.store(now + mFetchBackoff.count(), std::memory_order_relaxed);
+        mFetchBackoff = std::min(mFetchBackoff * 2, kMaxFetchBackoff);
+    }
+
+    mFetching.clear(std::memory_order_release);
+    return listener;
+}
+
+// Returns false, leaving the current listener in place, if |listener| is already dead.
+bool EventReporter::publishNetdEventListener(const android::sp<INetdEventListener>& listener) {
+    if (listener != nullptr) {
+        const android::status_t status =
+                android::IInterface::asBinder(listener)->linkToDeath(mDeathRecipient);
+        // Listeners that live in this process cannot be linked to, but they never die either.
+        if (status != android::OK && status != android::INVALID_OPERATION) {
+            ALOGE("Cannot watch netd event listener for death: %d", status);
+            return false;
+        }
+    }
+
+    android::sp<INetdEventListener> previous;
+    {
+        std::lock_guard<std::mutex> guard(mListenersLock);
+        previous = mListener;
+        mListener = listener;
+        mNetdEventListener.publish(std::make_unique<android::sp<INetdEventListener>>(listener));
+    }
+    if (previous != nullptr && previous != listener) {
+        android::IInterface::asBinder(previous)->unlinkToDeath(mDeathRecipient);
+    }
+    return true;
+}
+
+void EventReporter::onNetdEventListenerDied(const android::wp<android::IBinder>& who) {
+    std::lock_guard<std::mutex> guard(mListenersLock);
+    const android::sp<INetdEventListener> listener = *mNetdEventListener.read();
+    if (listener == nullptr || android::IInterface::asBinder(listener) != who.unsafe_get()) {
+        return;
+    }
+    ALOGW("Netd event listener died");
+    mListenerDeaths++;
+    mNetdEventListener.publish(std::make_unique<android::sp<INetdEventListener>>());
+    // Give the system server a moment to come back before fetching the listener again.
+    mNextFetchMs.store(steadyClockMs() + kMinFetchBackoff.count(), std::memory_order_relaxed);
+}
+
+void EventReporter::reportDnsEvent(DnsEvent&& event) {
+    // Count the event before it becomes visible, so that the reporter thread never takes more
+    // events out of the rings than it has been told about.
+    const size_t pending = ++mPending;
+    if (!mDnsEvents.tryPush(std::move(event))) {
+        mPending--;
+        mDroppedRingFull++;
+        return;
+    }
+    wakeReporterThread(pending);
+}
+
+void EventReporter::reportConnectEvent(ConnectEvent&& event) {
+    const size_t pending = ++mPending;
+    if (!mConnectEvents.tryPush(std::move(event))) {
+        mPending--;
+        mDroppedRingFull++;
+        return;
+    }
+    wakeReporterThread(pending);
+}
+
+void EventReporter::wakeReporterThread(size_t pending) {
+    std::call_once(mStartOnce, [this] { startReporterThread(); });
+
+    // Only wake up the reporter thread for the first event of a batch, or when a batch is full.
+    // Taking the lock here means the reporter thread can't miss the wakeup.
+    if (pending == 1 || pending == kMaxBatchSize) {
+        std::lock_guard<std::mutex> guard(mWakeLock);
+        mWakeCondition.notify_one();
+    }
+}
+
+void EventReporter::startReporterThread() {
+    mReporterThread = std::thread([this] { reporterLoop(); });
+}
+
+void EventReporter::reporterLoop() {
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(mWakeLock);
+            mWakeCondition.wait(lock, [this] { return mPending > 0 || mStopping; });
+            if (mStopping) return;
+            // Give more events a chance to join the batch.
+            mWakeCondition.wait_for(lock, kBatchDelay, [this] {
+                return mPending >= kMaxBatchSize || mStopping;
+            });
+        }
+        deliverQueuedEvents();
+    }
+}
+
+void EventReporter::deliverQueuedEvents() {
+    const android::sp<INetdEventListener> listener = getNetdEventListener();
+    size_t delivered;
+    do {
+        delivered = deliverDnsEvents(listener) + deliverConnectEvents(listener);
+        mPending -= delivered;
+    } while (delivered > 0);
+}
+
+// Sends up to kMaxBatchSize DNS events to |listener|, or drops them if there is no listener.
+// Returns the number of events taken from the ring.
+size_t EventReporter::deliverDnsEvents(const android::sp<INetdEventListener>& listener) {
+    std::vector<int32_t> netIds, eventTypes, returnCodes, latenciesMs, ipAddressesLengths,
+            ipAddressesCounts, uids;
+    std::vector<String16> hostnames, ipAddresses;
+    DnsEvent event;
+    size_t count = 0;
+    while (count < kMaxBatchSize && mDnsEvents.tryPop(&event)) {
+        netIds.push_back(event.netId);
+        eventTypes.push_back(event.eventType);
+        returnCodes.push_back(event.returnCode);
+        latenciesMs.push_back(event.latencyMs);
+        hostnames.push_back(event.hostname);
+        ipAddressesLengths.push_back(event.ipAddresses.size());
+        ipAddresses.insert(ipAddresses.end(), event.ipAddresses.begin(), event.ipAddresses.end());
+        ipAddressesCounts.push_back(event.ipAddressesCount);
+        uids.push_back(event.uid);
+        count++;
+    }
+    if (count == 0) return 0;
+
+    if (listener == nullptr) {
+        mDroppedNoListener += count;
+        return count;
+    }
+    listener->onDnsEvents(netIds, eventTypes, returnCodes, latenciesMs, hostnames, ipAddresses,
+                          ipAddressesLengths, ipAddressesCounts, uids);
+    mEventsDelivered += count;
+    mBatchesDelivered++;
+    return count;
+}
+
+// Sends up to kMaxBatchSize connect events to |listener|, or drops them if there is no listener.
+// Returns the number of events taken from the ring.
+size_t EventReporter::deliverConnectEvents(const android::sp<INetdEventListener>& listener) {
+    std::vector<int32_t> netIds, errors, latenciesMs, ports, uids;
+    std::vector<String16> ipAddrs;
+    ConnectEvent event;
+    size_t count = 0;
+    while (count < kMaxBatchSize && mConnectEvents.tryPop(&event)) {
+        netIds.push_back(event.netId);
+        errors.push_back(event.error);
+        latenciesMs.push_back(event.latencyMs);
+        ipAddrs.push_back(event.ipAddr);
+        ports.push_back(event.port);
+        uids.push_back(event.uid);
+        count++;
+    }
+    if (count == 0) return 0;
+
+    if (listener == nullptr) {
+        mDroppedNoListener += count;
+        return count;
+    }
+    listener->onConnectEvents(netIds, errors, latenciesMs, ipAddrs, ports, uids);
+    mEventsDelivered += count;
+    mBatchesDelivered++;
+    return count;
+}
+
+void EventReporter::dump(android::net::DumpWriter& dw) {
+    dw.incIndent();
+    dw.println("EventReporter");
+
+    dw.incIndent();
+    dw.println("Reporting level: %d", getMetricsReportingLevel());
+    dw.println("Listener: %s, fetched %" PRIu64 " times, died %" PRIu64 " times",
+               (*mNetdEventListener.read() != nullptr) ? "connected" : "not connected",
+               mListenerFetches.load(), mListenerDeaths.load());
+    dw.println("Events queued: %zu", mPending.load());
+    dw.println("Events delivered: %" PRIu64 " in %" PRIu64 " batches", mEventsDelivered.load(),
+               mBatchesDelivered.load());
+    dw.println("Events dropped: %" PRIu64 " because the queue was full, %" PRIu64
+               " because there was no listener", mDroppedRingFull.load(),
+               mDroppedNoListener.load());
+    dw.decIndent();
+
+    dw.decIndent();
 }
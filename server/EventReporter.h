@@ -19,34 +19,127 @@
 
 #include <atomic>
 #include <binder/IServiceManager.h>
+#include <chrono>
+#include <condition_variable>
 #include <mutex>
+#include <thread>
+#include <vector>
 
 #include "android/net/metrics/INetdEventListener.h"
+#include "DumpWriter.h"
+#include "EventRing.h"
+#include "SnapshotPublisher.h"
 
 /*
  * This class stores the reporting level and can be used to get the event listener service.
+ *
+ * DNS and connect events are not sent to the listener by the threads that report them. They are
+ * queued in lock-free rings and delivered in batches by a reporter thread, so that reporting an
+ * event never waits for a binder transaction. Events are dropped if the rings fill up faster than
+ * the reporter thread can deliver them.
  */
 class EventReporter {
 public:
+    struct DnsEvent {
+        int32_t netId;
+        int32_t eventType;
+        int32_t returnCode;
+        int32_t latencyMs;
+        android::String16 hostname;
+        std::vector<android::String16> ipAddresses;
+        int32_t ipAddressesCount;
+        int32_t uid;
+    };
+
+    struct ConnectEvent {
+        int32_t netId;
+        int32_t error;
+        int32_t latencyMs;
+        android::String16 ipAddr;
+        int32_t port;
+        int32_t uid;
+    };
+
+    EventReporter();
+    ~EventReporter();
+
     int setMetricsReportingLevel(const int level);
     int getMetricsReportingLevel() const;
 
     // Returns the binder reference to the netd events listener service, attempting to fetch it if
-    // we do not have it already. This method is threadsafe.
+    // we do not have it already. This method is threadsafe, and does not take any locks unless it
+    // has to fetch the listener.
     android::sp<android::net::metrics::INetdEventListener> getNetdEventListener();
 
+    // Queue an event for delivery to the listener. These methods never block.
+    void reportDnsEvent(DnsEvent&& event);
+    void reportConnectEvent(ConnectEvent&& event);
+
+    void dump(android::net::DumpWriter& dw);
+
+    // For testing.
+    void setNetdEventListener(const android::sp<android::net::metrics::INetdEventListener>& l);
+
 private:
+    // Must be powers of two.
+    static constexpr size_t kDnsRingSize = 512;
+    static constexpr size_t kConnectRingSize = 512;
+    // The most events sent to the listener in one binder call.
+    static constexpr size_t kMaxBatchSize = 100;
+    // How long the reporter thread waits for more events after the first one of a batch.
+    static constexpr std::chrono::milliseconds kBatchDelay{100};
+
+    class ListenerDeathRecipient;
+
+    android::sp<android::net::metrics::INetdEventListener> fetchNetdEventListener();
+    bool publishNetdEventListener(
+            const android::sp<android::net::metrics::INetdEventListener>& listener);
+    void onNetdEventListenerDied(const android::wp<android::IBinder>& who);
+
+    void wakeReporterThread(size_t pending);
+    void startReporterThread();
+    void reporterLoop();
+    void deliverQueuedEvents();
+    size_t deliverDnsEvents(const android::sp<android::net::metrics::INetdEventListener>& l);
+    size_t deliverConnectEvents(const android::sp<android::net::metrics::INetdEventListener>& l);
+
     std::atomic_int mReportingLevel{
             android::net::metrics::INetdEventListener::REPORTING_LEVEL_FULL};
-    // TODO: consider changing this into an atomic type such as
-    // std::atomic<android::net::metrics::INetdEventListener> and deleting the mutex.
-    //
-    // Alternatively, if this locking causes a performance penalty, have each single-threaded
-    // caller (DnsProxyListener, FwmarkServer) keep their own per-thread copy of NetdEventListener
-    // and remove mNetdEventListener entirely.
-    android::sp<android::net::metrics::INetdEventListener> mNetdEventListener;
-    std::mutex mutex;
 
+    // The listener that getNetdEventListener() returns, or null if it has died. Readers take their
+    // own reference to it without a lock. Published under mListenersLock.
+    android::net::SnapshotPublisher<android::sp<android::net::metrics::INetdEventListener>>
+            mNetdEventListener;
+    std::mutex mListenersLock;
+    // The listener that mDeathRecipient is linked to.
+    android::sp<android::net::metrics::INetdEventListener> mListener;  // GUARDED_BY(mListenersLock)
+    android::sp<android::IBinder::DeathRecipient> mDeathRecipient;
+
+    // While there is no listener, fetches are spaced out by exponentially increasing delays, so
+    // that reporting events does not make a binder call each time.
+    static constexpr std::chrono::milliseconds kMinFetchBackoff{100};
+    static constexpr std::chrono::milliseconds kMaxFetchBackoff{10000};
+    std::atomic_flag mFetching = ATOMIC_FLAG_INIT;
+    std::atomic<int64_t> mNextFetchMs{0};
+    std::chrono::milliseconds mFetchBackoff{kMinFetchBackoff};  // GUARDED_BY(mFetching)
+    std::atomic<uint64_t> mListenerFetches{0};
+    std::atomic<uint64_t> mListenerDeaths{0};
+
+    android::net::EventRing<DnsEvent> mDnsEvents{kDnsRingSize};
+    android::net::EventRing<ConnectEvent> mConnectEvents{kConnectRingSize};
+
+    // Number of events in the rings. The reporter thread sleeps while it is zero.
+    std::atomic<size_t> mPending{0};
+    std::once_flag mStartOnce;
+    std::thread mReporterThread;
+    std::mutex mWakeLock;
+    std::condition_variable mWakeCondition;
+    bool mStopping = false;  // GUARDED_BY(mWakeLock)
+
+    std::atomic<uint64_t> mEventsDelivered{0};
+    std::atomic<uint64_t> mBatchesDelivered{0};
+    std::atomic<uint64_t> mDroppedRingFull{0};
+    std::atomic<uint64_t> mDroppedNoListener{0};
 };
 
 #endif  // NETD_SERVER_EVENT_REPORTER_H
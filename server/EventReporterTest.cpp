@@ -0,0 +1,204 @@
+/*
+ * Copyright 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * EventReporterTest.cpp - unit tests for EventReporter.cpp
+ */
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "EventReporter.h"
+#include "android/net/metrics/BnNetdEventListener.h"
+
+using android::sp;
+using android::String16;
+using android::binder::Status;
+using android::net::metrics::BnNetdEventListener;
+using android::net::metrics::INetdEventListener;
+
+namespace {
+
+// Records the batches it receives.
+class FakeNetdEventListener : public BnNetdEventListener {
+public:
+    Status onDnsEvent(int32_t, int32_t, int32_t, int32_t, const String16&,
+                      const std::vector<String16>&, int32_t, int32_t) override {
+        ADD_FAILURE() << "Unexpected unbatched DNS event";
+        return Status::ok();
+    }
+
+    Status onConnectEvent(int32_t, int32_t, int32_t, const String16&, int32_t,
+                          int32_t) override {
+        ADD_FAILURE() << "Unexpected unbatched connect event";
+        return Status::ok();
+    }
+
+    Status onWakeupEvent(const String16&, int32_t, int32_t, int64_t) override {
+        return Status::ok();
+    }
+
+    Status onDnsEvents(const std::vector<int32_t>& netIds, const std::vector<int32_t>& eventTypes,
+                       const std::vector<int32_t>& returnCodes,
+                       const std::vector<int32_t>& latenciesMs,
+                       const std::vector<String16>& hostnames,
+                       const std::vector<String16>& ipAddresses,
+                       const std::vector<int32_t>& ipAddressesLengths,
+                       const std::vector<int32_t>& ipAddressesCounts,
+                       const std::vector<int32_t>& uids) override {
+        const size_t count = netIds.size();
+        EXPECT_EQ(count, eventTypes.size());
+        EXPECT_EQ(count, returnCodes.size());
+        EXPECT_EQ(count, hostnames.size());
+        EXPECT_EQ(count, ipAddressesLengths.size());
+        EXPECT_EQ(count, ipAddressesCounts.size());
+        EXPECT_EQ(count, uids.size());
+
+        std::lock_guard<std::mutex> guard(mLock);
+        size_t offset = 0;
+        for (size_t i = 0; i < count; i++) {
+            // Each lookup reports its latency as its sequence number.
+            EXPECT_EQ(static_cast<int32_t>(mDnsEvents), latenciesMs[i]);
+            EXPECT_EQ(String16("example.com"), hostnames[i]);
+            EXPECT_EQ(2, ipAddressesLengths[i]);
+            EXPECT_EQ(String16("192.0.2.1"), ipAddresses[offset]);
+            EXPECT_EQ(String16("2001:db8::1"), ipAddresses[offset + 1]);
+            offset += ipAddressesLengths[i];
+            mDnsEvents++;
+        }
+        EXPECT_EQ(offset, ipAddresses.size());
+        mDnsBatches++;
+        mCv.notify_all();
+        return Status::ok();
+    }
+
+    Status onConnectEvents(const std::vector<int32_t>& netIds, const std::vector<int32_t>&,
+                           const std::vector<int32_t>&, const std::vector<String16>& ipAddrs,
+                           const std::vector<int32_t>& ports,
+                           const std::vector<int32_t>&) override {
+        EXPECT_EQ(netIds.size(), ipAddrs.size());
+        EXPECT_EQ(netIds.size(), ports.size());
+
+        std::lock_guard<std::mutex> guard(mLock);
+        mConnectEvents += netIds.size();
+        mCv.notify_all();
+        return Status::ok();
+    }
+
+    // Waits until at least the given numbers of events have arrived.
+    bool waitForEvents(size_t dnsEvents, size_t connectEvents) {
+        std::unique_lock<std::mutex> lock(mLock);
+        return mCv.wait_for(lock, std::chrono::seconds(5), [&] {
+            return mDnsEvents >= dnsEvents && mConnectEvents >= connectEvents;
+        });
+    }
+
+    size_t dnsBatches() {
+        std::lock_guard<std::mutex> guard(mLock);
+        return mDnsBatches;
+    }
+
+private:
+    std::mutex mLock;
+    std::condition_variable mCv;
+    size_t mDnsEvents = 0;
+    size_t mDnsBatches = 0;
+    size_t mConnectEvents = 0;
+};
+
+}  // namespace
+
+TEST(EventReporterTest, DeliversEventsInBatches) {
+    constexpr int kNumDnsEvents = 250;
+    EventReporter reporter;
+    sp<FakeNetdEventListener> listener = new FakeNetdEventListener();
+    reporter.setNetdEventListener(listener);
+
+    for (int i = 0; i < kNumDnsEvents; i++) {
+        reporter.reportDnsEvent({
+                100, INetdEventListener::EVENT_GETADDRINFO, 0, i, String16("example.com"),
+                { String16("192.0.2.1"), String16("2001:db8::1") }, 2, 10000 });
+    }
+    reporter.reportConnectEvent({ 100, 0, 1, String16("192.0.2.1"), 443, 10000 });
+
+    ASSERT_TRUE(listener->waitForEvents(kNumDnsEvents, 1));
+    // No more than 100 events per batch, but far fewer batches than events.
+    EXPECT_LE(3U, listener->dnsBatches());
+    EXPECT_GT(static_cast<size_t>(kNumDnsEvents / 10), listener->dnsBatches());
+}
+
+TEST(EventReporterTest, ListenerCanBeReplacedWhileInUse) {
+    EventReporter reporter;
+    std::vector<sp<FakeNetdEventListener>> listeners;
+    for (int i = 0; i < 4; i++) {
+        listeners.push_back(new FakeNetdEventListener());
+    }
+    reporter.setNetdEventListener(listeners[0]);
+
+    std::atomic_bool stop(false);
+    std::vector<std::thread> readers;
+    for (int i = 0; i < 4; i++) {
+        readers.emplace_back([&] {
+            while (!stop) {
+                sp<INetdEventListener> listener = reporter.getNetdEventListener();
+                EXPECT_NE(nullptr, listener.get());
+                listener->onWakeupEvent(String16("iface"), 1000, 1000, 0);
+            }
+        });
+    }
+    for (int i = 0; i < 1000; i++) {
+        reporter.setNetdEventListener(listeners[i % listeners.size()]);
+    }
+    stop = true;
+    for (auto& reader : readers) {
+        reader.join();
+    }
+    EXPECT_EQ(listeners.back().get(), reporter.getNetdEventListener().get());
+}
+
+TEST(EventReporterTest, ReleasesReplacedListeners) {
+    EventReporter reporter;
+    sp<FakeNetdEventListener> first = new FakeNetdEventListener();
+    android::wp<FakeNetdEventListener> weakFirst = first;
+    reporter.setNetdEventListener(first);
+    first.clear();
+    EXPECT_NE(nullptr, weakFirst.promote().get());
+
+    std::atomic_bool stop(false);
+    std::vector<std::thread> readers;
+    for (int i = 0; i < 4; i++) {
+        readers.emplace_back([&] {
+            while (!stop) {
+                sp<INetdEventListener> listener = reporter.getNetdEventListener();
+                EXPECT_NE(nullptr, listener.get());
+                listener->onWakeupEvent(String16("iface"), 1000, 1000, 0);
+            }
+        });
+    }
+    // Each listener is released as soon as it is replaced, while the readers are still using them.
+    for (int i = 0; i < 1000; i++) {
+        reporter.setNetdEventListener(new FakeNetdEventListener());
+    }
+    stop = true;
+    for (auto& reader : readers) {
+        reader.join();
+    }
+    EXPECT_EQ(nullptr, weakFirst.promote().get());
+}
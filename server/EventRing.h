@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NETD_SERVER_EVENT_RING_H
+#define NETD_SERVER_EVENT_RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <memory>
+
+namespace android {
+namespace net {
+
+/*
+ * A fixed-size, lock-free queue that any number of threads can push to and pop from.
+ *
+ * Each slot carries a sequence number that tells whether it is ready to be written or read in the
+ * current lap around the ring, so pushing and popping only take one compare-and-swap each, and
+ * never wait for each other. Pushing to a full ring fails instead of blocking, which lets hot paths
+ * drop events rather than wait for a slow consumer.
+ */
+template <typename T>
+class EventRing {
+public:
+    // |capacity| must be a power of two.
+    explicit EventRing(size_t capacity) : mMask(capacity - 1), mSlots(new Slot[capacity]) {
+        for (size_t i = 0; i < capacity; i++) {
+            mSlots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    EventRing(const EventRing&) = delete;
+    EventRing& operator=(const EventRing&) = delete;
+
+    // Moves |item| into the ring. Returns false if the ring is full.
+    bool tryPush(T&& item) {
+        Slot* slot;
+        size_t pos = mHead.load(std::memory_order_relaxed);
+        for (;;) {
+            slot = &mSlots[pos & mMask];
+            const size_t sequence = slot->sequence.load(std::memory_order_acquire);
+            const intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+            if (diff == 0) {
+                if (mHead.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = mHead.load(std::memory_order_relaxed);
+            }
+        }
+        slot->item = std::move(item);
+        slot->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Moves the oldest item out of the ring into |item|. Returns false if the ring is empty.
+    bool tryPop(T* item) {
+        Slot* slot;
+        size_t pos = mTail.load(std::memory_order_relaxed);
+        for (;;) {
+            slot = &mSlots[pos & mMask];
+            const size_t sequence = slot->sequence.load(std::memory_order_acquire);
+            const intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos + 1);
+            if (diff == 0) {
+                if (mTail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = mTail.load(std::memory_order_relaxed);
+            }
+        }
+        *item = std::move(slot->item);
+        slot->item = T();
+        slot->sequence.store(pos + mMask + 1, std::memory_order_release);
+        return true;
+    }
+
+    size_t capacity() const { return mMask + 1; }
+
+private:
+    struct Slot {
+        std::atomic<size_t> sequence;
+        T item;
+    };
+
+    const size_t mMask;
+    const std::unique_ptr<Slot[]> mSlots;
+    // Producers and the consumer each write one of these, so keep them on separate cache lines.
+    alignas(64) std::atomic<size_t> mHead{0};
+    alignas(64) std::atomic<size_t> mTail{0};
+};
+
+}  // namespace net
+}  // namespace android
+
+#endif  // NETD_SERVER_EVENT_RING_H
@@ -0,0 +1,89 @@
+/*
+ * Copyright 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * EventRingTest.cpp - unit tests for EventRing.h
+ */
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "EventRing.h"
+
+namespace android {
+namespace net {
+
+TEST(EventRingTest, PopsInOrderAndRejectsWhenFull) {
+    EventRing<std::string> ring(4);
+    EXPECT_EQ(4U, ring.capacity());
+
+    std::string item;
+    EXPECT_FALSE(ring.tryPop(&item));
+
+    // Go around the ring a few times.
+    for (int lap = 0; lap < 3; lap++) {
+        for (int i = 0; i < 4; i++) {
+            EXPECT_TRUE(ring.tryPush(std::to_string(lap * 10 + i)));
+        }
+        EXPECT_FALSE(ring.tryPush("full"));
+
+        for (int i = 0; i < 4; i++) {
+            ASSERT_TRUE(ring.tryPop(&item));
+            EXPECT_EQ(std::to_string(lap * 10 + i), item);
+        }
+        EXPECT_FALSE(ring.tryPop(&item));
+    }
+}
+
+TEST(EventRingTest, ConcurrentProducers) {
+    constexpr int kProducers = 4;
+    constexpr int kItemsPerProducer = 20000;
+    EventRing<int> ring(64);
+
+    std::vector<std::thread> producers;
+    for (int p = 0; p < kProducers; p++) {
+        producers.emplace_back([&ring, p] {
+            for (int i = 0; i < kItemsPerProducer; i++) {
+                int item = p * kItemsPerProducer + i;
+                while (!ring.tryPush(std::move(item))) {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+
+    // Every item arrives exactly once, and the items of each producer arrive in order.
+    std::vector<int> next(kProducers, 0);
+    int item;
+    for (int received = 0; received < kProducers * kItemsPerProducer;) {
+        if (!ring.tryPop(&item)) {
+            std::this_thread::yield();
+            continue;
+        }
+        const int p = item / kItemsPerProducer;
+        ASSERT_EQ(next[p], item % kItemsPerProducer);
+        next[p]++;
+        received++;
+    }
+    for (auto& producer : producers) {
+        producer.join();
+    }
+    EXPECT_FALSE(ring.tryPop(&item));
+}
+
+}  // namespace net
+}  // namespace android
@@ -29,6 +29,7 @@
 #include "FirewallController.h"
 
 using android::base::StringAppendF;
+using android::base::StringPrintf;
 
 auto FirewallController::execIptables = ::execIptables;
 auto FirewallController::execIptablesSilently = ::execIptablesSilently;
@@ -228,22 +229,23 @@ FirewallType FirewallController::getFirewallType(ChildChain chain) {
     }
 }
 
-int FirewallController::setUidRule(ChildChain chain, int uid, FirewallRule rule) {
+int FirewallController::appendUidRuleCommands(std::string* commands,
+                                              const FirewallUidRule& rule) {
     const char* op;
     const char* target;
-    FirewallType firewallType = getFirewallType(chain);
+    FirewallType firewallType = getFirewallType(rule.chain);
     if (firewallType == WHITELIST) {
         target = "RETURN";
         // When adding, insert RETURN rules at the front, before the catch-all DROP at the end.
-        op = (rule == ALLOW)? "-I" : "-D";
+        op = (rule.rule == ALLOW)? "-I" : "-D";
     } else { // BLACKLIST mode
         target = "DROP";
         // When adding, append DROP rules at the end, after the RETURN rule that matches TCP RSTs.
-        op = (rule == DENY)? "-A" : "-D";
+        op = (rule.rule == DENY)? "-A" : "-D";
     }
 
     std::vector<std::string> chainNames;
-    switch(chain) {
+    switch(rule.chain) {
         case DOZABLE:
             chainNames = { LOCAL_DOZABLE };
             break;
@@ -257,18 +259,73 @@ int FirewallController::setUidRule(ChildChain chain, int uid, FirewallRule rule)
             chainNames = { LOCAL_INPUT, LOCAL_OUTPUT };
             break;
         default:
-            ALOGW("Unknown child chain: %d", chain);
+            ALOGW("Unknown child chain: %d", rule.chain);
             return -1;
     }
 
-    std::string command = "*filter\n";
     for (std::string chainName : chainNames) {
-        StringAppendF(&command, "%s %s -m owner --uid-owner %d -j %s\n",
-                      op, chainName.c_str(), uid, target);
+        StringAppendF(commands, "%s %s -m owner --uid-owner %d -j %s\n",
+                      op, chainName.c_str(), rule.uid, target);
+    }
+    return 0;
+}
+
+int FirewallController::setUidRule(ChildChain chain, int uid, FirewallRule rule) {
+    std::string command = "*filter\n";
+    if (appendUidRuleCommands(&command, { chain, uid, rule })) {
+        return -1;
     }
     StringAppendF(&command, "COMMIT\n");
 
-    return execIptablesRestore(V4V6, command);
+    int res = execIptablesRestore(V4V6, command);
+    if (res) {
+        mMirror.invalidateCommands(V4V6, command);
+    } else {
+        mMirror.applyCommands(V4V6, command);
+    }
+    return res;
+}
+
+int FirewallController::setUidRules(const std::vector<FirewallUidRule>& rules) {
+    if (rules.empty()) {
+        return 0;
+    }
+
+    // Undoing a rule change is applying the opposite rule: re-adding a deleted RETURN rule inserts
+    // it at the front and re-adding a deleted DROP rule appends it, which is where they belong.
+    std::string commands = "*filter\n";
+    std::string undoCommands = "*filter\n";
+    for (auto it = rules.rbegin(); it != rules.rend(); ++it) {
+        const FirewallUidRule undo = { it->chain, it->uid, (it->rule == ALLOW) ? DENY : ALLOW };
+        if (appendUidRuleCommands(&undoCommands, undo)) {
+            return -1;
+        }
+    }
+    for (const FirewallUidRule& rule : rules) {
+        appendUidRuleCommands(&commands, rule);
+    }
+    StringAppendF(&commands, "COMMIT\n");
+    StringAppendF(&undoCommands, "COMMIT\n");
+
+    // A failed transaction changes nothing, so only a failure after the IPv4 transaction has been
+    // committed needs to be undone.
+    int res = execIptablesRestore(V4, commands);
+    if (res) {
+        return res;
+    }
+    mMirror.applyCommands(V4, commands);
+    res = execIptablesRestore(V6, commands);
+    if (res) {
+        if (execIptablesRestore(V4, undoCommands)) {
+            ALOGE("Failed to undo %zu IPv4 UID rules after IPv6 failure", rules.size());
+            mMirror.invalidateCommands(V4, undoCommands);
+        } else {
+            mMirror.applyCommands(V4, undoCommands);
+        }
+        return res;
+    }
+    mMirror.applyCommands(V6, commands);
+    return 0;
 }
 
 int FirewallController::createChain(const char* chain, FirewallType type) {
@@ -276,36 +333,34 @@ int FirewallController::createChain(const char* chain, FirewallType type) {
     return replaceUidChain(chain, type == WHITELIST, NO_UIDS);
 }
 
-std::string FirewallController::makeUidRules(IptablesTarget target, const char *name,
+std::vector<std::string> FirewallController::makeUidRuleList(IptablesTarget target,
         bool isWhitelist, const std::vector<int32_t>& uids) {
-    std::string commands;
-    StringAppendF(&commands, "*filter\n:%s -\n", name);
+    std::vector<std::string> rules;
 
     // Whitelist chains have UIDs at the beginning, and new UIDs are added with '-I'.
     if (isWhitelist) {
         for (auto uid : uids) {
-            StringAppendF(&commands, "-A %s -m owner --uid-owner %d -j RETURN\n", name, uid);
+            rules.push_back(StringPrintf("-m owner --uid-owner %d -j RETURN", uid));
         }
 
         // Always whitelist system UIDs.
-        StringAppendF(&commands,
-                "-A %s -m owner --uid-owner %d-%d -j RETURN\n", name, 0, MAX_SYSTEM_UID);
+        rules.push_back(StringPrintf("-m owner --uid-owner %d-%d -j RETURN", 0, MAX_SYSTEM_UID));
     }
 
     // Always allow networking on loopback.
-    StringAppendF(&commands, "-A %s -i lo -j RETURN\n", name);
-    StringAppendF(&commands, "-A %s -o lo -j RETURN\n", name);
+    rules.push_back("-i lo -j RETURN");
+    rules.push_back("-o lo -j RETURN");
 
     // Allow TCP RSTs so we can cleanly close TCP connections of apps that no longer have network
     // access. Both incoming and outgoing RSTs are allowed.
-    StringAppendF(&commands, "-A %s -p tcp --tcp-flags RST RST -j RETURN\n", name);
+    rules.push_back("-p tcp --tcp-flags RST RST -j RETURN");
 
     if (isWhitelist) {
         // Allow ICMPv6 packets necessary to make IPv6 connectivity work. http://b/23158230 .
         if (target == V6) {
             for (size_t i = 0; i < ARRAY_SIZE(ICMPV6_TYPES); i++) {
-                StringAppendF(&commands, "-A %s -p icmpv6 --icmpv6-type %s -j RETURN\n",
-                       name, ICMPV6_TYPES[i]);
+                rules.push_back(StringPrintf("-p icmpv6 --icmpv6-type %s -j RETURN",
+                        ICMPV6_TYPES[i]));
             }
         }
     }
@@ -313,16 +368,26 @@ std::string FirewallController::makeUidRules(IptablesTarget target, const char *
     // Blacklist chains have UIDs at the end, and new UIDs are added with '-A'.
     if (!isWhitelist) {
         for (auto uid : uids) {
-            StringAppendF(&commands, "-A %s -m owner --uid-owner %d -j DROP\n", name, uid);
+            rules.push_back(StringPrintf("-m owner --uid-owner %d -j DROP", uid));
         }
     }
 
     // If it's a whitelist chain, add a default DROP at the end. This is not necessary for a
     // blacklist chain, because all user-defined chains implicitly RETURN at the end.
     if (isWhitelist) {
-        StringAppendF(&commands, "-A %s -j DROP\n", name);
+        rules.push_back("-j DROP");
     }
 
+    return rules;
+}
+
+std::string FirewallController::makeUidRules(IptablesTarget target, const char *name,
+        bool isWhitelist, const std::vector<int32_t>& uids) {
+    std::string commands;
+    StringAppendF(&commands, "*filter\n:%s -\n", name);
+    for (const auto& rule : makeUidRuleList(target, isWhitelist, uids)) {
+        StringAppendF(&commands, "-A %s %s\n", name, rule.c_str());
+    }
     StringAppendF(&commands, "COMMIT\n");
 
     return commands;
@@ -330,7 +395,35 @@ std::string FirewallController::makeUidRules(IptablesTarget target, const char *
 
 int FirewallController::replaceUidChain(
         const char *name, bool isWhitelist, const std::vector<int32_t>& uids) {
-   std::string commands4 = makeUidRules(V4, name, isWhitelist, uids);
-   std::string commands6 = makeUidRules(V6, name, isWhitelist, uids);
-   return execIptablesRestore(V4, commands4.c_str()) | execIptablesRestore(V6, commands6.c_str());
+    int res = 0;
+    for (IptablesTarget target : { V4, V6 }) {
+        const std::vector<std::string> rules = makeUidRuleList(target, isWhitelist, uids);
+        const std::string commands = mMirror.makeReplaceCommands(target, TABLE, name, rules);
+        if (commands.empty()) {
+            continue;
+        }
+        if (int ret = execIptablesRestore(target, commands)) {
+            mMirror.invalidateChain(target, TABLE, name);
+            res |= ret;
+        } else {
+            mMirror.commitChain(target, TABLE, name, rules);
+        }
+    }
+    return res;
+}
+
+void FirewallController::dump(android::net::DumpWriter& dw) {
+    android::RWLock::AutoRLock guard(lock);
+
+    dw.incIndent();
+    dw.println("FirewallController");
+
+    dw.incIndent();
+    dw.println("UID chains:");
+    dw.incIndent();
+    mMirror.dump(dw);
+    dw.decIndent();
+    dw.decIndent();
+
+    dw.decIndent();
 }
@@ -22,6 +22,8 @@
 
 #include <utils/RWLock.h>
 
+#include "DumpWriter.h"
+#include "IptablesMirror.h"
 #include "NetdConstants.h"
 
 enum FirewallRule { DENY, ALLOW };
@@ -36,6 +38,13 @@ enum ChildChain { NONE, DOZABLE, STANDBY, POWERSAVE, INVALID_CHAIN };
 #define PROTOCOL_TCP 6
 #define PROTOCOL_UDP 17
 
+// A change to the rule for one UID in one chain, as made by FirewallController::setUidRule().
+struct FirewallUidRule {
+    ChildChain chain;
+    int uid;
+    FirewallRule rule;
+};
+
 /*
  * Simple firewall that drops all packets except those matching explicitly
  * defined ALLOW rules.
@@ -62,11 +71,19 @@ public:
     int setEgressDestRule(const char*, int, int, FirewallRule);
     /* Match traffic owned by given UID. This is specific to a particular chain. */
     int setUidRule(ChildChain, int, FirewallRule);
+    /*
+     * Applies all of |rules|, in order, as one iptables-restore transaction per IP version. Either
+     * all the rules are applied, or none are: if the IPv6 transaction fails after the IPv4 one
+     * succeeded, the IPv4 changes are undone.
+     */
+    int setUidRules(const std::vector<FirewallUidRule>& rules);
 
     int enableChildChains(ChildChain, bool);
 
     int replaceUidChain(const char*, bool, const std::vector<int32_t>&);
 
+    void dump(android::net::DumpWriter& dw);
+
     static const char* TABLE;
 
     static const char* LOCAL_INPUT;
@@ -85,16 +102,22 @@ protected:
     friend class FirewallControllerTest;
     std::string makeUidRules(IptablesTarget target, const char *name, bool isWhitelist,
                              const std::vector<int32_t>& uids);
+    std::vector<std::string> makeUidRuleList(IptablesTarget target, bool isWhitelist,
+                                             const std::vector<int32_t>& uids);
     static int (*execIptables)(IptablesTarget target, ...);
     static int (*execIptablesSilently)(IptablesTarget target, ...);
     static int (*execIptablesRestore)(IptablesTarget target, const std::string& commands);
 
 private:
     FirewallType mFirewallType;
+    // The UID chains as last programmed, so that replacing one only sends the rules that change.
+    IptablesMirror mMirror;
     int attachChain(const char*, const char*);
     int detachChain(const char*, const char*);
     int createChain(const char*, FirewallType);
     FirewallType getFirewallType(ChildChain);
+    // Appends the iptables-restore lines that implement |rule| to |commands|.
+    int appendUidRuleCommands(std::string* commands, const FirewallUidRule& rule);
 };
 
 #endif
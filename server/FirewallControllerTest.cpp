@@ -16,6 +16,7 @@
  * FirewallControllerTest.cpp - unit tests for FirewallController.cpp
  */
 
+#include <set>
 #include <string>
 #include <vector>
 #include <stdio.h>
@@ -33,10 +34,20 @@ protected:
     FirewallControllerTest() {
         FirewallController::execIptables = fakeExecIptables;
         FirewallController::execIptablesSilently = fakeExecIptables;
-        FirewallController::execIptablesRestore = fakeExecIptablesRestore;
+        FirewallController::execIptablesRestore = fakeExecIptablesRestoreWithFailures;
+        sRestoreFailures.clear();
     }
     FirewallController mFw;
 
+    // Targets whose next iptables-restore call fails.
+    static std::set<IptablesTarget> sRestoreFailures;
+
+    static int fakeExecIptablesRestoreWithFailures(IptablesTarget target,
+                                                   const std::string& commands) {
+        fakeExecIptablesRestore(target, commands);
+        return sRestoreFailures.erase(target) ? -1 : 0;
+    }
+
     std::string makeUidRules(IptablesTarget a, const char* b, bool c,
                              const std::vector<int32_t>& d) {
         return mFw.makeUidRules(a, b, c, d);
@@ -48,6 +59,8 @@ protected:
 };
 
 
+std::set<IptablesTarget> FirewallControllerTest::sRestoreFailures;
+
 TEST_F(FirewallControllerTest, TestCreateWhitelistChain) {
     std::vector<std::string> expectedRestore4 = {
         "*filter",
@@ -150,6 +163,71 @@ TEST_F(FirewallControllerTest, TestSetFirewallRule) {
     expectIptablesRestoreCommands(expected);
 }
 
+TEST_F(FirewallControllerTest, TestSetUidRules) {
+    const std::string commands =
+            "*filter\n"
+            "-I fw_dozable -m owner --uid-owner 10001 -j RETURN\n"
+            "-A fw_standby -m owner --uid-owner 10002 -j DROP\n"
+            "-D fw_INPUT -m owner --uid-owner 10003 -j DROP\n"
+            "-D fw_OUTPUT -m owner --uid-owner 10003 -j DROP\n"
+            "COMMIT\n";
+    const std::vector<FirewallUidRule> rules = {
+        { DOZABLE, 10001, ALLOW },
+        { STANDBY, 10002, DENY },
+        { NONE, 10003, ALLOW },
+    };
+
+    ExpectedIptablesCommands expected = {
+        { V4, commands },
+        { V6, commands },
+    };
+    EXPECT_EQ(0, mFw.setUidRules(rules));
+    expectIptablesRestoreCommands(expected);
+
+    // Nothing to do.
+    EXPECT_EQ(0, mFw.setUidRules({}));
+    expectIptablesRestoreCommands(ExpectedIptablesCommands{});
+
+    // An unknown chain fails the whole batch before anything is applied.
+    EXPECT_EQ(-1, mFw.setUidRules({ { DOZABLE, 10001, ALLOW }, { INVALID_CHAIN, 10002, DENY } }));
+    expectIptablesRestoreCommands(ExpectedIptablesCommands{});
+}
+
+TEST_F(FirewallControllerTest, TestSetUidRulesFailure) {
+    const std::vector<FirewallUidRule> rules = {
+        { DOZABLE, 10001, ALLOW },
+        { STANDBY, 10002, ALLOW },
+    };
+    const std::string commands =
+            "*filter\n"
+            "-I fw_dozable -m owner --uid-owner 10001 -j RETURN\n"
+            "-D fw_standby -m owner --uid-owner 10002 -j DROP\n"
+            "COMMIT\n";
+    const std::string undoCommands =
+            "*filter\n"
+            "-A fw_standby -m owner --uid-owner 10002 -j DROP\n"
+            "-D fw_dozable -m owner --uid-owner 10001 -j RETURN\n"
+            "COMMIT\n";
+
+    // If IPv4 fails, IPv6 is not touched.
+    sRestoreFailures = { V4 };
+    ExpectedIptablesCommands expected = {
+        { V4, commands },
+    };
+    EXPECT_EQ(-1, mFw.setUidRules(rules));
+    expectIptablesRestoreCommands(expected);
+
+    // If IPv6 fails, the IPv4 changes are undone in reverse order.
+    sRestoreFailures = { V6 };
+    expected = {
+        { V4, commands },
+        { V6, commands },
+        { V4, undoCommands },
+    };
+    EXPECT_EQ(-1, mFw.setUidRules(rules));
+    expectIptablesRestoreCommands(expected);
+}
+
 TEST_F(FirewallControllerTest, TestReplaceWhitelistUidRule) {
     std::string expected =
             "*filter\n"
@@ -194,6 +272,71 @@ TEST_F(FirewallControllerTest, TestReplaceBlacklistUidRule) {
     EXPECT_EQ(expected, makeUidRules(V4 ,"FW_blackchain", false, uids));
 }
 
+TEST_F(FirewallControllerTest, TestReplaceUidChainSendsDiff) {
+    const std::string rebuild =
+            "*filter\n"
+            ":fw_standby -\n"
+            "-A fw_standby -i lo -j RETURN\n"
+            "-A fw_standby -o lo -j RETURN\n"
+            "-A fw_standby -p tcp --tcp-flags RST RST -j RETURN\n"
+            "-A fw_standby -m owner --uid-owner 10023 -j DROP\n"
+            "COMMIT\n";
+    ExpectedIptablesCommands expected = {
+        { V4, rebuild },
+        { V6, rebuild },
+    };
+    EXPECT_EQ(0, mFw.replaceUidChain("fw_standby", false, { 10023 }));
+    expectIptablesRestoreCommands(expected);
+
+    // Rules set one UID at a time are taken into account.
+    EXPECT_EQ(0, mFw.setUidRule(STANDBY, 10059, DENY));
+    expectIptablesRestoreCommands({
+        "*filter\n-A fw_standby -m owner --uid-owner 10059 -j DROP\nCOMMIT\n"
+    });
+
+    const std::string diff =
+            "*filter\n"
+            "-D fw_standby -m owner --uid-owner 10023 -j DROP\n"
+            "COMMIT\n";
+    expected = {
+        { V4, diff },
+        { V6, diff },
+    };
+    EXPECT_EQ(0, mFw.replaceUidChain("fw_standby", false, { 10059 }));
+    expectIptablesRestoreCommands(expected);
+
+    // Nothing to do.
+    EXPECT_EQ(0, mFw.replaceUidChain("fw_standby", false, { 10059 }));
+    expectIptablesRestoreCommands(ExpectedIptablesCommands{});
+
+    // After a failure, the chain is rebuilt.
+    sRestoreFailures.insert(V6);
+    const std::string add =
+            "*filter\n"
+            "-A fw_standby -m owner --uid-owner 10124 -j DROP\n"
+            "COMMIT\n";
+    expected = {
+        { V4, add },
+        { V6, add },
+    };
+    EXPECT_NE(0, mFw.replaceUidChain("fw_standby", false, { 10059, 10124 }));
+    expectIptablesRestoreCommands(expected);
+
+    expected = {
+        { V6,
+            "*filter\n"
+            ":fw_standby -\n"
+            "-A fw_standby -i lo -j RETURN\n"
+            "-A fw_standby -o lo -j RETURN\n"
+            "-A fw_standby -p tcp --tcp-flags RST RST -j RETURN\n"
+            "-A fw_standby -m owner --uid-owner 10059 -j DROP\n"
+            "-A fw_standby -m owner --uid-owner 10124 -j DROP\n"
+            "COMMIT\n" },
+    };
+    EXPECT_EQ(0, mFw.replaceUidChain("fw_standby", false, { 10059, 10124 }));
+    expectIptablesRestoreCommands(expected);
+}
+
 TEST_F(FirewallControllerTest, TestEnableChildChains) {
     std::vector<std::string> expected = {
         "*filter\n"
@@ -39,15 +39,20 @@ FwmarkServer::FwmarkServer(NetworkController* networkController, EventReporter*
 }
 
 bool FwmarkServer::onDataAvailable(SocketClient* client) {
+    FwmarkCommand command = {FwmarkCommand::ON_ACCEPT, 0, 0};
     int socketFd = -1;
-    int error = processClient(client, &socketFd);
+    int error = processClient(client, &command, &socketFd);
     if (socketFd >= 0) {
         close(socketFd);
     }
 
-    // Always send a response even if there were connection errors or read errors, so that we don't
-    // inadvertently cause the client to hang (which always waits for a response).
-    client->sendData(&error, sizeof(error));
+    // ON_CONNECT_COMPLETE is sent oneway: the client closes the connection without waiting for a
+    // response, so writing one would only fail. Any other command gets a response, even if there
+    // were connection errors or read errors, so that we don't inadvertently cause the client to
+    // hang (which always waits for a response).
+    if (command.cmdId != FwmarkCommand::ON_CONNECT_COMPLETE) {
+        client->sendData(&error, sizeof(error));
+    }
 
     // Always close the client connection (by returning false). This prevents a DoS attack where
     // the client issues multiple commands on the same connection, never reading the responses,
@@ -55,12 +60,11 @@ bool FwmarkServer::onDataAvailable(SocketClient* client) {
     return false;
 }
 
-int FwmarkServer::processClient(SocketClient* client, int* socketFd) {
-    FwmarkCommand command;
+int FwmarkServer::processClient(SocketClient* client, FwmarkCommand* command, int* socketFd) {
     FwmarkConnectInfo connectInfo;
 
     iovec iov[2] = {
-        { &command, sizeof(command) },
+        { command, sizeof(*command) },
         { &connectInfo, sizeof(connectInfo) },
     };
     msghdr message;
@@ -82,19 +86,20 @@ int FwmarkServer::processClient(SocketClient* client, int* socketFd) {
         return -errno;
     }
 
-    if (!((command.cmdId != FwmarkCommand::ON_CONNECT_COMPLETE && messageLength == sizeof(command))
-            || (command.cmdId == FwmarkCommand::ON_CONNECT_COMPLETE
-            && messageLength == sizeof(command) + sizeof(connectInfo)))) {
+    if (!((command->cmdId != FwmarkCommand::ON_CONNECT_COMPLETE
+            && messageLength == sizeof(*command))
+            || (command->cmdId == FwmarkCommand::ON_CONNECT_COMPLETE
+            && messageLength == sizeof(*command) + sizeof(connectInfo)))) {
         return -EBADMSG;
     }
 
     Permission permission = mNetworkController->getPermissionForUser(client->getUid());
 
-    if (command.cmdId == FwmarkCommand::QUERY_USER_ACCESS) {
+    if (command->cmdId == FwmarkCommand::QUERY_USER_ACCESS) {
         if ((permission & PERMISSION_SYSTEM) != PERMISSION_SYSTEM) {
             return -EPERM;
         }
-        return mNetworkController->checkUserNetworkAccess(command.uid, command.netId);
+        return mNetworkController->checkUserNetworkAccess(command->uid, command->netId);
     }
 
     cmsghdr* const cmsgh = CMSG_FIRSTHDR(&message);
@@ -113,7 +118,7 @@ int FwmarkServer::processClient(SocketClient* client, int* socketFd) {
         return -errno;
     }
 
-    switch (command.cmdId) {
+    switch (command->cmdId) {
         case FwmarkCommand::ON_ACCEPT: {
             // Called after a socket accept(). The kernel would've marked the NetId and necessary
             // permissions bits, so we just add the rest of the user's permissions here.
@@ -178,33 +183,30 @@ int FwmarkServer::processClient(SocketClient* client, int* socketFd) {
                 break;
             }
 
-            android::sp<android::net::metrics::INetdEventListener> netdEventListener =
-                    mEventReporter->getNetdEventListener();
-
-            if (netdEventListener != nullptr) {
-                char addrstr[INET6_ADDRSTRLEN];
-                char portstr[sizeof("65536")];
-                const int ret = getnameinfo((sockaddr*) &connectInfo.addr, sizeof(connectInfo.addr),
-                        addrstr, sizeof(addrstr), portstr, sizeof(portstr),
-                        NI_NUMERICHOST | NI_NUMERICSERV);
-
-                netdEventListener->onConnectEvent(fwmark.netId, connectInfo.error,
-                        connectInfo.latencyMs,
-                        (ret == 0) ? String16(addrstr) : String16(""),
-                        (ret == 0) ? strtoul(portstr, NULL, 10) : 0, client->getUid());
-            }
+            // The event is delivered to the listener later, by the EventReporter thread.
+            char addrstr[INET6_ADDRSTRLEN];
+            char portstr[sizeof("65536")];
+            const int nameRet = getnameinfo((sockaddr*) &connectInfo.addr,
+                    sizeof(connectInfo.addr), addrstr, sizeof(addrstr), portstr, sizeof(portstr),
+                    NI_NUMERICHOST | NI_NUMERICSERV);
+
+            mEventReporter->reportConnectEvent({
+                    (int32_t) fwmark.netId, connectInfo.error, (int32_t) connectInfo.latencyMs,
+                    (nameRet == 0) ? String16(addrstr) : String16(""),
+                    (nameRet == 0) ? (int32_t) strtoul(portstr, NULL, 10) : 0,
+                    (int32_t) client->getUid() });
             break;
         }
 
         case FwmarkCommand::SELECT_NETWORK: {
-            fwmark.netId = command.netId;
-            if (command.netId == NETID_UNSET) {
+            fwmark.netId = command->netId;
+            if (command->netId == NETID_UNSET) {
                 fwmark.explicitlySelected = false;
                 fwmark.protectedFromVpn = false;
                 permission = PERMISSION_NONE;
             } else {
                 if (int ret = mNetworkController->checkUserNetworkAccess(client->getUid(),
-                                                                         command.netId)) {
+                                                                         command->netId)) {
                     return ret;
                 }
                 fwmark.explicitlySelected = true;
@@ -235,7 +237,7 @@ int FwmarkServer::processClient(SocketClient* client, int* socketFd) {
             if ((permission & PERMISSION_SYSTEM) != PERMISSION_SYSTEM) {
                 return -EPERM;
             }
-            fwmark.netId = mNetworkController->getNetworkForUser(command.uid);
+            fwmark.netId = mNetworkController->getNetworkForUser(command->uid);
             fwmark.protectedFromVpn = true;
             break;
         }
@@ -36,8 +36,9 @@ private:
     // Overridden from SocketListener:
     bool onDataAvailable(SocketClient* client);
 
+    // Reads a command into |command| and processes it.
     // Returns 0 on success or a negative errno value on failure.
-    int processClient(SocketClient* client, int* socketFd);
+    int processClient(SocketClient* client, FwmarkCommand* command, int* socketFd);
 
     NetworkController* const mNetworkController;
     EventReporter* mEventReporter;
@@ -18,12 +18,16 @@
 
 #include <stdint.h>
 
+#include <utils/RWLock.h>
+
 class IdletimerController {
 public:
 
     IdletimerController();
     virtual ~IdletimerController();
 
+    android::RWLock lock;
+
     int enableIdletimerControl();
     int disableIdletimerControl();
     int addInterfaceIdletimer(const char *iface, uint32_t timeout,
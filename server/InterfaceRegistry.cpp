@@ -0,0 +1,143 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <net/if.h>
+#include <string.h>
+
+#define LOG_TAG "Netd"
+#include "log/log.h"
+
+#include "InterfaceRegistry.h"
+
+namespace android {
+namespace net {
+
+InterfaceRegistry gInterfaceRegistry;
+
+unsigned (*InterfaceRegistry::ifNameToIndexFunction)(const char*) = if_nametoindex;
+
+int InterfaceRegistry::load() {
+    struct if_nameindex* interfaces = if_nameindex();
+    if (interfaces == nullptr) {
+        ALOGE("if_nameindex failed: %s", strerror(errno));
+        return -errno;
+    }
+    android::RWLock::AutoWLock lock(mLock);
+    for (const struct if_nameindex* i = interfaces; i->if_index != 0; i++) {
+        addLocked(i->if_name, i->if_index);
+    }
+    if_freenameindex(interfaces);
+    return 0;
+}
+
+unsigned InterfaceRegistry::getIndex(const std::string& name) {
+    {
+        android::RWLock::AutoRLock lock(mLock);
+        const auto it = mInterfaces.find(name);
+        if (it != mInterfaces.end()) {
+            mHits++;
+            return it->second;
+        }
+    }
+
+    // Either the interface does not exist, or we have not processed the event that says it does.
+    mMisses++;
+    const unsigned ifindex = ifNameToIndexFunction(name.c_str());
+    if (ifindex != 0) {
+        android::RWLock::AutoWLock lock(mLock);
+        addLocked(name, ifindex);
+    }
+    return ifindex;
+}
+
+std::string InterfaceRegistry::getName(unsigned ifindex) {
+    android::RWLock::AutoRLock lock(mLock);
+    const auto it = mNames.find(ifindex);
+    return (it != mNames.end()) ? it->second : "";
+}
+
+void InterfaceRegistry::onInterfaceAdded(const std::string& name, unsigned ifindex) {
+    android::RWLock::AutoWLock lock(mLock);
+    addLocked(name, ifindex);
+}
+
+void InterfaceRegistry::onInterfaceRemoved(const std::string& name, unsigned ifindex) {
+    android::RWLock::AutoWLock lock(mLock);
+    if (ifindex == 0) {
+        const auto it = mInterfaces.find(name);
+        if (it == mInterfaces.end()) return;
+        ifindex = it->second;
+    }
+    removeLocked(ifindex);
+}
+
+void InterfaceRegistry::addLocked(const std::string& name, unsigned ifindex) {
+    const auto nameIt = mNames.find(ifindex);
+    if (nameIt != mNames.end() && nameIt->second == name) {
+        return;
+    }
+    // The kernel gives each new interface a higher index than the ones before it. Events come in
+    // on more than one netlink socket, so an event about an older interface that has since been
+    // replaced by a newer one with the same name can arrive late. Ignore those. Any other event
+    // that gives an interface a new name is current: the interface was created, renamed (possibly
+    // back to a name it had before), or came back after it was removed.
+    const auto it = mInterfaces.find(name);
+    if (it != mInterfaces.end() && it->second > ifindex) {
+        return;
+    }
+
+    // If the interface was renamed, its old name no longer exists. If another interface had this
+    // name, it has been renamed or removed.
+    if (nameIt != mNames.end()) {
+        mInterfaces.erase(nameIt->second);
+    }
+    if (it != mInterfaces.end()) {
+        mNames.erase(it->second);
+    }
+    mInterfaces[name] = ifindex;
+    mNames[ifindex] = name;
+}
+
+// A late removal event can only remove an interface that still exists. That is harmless: the next
+// lookup of it misses and asks the kernel.
+void InterfaceRegistry::removeLocked(unsigned ifindex) {
+    const auto it = mNames.find(ifindex);
+    if (it == mNames.end()) {
+        return;
+    }
+    mInterfaces.erase(it->second);
+    mNames.erase(it);
+}
+
+void InterfaceRegistry::dump(DumpWriter& dw) {
+    android::RWLock::AutoRLock lock(mLock);
+    dw.incIndent();
+    dw.println("InterfaceRegistry");
+
+    dw.incIndent();
+    dw.println("Lookups: %" PRIu64 " hits, %" PRIu64 " misses", mHits.load(), mMisses.load());
+    for (const auto& entry : mNames) {
+        dw.println("%u: %s", entry.first, entry.second.c_str());
+    }
+    dw.decIndent();
+
+    dw.decIndent();
+}
+
+}  // namespace net
+}  // namespace android
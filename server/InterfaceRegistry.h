@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NETD_SERVER_INTERFACE_REGISTRY_H
+#define NETD_SERVER_INTERFACE_REGISTRY_H
+
+#include <atomic>
+#include <string>
+#include <unordered_map>
+
+#include <utils/RWLock.h>
+
+#include "DumpWriter.h"
+
+namespace android {
+namespace net {
+
+/*
+ * Maps interface names to interface indexes without making system calls.
+ *
+ * The registry is loaded once at startup and then kept current by NetlinkHandler, which passes it
+ * the interfaces that netlink reports as added, changed or removed. NetlinkHandler does so before
+ * telling the framework about the change, so by the time the framework asks netd to do something
+ * with an interface, the registry already knows its index.
+ *
+ * Lookups of interfaces that the registry does not know about fall back to if_nametoindex(), so a
+ * netlink event that has not been processed yet only costs a system call.
+ */
+class InterfaceRegistry {
+public:
+    // Loads all the current interfaces. Returns 0 on success or negative errno on failure.
+    int load();
+
+    // Returns the index of the interface called |name|, or 0 if there is no such interface.
+    unsigned getIndex(const std::string& name);
+
+    // Returns the name of the interface with index |ifindex|, or an empty string if there is no
+    // such interface.
+    std::string getName(unsigned ifindex);
+
+    // Records that the interface called |name| has index |ifindex|.
+    void onInterfaceAdded(const std::string& name, unsigned ifindex);
+
+    // Records that the interface called |name| with index |ifindex| no longer exists. If |ifindex|
+    // is 0, whatever interface is called |name| no longer exists.
+    void onInterfaceRemoved(const std::string& name, unsigned ifindex);
+
+    void dump(DumpWriter& dw);
+
+    static unsigned (*ifNameToIndexFunction)(const char*);
+
+private:
+    // Called with mLock held for writing.
+    void addLocked(const std::string& name, unsigned ifindex);
+    void removeLocked(unsigned ifindex);
+
+    android::RWLock mLock;
+    // Only interfaces that exist are kept, by name and by index.
+    std::unordered_map<std::string, unsigned> mInterfaces;
+    std::unordered_map<unsigned, std::string> mNames;
+
+    std::atomic<uint64_t> mHits{0};
+    std::atomic<uint64_t> mMisses{0};
+};
+
+extern InterfaceRegistry gInterfaceRegistry;
+
+}  // namespace net
+}  // namespace android
+
+#endif  // NETD_SERVER_INTERFACE_REGISTRY_H
@@ -0,0 +1,153 @@
+/*
+ * Copyright 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * InterfaceRegistryTest.cpp - unit tests for InterfaceRegistry.cpp
+ */
+
+#include <net/if.h>
+
+#include <map>
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "InterfaceRegistry.h"
+
+namespace android {
+namespace net {
+
+namespace {
+
+// The interfaces that the fake if_nametoindex() knows about, and how many times it was called.
+std::map<std::string, unsigned> sKernelInterfaces;
+int sIfNameToIndexCalls;
+
+unsigned fakeIfNameToIndex(const char* name) {
+    sIfNameToIndexCalls++;
+    const auto it = sKernelInterfaces.find(name);
+    return (it != sKernelInterfaces.end()) ? it->second : 0;
+}
+
+}  // namespace
+
+class InterfaceRegistryTest : public ::testing::Test {
+public:
+    InterfaceRegistryTest() {
+        sKernelInterfaces.clear();
+        sIfNameToIndexCalls = 0;
+        InterfaceRegistry::ifNameToIndexFunction = fakeIfNameToIndex;
+    }
+
+    ~InterfaceRegistryTest() {
+        InterfaceRegistry::ifNameToIndexFunction = if_nametoindex;
+    }
+
+protected:
+    InterfaceRegistry mRegistry;
+};
+
+TEST_F(InterfaceRegistryTest, TestLookupsDoNotCallKernel) {
+    mRegistry.onInterfaceAdded("wlan0", 5);
+    EXPECT_EQ(5U, mRegistry.getIndex("wlan0"));
+    EXPECT_EQ("wlan0", mRegistry.getName(5));
+    EXPECT_EQ(0, sIfNameToIndexCalls);
+
+    mRegistry.onInterfaceRemoved("wlan0", 5);
+    EXPECT_EQ(0U, mRegistry.getIndex("wlan0"));
+    EXPECT_EQ("", mRegistry.getName(5));
+    EXPECT_EQ(1, sIfNameToIndexCalls);
+}
+
+TEST_F(InterfaceRegistryTest, TestMissFallsBackToKernel) {
+    sKernelInterfaces["rmnet0"] = 7;
+    EXPECT_EQ(7U, mRegistry.getIndex("rmnet0"));
+    EXPECT_EQ(7U, mRegistry.getIndex("rmnet0"));
+    EXPECT_EQ(1, sIfNameToIndexCalls);
+    EXPECT_EQ("rmnet0", mRegistry.getName(7));
+
+    EXPECT_EQ(0U, mRegistry.getIndex("nonexistent0"));
+}
+
+TEST_F(InterfaceRegistryTest, TestLateEventsAreIgnored) {
+    // tun0 is removed and created again while old events are still in flight.
+    mRegistry.onInterfaceAdded("tun0", 10);
+    mRegistry.onInterfaceRemoved("tun0", 10);
+    mRegistry.onInterfaceAdded("tun0", 12);
+    mRegistry.onInterfaceAdded("tun0", 10);
+    mRegistry.onInterfaceRemoved("tun0", 10);
+    EXPECT_EQ(12U, mRegistry.getIndex("tun0"));
+    EXPECT_EQ("", mRegistry.getName(10));
+
+    // Removal events that don't say which interface was removed remove the current one.
+    mRegistry.onInterfaceRemoved("tun0", 0);
+    EXPECT_EQ(0U, mRegistry.getIndex("tun0"));
+}
+
+TEST_F(InterfaceRegistryTest, TestRename) {
+    mRegistry.onInterfaceAdded("eth0", 3);
+    mRegistry.onInterfaceAdded("wan0", 3);
+    EXPECT_EQ("wan0", mRegistry.getName(3));
+    EXPECT_EQ(3U, mRegistry.getIndex("wan0"));
+    EXPECT_EQ(0U, mRegistry.getIndex("eth0"));
+}
+
+TEST_F(InterfaceRegistryTest, TestRenameBack) {
+    mRegistry.onInterfaceAdded("eth0", 3);
+    mRegistry.onInterfaceAdded("wan0", 3);
+    mRegistry.onInterfaceAdded("eth0", 3);
+    EXPECT_EQ("eth0", mRegistry.getName(3));
+    EXPECT_EQ(3U, mRegistry.getIndex("eth0"));
+    EXPECT_EQ(0U, mRegistry.getIndex("wan0"));
+    EXPECT_EQ(1, sIfNameToIndexCalls);
+}
+
+TEST_F(InterfaceRegistryTest, TestRenameOntoRemovedName) {
+    // wlan1 goes away, and an older interface takes its name.
+    mRegistry.onInterfaceAdded("wlan0", 4);
+    mRegistry.onInterfaceAdded("wlan1", 6);
+    mRegistry.onInterfaceRemoved("wlan1", 6);
+    mRegistry.onInterfaceAdded("wlan1", 4);
+    EXPECT_EQ(4U, mRegistry.getIndex("wlan1"));
+    EXPECT_EQ("wlan1", mRegistry.getName(4));
+    EXPECT_EQ("", mRegistry.getName(6));
+    EXPECT_EQ(0, sIfNameToIndexCalls);
+}
+
+TEST_F(InterfaceRegistryTest, TestRemoveAndReAdd) {
+    // The same interface can be reported removed and added again, e.g. when it moves to another
+    // network namespace and back.
+    mRegistry.onInterfaceAdded("rmnet0", 8);
+    mRegistry.onInterfaceRemoved("rmnet0", 8);
+    mRegistry.onInterfaceAdded("rmnet0", 8);
+    EXPECT_EQ(8U, mRegistry.getIndex("rmnet0"));
+    EXPECT_EQ("rmnet0", mRegistry.getName(8));
+    EXPECT_EQ(0, sIfNameToIndexCalls);
+
+    // A late removal only costs a lookup in the kernel.
+    mRegistry.onInterfaceRemoved("rmnet0", 8);
+    sKernelInterfaces["rmnet0"] = 8;
+    EXPECT_EQ(8U, mRegistry.getIndex("rmnet0"));
+    EXPECT_EQ(1, sIfNameToIndexCalls);
+}
+
+TEST_F(InterfaceRegistryTest, TestLoad) {
+    InterfaceRegistry::ifNameToIndexFunction = if_nametoindex;
+    ASSERT_EQ(0, mRegistry.load());
+    EXPECT_EQ(if_nametoindex("lo"), mRegistry.getIndex("lo"));
+    EXPECT_EQ("lo", mRegistry.getName(if_nametoindex("lo")));
+}
+
+}  // namespace net
+}  // namespace android
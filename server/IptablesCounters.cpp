@@ -0,0 +1,157 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include <linux/netfilter/x_tables.h>
+#include <linux/netfilter_ipv4/ip_tables.h>
+#include <linux/netfilter_ipv6/ip6_tables.h>
+
+#define LOG_TAG "IptablesCounters"
+#include <cutils/log.h>
+
+#include "android-base/unique_fd.h"
+
+#include "IptablesCounters.h"
+
+namespace {
+
+// The kernel returns EAGAIN if the table changes size between reading its size and its entries.
+constexpr int kMaxAttempts = 3;
+
+struct V4Traits {
+    typedef ipt_getinfo GetInfo;
+    typedef ipt_get_entries GetEntries;
+    typedef ipt_entry Entry;
+    static constexpr int kFamily = AF_INET;
+    static constexpr int kLevel = IPPROTO_IP;
+    static constexpr int kGetInfo = IPT_SO_GET_INFO;
+    static constexpr int kGetEntries = IPT_SO_GET_ENTRIES;
+    static const char* inIface(const Entry& e) { return e.ip.iniface; }
+    static const char* outIface(const Entry& e) { return e.ip.outiface; }
+};
+
+struct V6Traits {
+    typedef ip6t_getinfo GetInfo;
+    typedef ip6t_get_entries GetEntries;
+    typedef ip6t_entry Entry;
+    static constexpr int kFamily = AF_INET6;
+    static constexpr int kLevel = IPPROTO_IPV6;
+    static constexpr int kGetInfo = IP6T_SO_GET_INFO;
+    static constexpr int kGetEntries = IP6T_SO_GET_ENTRIES;
+    static const char* inIface(const Entry& e) { return e.ipv6.iniface; }
+    static const char* outIface(const Entry& e) { return e.ipv6.outiface; }
+};
+
+template <typename T>
+int readChainCounters(const char* table, const char* chain,
+                      std::vector<IptablesRuleCounters>* counters) {
+    android::base::unique_fd s(socket(T::kFamily, SOCK_RAW | SOCK_CLOEXEC, IPPROTO_RAW));
+    if (s.get() == -1) {
+        return -errno;
+    }
+
+    typename T::GetInfo info;
+    std::vector<uint8_t> buf;
+    for (int attempt = 0; ; attempt++) {
+        memset(&info, 0, sizeof(info));
+        if (strlcpy(info.name, table, sizeof(info.name)) >= sizeof(info.name)) {
+            return -EINVAL;
+        }
+        socklen_t len = sizeof(info);
+        if (getsockopt(s.get(), T::kLevel, T::kGetInfo, &info, &len) == -1) {
+            return -errno;
+        }
+
+        buf.assign(sizeof(typename T::GetEntries) + info.size, 0);
+        auto* entries = reinterpret_cast<typename T::GetEntries*>(buf.data());
+        strlcpy(entries->name, table, sizeof(entries->name));
+        entries->size = info.size;
+        len = buf.size();
+        if (getsockopt(s.get(), T::kLevel, T::kGetEntries, entries, &len) == 0) {
+            break;
+        }
+        if (errno != EAGAIN || attempt + 1 == kMaxAttempts) {
+            return -errno;
+        }
+    }
+
+    // Built-in chains start at the hook entry points. User-defined chains start with an ERROR
+    // target entry that holds the chain name, and end with an unconditional RETURN entry. The
+    // table itself ends with an ERROR target entry.
+    const auto* entries = reinterpret_cast<const typename T::GetEntries*>(buf.data());
+    const uint8_t* start = reinterpret_cast<const uint8_t*>(entries->entrytable);
+    const uint8_t* end = start + entries->size;
+    bool found = false;
+    counters->clear();
+    for (const uint8_t* p = start; p + sizeof(typename T::Entry) <= end;) {
+        const auto* e = reinterpret_cast<const typename T::Entry*>(p);
+        if (e->next_offset < sizeof(*e) || e->target_offset + sizeof(xt_entry_target) >
+                e->next_offset || p + e->next_offset > end) {
+            ALOGE("Malformed %s table entry at offset %td", table, p - start);
+            return -EBADMSG;
+        }
+        const auto* target = reinterpret_cast<const xt_entry_target*>(p + e->target_offset);
+        const bool isChainHead = !strcmp(target->u.user.name, XT_ERROR_TARGET);
+        bool isHook = false;
+        for (unsigned hook = 0; hook < NF_INET_NUMHOOKS; hook++) {
+            if ((info.valid_hooks & (1 << hook)) && info.hook_entry[hook] == p - start) {
+                isHook = true;
+            }
+        }
+        if (found && (isChainHead || isHook)) {
+            break;
+        }
+        if (isChainHead) {
+            const auto* error = reinterpret_cast<const xt_error_target*>(target);
+            found = !strncmp(error->errorname, chain, sizeof(error->errorname));
+        } else if (found) {
+            counters->push_back({
+                std::string(T::inIface(*e), strnlen(T::inIface(*e), IFNAMSIZ)),
+                std::string(T::outIface(*e), strnlen(T::outIface(*e), IFNAMSIZ)),
+                e->counters.pcnt,
+                e->counters.bcnt,
+            });
+        }
+        p += e->next_offset;
+    }
+
+    if (!found) {
+        return -ENOENT;
+    }
+    // Drop the RETURN entry that ends the chain.
+    if (!counters->empty()) {
+        counters->pop_back();
+    }
+    return 0;
+}
+
+}  // namespace
+
+int getIptablesChainCounters(IptablesTarget target, const char* table, const char* chain,
+                             std::vector<IptablesRuleCounters>* counters) {
+    switch (target) {
+        case V4:
+            return readChainCounters<V4Traits>(table, chain, counters);
+        case V6:
+            return readChainCounters<V6Traits>(table, chain, counters);
+        default:
+            return -EINVAL;
+    }
+}
@@ -0,0 +1,47 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _IPTABLES_COUNTERS_H
+#define _IPTABLES_COUNTERS_H
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "NetdConstants.h"
+
+struct IptablesRuleCounters {
+    std::string inIface;   // Empty if the rule matches any input interface.
+    std::string outIface;  // Empty if the rule matches any output interface.
+    uint64_t packets;
+    uint64_t bytes;
+};
+
+/*
+ * Reads the interfaces and counters of every rule in |chain| of |table|, in rule order.
+ *
+ * The rules are read straight from the kernel with the getsockopt() interface that the iptables
+ * binaries use, so this does not start a process and produces no text to parse. The kernel
+ * returns a consistent snapshot of the whole table.
+ *
+ * |target| must be V4 or V6. Returns 0 on success, -ENOENT if |chain| does not exist, or another
+ * negative errno on failure.
+ */
+int getIptablesChainCounters(IptablesTarget target, const char* table, const char* chain,
+                             std::vector<IptablesRuleCounters>* counters);
+
+#endif  // _IPTABLES_COUNTERS_H
@@ -0,0 +1,346 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+
+#include <algorithm>
+#include <sstream>
+#include <unordered_map>
+
+#define LOG_TAG "IptablesMirror"
+#include <cutils/log.h>
+
+#include <android-base/stringprintf.h>
+
+#include "IptablesMirror.h"
+
+using android::base::StringAppendF;
+using android::base::StringPrintf;
+
+namespace {
+
+// Bounds the memory used to diff the part of a chain that changed. Chains that change more than
+// this are rebuilt from scratch instead.
+constexpr size_t kMaxDiffCells = 1 << 18;
+
+std::vector<IptablesTarget> splitTarget(IptablesTarget target) {
+    if (target == V4V6) {
+        return { V4, V6 };
+    }
+    return { target };
+}
+
+// Splits "<word> <rest>" into |word| and |rest|.
+void splitWord(const std::string& line, std::string* word, std::string* rest) {
+    const size_t space = line.find(' ');
+    if (space == std::string::npos) {
+        *word = line;
+        rest->clear();
+    } else {
+        *word = line.substr(0, space);
+        *rest = line.substr(space + 1);
+    }
+}
+
+// "iptables -S" lists rules in its own spelling, which is not always the one they were added
+// with. It names every match module it loads, and prints protocols and ICMPv6 types as it
+// likes. Reduces a rule to a form that is the same for both spellings.
+std::string canonicalRule(const std::string& rule) {
+    static const std::unordered_map<std::string, std::string> kAliases = {
+        { "ipv6-icmp", "icmpv6" },
+        { "icmp6", "icmpv6" },
+        { "destination-unreachable", "1" },
+        { "packet-too-big", "2" },
+        { "time-exceeded", "3" },
+        { "parameter-problem", "4" },
+        { "echo-request", "128" },
+        { "echo-reply", "129" },
+        { "router-solicitation", "133" },
+        { "router-advertisement", "134" },
+        { "neighbour-solicitation", "135" },
+        { "neighbor-solicitation", "135" },
+        { "neighbour-advertisement", "136" },
+        { "neighbor-advertisement", "136" },
+        { "redirect", "137" },
+    };
+
+    std::string canonical;
+    std::istringstream stream(rule);
+    std::string word;
+    while (stream >> word) {
+        if (word == "-m") {
+            // The options that follow say which matches the rule uses.
+            stream >> word;
+            continue;
+        }
+        const auto alias = kAliases.find(word);
+        if (alias != kAliases.end()) {
+            word = alias->second;
+        }
+        if (!canonical.empty()) {
+            canonical += ' ';
+        }
+        canonical += word;
+    }
+    return canonical;
+}
+
+// Parses a 1-based rule number. Returns 0 if |word| is not one.
+size_t parseRuleNumber(const std::string& word) {
+    if (word.empty() || word.find_first_not_of("0123456789") != std::string::npos) {
+        return 0;
+    }
+    return strtoul(word.c_str(), nullptr, 10);
+}
+
+}  // namespace
+
+int (*IptablesMirror::execIptablesRestoreWithOutput)(IptablesTarget, const std::string&,
+                                                     std::string*) = ::execIptablesRestoreWithOutput;
+
+std::string IptablesMirror::makeReplaceCommands(IptablesTarget target, const std::string& table,
+                                                const std::string& chain,
+                                                const std::vector<std::string>& rules) const {
+    std::string full = StringPrintf("*%s\n:%s -\n", table.c_str(), chain.c_str());
+    for (const auto& rule : rules) {
+        StringAppendF(&full, "-A %s %s\n", chain.c_str(), rule.c_str());
+    }
+    full += "COMMIT\n";
+
+    const auto it = mChains.find(ChainKey(target, table, chain));
+    if (it == mChains.end()) {
+        return full;
+    }
+    const std::vector<std::string>& old = it->second;
+    if (old == rules) {
+        return "";
+    }
+
+    // Only diff what lies between the rules that are the same at both ends.
+    size_t prefix = 0;
+    while (prefix < old.size() && prefix < rules.size() && old[prefix] == rules[prefix]) {
+        prefix++;
+    }
+    size_t suffix = 0;
+    while (suffix < old.size() - prefix && suffix < rules.size() - prefix &&
+           old[old.size() - 1 - suffix] == rules[rules.size() - 1 - suffix]) {
+        suffix++;
+    }
+    const size_t n = old.size() - prefix - suffix;
+    const size_t m = rules.size() - prefix - suffix;
+    if ((n + 1) * (m + 1) > kMaxDiffCells) {
+        return full;
+    }
+
+    // lcs[i * (m + 1) + j] is the length of the longest common subsequence of the old rules from
+    // prefix + i and the new rules from prefix + j. The rules in it are the ones that stay.
+    std::vector<uint32_t> lcs((n + 1) * (m + 1), 0);
+    for (size_t i = n; i-- > 0;) {
+        for (size_t j = m; j-- > 0;) {
+            lcs[i * (m + 1) + j] = (old[prefix + i] == rules[prefix + j]) ?
+                    lcs[(i + 1) * (m + 1) + j + 1] + 1 :
+                    std::max(lcs[(i + 1) * (m + 1) + j], lcs[i * (m + 1) + j + 1]);
+        }
+    }
+
+    std::vector<size_t> deletes, inserts;
+    size_t i = 0, j = 0;
+    while (i < n || j < m) {
+        if (i < n && j < m && old[prefix + i] == rules[prefix + j]) {
+            i++;
+            j++;
+        } else if (j == m || (i < n && lcs[(i + 1) * (m + 1) + j] >= lcs[i * (m + 1) + j + 1])) {
+            deletes.push_back(prefix + i);
+            i++;
+        } else {
+            inserts.push_back(prefix + j);
+            j++;
+        }
+    }
+
+    // Delete from the end, so that each deletion leaves the positions of the next ones alone.
+    // Rules that appear once are deleted by their text, which fails loudly if the mirror is out of
+    // sync with the kernel. Deleting a duplicate by its text would delete the first copy, which is
+    // not necessarily the one that has to go, so duplicates are deleted by number.
+    std::unordered_map<std::string, size_t> copies;
+    for (const auto& rule : old) {
+        copies[rule]++;
+    }
+    std::string commands = StringPrintf("*%s\n", table.c_str());
+    for (auto index = deletes.rbegin(); index != deletes.rend(); ++index) {
+        if (copies[old[*index]] == 1) {
+            StringAppendF(&commands, "-D %s %s\n", chain.c_str(), old[*index].c_str());
+        } else {
+            StringAppendF(&commands, "-D %s %zu\n", chain.c_str(), *index + 1);
+        }
+    }
+
+    // Once the deletions are done, inserting the new rules in order puts each one right after the
+    // rules that precede it in |rules|.
+    size_t size = old.size() - (n - lcs[0]);
+    for (size_t index : inserts) {
+        if (index == size) {
+            StringAppendF(&commands, "-A %s %s\n", chain.c_str(), rules[index].c_str());
+        } else {
+            StringAppendF(&commands, "-I %s %zu %s\n", chain.c_str(), index + 1,
+                          rules[index].c_str());
+        }
+        size++;
+    }
+    commands += "COMMIT\n";
+
+    return (commands.size() < full.size()) ? commands : full;
+}
+
+void IptablesMirror::commitChain(IptablesTarget target, const std::string& table,
+                                 const std::string& chain, const std::vector<std::string>& rules) {
+    mChains[ChainKey(target, table, chain)] = rules;
+}
+
+void IptablesMirror::invalidateChain(IptablesTarget target, const std::string& table,
+                                     const std::string& chain) {
+    mChains.erase(ChainKey(target, table, chain));
+}
+
+void IptablesMirror::applyCommands(IptablesTarget target, const std::string& commands) {
+    updateCommands(target, commands, true);
+}
+
+void IptablesMirror::invalidateCommands(IptablesTarget target, const std::string& commands) {
+    updateCommands(target, commands, false);
+}
+
+void IptablesMirror::updateCommands(IptablesTarget target, const std::string& commands,
+                                    bool succeeded) {
+    for (IptablesTarget t : splitTarget(target)) {
+        std::string table;
+        std::istringstream stream(commands);
+        std::string line;
+        while (std::getline(stream, line)) {
+            if (line.empty() || line[0] == '#' || line == "COMMIT") {
+                continue;
+            }
+            if (line[0] == '*') {
+                table = line.substr(1);
+                continue;
+            }
+
+            std::string op, chain, rest;
+            if (line[0] == ':') {
+                // ":<chain> <policy>" creates the chain, or flushes it if it exists.
+                splitWord(line.substr(1), &chain, &rest);
+                if (succeeded) {
+                    mChains[ChainKey(t, table, chain)].clear();
+                } else {
+                    mChains.erase(ChainKey(t, table, chain));
+                }
+                continue;
+            }
+            splitWord(line, &op, &rest);
+            splitWord(std::string(rest), &chain, &rest);
+
+            const auto it = mChains.find(ChainKey(t, table, chain));
+            if (it == mChains.end()) {
+                continue;
+            }
+            if (!succeeded) {
+                mChains.erase(it);
+                continue;
+            }
+
+            std::vector<std::string>& rules = it->second;
+            std::string word, spec;
+            splitWord(rest, &word, &spec);
+            const size_t number = parseRuleNumber(word);
+            bool modeled = true;
+            if (op == "-A") {
+                rules.push_back(rest);
+            } else if (op == "-I" && number == 0) {
+                rules.insert(rules.begin(), rest);
+            } else if (op == "-I" && number <= rules.size() + 1) {
+                rules.insert(rules.begin() + number - 1, spec);
+            } else if (op == "-D" && number == 0) {
+                const auto rule = std::find(rules.begin(), rules.end(), rest);
+                modeled = (rule != rules.end());
+                if (modeled) rules.erase(rule);
+            } else if (op == "-D" && number <= rules.size() && spec.empty()) {
+                rules.erase(rules.begin() + number - 1);
+            } else if (op == "-F" && rest.empty()) {
+                rules.clear();
+            } else {
+                modeled = false;
+            }
+            if (!modeled) {
+                ALOGW("Forgetting chain %s after unexpected command: %s",
+                      chain.c_str(), line.c_str());
+                mChains.erase(it);
+            }
+        }
+    }
+}
+
+std::string IptablesMirror::checkKernel(IptablesTarget target, const std::string& table,
+                                        const std::string& chain) const {
+    const auto it = mChains.find(ChainKey(target, table, chain));
+    if (it == mChains.end()) {
+        return "not known";
+    }
+    const std::vector<std::string>& rules = it->second;
+
+    std::string output;
+    const std::string command = StringPrintf("*%s\n-S %s\nCOMMIT\n", table.c_str(),
+                                             chain.c_str());
+    if (execIptablesRestoreWithOutput(target, command, &output)) {
+        return "cannot list kernel rules";
+    }
+    const std::string prefix = StringPrintf("-A %s ", chain.c_str());
+    std::vector<std::string> kernel;
+    std::istringstream stream(output);
+    std::string line;
+    while (std::getline(stream, line)) {
+        if (line.compare(0, prefix.size(), prefix) == 0) {
+            kernel.push_back(line.substr(prefix.size()));
+        }
+    }
+
+    for (size_t i = 0; i < rules.size() && i < kernel.size(); i++) {
+        if (canonicalRule(rules[i]) != canonicalRule(kernel[i])) {
+            return StringPrintf("MISMATCH at rule %zu, kernel has: %s", i + 1, kernel[i].c_str());
+        }
+    }
+    if (kernel.size() != rules.size()) {
+        return StringPrintf("MISMATCH, kernel has %zu rules", kernel.size());
+    }
+    return "matches kernel";
+}
+
+void IptablesMirror::dump(android::net::DumpWriter& dw) const {
+    for (const auto& entry : mChains) {
+        const IptablesTarget target = std::get<0>(entry.first);
+        const std::string& table = std::get<1>(entry.first);
+        const std::string& chain = std::get<2>(entry.first);
+        const std::vector<std::string>& rules = entry.second;
+
+        dw.println("%s %s %s: %zu rules, %s", (target == V4) ? "IPv4" : "IPv6", table.c_str(),
+                   chain.c_str(), rules.size(), checkKernel(target, table, chain).c_str());
+
+        dw.incIndent();
+        for (const auto& rule : rules) {
+            dw.println("-A %s %s", chain.c_str(), rule.c_str());
+        }
+        dw.decIndent();
+    }
+}
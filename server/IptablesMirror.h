@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NETD_SERVER_IPTABLES_MIRROR_H
+#define NETD_SERVER_IPTABLES_MIRROR_H
+
+#include <map>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "DumpWriter.h"
+#include "NetdConstants.h"
+
+/*
+ * An in-memory copy of the rules in the iptables chains that a controller owns.
+ *
+ * A chain is known to the mirror once it has been created or replaced through it, and stays known
+ * until a change to it fails. Rules are kept as the text that follows "-A <chain> " in an
+ * iptables-restore script, so they compare equal as long as the controller always spells them the
+ * same way. Replacing a known chain only sends the rules that differ, instead of flushing the
+ * chain and adding every rule again. Replacing an unknown chain rebuilds it from scratch.
+ *
+ * So far only the UID chains of FirewallController are kept in a mirror. The other controllers
+ * still send their rules to iptables directly.
+ *
+ * Not thread-safe. Callers must hold the lock of the controller that owns the mirror.
+ */
+class IptablesMirror {
+  public:
+    // Returns the iptables-restore script that turns |chain| in |table| into |rules|, or the empty
+    // string if it already holds them. |target| must be V4 or V6. Call commitChain() if the script
+    // succeeds and invalidateChain() if it fails.
+    std::string makeReplaceCommands(IptablesTarget target, const std::string& table,
+                                    const std::string& chain,
+                                    const std::vector<std::string>& rules) const;
+    void commitChain(IptablesTarget target, const std::string& table, const std::string& chain,
+                     const std::vector<std::string>& rules);
+    void invalidateChain(IptablesTarget target, const std::string& table,
+                         const std::string& chain);
+
+    // Records the effect of an iptables-restore script that succeeded on |target| on the chains
+    // that the mirror knows. Known chains that the script changes in ways that the mirror does not
+    // model are forgotten.
+    void applyCommands(IptablesTarget target, const std::string& commands);
+    // Forgets every known chain that an iptables-restore script with an unknown outcome touches.
+    void invalidateCommands(IptablesTarget target, const std::string& commands);
+
+    // Compares the rules of a known chain with the ones that "iptables -S" lists in the kernel,
+    // and describes the first difference. Returns "matches kernel" if there is none.
+    std::string checkKernel(IptablesTarget target, const std::string& table,
+                            const std::string& chain) const;
+
+    // Prints every known chain, and checks each one against the kernel.
+    void dump(android::net::DumpWriter& dw) const;
+
+    size_t size() const { return mChains.size(); }
+
+    static int (*execIptablesRestoreWithOutput)(IptablesTarget target,
+                                                const std::string& commands, std::string* output);
+
+  private:
+    typedef std::tuple<IptablesTarget, std::string, std::string> ChainKey;
+
+    void updateCommands(IptablesTarget target, const std::string& commands, bool succeeded);
+
+    std::map<ChainKey, std::vector<std::string>> mChains;
+};
+
+#endif  // NETD_SERVER_IPTABLES_MIRROR_H
@@ -0,0 +1,203 @@
+/*
+ * Copyright 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * IptablesMirrorTest.cpp - unit tests for IptablesMirror.cpp
+ */
+
+#include <stdlib.h>
+
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "IptablesMirror.h"
+
+class IptablesMirrorTest : public ::testing::Test {
+protected:
+    IptablesMirror mMirror;
+
+    // Checks that the mirror holds exactly |rules| in |chain|.
+    void expectChain(IptablesTarget target, const char* chain,
+                     const std::vector<std::string>& rules) {
+        EXPECT_EQ("", mMirror.makeReplaceCommands(target, "filter", chain, rules));
+    }
+};
+
+TEST_F(IptablesMirrorTest, TestUnknownChainIsRebuilt) {
+    const std::string expected =
+            "*filter\n"
+            ":fw_test -\n"
+            "-A fw_test -i lo -j RETURN\n"
+            "-A fw_test -j DROP\n"
+            "COMMIT\n";
+    const std::vector<std::string> rules = { "-i lo -j RETURN", "-j DROP" };
+    EXPECT_EQ(expected, mMirror.makeReplaceCommands(V4, "filter", "fw_test", rules));
+
+    // Each IP version is tracked separately.
+    mMirror.commitChain(V4, "filter", "fw_test", rules);
+    expectChain(V4, "fw_test", rules);
+    EXPECT_EQ(expected, mMirror.makeReplaceCommands(V6, "filter", "fw_test", rules));
+
+    mMirror.invalidateChain(V4, "filter", "fw_test");
+    EXPECT_EQ(expected, mMirror.makeReplaceCommands(V4, "filter", "fw_test", rules));
+}
+
+TEST_F(IptablesMirrorTest, TestReplaceSendsDiff) {
+    std::vector<std::string> rules;
+    for (int uid = 10000; uid < 10020; uid++) {
+        rules.push_back("-m owner --uid-owner " + std::to_string(uid) + " -j DROP");
+    }
+    mMirror.commitChain(V4, "filter", "fw_test", rules);
+
+    std::vector<std::string> newRules = rules;
+    newRules.erase(newRules.begin() + 3);
+    newRules.insert(newRules.begin() + 10, "-m owner --uid-owner 20000 -j DROP");
+    newRules.push_back("-m owner --uid-owner 20001 -j DROP");
+
+    const std::string expected =
+            "*filter\n"
+            "-D fw_test -m owner --uid-owner 10003 -j DROP\n"
+            "-I fw_test 11 -m owner --uid-owner 20000 -j DROP\n"
+            "-A fw_test -m owner --uid-owner 20001 -j DROP\n"
+            "COMMIT\n";
+    EXPECT_EQ(expected, mMirror.makeReplaceCommands(V4, "filter", "fw_test", newRules));
+}
+
+TEST_F(IptablesMirrorTest, TestReplaceRebuildsWhenSmaller) {
+    const std::vector<std::string> rules = { "-i lo -j RETURN", "-o lo -j RETURN" };
+    mMirror.commitChain(V4, "filter", "fw_test", rules);
+
+    const std::string expected =
+            "*filter\n"
+            ":fw_test -\n"
+            "COMMIT\n";
+    EXPECT_EQ(expected, mMirror.makeReplaceCommands(V4, "filter", "fw_test", {}));
+}
+
+TEST_F(IptablesMirrorTest, TestDiffsApplyCleanly) {
+    srandom(42);
+    for (int iteration = 0; iteration < 200; iteration++) {
+        // Few distinct rules, so that there are many duplicates.
+        std::vector<std::string> oldRules(random() % 30), newRules(random() % 30);
+        for (auto& rule : oldRules) rule = "-m mark --mark " + std::to_string(random() % 8);
+        for (auto& rule : newRules) rule = "-m mark --mark " + std::to_string(random() % 8);
+
+        mMirror.commitChain(V6, "filter", "fw_test", oldRules);
+        const std::string commands =
+                mMirror.makeReplaceCommands(V6, "filter", "fw_test", newRules);
+        mMirror.applyCommands(V6, commands);
+        expectChain(V6, "fw_test", newRules);
+        ASSERT_EQ(1U, mMirror.size());
+    }
+}
+
+TEST_F(IptablesMirrorTest, TestApplyCommands) {
+    mMirror.commitChain(V4, "filter", "fw_test", { "-j b" });
+    mMirror.commitChain(V6, "filter", "fw_test", { "-j b" });
+
+    mMirror.applyCommands(V4V6,
+            "*filter\n"
+            "-A fw_test -j d\n"
+            "-I fw_test -j a\n"
+            "-I fw_test 3 -j c\n"
+            "-A fw_unknown -j x\n"
+            "COMMIT\n");
+    expectChain(V4, "fw_test", { "-j a", "-j b", "-j c", "-j d" });
+    expectChain(V6, "fw_test", { "-j a", "-j b", "-j c", "-j d" });
+    EXPECT_EQ(2U, mMirror.size());
+
+    mMirror.applyCommands(V4, "*filter\n-D fw_test -j b\n-D fw_test 1\nCOMMIT\n");
+    expectChain(V4, "fw_test", { "-j c", "-j d" });
+
+    // A chain created in a script is known from then on.
+    mMirror.applyCommands(V4, "*mangle\n:fw_new -\n-A fw_new -j e\nCOMMIT\n");
+    EXPECT_EQ("", mMirror.makeReplaceCommands(V4, "mangle", "fw_new", { "-j e" }));
+    EXPECT_EQ(3U, mMirror.size());
+}
+
+TEST_F(IptablesMirrorTest, TestUnexpectedCommandsForgetChain) {
+    mMirror.commitChain(V4, "filter", "fw_test", { "-j a" });
+    mMirror.commitChain(V4, "filter", "fw_other", { "-j a" });
+
+    // Replacing a rule is not modeled, and deleting a rule that is not there means the mirror is
+    // out of sync.
+    mMirror.applyCommands(V4, "*filter\n-R fw_test 1 -j b\n-D fw_other -j b\nCOMMIT\n");
+    EXPECT_EQ(0U, mMirror.size());
+}
+
+TEST_F(IptablesMirrorTest, TestInvalidateCommands) {
+    mMirror.commitChain(V4, "filter", "fw_test", { "-j a" });
+    mMirror.commitChain(V6, "filter", "fw_test", { "-j a" });
+    mMirror.commitChain(V6, "filter", "fw_other", { "-j a" });
+
+    mMirror.invalidateCommands(V4V6, "*filter\n-A fw_test -j b\nCOMMIT\n");
+    EXPECT_EQ(1U, mMirror.size());
+    expectChain(V6, "fw_other", { "-j a" });
+}
+
+namespace {
+
+std::string sKernelRules;
+std::string sListCommand;
+
+int fakeListChain(IptablesTarget, const std::string& commands, std::string* output) {
+    sListCommand = commands;
+    *output = sKernelRules;
+    return 0;
+}
+
+}  // namespace
+
+TEST_F(IptablesMirrorTest, TestCheckKernel) {
+    auto realExec = IptablesMirror::execIptablesRestoreWithOutput;
+    IptablesMirror::execIptablesRestoreWithOutput = fakeListChain;
+
+    mMirror.commitChain(V6, "filter", "fw_test", {
+        "-m owner --uid-owner 10000 -j RETURN",
+        "-p tcp --tcp-flags RST RST -j RETURN",
+        "-p icmpv6 --icmpv6-type packet-too-big -j RETURN",
+        "-j DROP",
+    });
+
+    // The kernel spells the same rules differently.
+    sKernelRules =
+            "-N fw_test\n"
+            "-A fw_test -m owner --uid-owner 10000 -j RETURN\n"
+            "-A fw_test -p tcp -m tcp --tcp-flags RST RST -j RETURN\n"
+            "-A fw_test -p ipv6-icmp -m icmp6 --icmpv6-type 2 -j RETURN\n"
+            "-A fw_test -j DROP\n";
+    EXPECT_EQ("matches kernel", mMirror.checkKernel(V6, "filter", "fw_test"));
+    EXPECT_EQ("*filter\n-S fw_test\nCOMMIT\n", sListCommand);
+
+    // The same number of rules, with different contents.
+    sKernelRules =
+            "-N fw_test\n"
+            "-A fw_test -m owner --uid-owner 10001 -j RETURN\n"
+            "-A fw_test -p tcp -m tcp --tcp-flags RST RST -j RETURN\n"
+            "-A fw_test -p ipv6-icmp -m icmp6 --icmpv6-type 2 -j RETURN\n"
+            "-A fw_test -j DROP\n";
+    EXPECT_EQ("MISMATCH at rule 1, kernel has: -m owner --uid-owner 10001 -j RETURN",
+              mMirror.checkKernel(V6, "filter", "fw_test"));
+
+    sKernelRules =
+            "-N fw_test\n"
+            "-A fw_test -m owner --uid-owner 10000 -j RETURN\n";
+    EXPECT_EQ("MISMATCH, kernel has 1 rules", mMirror.checkKernel(V6, "filter", "fw_test"));
+
+    EXPECT_EQ("not known", mMirror.checkKernel(V4, "filter", "fw_test"));
+
+    IptablesMirror::execIptablesRestoreWithOutput = realExec;
+}
@@ -16,18 +16,24 @@
 
 #include "IptablesRestoreController.h"
 
+#include <inttypes.h>
 #include <poll.h>
 #include <signal.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
+#include <chrono>
+
 #define LOG_TAG "IptablesRestoreController"
 #include <android-base/logging.h>
 #include <android-base/file.h>
+#include <android-base/stringprintf.h>
 #include <netdutils/Syscalls.h>
 
 #include "Controllers.h"
 
+using android::base::StringAppendF;
+using android::net::DumpWriter;
 using android::netdutils::StatusOr;
 using android::netdutils::sSyscalls;
 
@@ -38,6 +44,59 @@ constexpr char PING[] = "#PING\n";
 
 constexpr size_t PING_SIZE = sizeof(PING) - 1;
 
+constexpr int IptablesRestoreController::LATENCY_BUCKETS_MS[];
+
+namespace {
+
+// Returns the prefix of the first chain that |command| creates or changes. By convention, this
+// names the controller that owns the chain, e.g., "bw" for bw_INPUT or "fw" for fw_dozable.
+std::string getCaller(const std::string& command) {
+    size_t pos = 0;
+    while (pos < command.size()) {
+        size_t end = command.find('\n', pos);
+        if (end == std::string::npos) end = command.size();
+
+        // ":<chain> <policy>" or "-<op> <chain> ...".
+        size_t start = std::string::npos;
+        if (command[pos] == ':') {
+            start = pos + 1;
+        } else if (command[pos] == '-') {
+            start = command.find(' ', pos);
+            if (start != std::string::npos) start++;
+        }
+        if (start < end) {
+            const size_t chainEnd = std::min(command.find(' ', start), end);
+            const size_t underscore = command.find('_', start);
+            if (underscore < chainEnd) {
+                return command.substr(start, underscore - start);
+            }
+            return "other";
+        }
+        pos = end + 1;
+    }
+    return "other";
+}
+
+size_t getLatencyBucket(int64_t latencyUs) {
+    for (size_t i = 0; i < ARRAY_SIZE(IptablesRestoreController::LATENCY_BUCKETS_MS); i++) {
+        if (latencyUs < IptablesRestoreController::LATENCY_BUCKETS_MS[i] * 1000) {
+            return i;
+        }
+    }
+    return IptablesRestoreController::NUM_LATENCY_BUCKETS - 1;
+}
+
+const char* targetName(IptablesTarget target) {
+    switch (target) {
+        case V4: return "v4";
+        case V6: return "v6";
+        case V4V6: return "v4v6";
+    }
+    return "?";
+}
+
+}  // namespace
+
 // Not compile-time constants because they are changed by the unit tests.
 int IptablesRestoreController::MAX_RETRIES = 50;
 int IptablesRestoreController::POLL_TIMEOUT_MS = 100;
@@ -107,13 +166,14 @@ public:
     const pid_t pid;
     const int stdIn;
 
-    struct pollfd pollFds[2];
+    static constexpr size_t STDOUT_IDX = 0;
+    static constexpr size_t STDERR_IDX = 1;
+    static constexpr size_t NUM_FDS = 2;
+
+    struct pollfd pollFds[NUM_FDS];
     std::string errBuf;
 
     std::atomic_bool processTerminated;
-
-    static constexpr size_t STDOUT_IDX = 0;
-    static constexpr size_t STDERR_IDX = 1;
 };
 
 IptablesRestoreController::IptablesRestoreController() {
@@ -128,8 +188,29 @@ void IptablesRestoreController::Init() {
     // use by the other child process. see https://android-review.googlesource.com/469559 for what
     // breaks. This does not cause a latency hit, because the parent only has to wait for
     // forkAndExec, which is sub-millisecond, and the child processes then call exec() in parallel.
-    mIpRestore.reset(forkAndExec(IPTABLES_PROCESS));
-    mIp6Restore.reset(forkAndExec(IP6TABLES_PROCESS));
+    resetProcess(IPTABLES_PROCESS, forkAndExec(IPTABLES_PROCESS));
+    resetProcess(IP6TABLES_PROCESS, forkAndExec(IP6TABLES_PROCESS));
+}
+
+void IptablesRestoreController::resetProcess(const IptablesProcessType type,
+                                             IptablesProcess* process) {
+    getProcess(type).reset(process);
+    auto& pid = (type == IPTABLES_PROCESS) ? mIpRestorePid : mIp6RestorePid;
+    pid = (process != nullptr) ? process->pid : 0;
+}
+
+IptablesRestoreController::IptablesProcessType IptablesRestoreController::notifyChildTermination(
+        pid_t pid) {
+    // May run in a signal handler, so only touches atomics.
+    if (pid == mIpRestorePid) {
+        mIpRestoreTerminations++;
+        return IPTABLES_PROCESS;
+    }
+    if (pid == mIp6RestorePid) {
+        mIp6RestoreTerminations++;
+        return IP6TABLES_PROCESS;
+    }
+    return INVALID_PROCESS;
 }
 
 /* static */
@@ -200,15 +281,17 @@ IptablesProcess* IptablesRestoreController::forkAndExec(const IptablesProcessTyp
     return new IptablesProcess(child_pid.value(), stdin_pipe[1], stdout_pipe[0], stderr_pipe[0]);
 }
 
+std::unique_ptr<IptablesProcess>& IptablesRestoreController::getProcess(
+        const IptablesProcessType type) {
+    return (type == IPTABLES_PROCESS) ? mIpRestore : mIp6Restore;
+}
+
 // TODO: Return -errno on failure instead of -1.
 // TODO: Maybe we should keep a rotating buffer of the last N commands
 // so that they can be dumped on dumpsys.
 int IptablesRestoreController::sendCommand(const IptablesProcessType type,
-                                           const std::string& command,
-                                           std::string *output) {
-   std::unique_ptr<IptablesProcess> *process =
-           (type == IPTABLES_PROCESS) ? &mIpRestore : &mIp6Restore;
-
+                                           const std::string& command) {
+    std::unique_ptr<IptablesProcess>& process = getProcess(type);
 
     // We might need to fork a new process if we haven't forked one yet, or
     // if the forked process terminated.
@@ -217,42 +300,49 @@ int IptablesRestoreController::sendCommand(const IptablesProcessType type,
     // recover from a child death. If the child dies at some later point during
     // the execution of this method, we will receive an EPIPE and return an
     // error. The command will then need to be retried at a higher level.
-    IptablesProcess *existingProcess = process->get();
-    if (existingProcess != nullptr && !existingProcess->outputReady()) {
+    IptablesProcess *existingProcess = process.get();
+    if (existingProcess != nullptr && !existingProcess->processTerminated &&
+            !existingProcess->outputReady()) {
+        // The process died since the last command, most likely killed by something else on the
+        // system. Deaths noticed while waiting for a response are counted in drainAndWaitForAcks.
+        notifyChildTermination(existingProcess->pid);
         existingProcess->stop();
+    }
+    if (existingProcess != nullptr && existingProcess->processTerminated) {
         existingProcess = nullptr;
     }
 
     if (existingProcess == nullptr) {
         // Fork a new iptables[6]-restore process.
-        IptablesProcess *newProcess = IptablesRestoreController::forkAndExec(type);
+        IptablesProcess *newProcess;
+        {
+            std::lock_guard<std::mutex> lock(mForkLock);
+            newProcess = IptablesRestoreController::forkAndExec(type);
+        }
         if (newProcess == nullptr) {
             LOG(ERROR) << "Unable to fork ip[6]tables-restore, type: " << type;
             return -1;
         }
 
-        process->reset(newProcess);
+        resetProcess(type, newProcess);
+        std::lock_guard<std::mutex> lock(mStatsLock);
+        ((type == IPTABLES_PROCESS) ? mIpRestoreRestarts : mIp6RestoreRestarts)++;
     }
 
-    if (!android::base::WriteFully((*process)->stdIn, command.data(), command.length())) {
+    if (!android::base::WriteFully(process->stdIn, command.data(), command.length())) {
         ALOGE("Unable to send command: %s", strerror(errno));
         return -1;
     }
 
-    if (!android::base::WriteFully((*process)->stdIn, PING, PING_SIZE)) {
+    if (!android::base::WriteFully(process->stdIn, PING, PING_SIZE)) {
         ALOGE("Unable to send ping command: %s", strerror(errno));
         return -1;
     }
 
-    if (!drainAndWaitForAck(*process, command, output)) {
-        // drainAndWaitForAck has already logged an error.
-        return -1;
-    }
-
     return 0;
 }
 
-void IptablesRestoreController::maybeLogStderr(const std::unique_ptr<IptablesProcess> &process,
+void IptablesRestoreController::maybeLogStderr(IptablesProcess* process,
                                                const std::string& command) {
     if (process->errBuf.empty()) {
         return;
@@ -268,15 +358,22 @@ void IptablesRestoreController::maybeLogStderr(const std::unique_ptr<IptablesPro
     process->errBuf.clear();
 }
 
-/* static */
-bool IptablesRestoreController::drainAndWaitForAck(const std::unique_ptr<IptablesProcess> &process,
-                                                   const std::string& command,
-                                                   std::string *output) {
-    bool receivedAck = false;
+bool IptablesRestoreController::drainAndWaitForAcks(
+        const std::vector<IptablesProcess*>& processes, const std::string& command,
+        std::vector<std::string>* outputs, CommandStats* stats) {
+    // The fds of process p start at kFdsPerProcess * p. The fds of a process that has responded or
+    // died are set to -1, which makes poll() ignore them.
+    constexpr size_t kFdsPerProcess = IptablesProcess::NUM_FDS;
+    std::vector<struct pollfd> pollFds;
+    for (IptablesProcess* process : processes) {
+        pollFds.insert(pollFds.end(), process->pollFds, process->pollFds + kFdsPerProcess);
+    }
+    std::vector<bool> receivedAck(processes.size(), false);
+    size_t pending = processes.size();
+
     int timeout = 0;
-    while (!receivedAck && (timeout++ < MAX_RETRIES)) {
-        int numEvents = TEMP_FAILURE_RETRY(
-            poll(process->pollFds, ARRAY_SIZE(process->pollFds), POLL_TIMEOUT_MS));
+    while (pending > 0 && (timeout++ < MAX_RETRIES)) {
+        int numEvents = TEMP_FAILURE_RETRY(poll(pollFds.data(), pollFds.size(), POLL_TIMEOUT_MS));
         if (numEvents == -1) {
             ALOGE("Poll failed: %s", strerror(errno));
             return false;
@@ -286,86 +383,199 @@ bool IptablesRestoreController::drainAndWaitForAck(const std::unique_ptr<Iptable
         // become available to read with the ACK message, or that stderr should have been available
         // to read with an error message.
         if (numEvents == 0) {
+            stats->retries++;
             continue;
         }
 
         char buffer[PIPE_BUF];
-        for (size_t i = 0; i < ARRAY_SIZE(process->pollFds); ++i) {
-            const struct pollfd &pollfd = process->pollFds[i];
-            if (pollfd.revents & POLLIN) {
-                ssize_t size;
-                do {
-                    size = TEMP_FAILURE_RETRY(read(pollfd.fd, buffer, sizeof(buffer)));
-
-                    if (size == -1) {
-                        if (errno != EAGAIN) {
-                            ALOGE("Unable to read from descriptor: %s", strerror(errno));
+        for (size_t p = 0; p < processes.size(); ++p) {
+            IptablesProcess* process = processes[p];
+            std::string* output = &(*outputs)[p];
+            for (size_t i = 0; i < kFdsPerProcess; ++i) {
+                const struct pollfd &pollfd = pollFds[kFdsPerProcess * p + i];
+                if (pollfd.revents & POLLIN) {
+                    ssize_t size;
+                    do {
+                        size = TEMP_FAILURE_RETRY(read(pollfd.fd, buffer, sizeof(buffer)));
+
+                        if (size == -1) {
+                            if (errno != EAGAIN) {
+                                ALOGE("Unable to read from descriptor: %s", strerror(errno));
+                            }
+                            break;
                         }
-                        break;
-                    }
 
-                    if (i == IptablesProcess::STDOUT_IDX) {
-                        // i == STDOUT_IDX: accumulate stdout into *output, and look
-                        // for the ping response.
-                        output->append(buffer, size);
-                        size_t pos = output->find(PING);
-                        if (pos != std::string::npos) {
-                            if (output->size() > pos + PING_SIZE) {
-                                size_t extra = output->size() - (pos + PING_SIZE);
-                                ALOGW("%zd extra characters after iptables response: '%s...'",
-                                      extra, output->substr(pos + PING_SIZE, 128).c_str());
+                        if (i == IptablesProcess::STDOUT_IDX) {
+                            // i == STDOUT_IDX: accumulate stdout into *output, and look
+                            // for the ping response.
+                            output->append(buffer, size);
+                            size_t pos = output->find(PING);
+                            if (pos != std::string::npos) {
+                                if (output->size() > pos + PING_SIZE) {
+                                    size_t extra = output->size() - (pos + PING_SIZE);
+                                    ALOGW("%zd extra characters after iptables response: '%s...'",
+                                          extra, output->substr(pos + PING_SIZE, 128).c_str());
+                                }
+                                output->resize(pos);
+                                receivedAck[p] = true;
                             }
-                            output->resize(pos);
-                            receivedAck = true;
+                        } else {
+                            // i == STDERR_IDX: accumulate stderr into errBuf.
+                            process->errBuf.append(buffer, size);
                         }
-                    } else {
-                        // i == STDERR_IDX: accumulate stderr into errBuf.
-                        process->errBuf.append(buffer, size);
+                    } while (size > 0);
+                }
+                if (pollfd.revents & POLLHUP) {
+                    // The pipe was closed. This likely means the subprocess is exiting, since
+                    // iptables-restore only closes stdin on error.
+                    if (!process->processTerminated) {
+                        notifyChildTermination(process->pid);
                     }
-                } while (size > 0);
+                    process->stop();
+                    break;
+                }
             }
-            if (pollfd.revents & POLLHUP) {
-                // The pipe was closed. This likely means the subprocess is exiting, since
-                // iptables-restore only closes stdin on error.
-                process->stop();
-                break;
+            if ((receivedAck[p] || process->processTerminated) &&
+                    pollFds[kFdsPerProcess * p].fd != -1) {
+                for (size_t i = 0; i < kFdsPerProcess; ++i) {
+                    pollFds[kFdsPerProcess * p + i].fd = -1;
+                }
+                pending--;
             }
         }
     }
 
-    if (!receivedAck && !process->processTerminated) {
-        ALOGE("Timed out waiting for response from iptables process %d", process->pid);
-        // Kill the process so that if it eventually recovers, we don't misinterpret the ping
-        // response (or any output) of the command we just sent as coming from future commands.
-        process->stop();
-    }
+    bool allAcked = true;
+    for (size_t p = 0; p < processes.size(); ++p) {
+        IptablesProcess* process = processes[p];
+        if (!receivedAck[p] && !process->processTerminated) {
+            ALOGE("Timed out waiting for response from iptables process %d", process->pid);
+            stats->timeouts++;
+            // Kill the process so that if it eventually recovers, we don't misinterpret the ping
+            // response (or any output) of the command we just sent as coming from future commands.
+            process->stop();
+        }
 
-    maybeLogStderr(process, command);
+        maybeLogStderr(process, command);
+        allAcked &= receivedAck[p];
+    }
 
-    return receivedAck;
+    return allAcked;
 }
 
 int IptablesRestoreController::execute(const IptablesTarget target, const std::string& command,
                                        std::string *output) {
-    std::lock_guard<std::mutex> lock(mLock);
+    std::vector<IptablesProcessType> types;
+    if (target == V4 || target == V4V6) {
+        types.push_back(IPTABLES_PROCESS);
+    }
+    if (target == V6 || target == V4V6) {
+        types.push_back(IP6TABLES_PROCESS);
+    }
 
-    std::string buffer;
-    if (output == nullptr) {
-        output = &buffer;
-    } else {
-        output->clear();
+    std::vector<std::unique_lock<std::mutex>> locks;
+    for (const auto type : types) {
+        locks.emplace_back((type == IPTABLES_PROCESS) ? mIpRestoreLock : mIp6RestoreLock);
     }
 
+    // Write the command to every process before waiting for any of them, so that they all work
+    // on it at the same time.
+    const auto start = std::chrono::steady_clock::now();
+    CommandStats stats;
     int res = 0;
-    if (target == V4 || target == V4V6) {
-        res |= sendCommand(IPTABLES_PROCESS, command, output);
+    std::vector<IptablesProcess*> processes;
+    for (const auto type : types) {
+        if (sendCommand(type, command)) {
+            res = -1;
+        } else {
+            processes.push_back(getProcess(type).get());
+            stats.bytesWritten += command.size() + PING_SIZE;
+        }
     }
-    if (target == V6 || target == V4V6) {
-        res |= sendCommand(IP6TABLES_PROCESS, command, output);
+
+    std::vector<std::string> outputs(processes.size());
+    if (!drainAndWaitForAcks(processes, command, &outputs, &stats)) {
+        res = -1;
+    }
+    const int64_t latencyUs = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start).count();
+
+    if (output != nullptr) {
+        output->clear();
+        for (const auto& processOutput : outputs) {
+            output->append(processOutput);
+        }
     }
+
+    std::lock_guard<std::mutex> lock(mStatsLock);
+    CommandStats& total = mCommandStats[std::make_pair(getCaller(command), target)];
+    total.commands++;
+    total.failures += (res != 0);
+    total.timeouts += stats.timeouts;
+    total.retries += stats.retries;
+    total.bytesWritten += stats.bytesWritten;
+    total.totalLatencyUs += latencyUs;
+    total.latencyHistogram[getLatencyBucket(latencyUs)]++;
+
     return res;
 }
 
+IptablesRestoreController::CommandStatsMap IptablesRestoreController::getCommandStats() {
+    std::lock_guard<std::mutex> lock(mStatsLock);
+    return mCommandStats;
+}
+
+IptablesRestoreController::ProcessStats IptablesRestoreController::getProcessStats(
+        const IptablesProcessType type) {
+    std::lock_guard<std::mutex> lock(mStatsLock);
+    ProcessStats stats;
+    stats.restarts = (type == IPTABLES_PROCESS) ? mIpRestoreRestarts : mIp6RestoreRestarts;
+    stats.terminations = (type == IPTABLES_PROCESS) ? mIpRestoreTerminations.load() :
+                                                      mIp6RestoreTerminations.load();
+    return stats;
+}
+
+void IptablesRestoreController::dump(DumpWriter& dw) {
+    const CommandStatsMap commandStats = getCommandStats();
+
+    dw.incIndent();
+    dw.println("IptablesRestoreController");
+
+    dw.incIndent();
+    for (const auto type : { IPTABLES_PROCESS, IP6TABLES_PROCESS }) {
+        const ProcessStats stats = getProcessStats(type);
+        dw.println("%s: pid %d, %" PRIu64 " restarts, %" PRIu64 " terminations",
+                   (type == IPTABLES_PROCESS) ? "iptables-restore" : "ip6tables-restore",
+                   (type == IPTABLES_PROCESS) ? mIpRestorePid.load() : mIp6RestorePid.load(),
+                   stats.restarts, stats.terminations);
+    }
+
+    dw.blankline();
+    std::string buckets;
+    for (int bound : LATENCY_BUCKETS_MS) {
+        StringAppendF(&buckets, "<%d ", bound);
+    }
+    StringAppendF(&buckets, ">=%d", LATENCY_BUCKETS_MS[ARRAY_SIZE(LATENCY_BUCKETS_MS) - 1]);
+    dw.println("Commands by caller and target (latency buckets in ms: %s):", buckets.c_str());
+    dw.incIndent();
+    for (const auto& entry : commandStats) {
+        const CommandStats& stats = entry.second;
+        std::string histogram;
+        for (uint64_t count : stats.latencyHistogram) {
+            StringAppendF(&histogram, "%s%" PRIu64, histogram.empty() ? "" : " ", count);
+        }
+        dw.println("%s %s: %" PRIu64 " commands, %" PRIu64 " failures, %" PRIu64 " timeouts, "
+                   "%" PRIu64 " retries, %" PRIu64 " bytes, avg %.2fms, latency [%s]",
+                   entry.first.first.c_str(), targetName(entry.first.second), stats.commands,
+                   stats.failures, stats.timeouts, stats.retries, stats.bytesWritten,
+                   stats.totalLatencyUs / 1000.0 / stats.commands, histogram.c_str());
+    }
+    dw.decIndent();
+    dw.decIndent();
+
+    dw.decIndent();
+}
+
 int IptablesRestoreController::getIpRestorePid(const IptablesProcessType type) {
     return type == IPTABLES_PROCESS ? mIpRestore->pid : mIp6Restore->pid;
 }
@@ -17,10 +17,17 @@
 #ifndef NETD_SERVER_IPTABLES_RESTORE_CONTROLLER_H
 #define NETD_SERVER_IPTABLES_RESTORE_CONTROLLER_H
 
+#include <array>
+#include <atomic>
+#include <map>
 #include <memory>
 #include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
 #include <sys/types.h>
 
+#include "DumpWriter.h"
 #include "NetdConstants.h"
 
 class IptablesProcess;
@@ -51,17 +58,49 @@ class IptablesRestoreController final : public IptablesRestoreInterface {
         INVALID_PROCESS = -1,
     };
 
-    // Called by the SIGCHLD signal handler when it detects that one
-    // of the forked iptables[6]-restore process has died.
+    // Called when one of the forked iptables[6]-restore processes is found to have died, e.g.,
+    // because it closed its pipes. Counts the death in the process statistics.
     IptablesProcessType notifyChildTermination(pid_t pid);
 
+    // Upper bounds, in milliseconds, of all but the last latency histogram bucket.
+    static constexpr int LATENCY_BUCKETS_MS[] = { 1, 2, 5, 10, 20, 50, 100, 200, 500, 1000 };
+    static constexpr size_t NUM_LATENCY_BUCKETS = ARRAY_SIZE(LATENCY_BUCKETS_MS) + 1;
+
+    // Statistics for the commands that one caller sends to one target. Callers are told apart by
+    // the prefix of the first chain in the command, e.g., "bw" for bw_INPUT.
+    struct CommandStats {
+        uint64_t commands = 0;
+        uint64_t failures = 0;
+        // Processes that did not respond in time.
+        uint64_t timeouts = 0;
+        // Polls that returned without any output.
+        uint64_t retries = 0;
+        uint64_t bytesWritten = 0;
+        uint64_t totalLatencyUs = 0;
+        std::array<uint64_t, NUM_LATENCY_BUCKETS> latencyHistogram = {};
+    };
+    typedef std::map<std::pair<std::string, IptablesTarget>, CommandStats> CommandStatsMap;
+
+    struct ProcessStats {
+        // Processes forked after the first one, because the previous one died or was stopped.
+        uint64_t restarts = 0;
+        // Processes that died rather than being stopped by the controller.
+        uint64_t terminations = 0;
+    };
+
+    CommandStatsMap getCommandStats();
+    ProcessStats getProcessStats(const IptablesProcessType type);
+
+    void dump(android::net::DumpWriter& dw);
+
 protected:
     friend class IptablesRestoreControllerTest;
     pid_t getIpRestorePid(const IptablesProcessType type);
 
     // The maximum number of times we poll(2) for a response on our set of polled
     // fds. Chosen so that the overall timeout is 5s. The timeout is so high because
-    // our version of iptables still polls every second in xtables_lock.
+    // our version of iptables still polls every second in xtables_lock. When a command
+    // is sent to both processes, they share this budget.
     static int MAX_RETRIES;
 
     // The timeout (in millis) for each call to poll. The maximum wait is
@@ -73,21 +112,46 @@ protected:
 private:
     static IptablesProcess* forkAndExec(const IptablesProcessType type);
 
-    int sendCommand(const IptablesProcessType type, const std::string& command,
-                    std::string *output);
+    std::unique_ptr<IptablesProcess>& getProcess(const IptablesProcessType type);
+    void resetProcess(const IptablesProcessType type, IptablesProcess* process);
+
+    // Starts a process for |type| if there is no running one, and sends it |command| followed by
+    // a ping. Does not wait for the response.
+    int sendCommand(const IptablesProcessType type, const std::string& command);
 
-    static bool drainAndWaitForAck(const std::unique_ptr<IptablesProcess> &process,
-                                   const std::string& command,
-                                   std::string *output);
+    // Waits for all |processes| to respond to the ping that follows |command|, with a single poll
+    // set so that they process the command in parallel. Fills in one output per process.
+    bool drainAndWaitForAcks(const std::vector<IptablesProcess*>& processes,
+                             const std::string& command,
+                             std::vector<std::string>* outputs,
+                             CommandStats* stats);
 
-    static void maybeLogStderr(const std::unique_ptr<IptablesProcess> &process,
-                               const std::string& command);
+    static void maybeLogStderr(IptablesProcess* process, const std::string& command);
 
-    // Guards calls to execute().
-    std::mutex mLock;
+    // Guard calls to execute(). Each process has its own lock, so that IPv4-only and IPv6-only
+    // commands can run at the same time. Commands for both take mIpRestoreLock first.
+    std::mutex mIpRestoreLock;
+    std::mutex mIp6RestoreLock;
+
+    // Serializes forkAndExec() when a process is restarted. Two processes forked in parallel
+    // could inherit each other's pipes.
+    std::mutex mForkLock;
 
     std::unique_ptr<IptablesProcess> mIpRestore;
     std::unique_ptr<IptablesProcess> mIp6Restore;
+
+    // The PIDs of the current processes, for notifyChildTermination(), which cannot take locks.
+    std::atomic<pid_t> mIpRestorePid{0};
+    std::atomic<pid_t> mIp6RestorePid{0};
+    std::atomic<uint64_t> mIpRestoreTerminations{0};
+    std::atomic<uint64_t> mIp6RestoreTerminations{0};
+
+    // Guards the statistics below. Only held to update or copy them, never while waiting for a
+    // process.
+    std::mutex mStatsLock;
+    CommandStatsMap mCommandStats;
+    uint64_t mIpRestoreRestarts = 0;
+    uint64_t mIp6RestoreRestarts = 0;
 };
 
 #endif  // NETD_SERVER_IPTABLES_RESTORE_CONTROLLER_H
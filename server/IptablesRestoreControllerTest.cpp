@@ -15,6 +15,7 @@
  */
 
 #include <string>
+#include <thread>
 #include <fcntl.h>
 #include <sys/file.h>
 #include <sys/socket.h>
@@ -194,6 +195,10 @@ TEST_F(IptablesRestoreControllerTest, TestRestartOnProcessDeath) {
 
   pid_t pid4 = getIpRestorePid(IptablesRestoreController::IPTABLES_PROCESS);
   pid_t pid6 = getIpRestorePid(IptablesRestoreController::IP6TABLES_PROCESS);
+  const auto terminations4 =
+      con.getProcessStats(IptablesRestoreController::IPTABLES_PROCESS).terminations;
+  const auto terminations6 =
+      con.getProcessStats(IptablesRestoreController::IP6TABLES_PROCESS).terminations;
 
   ASSERT_EQ(0, kill(pid4, 0)) << "iptables-restore pid " << pid4 << " does not exist";
   ASSERT_EQ(0, kill(pid6, 0)) << "ip6tables-restore pid " << pid6 << " does not exist";
@@ -208,6 +213,12 @@ TEST_F(IptablesRestoreControllerTest, TestRestartOnProcessDeath) {
   EXPECT_NE(pid4, getIpRestorePid(IptablesRestoreController::IPTABLES_PROCESS));
   EXPECT_NE(pid6, getIpRestorePid(IptablesRestoreController::IP6TABLES_PROCESS));
 
+  // The deaths are counted, unlike processes that the controller stops itself.
+  EXPECT_EQ(terminations4 + 1,
+            con.getProcessStats(IptablesRestoreController::IPTABLES_PROCESS).terminations);
+  EXPECT_EQ(terminations6 + 1,
+            con.getProcessStats(IptablesRestoreController::IP6TABLES_PROCESS).terminations);
+
   // Check there are no zombies.
   expectNoIptablesRestoreProcess(pid4);
   expectNoIptablesRestoreProcess(pid6);
@@ -250,6 +261,81 @@ TEST_F(IptablesRestoreControllerTest, TestCommandTimeout) {
   EXPECT_EQ(expected, output);
 }
 
+TEST_F(IptablesRestoreControllerTest, TestConcurrentCommands) {
+  const std::string v4Expected = Join(std::vector<std::string>{
+      StringPrintf("Chain %s (0 references)", mChainName.c_str()),
+      "target     prot opt source               destination         ",
+      "RETURN     all  --  0.0.0.0/0            0.0.0.0/0           ",
+      ""
+  }, "\n");
+  const std::string v6Expected = Join(std::vector<std::string>{
+      StringPrintf("Chain %s (0 references)", mChainName.c_str()),
+      "target     prot opt source               destination         ",
+      "RETURN     all      ::/0                 ::/0                ",
+      ""
+  }, "\n");
+  const std::string commandString =
+      StringPrintf("*filter\n-n -L %s\nCOMMIT\n", mChainName.c_str());
+
+  // IPv4-only and IPv6-only commands do not wait for each other, and each one only sees the
+  // output of its own process.
+  constexpr int kIterations = 20;
+  std::thread v6Thread([&] {
+    for (int i = 0; i < kIterations; i++) {
+      std::string output;
+      EXPECT_EQ(0, con.execute(IptablesTarget::V6, commandString, &output));
+      EXPECT_EQ(v6Expected, output);
+    }
+  });
+  for (int i = 0; i < kIterations; i++) {
+    std::string output;
+    EXPECT_EQ(0, con.execute(IptablesTarget::V4, commandString, &output));
+    EXPECT_EQ(v4Expected, output);
+    EXPECT_EQ(0, con.execute(IptablesTarget::V4V6, commandString, &output));
+    EXPECT_EQ(v4Expected + v6Expected, output);
+  }
+  v6Thread.join();
+}
+
+TEST_F(IptablesRestoreControllerTest, TestCommandStats) {
+  // Don't wait 10 seconds for the timeout.
+  setRetryParameters(3, 50);
+
+  // The test chain is named netd_unit_test_NNNN, so commands on it are attributed to "netd".
+  const auto key = std::make_pair(std::string("netd"), IptablesTarget::V4);
+  const auto before = con.getCommandStats()[key];
+  const std::string commandString =
+      StringPrintf("*filter\n-n -L %s\nCOMMIT\n", mChainName.c_str());
+
+  EXPECT_EQ(0, con.execute(IptablesTarget::V4, commandString, nullptr));
+  ASSERT_EQ(0, acquireIptablesLock());
+  EXPECT_EQ(-1, con.execute(IptablesTarget::V4, commandString, nullptr));
+  releaseIptablesLock();
+
+  const auto after = con.getCommandStats()[key];
+  EXPECT_EQ(before.commands + 2, after.commands);
+  EXPECT_EQ(before.failures + 1, after.failures);
+  EXPECT_EQ(before.timeouts + 1, after.timeouts);
+  EXPECT_LE(before.retries + 1, after.retries);
+  EXPECT_LT(before.bytesWritten + 2 * commandString.size(), after.bytesWritten);
+  uint64_t histogramTotal = 0;
+  for (uint64_t count : after.latencyHistogram) histogramTotal += count;
+  EXPECT_EQ(after.commands, histogramTotal);
+
+  // The timed out process is replaced by the next command.
+  const auto restarts = con.getProcessStats(IptablesRestoreController::IPTABLES_PROCESS).restarts;
+  EXPECT_EQ(0, con.execute(IptablesTarget::V4, commandString, nullptr));
+  EXPECT_EQ(restarts + 1,
+            con.getProcessStats(IptablesRestoreController::IPTABLES_PROCESS).restarts);
+
+  // The timed out process was stopped, so it does not count as terminated.
+  EXPECT_EQ(0U, con.getProcessStats(IptablesRestoreController::IPTABLES_PROCESS).terminations);
+  const pid_t pid4 = getIpRestorePid(IptablesRestoreController::IPTABLES_PROCESS);
+  EXPECT_EQ(IptablesRestoreController::IPTABLES_PROCESS, con.notifyChildTermination(pid4));
+  EXPECT_EQ(IptablesRestoreController::INVALID_PROCESS, con.notifyChildTermination(1));
+  EXPECT_EQ(1U, con.getProcessStats(IptablesRestoreController::IPTABLES_PROCESS).terminations);
+}
+
 TEST_F(IptablesRestoreControllerTest, TestUidRuleBenchmark) {
     const std::vector<int> ITERATIONS = { 1, 5, 10 };
 
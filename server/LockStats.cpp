@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <inttypes.h>
+
+#include <algorithm>
+
+#include "DumpWriter.h"
+#include "LockStats.h"
+
+namespace android {
+namespace net {
+
+LockStats gLockStats;
+
+namespace {
+
+uint64_t toUs(float ms) {
+    return static_cast<uint64_t>(ms * 1000);
+}
+
+}  // namespace
+
+void LockStats::record(const std::string& caller, bool shared, uint64_t waitUs, uint64_t holdUs) {
+    std::lock_guard<std::mutex> guard(mLock);
+    Stats& stats = mStats[{caller, shared}];
+    stats.acquisitions++;
+    stats.totalWaitUs += waitUs;
+    stats.maxWaitUs = std::max(stats.maxWaitUs, waitUs);
+    stats.totalHoldUs += holdUs;
+    stats.maxHoldUs = std::max(stats.maxHoldUs, holdUs);
+}
+
+LockStats::StatsMap LockStats::getStats() const {
+    std::lock_guard<std::mutex> guard(mLock);
+    return mStats;
+}
+
+void LockStats::dump(DumpWriter& dw) const {
+    const StatsMap stats = getStats();
+
+    dw.incIndent();
+    dw.println("Controller locks");
+
+    dw.incIndent();
+    dw.println("Wait and hold times by caller (avg/max ms):");
+    dw.incIndent();
+    for (const auto& entry : stats) {
+        const Stats& s = entry.second;
+        dw.println("%s %s: %" PRIu64 " acquisitions, wait %.2f/%.2f, hold %.2f/%.2f",
+                   entry.first.first.c_str(), entry.first.second ? "shared" : "exclusive",
+                   s.acquisitions, s.totalWaitUs / 1000.0 / s.acquisitions, s.maxWaitUs / 1000.0,
+                   s.totalHoldUs / 1000.0 / s.acquisitions, s.maxHoldUs / 1000.0);
+    }
+    dw.decIndent();
+    dw.decIndent();
+
+    dw.decIndent();
+}
+
+TimedLock::TimedLock(android::RWLock* lock, Mode mode, std::string caller)
+    : mLock(lock), mMode(mode), mCaller(std::move(caller)) {
+    if (mLock) {
+        if (mMode == SHARED) {
+            mLock->readLock();
+        } else {
+            mLock->writeLock();
+        }
+    }
+    mWaitMs = mHeld.getTimeAndReset();
+}
+
+TimedLock::~TimedLock() {
+    const float heldMs = mHeld.timeTaken();
+    if (mLock) {
+        mLock->unlock();
+    }
+    gLockStats.record(mCaller, mMode == SHARED, toUs(mWaitMs), toUs(heldMs));
+}
+
+}  // namespace net
+}  // namespace android
@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NETD_SERVER_LOCK_STATS_H
+#define NETD_SERVER_LOCK_STATS_H
+
+#include <stdint.h>
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+
+#include <utils/RWLock.h>
+
+#include "Stopwatch.h"
+
+namespace android {
+namespace net {
+
+class DumpWriter;
+
+/*
+ * Keeps track of how long CommandListener commands and binder RPCs wait for the controller locks
+ * that serialize them, and how long they hold them once they have them.
+ */
+class LockStats {
+public:
+    struct Stats {
+        uint64_t acquisitions = 0;
+        uint64_t totalWaitUs = 0;
+        uint64_t maxWaitUs = 0;
+        uint64_t totalHoldUs = 0;
+        uint64_t maxHoldUs = 0;
+    };
+    // Map keys are callers, and whether they took their lock shared.
+    typedef std::map<std::pair<std::string, bool>, Stats> StatsMap;
+
+    void record(const std::string& caller, bool shared, uint64_t waitUs, uint64_t holdUs);
+    StatsMap getStats() const;
+    void dump(DumpWriter& dw) const;
+
+private:
+    mutable std::mutex mLock;
+    StatsMap mStats;
+};
+
+extern LockStats gLockStats;
+
+/*
+ * Holds a controller lock, shared or exclusively, for as long as it is in scope, and records the
+ * time spent waiting for and holding it in gLockStats under |caller|.
+ *
+ * |lock| may be null for callers whose controllers do their own locking. These are recorded too,
+ * with no wait time, so that the time they take shows up alongside the others.
+ */
+class TimedLock {
+public:
+    enum Mode { EXCLUSIVE, SHARED };
+
+    TimedLock(android::RWLock* lock, Mode mode, std::string caller);
+    ~TimedLock();
+
+    TimedLock(const TimedLock&) = delete;
+    TimedLock& operator=(const TimedLock&) = delete;
+
+private:
+    android::RWLock* const mLock;
+    const Mode mMode;
+    const std::string mCaller;
+    float mWaitMs;
+    Stopwatch mHeld;
+};
+
+}  // namespace net
+}  // namespace android
+
+#endif  // NETD_SERVER_LOCK_STATS_H
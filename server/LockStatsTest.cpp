@@ -0,0 +1,94 @@
+/*
+ * Copyright 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * LockStatsTest.cpp - unit tests for LockStats.cpp
+ */
+
+#include <chrono>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include "LockStats.h"
+
+namespace android {
+namespace net {
+
+namespace {
+
+constexpr auto kHoldTime = std::chrono::milliseconds(20);
+constexpr uint64_t kHoldTimeUs = 20000;
+
+LockStats::Stats getStats(const std::string& caller, bool shared) {
+    const LockStats::StatsMap stats = gLockStats.getStats();
+    auto iter = stats.find({caller, shared});
+    return (iter == stats.end()) ? LockStats::Stats() : iter->second;
+}
+
+}  // namespace
+
+TEST(LockStatsTest, RecordAggregatesByCallerAndMode) {
+    LockStats stats;
+    stats.record("foo", false, 10, 100);
+    stats.record("foo", false, 30, 50);
+    stats.record("foo", true, 5, 5);
+
+    const LockStats::StatsMap result = stats.getStats();
+    ASSERT_EQ(2U, result.size());
+    const LockStats::Stats& exclusive = result.at({"foo", false});
+    EXPECT_EQ(2U, exclusive.acquisitions);
+    EXPECT_EQ(40U, exclusive.totalWaitUs);
+    EXPECT_EQ(30U, exclusive.maxWaitUs);
+    EXPECT_EQ(150U, exclusive.totalHoldUs);
+    EXPECT_EQ(100U, exclusive.maxHoldUs);
+    EXPECT_EQ(1U, result.at({"foo", true}).acquisitions);
+}
+
+TEST(LockStatsTest, ExclusiveWaitsForSharedHolders) {
+    android::RWLock lock;
+    std::thread exclusive;
+    {
+        // Shared holders don't wait for each other.
+        TimedLock first(&lock, TimedLock::SHARED, "LockStatsTest shared");
+        TimedLock second(&lock, TimedLock::SHARED, "LockStatsTest shared");
+        exclusive = std::thread([&lock] {
+            TimedLock writer(&lock, TimedLock::EXCLUSIVE, "LockStatsTest exclusive");
+        });
+        std::this_thread::sleep_for(kHoldTime);
+    }
+    exclusive.join();
+
+    const LockStats::Stats shared = getStats("LockStatsTest shared", true);
+    EXPECT_EQ(2U, shared.acquisitions);
+    EXPECT_LE(2 * kHoldTimeUs, shared.totalHoldUs);
+
+    const LockStats::Stats writer = getStats("LockStatsTest exclusive", false);
+    EXPECT_EQ(1U, writer.acquisitions);
+    EXPECT_LT(kHoldTimeUs / 2, writer.maxWaitUs);
+    EXPECT_GT(kHoldTimeUs / 2, writer.maxHoldUs);
+}
+
+TEST(LockStatsTest, UnlockedCallersAreTimed) {
+    {
+        TimedLock unlocked(nullptr, TimedLock::EXCLUSIVE, "LockStatsTest unlocked");
+        std::this_thread::sleep_for(kHoldTime);
+    }
+    const LockStats::Stats stats = getStats("LockStatsTest unlocked", false);
+    EXPECT_EQ(1U, stats.acquisitions);
+    EXPECT_LE(kHoldTimeUs, stats.totalHoldUs);
+}
+
+}  // namespace net
+}  // namespace android
@@ -22,7 +22,7 @@
 #include <netinet/in.h>
 #include <pthread.h>
 #include <stdlib.h>
-#include <sys/poll.h>
+#include <sys/epoll.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <string.h>
@@ -139,15 +139,12 @@ void MDnsSdListener::Handler::stop(SocketClient *cli, int argc, char **argv, con
         return;
     }
     int requestId = atoi(argv[2]);
-    DNSServiceRef *ref = mMonitor->lookupServiceRef(requestId);
-    if (ref == NULL) {
+    if (!mMonitor->deallocateServiceRef(requestId)) {
         if (DBG) ALOGE("%s stop used unknown requestId %d", str, requestId);
         cli->sendMsg(ResponseCode::CommandParameterError, "Unknown requestId", false);
         return;
     }
-    if (VDBG) ALOGD("Stopping %s with ref %p", str, ref);
-    DNSServiceRefDeallocate(*ref);
-    mMonitor->freeServiceRef(requestId);
+    if (VDBG) ALOGD("Stopped %s %d", str, requestId);
     char *msg;
     asprintf(&msg, "%s stopped", str);
     cli->sendMsg(ResponseCode::CommandOkay, msg, false);
@@ -516,13 +513,10 @@ int MDnsSdListener::Handler::runCommand(SocketClient *cli,
 }
 
 MDnsSdListener::Monitor::Monitor() {
-    mHead = NULL;
-    mLiveCount = 0;
-    mPollFds = NULL;
-    mPollRefs = NULL;
-    mPollSize = 10;
-    socketpair(AF_LOCAL, SOCK_STREAM, 0, mCtrlSocketPair);
-    pthread_mutex_init(&mHeadMutex, NULL);
+    mNextGeneration = 0;
+    mEpollFd = epoll_create1(EPOLL_CLOEXEC);
+    LOG_ALWAYS_FATAL_IF((mEpollFd == -1), "epoll_create1 failed: %s", strerror(errno));
+    pthread_mutex_init(&mMutex, NULL);
 
     const int rval = ::android::net::threadLaunch(this);
     if (rval != 0) {
@@ -554,7 +548,7 @@ static int wait_for_property(const char *name, const char *desired_value, int ma
 int MDnsSdListener::Monitor::startService() {
     int result = 0;
     char property_value[PROPERTY_VALUE_MAX];
-    pthread_mutex_lock(&mHeadMutex);
+    pthread_mutex_lock(&mMutex);
     property_get(MDNS_SERVICE_STATUS, property_value, "");
     if (strcmp("running", property_value) != 0) {
         ALOGD("Starting MDNSD");
@@ -564,14 +558,14 @@ int MDnsSdListener::Monitor::startService() {
     } else {
         result = 0;
     }
-    pthread_mutex_unlock(&mHeadMutex);
+    pthread_mutex_unlock(&mMutex);
     return result;
 }
 
 int MDnsSdListener::Monitor::stopService() {
     int result = 0;
-    pthread_mutex_lock(&mHeadMutex);
-    if (mHead == NULL) {
+    pthread_mutex_lock(&mMutex);
+    if (mElements.empty()) {
         ALOGD("Stopping MDNSD");
         property_set("ctl.stop", MDNS_SERVICE_NAME);
         wait_for_property(MDNS_SERVICE_STATUS, "stopped", 5);
@@ -579,186 +573,114 @@ int MDnsSdListener::Monitor::stopService() {
     } else {
         result = 0;
     }
-    pthread_mutex_unlock(&mHeadMutex);
+    pthread_mutex_unlock(&mMutex);
     return result;
 }
 
-void MDnsSdListener::Monitor::run() {
-    int pollCount = 1;
-
-    mPollFds = (struct pollfd *)calloc(sizeof(struct pollfd), mPollSize);
-    mPollRefs = (DNSServiceRef **)calloc(sizeof(DNSServiceRef *), mPollSize);
-    LOG_ALWAYS_FATAL_IF((mPollFds == NULL), "initial calloc failed on mPollFds with a size of %d",
-            ((int)sizeof(struct pollfd)) * mPollSize);
-    LOG_ALWAYS_FATAL_IF((mPollRefs == NULL), "initial calloc failed on mPollRefs with a size of %d",
-            ((int)sizeof(DNSServiceRef *)) * mPollSize);
+#define MAX_EPOLL_EVENTS 16
 
-    mPollFds[0].fd = mCtrlSocketPair[0];
-    mPollFds[0].events = POLLIN;
+void MDnsSdListener::Monitor::run() {
+    struct epoll_event events[MAX_EPOLL_EVENTS];
 
     if (VDBG) ALOGD("MDnsSdListener starting to monitor");
     while (1) {
-        if (VDBG) ALOGD("Going to poll with pollCount %d", pollCount);
-        int pollResults = poll(mPollFds, pollCount, 10000000);
-        if (pollResults < 0) {
-            ALOGE("Error in poll - got %d", errno);
-        } else if (pollResults > 0) {
-            if (VDBG) ALOGD("Monitor poll got data pollCount = %d, %d", pollCount, pollResults);
-            for(int i = 1; i < pollCount; i++) {
-                if (mPollFds[i].revents != 0) {
-                    if (VDBG) {
-                        ALOGD("Monitor found [%d].revents = %d - calling ProcessResults",
-                                i, mPollFds[i].revents);
-                    }
-                    DNSServiceProcessResult(*(mPollRefs[i]));
-                    mPollFds[i].revents = 0;
-                }
-            }
-            if (VDBG) ALOGD("controlSocket shows revent= %d", mPollFds[0].revents);
-            switch (mPollFds[0].revents) {
-                case POLLIN: {
-                    char readBuf[2];
-                    read(mCtrlSocketPair[0], &readBuf, 1);
-                    if (DBG) ALOGD("MDnsSdListener::Monitor got %c", readBuf[0]);
-                    if (memcmp(RESCAN, readBuf, 1) == 0) {
-                        pollCount = rescan();
-                    }
-                }
-            }
-            mPollFds[0].revents = 0;
-        } else {
-            if (VDBG) ALOGD("MDnsSdListener::Monitor poll timed out");
+        int eventCount = epoll_wait(mEpollFd, events, MAX_EPOLL_EVENTS, -1);
+        if (eventCount < 0) {
+            if (errno != EINTR) ALOGE("Error in epoll_wait - got %d", errno);
+            continue;
         }
-    }
-    free(mPollFds);
-    free(mPollRefs);
-}
-
-#define DBG_RESCAN 0
-
-int MDnsSdListener::Monitor::rescan() {
-// rescan the list from mHead and make new pollfds and serviceRefs
-    if (VDBG) {
-        ALOGD("MDnsSdListener::Monitor poll rescanning - size=%d, live=%d", mPollSize, mLiveCount);
-    }
-    pthread_mutex_lock(&mHeadMutex);
-    Element **prevPtr = &mHead;
-    int i = 1;
-    if (mPollSize <= mLiveCount) {
-        mPollSize = mLiveCount + 5;
-        free(mPollFds);
-        free(mPollRefs);
-        mPollFds = (struct pollfd *)calloc(sizeof(struct pollfd), mPollSize);
-        mPollRefs = (DNSServiceRef **)calloc(sizeof(DNSServiceRef *), mPollSize);
-        LOG_ALWAYS_FATAL_IF((mPollFds == NULL), "calloc failed on mPollFds with a size of %d",
-                ((int)sizeof(struct pollfd)) * mPollSize);
-        LOG_ALWAYS_FATAL_IF((mPollRefs == NULL), "calloc failed on mPollRefs with a size of %d",
-                ((int)sizeof(DNSServiceRef *)) * mPollSize);
-    } else {
-        memset(mPollFds, 0, sizeof(struct pollfd) * mPollSize);
-        memset(mPollRefs, 0, sizeof(DNSServiceRef *) * mPollSize);
-    }
-    mPollFds[0].fd = mCtrlSocketPair[0];
-    mPollFds[0].events = POLLIN;
-    if (DBG_RESCAN) ALOGD("mHead = %p", mHead);
-    while (*prevPtr != NULL) {
-        if (DBG_RESCAN) ALOGD("checking %p, mReady = %d", *prevPtr, (*prevPtr)->mReady);
-        if ((*prevPtr)->mReady == 1) {
-            int fd = DNSServiceRefSockFD((*prevPtr)->mRef);
-            if (fd != -1) {
-                if (DBG_RESCAN) ALOGD("  adding FD %d", fd);
-                mPollFds[i].fd = fd;
-                mPollFds[i].events = POLLIN;
-                mPollRefs[i] = &((*prevPtr)->mRef);
-                i++;
-            } else {
-                ALOGE("Error retreving socket FD for live ServiceRef");
+        for (int i = 0; i < eventCount; i++) {
+            const int id = static_cast<int>(events[i].data.u64 & 0xffffffff);
+            const uint32_t generation = static_cast<uint32_t>(events[i].data.u64 >> 32);
+            if (VDBG) {
+                ALOGD("Monitor found %d events = %d - calling ProcessResults",
+                        id, events[i].events);
             }
-            prevPtr = &((*prevPtr)->mNext); // advance to the next element
-        } else if ((*prevPtr)->mReady == -1) {
-            if (DBG_RESCAN) ALOGD("  removing %p from  play", *prevPtr);
-            Element *cur = *prevPtr;
-            *prevPtr = (cur)->mNext; // change our notion of this element and don't advance
-            delete cur;
-        } else if ((*prevPtr)->mReady == 0) {
-            // Not ready so just skip this node and continue on
-            if (DBG_RESCAN) ALOGD("%p not ready.  Continuing.", *prevPtr);
-            prevPtr = &((*prevPtr)->mNext);
+            // Processing the result under the lock keeps the ref from being deallocated under us.
+            // The event may be stale: the ref may have been freed, and even its id reused, since
+            // epoll_wait returned.
+            pthread_mutex_lock(&mMutex);
+            auto it = mElements.find(id);
+            if (it != mElements.end() && it->second->mReady &&
+                    it->second->mGeneration == generation) {
+                DNSServiceProcessResult(it->second->mRef);
+            }
+            pthread_mutex_unlock(&mMutex);
         }
     }
-    pthread_mutex_unlock(&mHeadMutex);
-    return i;
 }
 
 DNSServiceRef *MDnsSdListener::Monitor::allocateServiceRef(int id, Context *context) {
-    if (lookupServiceRef(id) != NULL) {
+    pthread_mutex_lock(&mMutex);
+    auto inserted = mElements.emplace(id, nullptr);
+    if (!inserted.second) {
+        pthread_mutex_unlock(&mMutex);
         delete(context);
         return NULL;
     }
     Element *e = new Element(id, context);
-    pthread_mutex_lock(&mHeadMutex);
-    e->mNext = mHead;
-    mHead = e;
-    pthread_mutex_unlock(&mHeadMutex);
+    inserted.first->second.reset(e);
+    pthread_mutex_unlock(&mMutex);
     return &(e->mRef);
 }
 
-DNSServiceRef *MDnsSdListener::Monitor::lookupServiceRef(int id) {
-    pthread_mutex_lock(&mHeadMutex);
-    Element *cur = mHead;
-    while (cur != NULL) {
-        if (cur->mId == id) {
-            DNSServiceRef *result = &(cur->mRef);
-            pthread_mutex_unlock(&mHeadMutex);
-            return result;
+void MDnsSdListener::Monitor::startMonitoring(int id) {
+    if (VDBG) ALOGD("startMonitoring %d", id);
+    pthread_mutex_lock(&mMutex);
+    auto it = mElements.find(id);
+    if (it != mElements.end()) {
+        Element *e = it->second.get();
+        int fd = DNSServiceRefSockFD(e->mRef);
+        if (fd != -1) {
+            e->mGeneration = mNextGeneration++;
+            struct epoll_event event = {};
+            event.events = EPOLLIN;
+            event.data.u64 = (static_cast<uint64_t>(e->mGeneration) << 32) |
+                    static_cast<uint32_t>(id);
+            if (epoll_ctl(mEpollFd, EPOLL_CTL_ADD, fd, &event) == 0) {
+                e->mReady = true;
+            } else {
+                ALOGE("Error adding ServiceRef %d to epoll set: %s", id, strerror(errno));
+            }
+        } else {
+            ALOGE("Error retreving socket FD for live ServiceRef");
         }
-        cur = cur->mNext;
     }
-    pthread_mutex_unlock(&mHeadMutex);
-    return NULL;
+    pthread_mutex_unlock(&mMutex);
 }
 
-void MDnsSdListener::Monitor::startMonitoring(int id) {
-    if (VDBG) ALOGD("startMonitoring %d", id);
-    pthread_mutex_lock(&mHeadMutex);
-    Element *cur = mHead;
-    while (cur != NULL) {
-        if (cur->mId == id) {
-            if (DBG_RESCAN) ALOGD("marking %p as ready to be added", cur);
-            mLiveCount++;
-            cur->mReady = 1;
-            pthread_mutex_unlock(&mHeadMutex);
-            write(mCtrlSocketPair[1], RESCAN, 1);  // trigger a rescan for a fresh poll
-            if (VDBG) ALOGD("triggering rescan");
-            return;
-        }
-        cur = cur->mNext;
+// Must be called with mMutex held.
+void MDnsSdListener::Monitor::stopMonitoring(Element *e) {
+    if (!e->mReady) return;
+    int fd = DNSServiceRefSockFD(e->mRef);
+    if (fd != -1 && epoll_ctl(mEpollFd, EPOLL_CTL_DEL, fd, NULL) != 0) {
+        ALOGE("Error removing ServiceRef %d from epoll set: %s", e->mId, strerror(errno));
     }
-    pthread_mutex_unlock(&mHeadMutex);
+    e->mReady = false;
 }
 
 void MDnsSdListener::Monitor::freeServiceRef(int id) {
     if (VDBG) ALOGD("freeServiceRef %d", id);
-    pthread_mutex_lock(&mHeadMutex);
-    Element **prevPtr = &mHead;
-    Element *cur;
-    while (*prevPtr != NULL) {
-        cur = *prevPtr;
-        if (cur->mId == id) {
-            if (DBG_RESCAN) ALOGD("marking %p as ready to be removed", cur);
-            mLiveCount--;
-            if (cur->mReady == 1) {
-                cur->mReady = -1; // tell poll thread to delete
-                write(mCtrlSocketPair[1], RESCAN, 1); // trigger a rescan for a fresh poll
-                if (VDBG) ALOGD("triggering rescan");
-            } else {
-                *prevPtr = cur->mNext;
-                delete cur;
-            }
-            pthread_mutex_unlock(&mHeadMutex);
-            return;
-        }
-        prevPtr = &(cur->mNext);
+    pthread_mutex_lock(&mMutex);
+    auto it = mElements.find(id);
+    if (it != mElements.end()) {
+        stopMonitoring(it->second.get());
+        mElements.erase(it);
     }
-    pthread_mutex_unlock(&mHeadMutex);
+    pthread_mutex_unlock(&mMutex);
+}
+
+bool MDnsSdListener::Monitor::deallocateServiceRef(int id) {
+    if (VDBG) ALOGD("deallocateServiceRef %d", id);
+    pthread_mutex_lock(&mMutex);
+    auto it = mElements.find(id);
+    if (it == mElements.end()) {
+        pthread_mutex_unlock(&mMutex);
+        return false;
+    }
+    stopMonitoring(it->second.get());
+    DNSServiceRefDeallocate(it->second->mRef);
+    mElements.erase(it);
+    pthread_mutex_unlock(&mMutex);
+    return true;
 }
@@ -21,6 +21,9 @@
 #include <sysutils/FrameworkListener.h>
 #include <dns_sd.h>
 
+#include <memory>
+#include <unordered_map>
+
 #include "NetdCommand.h"
 
 // callbacks
@@ -44,8 +47,6 @@ void MDnsSdListenerGetAddrInfoCallback(DNSServiceRef sdRef, DNSServiceFlags flag
         uint32_t interface, DNSServiceErrorType errorCode, const char *hostname,
         const struct sockaddr *const sa, uint32_t ttl, void *inContext);
 
-#define RESCAN "1"
-
 class MDnsSdListener : public FrameworkListener {
 public:
     MDnsSdListener();
@@ -74,32 +75,34 @@ private:
         virtual ~Monitor() {}
         DNSServiceRef *allocateServiceRef(int id, Context *c);
         void startMonitoring(int id);
-        DNSServiceRef *lookupServiceRef(int id);
         void freeServiceRef(int id);
+        // Stops monitoring and deallocates the ref of request |id|, then frees it. Returns false
+        // if there is no such request.
+        bool deallocateServiceRef(int id);
         int startService();
         int stopService();
         void run();
 
     private:
-        int rescan(); // returns the number of elements in the poll
         class Element {
         public:
-            int mId;
-            Element *mNext;
+            const int mId;
             DNSServiceRef mRef;
             Context *mContext;
-            int mReady;
+            bool mReady;  // mRef is initialized and its socket is in the epoll set.
+            uint32_t mGeneration;  // Tells the refs of requests that reused an id apart.
             Element(int id, Context *context)
-                    : mId(id), mNext(NULL), mContext(context), mReady(0) {}
+                    : mId(id), mRef(NULL), mContext(context), mReady(false), mGeneration(0) {}
             virtual ~Element() { delete(mContext); }
         };
-        Element *mHead;
-        int mLiveCount;
-        struct pollfd *mPollFds;
-        DNSServiceRef **mPollRefs;
-        int mPollSize;
-        int mCtrlSocketPair[2];
-        pthread_mutex_t mHeadMutex;
+        void stopMonitoring(Element *e);
+
+        // Keyed by request id. Each ref is used both by the thread running the command that owns
+        // it and by the monitor thread, so all of these are guarded by mMutex.
+        std::unordered_map<int, std::unique_ptr<Element>> mElements;
+        uint32_t mNextGeneration;
+        int mEpollFd;
+        pthread_mutex_t mMutex;
     };
 
     class Handler : public NetdCommand {
@@ -42,12 +42,18 @@ using netdutils::sSyscalls;
 using netdutils::findWithDefault;
 using netdutils::status::ok;
 using netdutils::extract;
+using netdutils::isOk;
 
 constexpr int kNFLogConfigMsgType = (NFNL_SUBSYS_ULOG << 8) | NFULNL_MSG_CONFIG;
 constexpr int kNFLogPacketMsgType = (NFNL_SUBSYS_ULOG << 8) | NFULNL_MSG_PACKET;
 constexpr int kNetlinkDoneMsgType = (NFNL_SUBSYS_NONE << 8) | NLMSG_DONE;
-constexpr size_t kPacketRange = 0;
-constexpr size_t kCopyMode = NFULNL_COPY_NONE;
+
+// Largest batch of messages the kernel accumulates for a group before sending it, and so the
+// largest datagram we need to receive. The kernel default is a single page.
+constexpr uint32_t kNFLogBufSize = 8192;
+// Datagrams received per recvmmsg(), and the socket buffer that holds them while we are busy.
+constexpr size_t kNFLogBatchSize = 16;
+constexpr int kNFLogRcvBufSize = 256 * 1024;
 
 namespace {
 
@@ -102,6 +108,26 @@ Status cfgMode(const SendFn& send, uint16_t nfLogGroup, uint32_t range, uint8_t
     return send(makeSlice(msg));
 }
 
+// Set the size of the buffer in which the kernel batches NFLOG messages marked with nfLogGroup.
+Status cfgNlBufSize(const SendFn& send, uint16_t nfLogGroup, uint32_t size) {
+    struct {
+        nlmsghdr nlhdr;
+        nfgenmsg nfhdr;
+        nfattr attr;
+        uint32_t size;
+    } __attribute__((packed)) msg = {};
+
+    msg.nlhdr.nlmsg_len = sizeof(msg);
+    msg.nlhdr.nlmsg_type = kNFLogConfigMsgType;
+    msg.nlhdr.nlmsg_flags = NLM_F_REQUEST;
+    msg.nfhdr.nfgen_family = AF_UNSPEC;
+    msg.nfhdr.res_id = htobe16(nfLogGroup);
+    msg.attr.nfa_len = sizeof(msg.attr) + sizeof(msg.size);
+    msg.attr.nfa_type = NFULA_CFG_NLBUFSIZ;
+    msg.size = htobe32(size);
+    return send(makeSlice(msg));
+}
+
 // Request that NFLOG messages marked with nfLogGroup are delivered to this socket
 Status cfgCmdBind(const SendFn& send, uint16_t nfLogGroup) {
     struct {
@@ -145,13 +171,13 @@ Status cfgCmdUnbind(const SendFn& send, uint16_t nfLogGroup) {
 }  // namespace
 
 NFLogListener::NFLogListener(std::shared_ptr<NetlinkListenerInterface> listener)
-    : mListener(std::move(listener)) {
+    : mListener(std::move(listener)), mDispatchMap(std::make_unique<DispatchMap>()) {
     // Rx handler extracts nfgenmsg looks up and invokes registered dispatch function.
     const auto rxHandler = [this](const nlmsghdr& nlmsg, const Slice msg) {
         nfgenmsg nfmsg = {};
         extract(msg, nfmsg);
-        std::lock_guard<std::mutex> guard(mMutex);
-        const auto& fn = findWithDefault(mDispatchMap, be16toh(nfmsg.res_id), kDefaultDispatchFn);
+        const auto dispatchMap = mDispatchMap.read();
+        const auto& fn = findWithDefault(*dispatchMap, be16toh(nfmsg.res_id), kDefaultDispatchFn);
         fn(nlmsg, nfmsg, drop(msg, sizeof(nfmsg)));
     };
     expectOk(mListener->subscribe(kNFLogPacketMsgType, rxHandler));
@@ -170,22 +196,28 @@ NFLogListener::~NFLogListener() {
     expectOk(mListener->unsubscribe(kNFLogPacketMsgType));
     expectOk(mListener->unsubscribe(kNetlinkDoneMsgType));
     const auto sendFn = [this](const Slice msg) { return mListener->send(msg); };
-    for (auto pair : mDispatchMap) {
+    for (const auto& pair : *mDispatchMap.read()) {
         expectOk(cfgCmdUnbind(sendFn, pair.first));
     }
 }
 
-Status NFLogListener::subscribe(uint16_t nfLogGroup, const DispatchFn& fn) {
+Status NFLogListener::subscribe(uint16_t nfLogGroup, uint32_t copyRange, const DispatchFn& fn) {
     const auto sendFn = [this](const Slice msg) { return mListener->send(msg); };
     // Install fn into the dispatch map BEFORE requesting delivery of messages
     {
         std::lock_guard<std::mutex> guard(mMutex);
-        mDispatchMap[nfLogGroup] = fn;
+        auto dispatchMap = std::make_unique<DispatchMap>(*mDispatchMap.read());
+        (*dispatchMap)[nfLogGroup] = fn;
+        mDispatchMap.publish(std::move(dispatchMap));
     }
     RETURN_IF_NOT_OK(cfgCmdBind(sendFn, nfLogGroup));
 
+    // Batches must fit in the datagrams that the NetlinkListener receives
+    RETURN_IF_NOT_OK(cfgNlBufSize(sendFn, nfLogGroup, kNFLogBufSize));
+
     // Mode must be set for every nfLogGroup
-    return cfgMode(sendFn, nfLogGroup, kPacketRange, kCopyMode);
+    const uint8_t copyMode = copyRange > 0 ? NFULNL_COPY_PACKET : NFULNL_COPY_NONE;
+    return cfgMode(sendFn, nfLogGroup, copyRange, copyMode);
 }
 
 Status NFLogListener::unsubscribe(uint16_t nfLogGroup) {
@@ -194,11 +226,17 @@ Status NFLogListener::unsubscribe(uint16_t nfLogGroup) {
     // Remove from the dispatch map AFTER stopping message delivery.
     {
         std::lock_guard<std::mutex> guard(mMutex);
-        mDispatchMap.erase(nfLogGroup);
+        auto dispatchMap = std::make_unique<DispatchMap>(*mDispatchMap.read());
+        dispatchMap->erase(nfLogGroup);
+        mDispatchMap.publish(std::move(dispatchMap));
     }
     return ok;
 }
 
+NetlinkListenerInterface::Stats NFLogListener::getStats() const {
+    return mListener->getStats();
+}
+
 StatusOr<std::unique_ptr<NFLogListener>> makeNFLogListener() {
     const auto& sys = sSyscalls.get();
     ASSIGN_OR_RETURN(auto event, sys.eventfd(0, EFD_CLOEXEC));
@@ -210,8 +248,17 @@ StatusOr<std::unique_ptr<NFLogListener>> makeNFLogListener() {
     // Timestamps are disabled by default. Request RX timestamping
     RETURN_IF_NOT_OK(sys.setsockopt<int32_t>(sock, SOL_SOCKET, SO_TIMESTAMP, 1));
 
-    std::shared_ptr<NetlinkListenerInterface> listener =
-        std::make_unique<NetlinkListener>(std::move(event), std::move(sock));
+    // Leave room for bursts of wakeup packets. SO_RCVBUFFORCE ignores rmem_max but needs
+    // CAP_NET_ADMIN; without it, take as much as rmem_max allows.
+    if (!isOk(sys.setsockopt<int32_t>(sock, SOL_SOCKET, SO_RCVBUFFORCE, kNFLogRcvBufSize))) {
+        const auto status = sys.setsockopt<int32_t>(sock, SOL_SOCKET, SO_RCVBUF, kNFLogRcvBufSize);
+        if (!isOk(status)) {
+            ALOGW("Unable to set NFLOG socket buffer size: %s", toString(status).c_str());
+        }
+    }
+
+    std::shared_ptr<NetlinkListenerInterface> listener = std::make_unique<NetlinkListener>(
+        std::move(event), std::move(sock), kNFLogBufSize, kNFLogBatchSize);
     const auto sendFn = [&listener](const Slice msg) { return listener->send(msg); };
     RETURN_IF_NOT_OK(cfgCmdPfUnbind(sendFn));
     return std::unique_ptr<NFLogListener>(new NFLogListener(std::move(listener)));
@@ -38,12 +38,26 @@ class NFLogListenerInterface {
     // Threadsafe.
     // All dispatch functions invoked on a single service thread.
     // subscribe() and join() must not be called from the stack of fn().
-    virtual netdutils::Status subscribe(uint16_t nfLogGroup, const DispatchFn& fn) = 0;
+    netdutils::Status subscribe(uint16_t nfLogGroup, const DispatchFn& fn) {
+        return subscribe(nfLogGroup, 0, fn);
+    }
+
+    // As above, but also requests that the first |copyRange| bytes of
+    // each logged packet, starting at the network header, are delivered
+    // in the NFULA_PAYLOAD attribute. No payload is delivered if
+    // |copyRange| is 0.
+    virtual netdutils::Status subscribe(uint16_t nfLogGroup, uint32_t copyRange,
+                                        const DispatchFn& fn) = 0;
 
     // Halt delivery of messages from a nfLogGroup previously subscribed to above.
     //
     // Threadsafe.
     virtual netdutils::Status unsubscribe(uint16_t nfLogGroup) = 0;
+
+    // Counters of the underlying NetlinkListener.
+    //
+    // Threadsafe.
+    virtual NetlinkListenerInterface::Stats getStats() const = 0;
 };
 
 // NFLogListener manages a single netlink socket with specialized
@@ -62,14 +76,21 @@ class NFLogListener : public NFLogListenerInterface {
 
     ~NFLogListener() override;
 
-    netdutils::Status subscribe(uint16_t nfLogGroup, const DispatchFn& fn) override;
+    using NFLogListenerInterface::subscribe;
+
+    netdutils::Status subscribe(uint16_t nfLogGroup, uint32_t copyRange,
+                                const DispatchFn& fn) override;
 
     netdutils::Status unsubscribe(uint16_t nfLogGroup) override;
 
+    NetlinkListenerInterface::Stats getStats() const override;
+
   private:
+    using DispatchMap = std::map<uint16_t, DispatchFn>;
+
     std::shared_ptr<NetlinkListenerInterface> mListener;
-    std::mutex mMutex;
-    std::map<uint16_t, DispatchFn> mDispatchMap;  // guarded by mMutex
+    std::mutex mMutex;  // Serializes changes to mDispatchMap
+    SnapshotPublisher<DispatchMap> mDispatchMap;
 };
 
 // Allocate and return a new NFLogListener. On success, the returned
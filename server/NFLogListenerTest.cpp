@@ -17,7 +17,10 @@
 #include <atomic>
 #include <deque>
 #include <iostream>
+#include <memory>
 #include <mutex>
+#include <string>
+#include <vector>
 
 #include <endian.h>
 #include <gmock/gmock.h>
@@ -58,6 +61,7 @@ class MockNetlinkListener : public NetlinkListenerInterface {
     MOCK_METHOD1(send, netdutils::Status(const netdutils::Slice msg));
     MOCK_METHOD2(subscribe, netdutils::Status(uint16_t type, const DispatchFn& fn));
     MOCK_METHOD1(unsubscribe, netdutils::Status(uint16_t type));
+    MOCK_CONST_METHOD0(getStats, Stats());
     MOCK_METHOD0(join, void());
 };
 
@@ -79,8 +83,9 @@ class NFLogListenerTest : public testing::Test {
     static StatusOr<size_t> sendOk(const Slice buf) { return buf.size(); }
 
     void subscribe(uint16_t type, NFLogListenerInterface::DispatchFn fn) {
-        // Two sends for cfgCmdBind() & cfgMode(), one send at destruction time for cfgCmdUnbind()
-        EXPECT_CALL(*mNLListener, send(_)).Times(Exactly(3)).WillRepeatedly(Invoke(sendOk));
+        // Three sends for cfgCmdBind(), cfgNlBufSize() & cfgMode(), one send at destruction time
+        // for cfgCmdUnbind()
+        EXPECT_CALL(*mNLListener, send(_)).Times(Exactly(4)).WillRepeatedly(Invoke(sendOk));
         mListener->subscribe(type, fn);
     }
 
@@ -109,6 +114,36 @@ TEST_F(NFLogListenerTest, subscribe) {
     subscribe(kType, dispatchFn);
 }
 
+TEST_F(NFLogListenerTest, subscribeWithCopyRange) {
+    constexpr uint16_t kType = 38;
+    constexpr uint32_t kCopyRange = 128;
+    // Outlives this test, for the cfgCmdUnbind() sent when mListener is destroyed.
+    const auto sent = std::make_shared<std::vector<std::string>>();
+    EXPECT_CALL(*mNLListener, send(_))
+        .Times(Exactly(4))
+        .WillRepeatedly(Invoke([sent](const Slice msg) {
+            sent->push_back(toString(msg));
+            return ok;
+        }));
+    const auto dispatchFn = [](const nlmsghdr&, const nfgenmsg&, const netdutils::Slice) {};
+    EXPECT_EQ(ok, mListener->subscribe(kType, kCopyRange, dispatchFn));
+
+    // The last message configures the copy mode.
+    ASSERT_EQ(3U, sent->size());
+    struct {
+        nlmsghdr nlhdr;
+        nfgenmsg nfhdr;
+        nfattr attr;
+        nfulnl_msg_config_mode mode;
+    } __attribute__((packed)) msg = {};
+    ASSERT_EQ(sizeof(msg), (*sent)[2].size());
+    memcpy(&msg, (*sent)[2].data(), sizeof(msg));
+    EXPECT_EQ(kType, be16toh(msg.nfhdr.res_id));
+    EXPECT_EQ(NFULA_CFG_MODE, msg.attr.nfa_type);
+    EXPECT_EQ(NFULNL_COPY_PACKET, msg.mode.copy_mode);
+    EXPECT_EQ(kCopyRange, be32toh(msg.mode.copy_range));
+}
+
 TEST_F(NFLogListenerTest, nlmsgDone) {
     constexpr uint16_t kType = 38;
     const auto dispatchFn = [](const nlmsghdr&, const nfgenmsg&, const netdutils::Slice) {};
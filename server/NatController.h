@@ -21,6 +21,8 @@
 #include <list>
 #include <string>
 
+#include <utils/RWLock.h>
+
 #include "NetdConstants.h"
 
 class NatController {
@@ -28,6 +30,8 @@ public:
     NatController();
     virtual ~NatController();
 
+    android::RWLock lock;
+
     int enableNat(const char* intIface, const char* extIface);
     int disableNat(const char* intIface, const char* extIface);
     int setupIptablesHooks();
@@ -27,8 +27,6 @@
 
 #include <private/android_filesystem_config.h>
 
-#include "utils/RWLock.h"
-
 const int PROTECT_MARK = 0x1;
 const int MAX_SYSTEM_UID = AID_APP - 1;
 
@@ -90,18 +88,4 @@ struct IfaddrsDeleter {
 
 typedef std::unique_ptr<struct ifaddrs, struct IfaddrsDeleter> ScopedIfaddrs;
 
-namespace android {
-namespace net {
-
-/**
- * This lock exists to make NetdNativeService RPCs (which come in on multiple Binder threads)
- * coexist with the commands in CommandListener.cpp. These are presumed not thread-safe because
- * CommandListener has only one user (NetworkManagementService), which is connected through a
- * FrameworkListener that passes in commands one at a time.
- */
-extern android::RWLock gBigNetdLock;
-
-}  // namespace net
-}  // namespace android
-
 #endif  // _NETD_CONSTANTS_H
@@ -41,14 +41,6 @@ using android::hardware::Void;
 namespace android {
 namespace net {
 
-/**
- * This lock exists to make NetdHwService RPCs (which come in on multiple HwBinder threads)
- * coexist with the commands in CommandListener.cpp. These are presumed not thread-safe because
- * CommandListener has only one user (NetworkManagementService), which is connected through a
- * FrameworkListener that passes in commands one at a time.
- */
-extern android::RWLock gBigNetdLock;
-
 static INetd::StatusCode toHalStatus(int ret) {
     switch(ret) {
         case 0:
@@ -80,7 +72,7 @@ Return<void> NetdHwService::createOemNetwork(createOemNetwork_cb _hidl_cb) {
     unsigned netId;
     Permission permission = PERMISSION_SYSTEM;
 
-    android::RWLock::AutoWLock _lock(gBigNetdLock);
+    // NetworkController does its own locking.
     int ret = gCtls->netCtrl.createPhysicalOemNetwork(permission, &netId);
 
     Fwmark fwmark;
@@ -100,8 +92,6 @@ Return<INetd::StatusCode> NetdHwService::destroyOemNetwork(uint64_t netHandle) {
         return INetd::StatusCode::INVALID_ARGUMENTS;
     }
 
-    android::RWLock::AutoWLock _lock(gBigNetdLock);
-
     return toHalStatus(gCtls->netCtrl.destroyNetwork(netId));
 }
 
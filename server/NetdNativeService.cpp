@@ -16,6 +16,7 @@
 
 #define LOG_TAG "Netd"
 
+#include <algorithm>
 #include <vector>
 
 #include <android-base/stringprintf.h>
@@ -34,6 +35,8 @@
 #include "DumpWriter.h"
 #include "EventReporter.h"
 #include "InterfaceController.h"
+#include "InterfaceRegistry.h"
+#include "LockStats.h"
 #include "NetdConstants.h"
 #include "NetdNativeService.h"
 #include "RouteController.h"
@@ -100,9 +103,11 @@ binder::Status getXfrmStatus(int xfrmCode) {
 
 #define NETD_LOCKING_RPC(permission, lock)                  \
     ENFORCE_PERMISSION(permission);                         \
-    android::RWLock::AutoWLock _lock(lock);
+    TimedLock _lock(&(lock), TimedLock::EXCLUSIVE, __func__);
 
-#define NETD_BIG_LOCK_RPC(permission) NETD_LOCKING_RPC((permission), gBigNetdLock)
+#define NETD_READ_LOCKING_RPC(permission, lock)             \
+    ENFORCE_PERMISSION(permission);                         \
+    TimedLock _lock(&(lock), TimedLock::SHARED, __func__);
 }  // namespace
 
 
@@ -132,12 +137,30 @@ status_t NetdNativeService::dump(int fd, const Vector<String16> & /* args */) {
     dw.blankline();
     gCtls->netCtrl.dump(dw);
     dw.blankline();
+    RouteController::dump(dw);
+    dw.blankline();
+    gInterfaceRegistry.dump(dw);
+    dw.blankline();
+    gCtls->dnsWorkerPool.dump(dw);
+    dw.blankline();
+    gCtls->firewallCtrl.dump(dw);
+    dw.blankline();
+    gCtls->iptablesRestoreCtrl.dump(dw);
+    dw.blankline();
+    gCtls->eventReporter.dump(dw);
+    dw.blankline();
+    SockDiag::dump(dw);
+    dw.blankline();
+    gCtls->wakeupCtrl.dump(dw);
+    dw.blankline();
+    gLockStats.dump(dw);
+    dw.blankline();
 
     return NO_ERROR;
 }
 
 binder::Status NetdNativeService::isAlive(bool *alive) {
-    NETD_BIG_LOCK_RPC(CONNECTIVITY_INTERNAL);
+    ENFORCE_PERMISSION(CONNECTIVITY_INTERNAL);
 
     *alive = true;
     return binder::Status::ok();
@@ -153,6 +176,45 @@ binder::Status NetdNativeService::firewallReplaceUidChain(const android::String1
     return binder::Status::ok();
 }
 
+binder::Status NetdNativeService::firewallSetUidRules(const std::vector<int32_t>& chains,
+        const std::vector<int32_t>& uids, const std::vector<int32_t>& rules) {
+    NETD_LOCKING_RPC(CONNECTIVITY_INTERNAL, gCtls->firewallCtrl.lock);
+
+    if (chains.size() != uids.size() || chains.size() != rules.size()) {
+        return binder::Status::fromServiceSpecificError(EINVAL, "Array lengths differ");
+    }
+
+    std::vector<FirewallUidRule> uidRules;
+    uidRules.reserve(chains.size());
+    for (size_t i = 0; i < chains.size(); i++) {
+        ChildChain chain;
+        switch (chains[i]) {
+            case INetd::FIREWALL_CHAIN_NONE: chain = NONE; break;
+            case INetd::FIREWALL_CHAIN_DOZABLE: chain = DOZABLE; break;
+            case INetd::FIREWALL_CHAIN_STANDBY: chain = STANDBY; break;
+            case INetd::FIREWALL_CHAIN_POWERSAVE: chain = POWERSAVE; break;
+            default:
+                return binder::Status::fromServiceSpecificError(EINVAL,
+                        String8::format("Unknown firewall chain %d", chains[i]));
+        }
+        FirewallRule rule;
+        switch (rules[i]) {
+            case INetd::FIREWALL_RULE_ALLOW: rule = ALLOW; break;
+            case INetd::FIREWALL_RULE_DENY: rule = DENY; break;
+            default:
+                return binder::Status::fromServiceSpecificError(EINVAL,
+                        String8::format("Unknown firewall rule %d", rules[i]));
+        }
+        uidRules.push_back({ chain, uids[i], rule });
+    }
+
+    if (gCtls->firewallCtrl.setUidRules(uidRules) != 0) {
+        return binder::Status::fromServiceSpecificError(EREMOTEIO,
+                String8::format("Failed to apply %zu firewall UID rules", uidRules.size()));
+    }
+    return binder::Status::ok();
+}
+
 binder::Status NetdNativeService::bandwidthEnableDataSaver(bool enable, bool *ret) {
     NETD_LOCKING_RPC(CONNECTIVITY_INTERNAL, gCtls->bandwidthCtrl.lock);
 
@@ -161,14 +223,39 @@ binder::Status NetdNativeService::bandwidthEnableDataSaver(bool enable, bool *re
     return binder::Status::ok();
 }
 
+binder::Status NetdNativeService::tetherGetStats(std::vector<std::string>* ifacePairs,
+        std::vector<int64_t>* stats) {
+    NETD_READ_LOCKING_RPC(CONNECTIVITY_INTERNAL, gCtls->bandwidthCtrl.lock);
+
+    std::vector<BandwidthController::TetherStats> statsList;
+    std::string extraProcessingInfo;
+    int err = gCtls->bandwidthCtrl.getTetherStats(BandwidthController::TetherStats(), &statsList,
+            extraProcessingInfo);
+    if (err != 0) {
+        return binder::Status::fromServiceSpecificError(EREMOTEIO,
+                "Failed to get tethering stats");
+    }
+
+    ifacePairs->clear();
+    stats->assign(statsList.size() * INetd::TETHER_STATS_ARRAY_SIZE, 0);
+    for (size_t i = 0; i < statsList.size(); i++) {
+        const BandwidthController::TetherStats& s = statsList[i];
+        ifacePairs->push_back(s.intIface);
+        ifacePairs->push_back(s.extIface);
+        int64_t* pairStats = stats->data() + i * INetd::TETHER_STATS_ARRAY_SIZE;
+        pairStats[INetd::TETHER_STATS_RX_BYTES] = s.rxBytes;
+        pairStats[INetd::TETHER_STATS_RX_PACKETS] = s.rxPackets;
+        pairStats[INetd::TETHER_STATS_TX_BYTES] = s.txBytes;
+        pairStats[INetd::TETHER_STATS_TX_PACKETS] = s.txPackets;
+    }
+    return binder::Status::ok();
+}
+
 binder::Status NetdNativeService::networkRejectNonSecureVpn(bool add,
         const std::vector<UidRange>& uidRangeArray) {
-    // TODO: elsewhere RouteController is only used from the tethering and network controllers, so
-    // it should be possible to use the same lock as NetworkController. However, every call through
-    // the CommandListener "network" command will need to hold this lock too, not just the ones that
-    // read/modify network internal state (that is sufficient for ::dump() because it doesn't
-    // look at routes, but it's not enough here).
-    NETD_BIG_LOCK_RPC(CONNECTIVITY_INTERNAL);
+    // The reject rules are independent of any network state, and RouteController locks what little
+    // state it has internally.
+    ENFORCE_PERMISSION(CONNECTIVITY_INTERNAL);
 
     UidRanges uidRanges(uidRangeArray);
 
@@ -277,8 +364,14 @@ binder::Status NetdNativeService::removePrivateDnsServer(const std::string& serv
     return binder::Status::ok();
 }
 
+binder::Status NetdNativeService::revalidatePrivateDnsServers(int32_t netId) {
+    ENFORCE_PERMISSION(CONNECTIVITY_INTERNAL);
+    gCtls->resolverCtrl.revalidatePrivateDnsServers(netId);
+    return binder::Status::ok();
+}
+
 binder::Status NetdNativeService::tetherApplyDnsInterfaces(bool *ret) {
-    NETD_BIG_LOCK_RPC(CONNECTIVITY_INTERNAL);
+    NETD_LOCKING_RPC(CONNECTIVITY_INTERNAL, gCtls->tetherCtrl.lock);
 
     *ret = gCtls->tetherCtrl.applyDnsInterfaces();
     return binder::Status::ok();
@@ -481,5 +574,103 @@ binder::Status NetdNativeService::wakeupDelInterface(const std::string& ifName,
     return toBinderStatus(gCtls->wakeupCtrl.delInterface(ifName, prefix, mark, mask));
 }
 
+binder::Status NetdNativeService::wakeupGetStats(int64_t sinceNs,
+                                                 std::vector<std::string>* prefixes,
+                                                 std::vector<int64_t>* stats) {
+    // No lock needed: the controller guards its own statistics.
+    ENFORCE_PERMISSION(CONNECTIVITY_INTERNAL);
+
+    const auto rows = gCtls->wakeupCtrl.getStats(std::max<int64_t>(sinceNs, 0));
+    prefixes->clear();
+    stats->assign(rows.size() * INetd::WAKEUP_STATS_ARRAY_SIZE, 0);
+    int64_t* row = stats->data();
+    for (const auto& r : rows) {
+        prefixes->push_back(r.key.prefix);
+        row[INetd::WAKEUP_STATS_UID] = static_cast<int32_t>(r.key.uid);
+        row[INetd::WAKEUP_STATS_ETHERTYPE] = r.key.ethertype;
+        row[INetd::WAKEUP_STATS_IP_NEXT_HEADER] = r.key.ipNextHeader;
+        row[INetd::WAKEUP_STATS_PORT] = r.key.port;
+        row[INetd::WAKEUP_STATS_BUCKET_START_NS] = r.bucketStartNs;
+        row[INetd::WAKEUP_STATS_COUNT] = r.count;
+        row += INetd::WAKEUP_STATS_ARRAY_SIZE;
+    }
+    return binder::Status::ok();
+}
+
+binder::Status NetdNativeService::iptablesRestoreGetStats(std::vector<std::string>* callers,
+        std::vector<int64_t>* stats, std::vector<int64_t>* processStats) {
+    static_assert(INetd::IPTABLES_RESTORE_STATS_LATENCY_BUCKETS ==
+                  IptablesRestoreController::NUM_LATENCY_BUCKETS, "Histogram size mismatch");
+    static_assert(INetd::IPTABLES_RESTORE_STATS_ARRAY_SIZE ==
+                  INetd::IPTABLES_RESTORE_STATS_LATENCY_HISTOGRAM +
+                  INetd::IPTABLES_RESTORE_STATS_LATENCY_BUCKETS, "Stats array size mismatch");
+    static_assert(INetd::IPTABLES_TARGET_V4 == V4 && INetd::IPTABLES_TARGET_V6 == V6 &&
+                  INetd::IPTABLES_TARGET_V4V6 == V4V6, "IptablesTarget mismatch");
+
+    // No lock needed: the controller guards its own statistics.
+    ENFORCE_PERMISSION(CONNECTIVITY_INTERNAL);
+
+    const auto commandStats = gCtls->iptablesRestoreCtrl.getCommandStats();
+    callers->clear();
+    stats->clear();
+    for (const auto& entry : commandStats) {
+        const IptablesRestoreController::CommandStats& s = entry.second;
+        callers->push_back(entry.first.first);
+        stats->push_back(entry.first.second);
+        stats->push_back(s.commands);
+        stats->push_back(s.failures);
+        stats->push_back(s.timeouts);
+        stats->push_back(s.retries);
+        stats->push_back(s.bytesWritten);
+        stats->push_back(s.totalLatencyUs);
+        stats->insert(stats->end(), s.latencyHistogram.begin(), s.latencyHistogram.end());
+    }
+
+    processStats->clear();
+    for (const auto type : { IptablesRestoreController::IPTABLES_PROCESS,
+                             IptablesRestoreController::IP6TABLES_PROCESS }) {
+        const auto s = gCtls->iptablesRestoreCtrl.getProcessStats(type);
+        processStats->push_back(s.restarts);
+        processStats->push_back(s.terminations);
+    }
+    return binder::Status::ok();
+}
+
+binder::Status NetdNativeService::socketGetStats(std::vector<int64_t>* stats) {
+    // No lock needed: the dump only reads kernel state.
+    ENFORCE_PERMISSION(CONNECTIVITY_INTERNAL);
+
+    SockDiag sd;
+    if (!sd.open()) {
+        return binder::Status::fromServiceSpecificError(EIO,
+                String8("Could not open SOCK_DIAG socket"));
+    }
+
+    SockDiag::SocketStatsMap statsMap;
+    if (int err = sd.getSocketStats(&statsMap)) {
+        return binder::Status::fromServiceSpecificError(-err,
+                String8::format("getSocketStats: %s", strerror(-err)));
+    }
+
+    stats->assign(statsMap.size() * INetd::SOCKET_STATS_ARRAY_SIZE, 0);
+    int64_t* row = stats->data();
+    for (const auto& entry : statsMap) {
+        const SockDiag::SocketStats& s = entry.second;
+        row[INetd::SOCKET_STATS_UID] = entry.first.first;
+        row[INetd::SOCKET_STATS_NETID] = entry.first.second;
+        row[INetd::SOCKET_STATS_ESTABLISHED] = s.established;
+        row[INetd::SOCKET_STATS_OPENING] = s.opening;
+        row[INetd::SOCKET_STATS_CLOSING] = s.closing;
+        row[INetd::SOCKET_STATS_LISTENING] = s.listening;
+        row[INetd::SOCKET_STATS_MEAN_RTT_US] = s.rttSamples ? s.totalRttUs / s.rttSamples : 0;
+        row[INetd::SOCKET_STATS_MAX_RTT_US] = s.maxRttUs;
+        row[INetd::SOCKET_STATS_RETRANSMITS] = s.retransmits;
+        row[INetd::SOCKET_STATS_BYTES_ACKED] = s.bytesAcked;
+        row[INetd::SOCKET_STATS_BYTES_RECEIVED] = s.bytesReceived;
+        row += INetd::SOCKET_STATS_ARRAY_SIZE;
+    }
+    return binder::Status::ok();
+}
+
 }  // namespace net
 }  // namespace android
@@ -37,7 +37,11 @@ class NetdNativeService : public BinderService<NetdNativeService>, public BnNetd
     binder::Status firewallReplaceUidChain(
             const String16& chainName, bool isWhitelist,
             const std::vector<int32_t>& uids, bool *ret) override;
+    binder::Status firewallSetUidRules(const std::vector<int32_t>& chains,
+            const std::vector<int32_t>& uids, const std::vector<int32_t>& rules) override;
     binder::Status bandwidthEnableDataSaver(bool enable, bool *ret) override;
+    binder::Status tetherGetStats(std::vector<std::string>* ifacePairs,
+            std::vector<int64_t>* stats) override;
     binder::Status networkRejectNonSecureVpn(bool enable, const std::vector<UidRange>& uids)
             override;
     binder::Status socketDestroy(const std::vector<UidRange>& uids,
@@ -51,8 +55,12 @@ class NetdNativeService : public BinderService<NetdNativeService>, public BnNetd
             const std::string& fingerprintAlgorithm,
             const std::vector<std::string>& fingerprints) override;
     binder::Status removePrivateDnsServer(const std::string& server) override;
+    binder::Status revalidatePrivateDnsServers(int32_t netId) override;
 
     binder::Status setIPv6AddrGenMode(const std::string& ifName, int32_t mode) override;
+    binder::Status iptablesRestoreGetStats(std::vector<std::string>* callers,
+            std::vector<int64_t>* stats, std::vector<int64_t>* processStats) override;
+    binder::Status socketGetStats(std::vector<int64_t>* stats) override;
 
     // NFLOG-related commands
     binder::Status wakeupAddInterface(const std::string& ifName, const std::string& prefix,
@@ -61,6 +69,9 @@ class NetdNativeService : public BinderService<NetdNativeService>, public BnNetd
     binder::Status wakeupDelInterface(const std::string& ifName, const std::string& prefix,
                                       int32_t mark, int32_t mask) override;
 
+    binder::Status wakeupGetStats(int64_t sinceNs, std::vector<std::string>* prefixes,
+                                  std::vector<int64_t>* stats) override;
+
     // Tethering-related commands.
     binder::Status tetherApplyDnsInterfaces(bool *ret) override;
 
@@ -15,21 +15,131 @@
  */
 
 #include <errno.h>
+#include <string.h>
 #include <unistd.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <linux/netlink.h>
 #include <linux/rtnetlink.h>
 
+#include <atomic>
+#include <mutex>
+
 #define LOG_TAG "Netd"
 #include <cutils/log.h>
 
 #include "NetdConstants.h"
 #include "NetlinkCommands.h"
 
+#ifndef NETLINK_CAP_ACK
+#define NETLINK_CAP_ACK 10
+#endif
+
 namespace android {
 namespace net {
 
+namespace {
+
+// The most bytes of requests that NetlinkBatch sends at once. The ACKs for them must fit in the
+// receive buffer of the socket, or the kernel drops them.
+const size_t kNetlinkBatchSendSize = 8192;
+
+// How long to wait for an ACK. The kernel processes rtnetlink requests in the context of the
+// sender, so the ACKs are usually queued by the time send() returns.
+const timeval kNetlinkAckTimeout = { .tv_sec = 1, .tv_usec = 0 };
+
+// Rtnetlink sockets that are connected to the kernel and have no data queued. Keeping a few of
+// them around saves opening and closing a socket for every route or rule change.
+class NetlinkSocketPool {
+  public:
+    // Returns a socket, or negative errno on failure.
+    int acquire() {
+        {
+            std::lock_guard<std::mutex> guard(mLock);
+            if (!mIdle.empty()) {
+                const int sock = mIdle.back();
+                mIdle.pop_back();
+                return sock;
+            }
+        }
+        const int sock = openNetlinkSocket(NETLINK_ROUTE);
+        if (sock < 0) {
+            return sock;
+        }
+        if (setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &kNetlinkAckTimeout,
+                       sizeof(kNetlinkAckTimeout)) == -1) {
+            const int ret = -errno;
+            close(sock);
+            return ret;
+        }
+        // Don't echo failed requests back in their ACKs. Not supported by older kernels, which
+        // only makes ACKs bigger.
+        const int on = 1;
+        setsockopt(sock, SOL_NETLINK, NETLINK_CAP_ACK, &on, sizeof(on));
+        return sock;
+    }
+
+    // Returns a socket to the pool. Sockets that may still have ACKs queued are closed instead.
+    void release(int sock, bool healthy) {
+        if (healthy) {
+            std::lock_guard<std::mutex> guard(mLock);
+            if (mIdle.size() < kMaxIdleSockets) {
+                mIdle.push_back(sock);
+                return;
+            }
+        }
+        close(sock);
+    }
+
+  private:
+    static constexpr size_t kMaxIdleSockets = 4;
+
+    std::mutex mLock;
+    std::vector<int> mIdle;
+};
+
+NetlinkSocketPool sSocketPool;
+
+// Sequence numbers of batched requests. Every batch takes a range of them, so that ACKs to requests
+// that timed out can never be mistaken for ACKs to later ones.
+std::atomic<uint32_t> sNextSequence(1);
+
+// Receives ACKs until every request in |seqs| has one or an error occurs. Each ACK is matched to
+// its request by sequence number: request |i| of the batch was sent with sequence number
+// |firstSeq| + |i|. Returns 0, or negative errno if receiving failed.
+int recvNetlinkBatchAcks(int sock, uint32_t firstSeq, size_t begin, size_t end,
+                         std::vector<int>* results, std::vector<bool>* acked) {
+    // Aligned so that the messages in it can be accessed in place.
+    uint32_t buf[kNetlinkDumpBufferSize / sizeof(uint32_t)];
+    size_t pending = end - begin;
+    while (pending > 0) {
+        const ssize_t bytesread = recv(sock, buf, sizeof(buf), 0);
+        if (bytesread == -1) {
+            return (errno == EAGAIN) ? -ETIMEDOUT : -errno;
+        }
+        uint32_t len = bytesread;
+        for (nlmsghdr* nlh = reinterpret_cast<nlmsghdr*>(buf); NLMSG_OK(nlh, len);
+             nlh = NLMSG_NEXT(nlh, len)) {
+            if (nlh->nlmsg_type != NLMSG_ERROR ||
+                nlh->nlmsg_len < NLMSG_LENGTH(sizeof(nlmsgerr))) {
+                continue;
+            }
+            const size_t i = nlh->nlmsg_seq - firstSeq;
+            if (i < begin || i >= end || (*acked)[i]) {
+                // Left over from an earlier request. Ignore it.
+                continue;
+            }
+            (*results)[i] = reinterpret_cast<nlmsgerr*>(NLMSG_DATA(nlh))->error;
+            (*acked)[i] = true;
+            pending--;
+        }
+    }
+    return 0;
+}
+
+}  // namespace
+
 int openNetlinkSocket(int protocol) {
     int sock = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, protocol);
     if (sock == -1) {
@@ -75,6 +185,12 @@ __attribute__((optnone))
 #endif
 WARN_UNUSED_RESULT int sendNetlinkRequest(uint16_t action, uint16_t flags, iovec* iov, int iovlen,
                                           const NetlinkDumpCallback *callback) {
+    if ((flags & NLM_F_ACK) && !(flags & NLM_F_DUMP)) {
+        NetlinkBatch batch;
+        batch.add(action, flags, iov, iovlen);
+        return batch.send();
+    }
+
     nlmsghdr nlmsg = {
         .nlmsg_type = action,
         .nlmsg_flags = flags,
@@ -99,9 +215,7 @@ WARN_UNUSED_RESULT int sendNetlinkRequest(uint16_t action, uint16_t flags, iovec
         return ret;
     }
 
-    if (flags & NLM_F_ACK) {
-        ret = recvNetlinkAck(sock);
-    } else if ((flags & NLM_F_DUMP) && callback != nullptr) {
+    if ((flags & NLM_F_DUMP) && callback != nullptr) {
         ret = processNetlinkDump(sock, *callback);
     }
 
@@ -114,6 +228,99 @@ int sendNetlinkRequest(uint16_t action, uint16_t flags, iovec* iov, int iovlen)
     return sendNetlinkRequest(action, flags, iov, iovlen, nullptr);
 }
 
+size_t NetlinkBatch::add(uint16_t action, uint16_t flags, const iovec* iov, int iovlen) {
+    nlmsghdr nlmsg = {
+        .nlmsg_len = sizeof(nlmsg),
+        .nlmsg_type = action,
+        .nlmsg_flags = static_cast<uint16_t>(flags | NLM_F_ACK),
+    };
+    for (int i = 1; i < iovlen; ++i) {
+        nlmsg.nlmsg_len += iov[i].iov_len;
+    }
+
+    const size_t offset = mBuffer.size();
+    mBuffer.resize(offset + NLMSG_ALIGN(nlmsg.nlmsg_len));
+    uint8_t* p = mBuffer.data() + offset;
+    memcpy(p, &nlmsg, sizeof(nlmsg));
+    p += sizeof(nlmsg);
+    for (int i = 1; i < iovlen; ++i) {
+        if (iov[i].iov_len) {
+            memcpy(p, iov[i].iov_base, iov[i].iov_len);
+            p += iov[i].iov_len;
+        }
+    }
+
+    mOffsets.push_back(offset);
+    mResults.push_back(0);
+    return mOffsets.size() - 1;
+}
+
+int NetlinkBatch::send() {
+    const size_t count = mOffsets.size();
+    if (count == 0) {
+        return 0;
+    }
+
+    int sock = sSocketPool.acquire();
+    if (sock < 0) {
+        ALOGE("cannot open netlink socket (%s)", strerror(-sock));
+        mResults.assign(count, sock);
+        return sock;
+    }
+
+    const uint32_t firstSeq = sNextSequence.fetch_add(count);
+    for (size_t i = 0; i < count; i++) {
+        reinterpret_cast<nlmsghdr*>(mBuffer.data() + mOffsets[i])->nlmsg_seq = firstSeq + i;
+    }
+
+    // The offset just past request |i| in mBuffer.
+    const auto endOf = [this, count](size_t i) {
+        return (i + 1 < count) ? mOffsets[i + 1] : mBuffer.size();
+    };
+
+    std::vector<bool> acked(count, false);
+    int ret = 0;
+    size_t begin = 0;
+    while (begin < count && ret == 0) {
+        // Send as many requests as fit, but always at least one.
+        size_t end = begin + 1;
+        while (end < count && endOf(end) - mOffsets[begin] <= kNetlinkBatchSendSize) {
+            end++;
+        }
+        const size_t bytes = endOf(end - 1) - mOffsets[begin];
+        const ssize_t written = ::send(sock, mBuffer.data() + mOffsets[begin], bytes, 0);
+        if (written == -1) {
+            ret = -errno;
+            ALOGE("netlink send failed (%s)", strerror(-ret));
+        } else if (static_cast<size_t>(written) != bytes) {
+            ret = -EMSGSIZE;
+            ALOGE("short netlink send (%zd != %zu)", written, bytes);
+        } else if ((ret = recvNetlinkBatchAcks(sock, firstSeq, begin, end, &mResults, &acked))) {
+            ALOGE("netlink recv failed (%s)", strerror(-ret));
+        }
+        begin = end;
+    }
+
+    // Requests that never got an ACK fail with the error that stopped the batch.
+    if (ret) {
+        for (size_t i = 0; i < count; i++) {
+            if (!acked[i]) mResults[i] = ret;
+        }
+    }
+    sSocketPool.release(sock, ret == 0);
+
+    for (int result : mResults) {
+        if (result) return result;
+    }
+    return 0;
+}
+
+void NetlinkBatch::clear() {
+    mBuffer.clear();
+    mOffsets.clear();
+    mResults.clear();
+}
+
 int processNetlinkDump(int sock, const NetlinkDumpCallback& callback) {
     char buf[kNetlinkDumpBufferSize];
 
@@ -153,29 +360,16 @@ WARN_UNUSED_RESULT int rtNetlinkFlush(uint16_t getAction, uint16_t deleteAction,
         return -EINVAL;
     }
 
-    int writeSock = openNetlinkSocket(NETLINK_ROUTE);
-    if (writeSock < 0) {
-        return writeSock;
-    }
-
-    NetlinkDumpCallback callback = [writeSock, deleteAction, shouldDelete, what] (nlmsghdr *nlh) {
+    // Collect the objects to delete while dumping, and delete them all at once afterwards.
+    NetlinkBatch deletes;
+    NetlinkDumpCallback callback = [&deletes, deleteAction, shouldDelete] (nlmsghdr *nlh) {
         if (!shouldDelete(nlh)) return;
 
-        nlh->nlmsg_type = deleteAction;
-        nlh->nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
-        if (write(writeSock, nlh, nlh->nlmsg_len) == -1) {
-            ALOGE("Error writing flush request: %s", strerror(errno));
-            return;
-        }
-
-        int ret = recvNetlinkAck(writeSock);
-        // A flush works by dumping routes and deleting each route as it's returned, and it can
-        // fail if something else deletes the route between the dump and the delete. This can
-        // happen, for example, if an interface goes down while we're trying to flush its routes.
-        // So ignore ENOENT.
-        if (ret != 0 && ret != -ENOENT) {
-            ALOGW("Flushing %s: %s", what, strerror(-ret));
-        }
+        iovec iov[] = {
+            { NULL,            0 },
+            { NLMSG_DATA(nlh), nlh->nlmsg_len - NLMSG_HDRLEN },
+        };
+        deletes.add(deleteAction, NLM_F_REQUEST | NLM_F_ACK, iov, ARRAY_SIZE(iov));
     };
 
     int ret = 0;
@@ -195,7 +389,16 @@ WARN_UNUSED_RESULT int rtNetlinkFlush(uint16_t getAction, uint16_t deleteAction,
         }
     }
 
-    close(writeSock);
+    // A flush works by dumping routes and then deleting them, and it can fail if something else
+    // deletes a route between the dump and the delete. This can happen, for example, if an
+    // interface goes down while we're trying to flush its routes. So ignore ENOENT.
+    if (deletes.send()) {
+        for (int result : deletes.results()) {
+            if (result != 0 && result != -ENOENT) {
+                ALOGW("Flushing %s: %s", what, strerror(-result));
+            }
+        }
+    }
 
     return ret;
 }
@@ -18,6 +18,8 @@
 #define NETD_SERVER_NETLINK_UTIL_H
 
 #include <functional>
+#include <vector>
+
 #include <linux/netlink.h>
 #include <linux/rtnetlink.h>
 
@@ -46,7 +48,7 @@ WARN_UNUSED_RESULT int recvNetlinkAck(int sock);
 
 // Sends a netlink request and possibly expects an ACK. The first element of iov should be null and
 // will be set to the netlink message headerheader. The subsequent elements are the contents of the
-// request.
+// request. Requests that expect an ACK are sent over a pooled socket, as a NetlinkBatch of one.
 
 // Disable optimizations in ASan build.
 // ASan reports an out-of-bounds 32-bit(!) access in the first loop of the
@@ -69,6 +71,34 @@ WARN_UNUSED_RESULT int processNetlinkDump(int sock, const NetlinkDumpCallback& c
 WARN_UNUSED_RESULT int rtNetlinkFlush(uint16_t getAction, uint16_t deleteAction,
                                       const char *what, const NetlinkDumpFilter& shouldDelete);
 
+// Sends many netlink requests over a pooled NETLINK_ROUTE socket. As many requests as fit are packed
+// into each send(), and the kernel's ACKs are matched back to the requests by sequence number, so
+// that the result of every request is known even if some of them fail.
+//
+// Not thread-safe. Threads that send requests concurrently must use separate batches.
+class NetlinkBatch {
+  public:
+    // Appends a request. |iov| is laid out as for sendNetlinkRequest(); its first element is
+    // ignored. NLM_F_ACK is always set, so dump requests are not supported. Returns the index of
+    // the request in results().
+    size_t add(uint16_t action, uint16_t flags, const iovec* iov, int iovlen);
+
+    // Sends every request added since the last call to clear(). Returns 0 if all of them
+    // succeeded, or the error of the first one that failed.
+    WARN_UNUSED_RESULT int send();
+
+    // The result of each request after send(): 0 on success or negative errno on failure.
+    const std::vector<int>& results() const { return mResults; }
+
+    size_t size() const { return mOffsets.size(); }
+    void clear();
+
+  private:
+    std::vector<uint8_t> mBuffer;
+    std::vector<size_t> mOffsets;
+    std::vector<int> mResults;
+};
+
 // Returns the value of the specific __u32 attribute, or 0 if the attribute was not present.
 uint32_t getRtmU32Attribute(const nlmsghdr *nlh, int attribute);
 
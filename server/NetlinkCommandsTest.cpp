@@ -0,0 +1,121 @@
+/*
+ * Copyright 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * NetlinkCommandsTest.cpp - unit tests for NetlinkCommands.cpp
+ */
+
+#include <arpa/inet.h>
+
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "NetlinkCommands.h"
+
+namespace android {
+namespace net {
+
+namespace {
+
+// A table number that's not used by the system.
+const uint32_t kTestTable = 500;
+
+// Adds a request to |batch| that adds or deletes an unreachable route to the IPv4 address |dst|.
+void addUnreachableRoute(NetlinkBatch* batch, uint16_t action, const char* dst) {
+    rtmsg route = {
+        .rtm_family = AF_INET,
+        .rtm_dst_len = 32,
+        .rtm_protocol = RTPROT_STATIC,
+        .rtm_scope = RT_SCOPE_LINK,
+        .rtm_type = RTN_UNREACHABLE,
+    };
+    uint32_t table = kTestTable;
+    in_addr addr;
+    ASSERT_EQ(1, inet_pton(AF_INET, dst, &addr));
+    rtattr rtaTable = { static_cast<uint16_t>(RTA_LENGTH(sizeof(table))), RTA_TABLE };
+    rtattr rtaDst = { static_cast<uint16_t>(RTA_LENGTH(sizeof(addr))), RTA_DST };
+
+    iovec iov[] = {
+        { nullptr,   0                },
+        { &route,    sizeof(route)    },
+        { &rtaTable, sizeof(rtaTable) },
+        { &table,    sizeof(table)    },
+        { &rtaDst,   sizeof(rtaDst)   },
+        { &addr,     sizeof(addr)     },
+    };
+    uint16_t flags = (action == RTM_NEWROUTE) ? NETLINK_CREATE_REQUEST_FLAGS :
+                                                NETLINK_REQUEST_FLAGS;
+    batch->add(action, flags, iov, ARRAY_SIZE(iov));
+}
+
+}  // namespace
+
+TEST(NetlinkCommandsTest, TestBatchReportsEachResult) {
+    NetlinkBatch batch;
+    EXPECT_EQ(0, batch.send());
+
+    addUnreachableRoute(&batch, RTM_NEWROUTE, "192.0.2.2");
+    addUnreachableRoute(&batch, RTM_NEWROUTE, "192.0.2.3");
+    addUnreachableRoute(&batch, RTM_NEWROUTE, "192.0.2.2");
+    EXPECT_EQ(3U, batch.size());
+    EXPECT_EQ(-EEXIST, batch.send());
+    EXPECT_EQ(std::vector<int>({ 0, 0, -EEXIST }), batch.results());
+
+    batch.clear();
+    addUnreachableRoute(&batch, RTM_DELROUTE, "192.0.2.4");
+    addUnreachableRoute(&batch, RTM_DELROUTE, "192.0.2.3");
+    addUnreachableRoute(&batch, RTM_DELROUTE, "192.0.2.2");
+    EXPECT_EQ(-ESRCH, batch.send());
+    EXPECT_EQ(std::vector<int>({ -ESRCH, 0, 0 }), batch.results());
+}
+
+TEST(NetlinkCommandsTest, TestLargeBatch) {
+    // More requests than fit in one send().
+    const int kNumRoutes = 500;
+    NetlinkBatch batch;
+    char dst[INET_ADDRSTRLEN];
+    for (int i = 0; i < kNumRoutes; i++) {
+        snprintf(dst, sizeof(dst), "198.18.%d.%d", i / 256, i % 256);
+        addUnreachableRoute(&batch, RTM_NEWROUTE, dst);
+    }
+    EXPECT_EQ(0, batch.send());
+
+    // Deleting them one at a time goes through the same pooled sockets.
+    for (int i = 0; i < kNumRoutes; i++) {
+        NetlinkBatch single;
+        snprintf(dst, sizeof(dst), "198.18.%d.%d", i / 256, i % 256);
+        addUnreachableRoute(&single, RTM_DELROUTE, dst);
+        ASSERT_EQ(0, single.send()) << dst;
+    }
+}
+
+TEST(NetlinkCommandsTest, TestFlushDeletesInBatch) {
+    NetlinkBatch batch;
+    addUnreachableRoute(&batch, RTM_NEWROUTE, "192.0.2.2");
+    addUnreachableRoute(&batch, RTM_NEWROUTE, "192.0.2.3");
+    ASSERT_EQ(0, batch.send());
+
+    NetlinkDumpFilter inTestTable = [](nlmsghdr* nlh) {
+        return getRtmU32Attribute(nlh, RTA_TABLE) == kTestTable;
+    };
+    EXPECT_EQ(0, rtNetlinkFlush(RTM_GETROUTE, RTM_DELROUTE, "routes", inTestTable));
+
+    batch.clear();
+    addUnreachableRoute(&batch, RTM_DELROUTE, "192.0.2.2");
+    EXPECT_EQ(-ESRCH, batch.send());
+}
+
+}  // namespace net
+}  // namespace android
@@ -19,6 +19,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <net/if.h>
 
 #define LOG_TAG "Netd"
 
@@ -26,6 +27,7 @@
 
 #include <netutils/ifc.h>
 #include <sysutils/NetlinkEvent.h>
+#include "InterfaceRegistry.h"
 #include "NetlinkHandler.h"
 #include "NetlinkManager.h"
 #include "ResponseCode.h"
@@ -37,6 +39,30 @@ static const char *kRemoved = "removed";
 namespace android {
 namespace net {
 
+namespace {
+
+void updateInterfaceRegistry(NetlinkEvent::Action action, const char *iface,
+                             const char *ifindexString) {
+    if (!iface || !*iface) {
+        return;
+    }
+    // Both uevents and RTM_NEWLINK messages carry the interface index.
+    unsigned ifindex = ifindexString ? strtoul(ifindexString, nullptr, 10) : 0;
+    if (action == NetlinkEvent::Action::kAdd || action == NetlinkEvent::Action::kLinkUp ||
+            action == NetlinkEvent::Action::kLinkDown) {
+        if (!ifindex) {
+            ifindex = if_nametoindex(iface);
+        }
+        if (ifindex) {
+            gInterfaceRegistry.onInterfaceAdded(iface, ifindex);
+        }
+    } else if (action == NetlinkEvent::Action::kRemove) {
+        gInterfaceRegistry.onInterfaceRemoved(iface, ifindex);
+    }
+}
+
+}  // namespace
+
 NetlinkHandler::NetlinkHandler(NetlinkManager *nm, int listenerSocket,
                                int format) :
                         NetlinkListener(listenerSocket, format) {
@@ -65,6 +91,10 @@ void NetlinkHandler::onEvent(NetlinkEvent *evt) {
         NetlinkEvent::Action action = evt->getAction();
         const char *iface = evt->findParam("INTERFACE");
 
+        // Update the registry before telling the framework, so that by the time the framework asks
+        // us to do anything with the interface, the registry knows its index.
+        updateInterfaceRegistry(action, iface, evt->findParam("IFINDEX"));
+
         if (action == NetlinkEvent::Action::kAdd) {
             notifyInterfaceAdded(iface);
         } else if (action == NetlinkEvent::Action::kRemove) {
@@ -16,6 +16,7 @@
 
 #define LOG_TAG "NetlinkListener"
 
+#include <algorithm>
 #include <sstream>
 #include <vector>
 
@@ -34,8 +35,8 @@ using netdutils::Fd;
 using netdutils::Slice;
 using netdutils::Status;
 using netdutils::UniqueFd;
-using netdutils::findWithDefault;
 using netdutils::forEachNetlinkMessage;
+using netdutils::isOk;
 using netdutils::makeSlice;
 using netdutils::sSyscalls;
 using netdutils::status::ok;
@@ -45,6 +46,9 @@ namespace {
 
 constexpr int kNetlinkMsgErrorType = (NFNL_SUBSYS_NONE << 8) | NLMSG_ERROR;
 
+// Bounds the time spent draining the socket before checking whether we have been asked to stop.
+constexpr int kMaxBatchesPerWakeup = 16;
+
 constexpr sockaddr_nl kKernelAddr = {
     .nl_family = AF_NETLINK, .nl_pad = 0, .nl_pid = 0, .nl_groups = 0,
 };
@@ -57,8 +61,14 @@ const NetlinkListener::DispatchFn kDefaultDispatchFn = [](const nlmsghdr& nlmsg,
 
 }  // namespace
 
-NetlinkListener::NetlinkListener(UniqueFd event, UniqueFd sock)
-    : mEvent(std::move(event)), mSock(std::move(sock)), mWorker([this]() { run(); }) {
+NetlinkListener::NetlinkListener(UniqueFd event, UniqueFd sock, size_t datagramSize,
+                                 size_t batchSize)
+    : mEvent(std::move(event)),
+      mSock(std::move(sock)),
+      mDatagramSize(datagramSize),
+      mBatchSize(std::max<size_t>(batchSize, 1)),
+      mDispatchMap(std::make_unique<DispatchMap>()),
+      mWorker([this]() { run(); }) {
     const auto rxErrorHandler = [](const nlmsghdr& nlmsg, const Slice msg) {
         std::stringstream ss;
         ss << nlmsg << " " << msg << " " << netdutils::toHex(msg, 32);
@@ -86,24 +96,44 @@ Status NetlinkListener::send(const Slice msg) {
 
 Status NetlinkListener::subscribe(uint16_t type, const DispatchFn& fn) {
     std::lock_guard<std::mutex> guard(mMutex);
-    mDispatchMap[type] = fn;
+    auto dispatchMap = std::make_unique<DispatchMap>(*mDispatchMap.read());
+    (*dispatchMap)[type] = fn;
+    mDispatchMap.publish(std::move(dispatchMap));
     return ok;
 }
 
 Status NetlinkListener::unsubscribe(uint16_t type) {
     std::lock_guard<std::mutex> guard(mMutex);
-    mDispatchMap.erase(type);
+    auto dispatchMap = std::make_unique<DispatchMap>(*mDispatchMap.read());
+    dispatchMap->erase(type);
+    // Once this returns, the service thread is no longer dispatching to the old function.
+    mDispatchMap.publish(std::move(dispatchMap));
     return ok;
 }
 
-Status NetlinkListener::run() {
-    std::vector<char> rxbuf(4096);
+NetlinkListener::Stats NetlinkListener::getStats() const {
+    Stats stats = {};
+    stats.wakeups = mWakeups.load();
+    stats.datagrams = mDatagrams.load();
+    stats.messages = mMessages.load();
+    stats.unhandled = mUnhandled.load();
+    stats.truncated = mTruncated.load();
+    stats.enobufs = mEnobufs.load();
+    stats.maxBatch = mMaxBatch.load();
+    return stats;
+}
 
-    const auto rxHandler = [this](const nlmsghdr& nlmsg, const Slice& buf) {
-        std::lock_guard<std::mutex> guard(mMutex);
-        const auto& fn = findWithDefault(mDispatchMap, nlmsg.nlmsg_type, kDefaultDispatchFn);
-        fn(nlmsg, buf);
-    };
+Status NetlinkListener::run() {
+    // One contiguous buffer, carved into a slot for each datagram in a batch.
+    std::vector<char> rxbuf(mDatagramSize * mBatchSize);
+    std::vector<iovec> iovs(mBatchSize);
+    std::vector<mmsghdr> msgs(mBatchSize);
+    for (size_t i = 0; i < mBatchSize; ++i) {
+        iovs[i].iov_base = &rxbuf[i * mDatagramSize];
+        iovs[i].iov_len = mDatagramSize;
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
 
     const auto& sys = sSyscalls.get();
     const std::array<Fd, 2> fds{{{mEvent}, {mSock}}};
@@ -115,14 +145,63 @@ Status NetlinkListener::run() {
         if (revents[0] & POLLIN) {
             break;
         }
-        if (revents[1] & POLLIN) {
-            auto rx = sys.recvfrom(mSock, makeSlice(rxbuf), 0);
-            if (rx.status().code() == ENOBUFS) {
-                // Ignore ENOBUFS - the socket is still usable
-                // TODO: Users other than NFLOG may need to know about this
+        if (revents[1] & (POLLIN | POLLERR)) {
+            ++mWakeups;
+            RETURN_IF_NOT_OK(drain(msgs));
+        }
+    }
+    return ok;
+}
+
+Status NetlinkListener::drain(std::vector<mmsghdr>& msgs) {
+    const auto& sys = sSyscalls.get();
+    for (int batch = 0; batch < kMaxBatchesPerWakeup; ++batch) {
+        auto rx = sys.recvmmsg(mSock, msgs.data(), msgs.size(), MSG_DONTWAIT);
+        if (!isOk(rx)) {
+            const int code = rx.status().code();
+            if (code == ENOBUFS) {
+                // The kernel dropped messages, but the socket is still usable and may hold more.
+                ++mEnobufs;
+                continue;
+            }
+            if (code == EAGAIN || code == EWOULDBLOCK) {
+                return ok;
+            }
+            ALOGE("%s", toString(rx.status()).c_str());
+            return rx.status();
+        }
+
+        const uint64_t received = rx.value();
+        mDatagrams += received;
+        if (received > mMaxBatch.load()) {
+            mMaxBatch = received;
+        }
+
+        // Hold one snapshot of the subscriptions for the whole batch.
+        const auto dispatchMap = mDispatchMap.read();
+        const auto rxHandler = [this, &dispatchMap](const nlmsghdr& nlmsg, const Slice& buf) {
+            ++mMessages;
+            const auto it = dispatchMap->find(nlmsg.nlmsg_type);
+            if (it == dispatchMap->end()) {
+                ++mUnhandled;
+                kDefaultDispatchFn(nlmsg, buf);
+                return;
+            }
+            it->second(nlmsg, buf);
+        };
+        for (size_t i = 0; i < received; ++i) {
+            const msghdr& hdr = msgs[i].msg_hdr;
+            if (hdr.msg_flags & MSG_TRUNC) {
+                // The tail of the datagram is gone, and with it any message that crossed the end
+                // of the buffer. Drop the whole datagram rather than parse a partial one.
+                ++mTruncated;
                 continue;
             }
-            forEachNetlinkMessage(rx.value(), rxHandler);
+            forEachNetlinkMessage(Slice(hdr.msg_iov->iov_base, msgs[i].msg_len), rxHandler);
+        }
+
+        if (received < msgs.size()) {
+            return ok;
         }
     }
     return ok;
@@ -17,16 +17,22 @@
 #ifndef NETLINK_LISTENER_H
 #define NETLINK_LISTENER_H
 
+#include <atomic>
 #include <functional>
 #include <map>
 #include <mutex>
 #include <thread>
+#include <vector>
+
+#include <sys/socket.h>
 
 #include <netdutils/Netlink.h>
 #include <netdutils/Slice.h>
 #include <netdutils/StatusOr.h>
 #include <netdutils/UniqueFd.h>
 
+#include "SnapshotPublisher.h"
+
 namespace android {
 namespace net {
 
@@ -34,6 +40,17 @@ class NetlinkListenerInterface {
   public:
     using DispatchFn = std::function<void(const nlmsghdr& nlmsg, const netdutils::Slice msg)>;
 
+    // Counters describing how well the listener is keeping up with the kernel.
+    struct Stats {
+        uint64_t wakeups;     // Times the socket was found readable
+        uint64_t datagrams;   // Datagrams received
+        uint64_t messages;    // Netlink messages dispatched, including to the default handler
+        uint64_t unhandled;   // Messages of a type that nobody subscribed to
+        uint64_t truncated;   // Datagrams larger than the receive buffer, dropped whole
+        uint64_t enobufs;     // Times the kernel reported that the socket overflowed
+        uint64_t maxBatch;    // Most datagrams returned by a single receive
+    };
+
     virtual ~NetlinkListenerInterface() = default;
 
     // Send message to the kernel using the underlying netlink socket
@@ -49,6 +66,9 @@ class NetlinkListenerInterface {
     // Halt delivery of future messages with nlmsghdr.nlmsg_type == type.
     // Threadsafe.
     virtual netdutils::Status unsubscribe(uint16_t type) = 0;
+
+    // Threadsafe.
+    virtual Stats getStats() const = 0;
 };
 
 // NetlinkListener manages a netlink socket and associated blocking
@@ -68,9 +88,22 @@ class NetlinkListenerInterface {
 // Note that NetlinkListener is capable of processing multiple batched
 // netlink messages in a single system call. This is useful to
 // netfilter extensions that allow batching of events like NFLOG.
+// Each wakeup drains up to several batches of |batchSize| datagrams
+// with recvmmsg(), so |datagramSize| should be at least as large as
+// the biggest batch the kernel is configured to send.
+//
+// Dispatch functions are looked up in an immutable snapshot of the
+// subscriptions, so the service thread never waits for subscribe()
+// or unsubscribe(). Those in turn wait for the service thread to
+// finish with any datagrams it received under the old subscriptions.
 class NetlinkListener : public NetlinkListenerInterface {
   public:
-    NetlinkListener(netdutils::UniqueFd event, netdutils::UniqueFd sock);
+    static constexpr size_t kDefaultDatagramSize = 4096;
+    static constexpr size_t kDefaultBatchSize = 8;
+
+    NetlinkListener(netdutils::UniqueFd event, netdutils::UniqueFd sock,
+                    size_t datagramSize = kDefaultDatagramSize,
+                    size_t batchSize = kDefaultBatchSize);
 
     ~NetlinkListener() override;
 
@@ -80,13 +113,32 @@ class NetlinkListener : public NetlinkListenerInterface {
 
     netdutils::Status unsubscribe(uint16_t type) override;
 
+    Stats getStats() const override;
+
   private:
+    using DispatchMap = std::map<uint16_t, DispatchFn>;
+
     netdutils::Status run();
 
+    // Receives and dispatches datagrams until the socket is empty or
+    // kMaxBatchesPerWakeup batches have been processed.
+    netdutils::Status drain(std::vector<mmsghdr>& msgs);
+
     netdutils::UniqueFd mEvent;
     netdutils::UniqueFd mSock;
-    std::mutex mMutex;
-    std::map<uint16_t, DispatchFn> mDispatchMap;  // guarded by mMutex
+    const size_t mDatagramSize;
+    const size_t mBatchSize;
+    std::mutex mMutex;  // Serializes changes to mDispatchMap
+    SnapshotPublisher<DispatchMap> mDispatchMap;
+
+    std::atomic<uint64_t> mWakeups{0};
+    std::atomic<uint64_t> mDatagrams{0};
+    std::atomic<uint64_t> mMessages{0};
+    std::atomic<uint64_t> mUnhandled{0};
+    std::atomic<uint64_t> mTruncated{0};
+    std::atomic<uint64_t> mEnobufs{0};
+    std::atomic<uint64_t> mMaxBatch{0};
+
     std::thread mWorker;
 };
 
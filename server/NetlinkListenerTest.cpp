@@ -0,0 +1,186 @@
+/*
+ * Copyright 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * NetlinkListenerTest.cpp - unit tests for NetlinkListener.cpp
+ */
+
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <netdutils/Syscalls.h>
+
+#include "NetlinkListener.h"
+
+namespace android {
+namespace net {
+
+using netdutils::Slice;
+using netdutils::UniqueFd;
+using netdutils::makeSlice;
+using netdutils::sSyscalls;
+using netdutils::status::ok;
+
+namespace {
+
+constexpr uint16_t kType = 0x1234;
+constexpr uint16_t kOtherType = 0x1235;
+
+// Appends a netlink message of |type| carrying |payloadSize| bytes of payload to |datagram|.
+void appendMessage(std::vector<char>* datagram, uint16_t type, size_t payloadSize) {
+    nlmsghdr nlmsg = {};
+    nlmsg.nlmsg_len = NLMSG_LENGTH(payloadSize);
+    nlmsg.nlmsg_type = type;
+    const size_t offset = datagram->size();
+    datagram->resize(offset + NLMSG_SPACE(payloadSize), 'x');
+    memcpy(datagram->data() + offset, &nlmsg, sizeof(nlmsg));
+}
+
+// Waits for |predicate| to become true, for up to a second.
+template <typename Predicate>
+bool waitFor(Predicate predicate) {
+    for (int i = 0; i < 1000; i++) {
+        if (predicate()) return true;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return predicate();
+}
+
+}  // namespace
+
+class NetlinkListenerTest : public testing::Test {
+  protected:
+    // Datagram sockets stand in for netlink: both deliver whole datagrams and report truncation.
+    void startListener(size_t datagramSize, size_t batchSize) {
+        int fds[2];
+        ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, fds));
+        mPeer.reset(fds[1]);
+        auto event = sSyscalls.get().eventfd(0, EFD_CLOEXEC);
+        ASSERT_TRUE(isOk(event));
+        mListener.reset(new NetlinkListener(std::move(event.value()), UniqueFd(fds[0]),
+                                            datagramSize, batchSize));
+    }
+
+    void sendDatagram(const std::vector<char>& datagram) {
+        auto sent = sSyscalls.get().write(mPeer, makeSlice(datagram));
+        ASSERT_TRUE(isOk(sent));
+        ASSERT_EQ(datagram.size(), sent.value());
+    }
+
+    UniqueFd mPeer;
+    std::unique_ptr<NetlinkListener> mListener;
+};
+
+TEST_F(NetlinkListenerTest, DispatchesEveryMessageOfEveryDatagram) {
+    startListener(NetlinkListener::kDefaultDatagramSize, 4);
+    std::atomic<int> received{0};
+    EXPECT_EQ(ok, mListener->subscribe(kType, [&received](const nlmsghdr& nlmsg, const Slice msg) {
+        EXPECT_EQ(kType, nlmsg.nlmsg_type);
+        EXPECT_EQ(16U, msg.size());
+        received++;
+    }));
+
+    // Queue more datagrams than fit in one batch before the listener gets to them.
+    constexpr int kDatagrams = 10;
+    constexpr int kMessagesPerDatagram = 3;
+    std::vector<char> datagram;
+    for (int i = 0; i < kMessagesPerDatagram; i++) {
+        appendMessage(&datagram, kType, 16);
+    }
+    for (int i = 0; i < kDatagrams; i++) {
+        sendDatagram(datagram);
+    }
+
+    EXPECT_TRUE(waitFor([&received] { return received == kDatagrams * kMessagesPerDatagram; }));
+    const auto stats = mListener->getStats();
+    EXPECT_EQ(static_cast<uint64_t>(kDatagrams), stats.datagrams);
+    EXPECT_EQ(static_cast<uint64_t>(kDatagrams * kMessagesPerDatagram), stats.messages);
+    EXPECT_LE(stats.maxBatch, 4U);
+    EXPECT_GE(stats.maxBatch, 1U);
+    EXPECT_LE(stats.wakeups, stats.datagrams);
+    EXPECT_EQ(0U, stats.truncated);
+    EXPECT_EQ(0U, stats.unhandled);
+}
+
+TEST_F(NetlinkListenerTest, CountsDroppedMessages) {
+    startListener(256, 2);
+    std::atomic<int> received{0};
+    EXPECT_EQ(ok, mListener->subscribe(kType, [&received](const nlmsghdr&, const Slice) {
+        received++;
+    }));
+
+    // Too big for the buffer: neither message is delivered.
+    std::vector<char> tooBig;
+    appendMessage(&tooBig, kType, 100);
+    appendMessage(&tooBig, kType, 200);
+    sendDatagram(tooBig);
+
+    std::vector<char> unhandled;
+    appendMessage(&unhandled, kOtherType, 8);
+    sendDatagram(unhandled);
+
+    std::vector<char> handled;
+    appendMessage(&handled, kType, 8);
+    sendDatagram(handled);
+
+    // Datagrams are counted when they are received, before their messages are dispatched, so wait
+    // for the dispatch of the last one.
+    EXPECT_TRUE(waitFor([this, &received] {
+        const auto stats = mListener->getStats();
+        return received == 1 && stats.unhandled == 1 && stats.truncated == 1;
+    }));
+    const auto stats = mListener->getStats();
+    EXPECT_EQ(3U, stats.datagrams);
+    EXPECT_EQ(1, received);
+    EXPECT_EQ(1U, stats.truncated);
+    EXPECT_EQ(1U, stats.unhandled);
+    EXPECT_EQ(2U, stats.messages);
+}
+
+TEST_F(NetlinkListenerTest, NoDispatchAfterUnsubscribe) {
+    startListener(NetlinkListener::kDefaultDatagramSize, NetlinkListener::kDefaultBatchSize);
+    std::atomic<int> received{0};
+    EXPECT_EQ(ok, mListener->subscribe(kType, [&received](const nlmsghdr&, const Slice) {
+        // Give unsubscribe() a chance to run while a message is being dispatched.
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        received++;
+    }));
+
+    std::vector<char> datagram;
+    appendMessage(&datagram, kType, 8);
+    for (int i = 0; i < 20; i++) {
+        sendDatagram(datagram);
+    }
+    EXPECT_TRUE(waitFor([&received] { return received > 0; }));
+    EXPECT_EQ(ok, mListener->unsubscribe(kType));
+    const int receivedAtUnsubscribe = received;
+
+    sendDatagram(datagram);
+    // Each message ends up either received or unhandled, once it has been dispatched.
+    EXPECT_TRUE(waitFor([this, &received] {
+        return received + mListener->getStats().unhandled == 21;
+    }));
+    EXPECT_EQ(receivedAtUnsubscribe, received);
+    EXPECT_LE(1U, mListener->getStats().unhandled);
+}
+
+}  // namespace net
+}  // namespace android
@@ -19,16 +19,19 @@
 // The methods in this file are called from multiple threads (from CommandListener, FwmarkServer
 // and DnsProxyListener). So, all accesses to shared state are guarded by a lock.
 //
-// In some cases, a single non-const method acquires and releases the lock several times, like so:
-//     if (isValidNetwork(...)) {  // isValidNetwork() acquires and releases the lock.
-//        setDefaultNetwork(...);  // setDefaultNetwork() also acquires and releases the lock.
+// Non-const methods are called concurrently too: CommandListener, the binder service and the HAL
+// service all create and destroy networks, each on its own threads, and no lock serializes them.
+// So every non-const method checks that the network exists, and then changes it, under a single
+// acquisition of the lock. It must never check with a method that takes the lock itself, such as
+// getNetworkForInterface(), and then take the lock again to act on the result, because the network
+// may have been destroyed in between.
 //
-// It might seem that this allows races where the state changes between the two statements, but in
-// fact there are no races because:
-//     1. This pattern only occurs in non-const methods (i.e., those that mutate state).
-//     2. Only CommandListener calls these non-const methods. The others call only const methods.
-//     3. CommandListener only processes one command at a time. I.e., it's serialized.
-// Thus, no other mutation can occur in between the two statements above.
+// The methods that select networks and marks for DNS lookups and connect() calls are called for
+// every lookup and every connect(), so they don't take the lock at all. Instead, every method that
+// changes the state publishes an immutable snapshot of it before releasing the write lock (see
+// WriteLock), and the selection methods read the latest snapshot.
+
+#include <inttypes.h>
 
 #include "NetworkController.h"
 
@@ -38,6 +41,9 @@
 #include "cutils/misc.h"
 #include "resolv_netid.h"
 
+#include <unordered_map>
+#include <unordered_set>
+
 #include "Controllers.h"
 #include "DummyNetwork.h"
 #include "DumpWriter.h"
@@ -66,6 +72,48 @@ const unsigned NetworkController::DUMMY_NET_ID = 51;
 // NetIds 52..98 are reserved for future use.
 const unsigned NetworkController::LOCAL_NET_ID = 99;
 
+// The state that selects networks and marks, copied out of NetworkController and its networks.
+struct NetworkController::Snapshot {
+    struct NetworkInfo {
+        unsigned netId;
+        Network::Type type;
+        // Only physical networks require a permission.
+        Permission permission;
+        // Only used for virtual networks.
+        bool hasDns;
+        bool secure;
+    };
+
+    const NetworkInfo* getNetwork(unsigned netId) const;
+    const NetworkInfo* getVirtualNetworkForUser(uid_t uid) const;
+    Permission getPermissionForUser(uid_t uid) const;
+    bool canProtect(uid_t uid) const;
+    int checkUserNetworkAccess(uid_t uid, unsigned netId) const;
+    uint32_t getNetworkForDns(unsigned* netId, uid_t uid) const;
+    unsigned getNetworkForUser(uid_t uid) const;
+    unsigned getNetworkForConnect(uid_t uid) const;
+
+    uint64_t version = 0;
+    unsigned defaultNetId = NETID_UNSET;
+    std::unordered_map<unsigned, NetworkInfo> networks;
+    UidRangeIndex vpnUids;
+    std::unordered_map<uid_t, Permission> users;
+    std::unordered_set<uid_t> protectableUsers;
+};
+
+// Holds a write lock on mRWLock, and publishes a new snapshot of the state before releasing it.
+class NetworkController::WriteLock {
+public:
+    explicit WriteLock(NetworkController* networkController) :
+            mNetworkController(networkController), mLock(networkController->mRWLock) {}
+
+    ~WriteLock() { mNetworkController->publishSnapshotLocked(); }
+
+private:
+    NetworkController* const mNetworkController;
+    android::RWLock::AutoWLock mLock;
+};
+
 // All calls to methods here are made while holding a write lock on mRWLock.
 class NetworkController::DelegateImpl : public PhysicalNetwork::Delegate {
 public:
@@ -141,18 +189,22 @@ int NetworkController::DelegateImpl::modifyFallthrough(const std::string& physic
 
 NetworkController::NetworkController() :
         mDelegateImpl(new NetworkController::DelegateImpl(this)), mDefaultNetId(NETID_UNSET),
-        mProtectableUsers({AID_VPN}) {
+        mProtectableUsers({AID_VPN}), mSnapshots(std::unique_ptr<Snapshot>(new Snapshot)),
+        mSnapshotVersion(0) {
     mNetworks[LOCAL_NET_ID] = new LocalNetwork(LOCAL_NET_ID);
     mNetworks[DUMMY_NET_ID] = new DummyNetwork(DUMMY_NET_ID);
+    publishSnapshotLocked();
+}
+
+NetworkController::~NetworkController() {
 }
 
 unsigned NetworkController::getDefaultNetwork() const {
-    android::RWLock::AutoRLock lock(mRWLock);
-    return mDefaultNetId;
+    return mSnapshots.read()->defaultNetId;
 }
 
 int NetworkController::setDefaultNetwork(unsigned netId) {
-    android::RWLock::AutoWLock lock(mRWLock);
+    WriteLock lock(this);
 
     if (netId == mDefaultNetId) {
         return 0;
@@ -189,50 +241,13 @@ int NetworkController::setDefaultNetwork(unsigned netId) {
 }
 
 uint32_t NetworkController::getNetworkForDns(unsigned* netId, uid_t uid) const {
-    android::RWLock::AutoRLock lock(mRWLock);
-    Fwmark fwmark;
-    fwmark.protectedFromVpn = true;
-    fwmark.permission = PERMISSION_SYSTEM;
-    if (checkUserNetworkAccessLocked(uid, *netId) == 0) {
-        // If a non-zero NetId was explicitly specified, and the user has permission for that
-        // network, use that network's DNS servers. Do not fall through to the default network even
-        // if the explicitly selected network is a split tunnel VPN: the explicitlySelected bit
-        // ensures that the VPN fallthrough rule does not match.
-        fwmark.explicitlySelected = true;
-
-        // If the network is a VPN and it doesn't have DNS servers, use the default network's DNS
-        // servers (through the default network). Otherwise, the query is guaranteed to fail.
-        // http://b/29498052
-        Network *network = getNetworkLocked(*netId);
-        if (network && network->getType() == Network::VIRTUAL &&
-                !static_cast<VirtualNetwork *>(network)->getHasDns()) {
-            *netId = mDefaultNetId;
-        }
-    } else {
-        // If the user is subject to a VPN and the VPN provides DNS servers, use those servers
-        // (possibly falling through to the default network if the VPN doesn't provide a route to
-        // them). Otherwise, use the default network's DNS servers.
-        VirtualNetwork* virtualNetwork = getVirtualNetworkForUserLocked(uid);
-        if (virtualNetwork && virtualNetwork->getHasDns()) {
-            *netId = virtualNetwork->getNetId();
-        } else {
-            // TODO: return an error instead of silently doing the DNS lookup on the wrong network.
-            // http://b/27560555
-            *netId = mDefaultNetId;
-        }
-    }
-    fwmark.netId = *netId;
-    return fwmark.intValue;
+    return mSnapshots.read()->getNetworkForDns(netId, uid);
 }
 
 // Returns the NetId that a given UID would use if no network is explicitly selected. Specifically,
 // the VPN that applies to the UID if any; otherwise, the default network.
 unsigned NetworkController::getNetworkForUser(uid_t uid) const {
-    android::RWLock::AutoRLock lock(mRWLock);
-    if (VirtualNetwork* virtualNetwork = getVirtualNetworkForUserLocked(uid)) {
-        return virtualNetwork->getNetId();
-    }
-    return mDefaultNetId;
+    return mSnapshots.read()->getNetworkForUser(uid);
 }
 
 // Returns the NetId that will be set when a socket connect()s. This is the bypassable VPN that
@@ -250,12 +265,7 @@ unsigned NetworkController::getNetworkForUser(uid_t uid) const {
 // the fallthrough rules also go away), the socket that used to fallthrough to the default network
 // will stop working.
 unsigned NetworkController::getNetworkForConnect(uid_t uid) const {
-    android::RWLock::AutoRLock lock(mRWLock);
-    VirtualNetwork* virtualNetwork = getVirtualNetworkForUserLocked(uid);
-    if (virtualNetwork && !virtualNetwork->isSecure()) {
-        return virtualNetwork->getNetId();
-    }
-    return mDefaultNetId;
+    return mSnapshots.read()->getNetworkForConnect(uid);
 }
 
 void NetworkController::getNetworkContext(
@@ -281,19 +291,20 @@ void NetworkController::getNetworkContext(
     //
     // In all these cases (with the possible exception of #3), the right thing to do is to treat
     // such cases as explicitlySelected.
+    const auto snapshot = mSnapshots.read();
     const bool explicitlySelected = (nc.app_netid != NETID_UNSET);
     if (!explicitlySelected) {
-        nc.app_netid = getNetworkForConnect(uid);
+        nc.app_netid = snapshot->getNetworkForConnect(uid);
     }
 
     Fwmark fwmark;
     fwmark.netId = nc.app_netid;
     fwmark.explicitlySelected = explicitlySelected;
-    fwmark.protectedFromVpn = explicitlySelected && canProtect(uid);
-    fwmark.permission = getPermissionForUser(uid);
+    fwmark.protectedFromVpn = explicitlySelected && snapshot->canProtect(uid);
+    fwmark.permission = snapshot->getPermissionForUser(uid);
     nc.app_mark = fwmark.intValue;
 
-    nc.dns_mark = getNetworkForDns(&(nc.dns_netid), uid);
+    nc.dns_mark = snapshot->getNetworkForDns(&(nc.dns_netid), uid);
 
     if (DBG) {
         ALOGD("app_netid:0x%x app_mark:0x%x dns_netid:0x%x dns_mark:0x%x uid:%d",
@@ -307,6 +318,10 @@ void NetworkController::getNetworkContext(
 
 unsigned NetworkController::getNetworkForInterface(const char* interface) const {
     android::RWLock::AutoRLock lock(mRWLock);
+    return getNetworkForInterfaceLocked(interface);
+}
+
+unsigned NetworkController::getNetworkForInterfaceLocked(const char* interface) const {
     for (const auto& entry : mNetworks) {
         if (entry.second->hasInterface(interface)) {
             return entry.first;
@@ -316,9 +331,8 @@ unsigned NetworkController::getNetworkForInterface(const char* interface) const
 }
 
 bool NetworkController::isVirtualNetwork(unsigned netId) const {
-    android::RWLock::AutoRLock lock(mRWLock);
-    Network* network = getNetworkLocked(netId);
-    return network && network->getType() == Network::VIRTUAL;
+    const Snapshot::NetworkInfo* network = mSnapshots.read()->getNetwork(netId);
+    return network && network->type == Network::VIRTUAL;
 }
 
 int NetworkController::createPhysicalNetworkLocked(unsigned netId, Permission permission) {
@@ -345,7 +359,7 @@ int NetworkController::createPhysicalNetworkLocked(unsigned netId, Permission pe
 }
 
 int NetworkController::createPhysicalNetwork(unsigned netId, Permission permission) {
-    android::RWLock::AutoWLock lock(mRWLock);
+    WriteLock lock(this);
     return createPhysicalNetworkLocked(netId, permission);
 }
 
@@ -354,7 +368,7 @@ int NetworkController::createPhysicalOemNetwork(Permission permission, unsigned
         return -EINVAL;
     }
 
-    android::RWLock::AutoWLock lock(mRWLock);
+    WriteLock lock(this);
     for (*pNetId = MIN_OEM_ID; *pNetId <= MAX_OEM_ID; (*pNetId)++) {
         if (!isValidNetworkLocked(*pNetId)) {
             break;
@@ -381,12 +395,12 @@ int NetworkController::createVirtualNetwork(unsigned netId, bool hasDns, bool se
         return -EINVAL;
     }
 
-    if (isValidNetwork(netId)) {
+    WriteLock lock(this);
+    if (isValidNetworkLocked(netId)) {
         ALOGE("duplicate netId %u", netId);
         return -EEXIST;
     }
 
-    android::RWLock::AutoWLock lock(mRWLock);
     if (int ret = modifyFallthroughLocked(netId, true)) {
         return ret;
     }
@@ -399,16 +413,15 @@ int NetworkController::destroyNetwork(unsigned netId) {
         ALOGE("cannot destroy local network");
         return -EINVAL;
     }
-    if (!isValidNetwork(netId)) {
+    WriteLock lock(this);
+    Network* network = getNetworkLocked(netId);
+    if (!network) {
         ALOGE("no such netId %u", netId);
         return -ENONET;
     }
 
     // TODO: ioctl(SIOCKILLADDR, ...) to kill all sockets on the old network.
 
-    android::RWLock::AutoWLock lock(mRWLock);
-    Network* network = getNetworkLocked(netId);
-
     // If we fail to destroy a network, things will get stuck badly. Therefore, unlike most of the
     // other network code, ignore failures and attempt to clear out as much state as possible, even
     // if we hit an error on the way. Return the first error that we see.
@@ -428,60 +441,62 @@ int NetworkController::destroyNetwork(unsigned netId) {
                 ret = err;
             }
         }
+        mVpnUids.removeNetwork(netId);
     }
     mNetworks.erase(netId);
     delete network;
     _resolv_delete_cache_for_net(netId);
+    android::net::gCtls->resolverCtrl.getDnsCache().invalidate(netId);
     return ret;
 }
 
 int NetworkController::addInterfaceToNetwork(unsigned netId, const char* interface) {
-    if (!isValidNetwork(netId)) {
+    WriteLock lock(this);
+    Network* network = getNetworkLocked(netId);
+    if (!network) {
         ALOGE("no such netId %u", netId);
         return -ENONET;
     }
 
-    unsigned existingNetId = getNetworkForInterface(interface);
+    unsigned existingNetId = getNetworkForInterfaceLocked(interface);
     if (existingNetId != NETID_UNSET && existingNetId != netId) {
         ALOGE("interface %s already assigned to netId %u", interface, existingNetId);
         return -EBUSY;
     }
 
-    android::RWLock::AutoWLock lock(mRWLock);
-    return getNetworkLocked(netId)->addInterface(interface);
+    return network->addInterface(interface);
 }
 
 int NetworkController::removeInterfaceFromNetwork(unsigned netId, const char* interface) {
-    if (!isValidNetwork(netId)) {
+    WriteLock lock(this);
+    Network* network = getNetworkLocked(netId);
+    if (!network) {
         ALOGE("no such netId %u", netId);
         return -ENONET;
     }
 
-    android::RWLock::AutoWLock lock(mRWLock);
-    return getNetworkLocked(netId)->removeInterface(interface);
+    return network->removeInterface(interface);
 }
 
 Permission NetworkController::getPermissionForUser(uid_t uid) const {
-    android::RWLock::AutoRLock lock(mRWLock);
-    return getPermissionForUserLocked(uid);
+    return mSnapshots.read()->getPermissionForUser(uid);
 }
 
 void NetworkController::setPermissionForUsers(Permission permission,
                                               const std::vector<uid_t>& uids) {
-    android::RWLock::AutoWLock lock(mRWLock);
+    WriteLock lock(this);
     for (uid_t uid : uids) {
         mUsers[uid] = permission;
     }
 }
 
 int NetworkController::checkUserNetworkAccess(uid_t uid, unsigned netId) const {
-    android::RWLock::AutoRLock lock(mRWLock);
-    return checkUserNetworkAccessLocked(uid, netId);
+    return mSnapshots.read()->checkUserNetworkAccess(uid, netId);
 }
 
 int NetworkController::setPermissionForNetworks(Permission permission,
                                                 const std::vector<unsigned>& netIds) {
-    android::RWLock::AutoWLock lock(mRWLock);
+    WriteLock lock(this);
     for (unsigned netId : netIds) {
         Network* network = getNetworkLocked(netId);
         if (!network) {
@@ -501,7 +516,7 @@ int NetworkController::setPermissionForNetworks(Permission permission,
 }
 
 int NetworkController::addUsersToNetwork(unsigned netId, const UidRanges& uidRanges) {
-    android::RWLock::AutoWLock lock(mRWLock);
+    WriteLock lock(this);
     Network* network = getNetworkLocked(netId);
     if (!network) {
         ALOGE("no such netId %u", netId);
@@ -514,11 +529,12 @@ int NetworkController::addUsersToNetwork(unsigned netId, const UidRanges& uidRan
     if (int ret = static_cast<VirtualNetwork*>(network)->addUsers(uidRanges, mProtectableUsers)) {
         return ret;
     }
+    mVpnUids.addRanges(netId, uidRanges);
     return 0;
 }
 
 int NetworkController::removeUsersFromNetwork(unsigned netId, const UidRanges& uidRanges) {
-    android::RWLock::AutoWLock lock(mRWLock);
+    WriteLock lock(this);
     Network* network = getNetworkLocked(netId);
     if (!network) {
         ALOGE("no such netId %u", netId);
@@ -532,6 +548,7 @@ int NetworkController::removeUsersFromNetwork(unsigned netId, const UidRanges& u
                                                                      mProtectableUsers)) {
         return ret;
     }
+    mVpnUids.removeRanges(netId, uidRanges);
     return 0;
 }
 
@@ -546,18 +563,16 @@ int NetworkController::removeRoute(unsigned netId, const char* interface, const
 }
 
 bool NetworkController::canProtect(uid_t uid) const {
-    android::RWLock::AutoRLock lock(mRWLock);
-    return ((getPermissionForUserLocked(uid) & PERMISSION_SYSTEM) == PERMISSION_SYSTEM) ||
-           mProtectableUsers.find(uid) != mProtectableUsers.end();
+    return mSnapshots.read()->canProtect(uid);
 }
 
 void NetworkController::allowProtect(const std::vector<uid_t>& uids) {
-    android::RWLock::AutoWLock lock(mRWLock);
+    WriteLock lock(this);
     mProtectableUsers.insert(uids.begin(), uids.end());
 }
 
 void NetworkController::denyProtect(const std::vector<uid_t>& uids) {
-    android::RWLock::AutoWLock lock(mRWLock);
+    WriteLock lock(this);
     for (uid_t uid : uids) {
         mProtectableUsers.erase(uid);
     }
@@ -571,6 +586,8 @@ void NetworkController::dump(DumpWriter& dw) {
 
     dw.incIndent();
     dw.println("Default network: %u", mDefaultNetId);
+    dw.println("Snapshot version: %" PRIu64, mSnapshots.read()->version);
+    dw.println("VPN UID segments: %zu", mVpnUids.getSegmentCount());
 
     dw.blankline();
     dw.println("Networks:");
@@ -598,70 +615,20 @@ bool NetworkController::isValidNetworkLocked(unsigned netId) const {
     return getNetworkLocked(netId);
 }
 
-bool NetworkController::isValidNetwork(unsigned netId) const {
-    android::RWLock::AutoRLock lock(mRWLock);
-    return isValidNetworkLocked(netId);
-}
-
 Network* NetworkController::getNetworkLocked(unsigned netId) const {
     auto iter = mNetworks.find(netId);
     return iter == mNetworks.end() ? NULL : iter->second;
 }
 
-VirtualNetwork* NetworkController::getVirtualNetworkForUserLocked(uid_t uid) const {
-    for (const auto& entry : mNetworks) {
-        if (entry.second->getType() == Network::VIRTUAL) {
-            VirtualNetwork* virtualNetwork = static_cast<VirtualNetwork*>(entry.second);
-            if (virtualNetwork->appliesToUser(uid)) {
-                return virtualNetwork;
-            }
-        }
-    }
-    return NULL;
-}
-
-Permission NetworkController::getPermissionForUserLocked(uid_t uid) const {
-    auto iter = mUsers.find(uid);
-    if (iter != mUsers.end()) {
-        return iter->second;
-    }
-    return uid < FIRST_APPLICATION_UID ? PERMISSION_SYSTEM : PERMISSION_NONE;
-}
-
-int NetworkController::checkUserNetworkAccessLocked(uid_t uid, unsigned netId) const {
-    Network* network = getNetworkLocked(netId);
-    if (!network) {
-        return -ENONET;
-    }
-
-    // If uid is INVALID_UID, this likely means that we were unable to retrieve the UID of the peer
-    // (using SO_PEERCRED). Be safe and deny access to the network, even if it's valid.
-    if (uid == INVALID_UID) {
-        return -EREMOTEIO;
-    }
-    Permission userPermission = getPermissionForUserLocked(uid);
-    if ((userPermission & PERMISSION_SYSTEM) == PERMISSION_SYSTEM) {
-        return 0;
-    }
-    if (network->getType() == Network::VIRTUAL) {
-        return static_cast<VirtualNetwork*>(network)->appliesToUser(uid) ? 0 : -EPERM;
-    }
-    VirtualNetwork* virtualNetwork = getVirtualNetworkForUserLocked(uid);
-    if (virtualNetwork && virtualNetwork->isSecure() &&
-            mProtectableUsers.find(uid) == mProtectableUsers.end()) {
-        return -EPERM;
-    }
-    Permission networkPermission = static_cast<PhysicalNetwork*>(network)->getPermission();
-    return ((userPermission & networkPermission) == networkPermission) ? 0 : -EACCES;
-}
-
 int NetworkController::modifyRoute(unsigned netId, const char* interface, const char* destination,
                                    const char* nexthop, bool add, bool legacy, uid_t uid) {
-    if (!isValidNetwork(netId)) {
+    // Held until the route is changed, so that the network can't be destroyed in the meantime.
+    android::RWLock::AutoRLock lock(mRWLock);
+    if (!isValidNetworkLocked(netId)) {
         ALOGE("no such netId %u", netId);
         return -ENONET;
     }
-    unsigned existingNetId = getNetworkForInterface(interface);
+    unsigned existingNetId = getNetworkForInterfaceLocked(interface);
     if (existingNetId == NETID_UNSET) {
         ALOGE("interface %s not assigned to any netId", interface);
         return -ENODEV;
@@ -711,5 +678,134 @@ int NetworkController::modifyFallthroughLocked(unsigned vpnNetId, bool add) {
     return 0;
 }
 
+void NetworkController::publishSnapshotLocked() {
+    std::unique_ptr<Snapshot> snapshot(new Snapshot);
+    snapshot->version = ++mSnapshotVersion;
+    snapshot->defaultNetId = mDefaultNetId;
+    for (const auto& entry : mNetworks) {
+        const Network* network = entry.second;
+        Snapshot::NetworkInfo& info = snapshot->networks[entry.first];
+        info.netId = entry.first;
+        info.type = network->getType();
+        info.permission = PERMISSION_NONE;
+        info.hasDns = false;
+        info.secure = false;
+        if (info.type == Network::PHYSICAL) {
+            info.permission = static_cast<const PhysicalNetwork*>(network)->getPermission();
+        } else if (info.type == Network::VIRTUAL) {
+            const VirtualNetwork* virtualNetwork = static_cast<const VirtualNetwork*>(network);
+            info.hasDns = virtualNetwork->getHasDns();
+            info.secure = virtualNetwork->isSecure();
+        }
+    }
+    snapshot->vpnUids = mVpnUids;
+    snapshot->users.insert(mUsers.begin(), mUsers.end());
+    snapshot->protectableUsers.insert(mProtectableUsers.begin(), mProtectableUsers.end());
+    mSnapshots.publish(std::move(snapshot));
+}
+
+const NetworkController::Snapshot::NetworkInfo* NetworkController::Snapshot::getNetwork(
+        unsigned netId) const {
+    auto iter = networks.find(netId);
+    return iter == networks.end() ? nullptr : &iter->second;
+}
+
+const NetworkController::Snapshot::NetworkInfo*
+NetworkController::Snapshot::getVirtualNetworkForUser(uid_t uid) const {
+    // A user that more than one VPN applies to always gets the one with the lowest netId.
+    const unsigned netId = vpnUids.getNetId(uid);
+    return netId ? getNetwork(netId) : nullptr;
+}
+
+Permission NetworkController::Snapshot::getPermissionForUser(uid_t uid) const {
+    auto iter = users.find(uid);
+    if (iter != users.end()) {
+        return iter->second;
+    }
+    return uid < FIRST_APPLICATION_UID ? PERMISSION_SYSTEM : PERMISSION_NONE;
+}
+
+bool NetworkController::Snapshot::canProtect(uid_t uid) const {
+    return ((getPermissionForUser(uid) & PERMISSION_SYSTEM) == PERMISSION_SYSTEM) ||
+           protectableUsers.find(uid) != protectableUsers.end();
+}
+
+int NetworkController::Snapshot::checkUserNetworkAccess(uid_t uid, unsigned netId) const {
+    const NetworkInfo* network = getNetwork(netId);
+    if (!network) {
+        return -ENONET;
+    }
+
+    // If uid is INVALID_UID, this likely means that we were unable to retrieve the UID of the peer
+    // (using SO_PEERCRED). Be safe and deny access to the network, even if it's valid.
+    if (uid == INVALID_UID) {
+        return -EREMOTEIO;
+    }
+    Permission userPermission = getPermissionForUser(uid);
+    if ((userPermission & PERMISSION_SYSTEM) == PERMISSION_SYSTEM) {
+        return 0;
+    }
+    if (network->type == Network::VIRTUAL) {
+        return vpnUids.hasUid(netId, uid) ? 0 : -EPERM;
+    }
+    const NetworkInfo* virtualNetwork = getVirtualNetworkForUser(uid);
+    if (virtualNetwork && virtualNetwork->secure &&
+            protectableUsers.find(uid) == protectableUsers.end()) {
+        return -EPERM;
+    }
+    Permission networkPermission = network->permission;
+    return ((userPermission & networkPermission) == networkPermission) ? 0 : -EACCES;
+}
+
+uint32_t NetworkController::Snapshot::getNetworkForDns(unsigned* netId, uid_t uid) const {
+    Fwmark fwmark;
+    fwmark.protectedFromVpn = true;
+    fwmark.permission = PERMISSION_SYSTEM;
+    if (checkUserNetworkAccess(uid, *netId) == 0) {
+        // If a non-zero NetId was explicitly specified, and the user has permission for that
+        // network, use that network's DNS servers. Do not fall through to the default network even
+        // if the explicitly selected network is a split tunnel VPN: the explicitlySelected bit
+        // ensures that the VPN fallthrough rule does not match.
+        fwmark.explicitlySelected = true;
+
+        // If the network is a VPN and it doesn't have DNS servers, use the default network's DNS
+        // servers (through the default network). Otherwise, the query is guaranteed to fail.
+        // http://b/29498052
+        const NetworkInfo* network = getNetwork(*netId);
+        if (network && network->type == Network::VIRTUAL && !network->hasDns) {
+            *netId = defaultNetId;
+        }
+    } else {
+        // If the user is subject to a VPN and the VPN provides DNS servers, use those servers
+        // (possibly falling through to the default network if the VPN doesn't provide a route to
+        // them). Otherwise, use the default network's DNS servers.
+        const NetworkInfo* virtualNetwork = getVirtualNetworkForUser(uid);
+        if (virtualNetwork && virtualNetwork->hasDns) {
+            *netId = virtualNetwork->netId;
+        } else {
+            // TODO: return an error instead of silently doing the DNS lookup on the wrong network.
+            // http://b/27560555
+            *netId = defaultNetId;
+        }
+    }
+    fwmark.netId = *netId;
+    return fwmark.intValue;
+}
+
+unsigned NetworkController::Snapshot::getNetworkForUser(uid_t uid) const {
+    if (const NetworkInfo* virtualNetwork = getVirtualNetworkForUser(uid)) {
+        return virtualNetwork->netId;
+    }
+    return defaultNetId;
+}
+
+unsigned NetworkController::Snapshot::getNetworkForConnect(uid_t uid) const {
+    const NetworkInfo* virtualNetwork = getVirtualNetworkForUser(uid);
+    if (virtualNetwork && !virtualNetwork->secure) {
+        return virtualNetwork->netId;
+    }
+    return defaultNetId;
+}
+
 }  // namespace net
 }  // namespace android
@@ -20,6 +20,8 @@
 #include <android/multinetwork.h>
 #include "NetdConstants.h"
 #include "Permission.h"
+#include "SnapshotPublisher.h"
+#include "UidRangeIndex.h"
 
 #include "utils/RWLock.h"
 
@@ -66,7 +68,6 @@ static inline net_handle_t netIdToNetHandle(unsigned fromNetId) {
 
 class DumpWriter;
 class Network;
-class UidRanges;
 class VirtualNetwork;
 
 /*
@@ -83,6 +84,7 @@ public:
     static const unsigned DUMMY_NET_ID;
 
     NetworkController();
+    ~NetworkController();
 
     unsigned getDefaultNetwork() const;
     int setDefaultNetwork(unsigned netId) WARN_UNUSED_RESULT;
@@ -131,12 +133,13 @@ public:
     void dump(DumpWriter& dw);
 
 private:
-    bool isValidNetwork(unsigned netId) const;
+    struct Snapshot;
+    class WriteLock;
+
     bool isValidNetworkLocked(unsigned netId) const;
+    unsigned getNetworkForInterfaceLocked(const char* interface) const;
     Network* getNetworkLocked(unsigned netId) const;
-    VirtualNetwork* getVirtualNetworkForUserLocked(uid_t uid) const;
-    Permission getPermissionForUserLocked(uid_t uid) const;
-    int checkUserNetworkAccessLocked(uid_t uid, unsigned netId) const;
+    void publishSnapshotLocked();
     int createPhysicalNetworkLocked(unsigned netId, Permission permission) WARN_UNUSED_RESULT;
 
     int modifyRoute(unsigned netId, const char* interface, const char* destination,
@@ -146,12 +149,21 @@ private:
     class DelegateImpl;
     DelegateImpl* const mDelegateImpl;
 
-    // mRWLock guards all accesses to mDefaultNetId, mNetworks, mUsers and mProtectableUsers.
+    // mRWLock guards all accesses to mDefaultNetId, mNetworks, mUsers, mProtectableUsers and
+    // mVpnUids.
     mutable android::RWLock mRWLock;
     unsigned mDefaultNetId;
     std::map<unsigned, Network*> mNetworks;  // Map keys are NetIds.
     std::map<uid_t, Permission> mUsers;
     std::set<uid_t> mProtectableUsers;
+    // The UID ranges of all VPNs, merged so that finding the VPN for a UID is one lookup.
+    UidRangeIndex mVpnUids;
+
+    // An immutable copy of the state above that selects networks and marks for DNS lookups and
+    // connect() calls. Every change to that state publishes a new one before releasing mRWLock, so
+    // the methods that only select networks read it instead of taking the lock.
+    SnapshotPublisher<Snapshot> mSnapshots;
+    uint64_t mSnapshotVersion;
 };
 
 }  // namespace net
@@ -21,6 +21,8 @@
 
 #include <list>
 
+#include <utils/RWLock.h>
+
 typedef std::list<char *> TtyCollection;
 
 class PppController {
@@ -31,6 +33,8 @@ public:
     PppController();
     virtual ~PppController();
 
+    android::RWLock lock;
+
     int attachPppd(const char *tty, struct in_addr local,
                    struct in_addr remote, struct in_addr dns1,
                    struct in_addr dns2);
@@ -27,6 +27,7 @@
 #include <utility>
 #include <vector>
 #include <cutils/log.h>
+#include <inttypes.h>
 #include <net/if.h>
 #include <sys/socket.h>
 #include <netdb.h>
@@ -39,6 +40,7 @@
 #include <resolv_params.h>
 #include <resolv_stats.h>
 
+#include <android-base/stringprintf.h>
 #include <android-base/strings.h>
 #include <android/net/INetd.h>
 
@@ -106,8 +108,8 @@ typedef std::set<PrivateDnsServer> PrivateDnsSet;
 PrivateDnsSet privateDnsServers;
 
 // Structure for tracking the validation status of servers on a specific netid.
-// Servers that fail validation are removed from the tracker, and can be retried.
-enum class Validation : bool { in_process, success };
+// Servers that fail validation stay in the tracker while the validation scheduler retries them.
+enum class Validation : uint8_t { in_process, success, fail };
 typedef std::map<PrivateDnsServer, Validation> PrivateDnsTracker;
 std::map<unsigned, PrivateDnsTracker> privateDnsTransports;
 
@@ -122,15 +124,13 @@ PrivateDnsSet parseServers(const char** servers, int numservers, in_port_t port)
     return set;
 }
 
-void checkPrivateDnsProviders(const unsigned netId, const char** servers, int numservers) {
+void checkPrivateDnsProviders(const unsigned netId, const char** servers, int numservers,
+        DnsTlsValidationScheduler* scheduler) {
     if (DBG) {
         ALOGD("checkPrivateDnsProviders(%u)", netId);
     }
 
     std::lock_guard<std::mutex> guard(privateDnsLock);
-    if (privateDnsServers.empty()) {
-        return;
-    }
 
     // First compute the intersection of the servers to check with the
     // servers that are permitted to use DNS over TLS.  The intersection
@@ -140,12 +140,12 @@ void checkPrivateDnsProviders(const unsigned netId, const char** servers, int nu
     std::set_intersection(privateDnsServers.begin(), privateDnsServers.end(),
         serversToCheck.begin(), serversToCheck.end(),
         std::inserter(intersection, intersection.begin()));
-    if (intersection.empty()) {
-        return;
-    }
 
     auto netPair = privateDnsTransports.find(netId);
     if (netPair == privateDnsTransports.end()) {
+        if (intersection.empty()) {
+            return;
+        }
         // New netId
         bool added;
         std::tie(netPair, added) = privateDnsTransports.emplace(netId, PrivateDnsTracker());
@@ -156,56 +156,106 @@ void checkPrivateDnsProviders(const unsigned netId, const char** servers, int nu
     }
 
     auto& tracker = netPair->second;
+    // Forget the servers that the network no longer uses, so that queries are not sent to them
+    // over TLS and their failed validations are not retried.
+    for (auto it = tracker.begin(); it != tracker.end();) {
+        if (intersection.count(it->first) == 0) {
+            scheduler->cancel(netId, it->first.ss);
+            it = tracker.erase(it);
+        } else {
+            ++it;
+        }
+    }
     for (const auto& privateServer : intersection) {
         if (tracker.count(privateServer) != 0) {
             continue;
         }
         tracker[privateServer] = Validation::in_process;
-        std::thread validate_thread([privateServer, netId] {
-            // validateDnsTlsServer() is a blocking call that performs network operations.
-            // It can take milliseconds to minutes, up to the SYN retry limit.
-            bool success = validateDnsTlsServer(netId,
-                    privateServer.ss, privateServer.fingerprints);
-            std::lock_guard<std::mutex> guard(privateDnsLock);
-            auto netPair = privateDnsTransports.find(netId);
-            if (netPair == privateDnsTransports.end()) {
-                ALOGW("netId %u was erased during private DNS validation", netId);
-                return;
-            }
-            auto& tracker = netPair->second;
-            if (privateDnsServers.count(privateServer) == 0) {
-                ALOGW("Server was removed during private DNS validation");
-                success = false;
-            }
-            if (success) {
-                tracker[privateServer] = Validation::success;
-            } else {
-                // Validation failure is expected if a user is on a captive portal.
-                // TODO: Trigger a second validation attempt after captive portal login
-                // succeeds.
-                tracker.erase(privateServer);
-            }
-        });
-        validate_thread.detach();
+        scheduler->schedule(netId, privateServer.ss, privateServer.fingerprints);
+    }
+    if (tracker.empty()) {
+        privateDnsTransports.erase(netPair);
+    }
+}
+
+// Records the outcome of a validation started by checkPrivateDnsProviders(). Returns true if a
+// failed validation should be retried.
+bool onPrivateDnsValidated(unsigned netId, const sockaddr_storage& server, bool success) {
+    std::lock_guard<std::mutex> guard(privateDnsLock);
+    auto netPair = privateDnsTransports.find(netId);
+    if (netPair == privateDnsTransports.end()) {
+        ALOGW("netId %u was erased during private DNS validation", netId);
+        return false;
+    }
+    auto& tracker = netPair->second;
+    const PrivateDnsServer privateServer(server);
+    if (privateDnsServers.count(privateServer) == 0) {
+        ALOGW("Server was removed during private DNS validation");
+        tracker.erase(privateServer);
+        return false;
     }
+    const auto serverPair = tracker.find(privateServer);
+    if (serverPair == tracker.end()) {
+        // The network stopped using the server while it was being validated.
+        if (DBG) {
+            ALOGD("Server is no longer used by netId %u", netId);
+        }
+        return false;
+    }
+    // Validation failure is expected if a user is on a captive portal. The scheduler retries
+    // with backoff, and revalidatePrivateDnsServers() retries immediately after login.
+    serverPair->second = success ? Validation::success : Validation::fail;
+    return !success;
+}
+
+const char* validationToString(Validation validation) {
+    switch (validation) {
+        case Validation::in_process: return "validating";
+        case Validation::success: return "validated";
+        case Validation::fail: return "failed, retrying";
+    }
+    return "unknown";
 }
 
-void clearPrivateDnsProviders(unsigned netId) {
+std::string addrToString(const sockaddr_storage& ss) {
+    char hbuf[NI_MAXHOST];
+    char sbuf[NI_MAXSERV];
+    if (getnameinfo(reinterpret_cast<const sockaddr*>(&ss), sizeof(ss), hbuf, sizeof(hbuf),
+            sbuf, sizeof(sbuf), NI_NUMERICHOST | NI_NUMERICSERV) != 0) {
+        return "<invalid>";
+    }
+    return android::base::StringPrintf((ss.ss_family == AF_INET6) ? "[%s]:%s" : "%s:%s",
+            hbuf, sbuf);
+}
+
+void clearPrivateDnsProviders(unsigned netId, DnsTlsValidationScheduler* scheduler) {
     if (DBG) {
         ALOGD("clearPrivateDnsProviders(%u)", netId);
     }
     std::lock_guard<std::mutex> guard(privateDnsLock);
     privateDnsTransports.erase(netId);
+    scheduler->cancelNetwork(netId);
 }
 
 }  // namespace
 
+ResolverController::ResolverController()
+    : mValidationScheduler(
+              [this](unsigned netId, const sockaddr_storage& server,
+                      const std::set<std::vector<uint8_t>>& fingerprints) {
+                  return validateDnsTlsServer(netId, server, fingerprints,
+                          &mDnsTlsDispatcher.getSessionCache());
+              },
+              onPrivateDnsValidated) {}
+
 int ResolverController::setDnsServers(unsigned netId, const char* searchDomains,
         const char** servers, int numservers, const __res_params* params) {
     if (DBG) {
         ALOGD("setDnsServers netId = %u\n", netId);
     }
-    checkPrivateDnsProviders(netId, servers, numservers);
+    checkPrivateDnsProviders(netId, servers, numservers, &mValidationScheduler);
+    // Answers from the previous servers may not be valid any more.
+    mDnsCache.invalidate(netId);
     return -_resolv_set_nameservers_for_net(netId, servers, numservers, searchDomains, params);
 }
 
@@ -235,7 +285,8 @@ int ResolverController::clearDnsServers(unsigned netId) {
     if (DBG) {
         ALOGD("clearDnsServers netId = %u\n", netId);
     }
-    clearPrivateDnsProviders(netId);
+    clearPrivateDnsProviders(netId, &mValidationScheduler);
+    mDnsCache.invalidate(netId);
     return 0;
 }
 
@@ -245,6 +296,7 @@ int ResolverController::flushDnsCache(unsigned netId) {
     }
 
     _resolv_flush_cache_for_net(netId);
+    mDnsCache.invalidate(netId);
 
     return 0;
 }
@@ -427,6 +479,29 @@ void ResolverController::dump(DumpWriter& dw, unsigned netId) {
                     static_cast<unsigned>(params.max_samples));
         }
     }
+    mDnsCache.dump(dw, netId);
+    dumpPrivateDns(dw, netId);
+    dw.decIndent();
+}
+
+void ResolverController::dumpPrivateDns(DumpWriter& dw, unsigned netId) {
+    std::lock_guard<std::mutex> guard(privateDnsLock);
+    const auto netPair = privateDnsTransports.find(netId);
+    if (netPair == privateDnsTransports.end() || netPair->second.empty()) {
+        dw.println("No private DNS servers");
+        return;
+    }
+    dw.println("Private DNS servers: # IP:port (status, TLS handshakes, resumed, resumption rate)");
+    dw.incIndent();
+    for (const auto& serverPair : netPair->second) {
+        const PrivateDnsServer& server = serverPair.first;
+        const DnsTlsSessionCache::Stats stats = mDnsTlsDispatcher.getSessionCache().getStats(
+                DnsTlsSessionCache::makeKey(server.ss, server.fingerprints));
+        const unsigned rate = stats.handshakes ? (100 * stats.resumed / stats.handshakes) : 0;
+        dw.println("%s (%s, %" PRIu64 ", %" PRIu64 ", %u%%)", addrToString(server.ss).c_str(),
+                validationToString(serverPair.second),
+                stats.handshakes, stats.resumed, rate);
+    }
     dw.decIndent();
 }
 
@@ -478,8 +553,16 @@ int ResolverController::removePrivateDnsServer(const std::string& server) {
     for (auto& pair : privateDnsTransports) {
         pair.second.erase(parsed);
     }
+    mValidationScheduler.cancelServer(parsed);
     return INetd::PRIVATE_DNS_SUCCESS;
 }
 
+void ResolverController::revalidatePrivateDnsServers(unsigned netId) {
+    if (DBG) {
+        ALOGD("revalidatePrivateDnsServers(%u)", netId);
+    }
+    mValidationScheduler.revalidate(netId);
+}
+
 }  // namespace net
 }  // namespace android
@@ -21,6 +21,10 @@
 #include <netinet/in.h>
 #include <linux/in.h>
 
+#include "DnsCache.h"
+#include "dns/DnsTlsDispatcher.h"
+#include "dns/DnsTlsValidationScheduler.h"
+
 struct __res_params;
 
 namespace android {
@@ -31,7 +35,7 @@ struct ResolverStats;
 
 class ResolverController {
 public:
-    ResolverController() {};
+    ResolverController();
 
     virtual ~ResolverController() {};
 
@@ -70,6 +74,25 @@ public:
             const std::string& fingerprintAlgorithm,
             const std::set<std::vector<uint8_t>>& fingerprints);
     int removePrivateDnsServer(const std::string& server);
+
+    // Immediately retries the validation of any private DNS servers on |netId| that failed
+    // validation, e.g. because the network was behind a captive portal.
+    void revalidatePrivateDnsServers(unsigned netId);
+
+    // Pool of DNS-over-TLS connections used for queries to validated private DNS servers.
+    DnsTlsDispatcher& getDnsTlsDispatcher() { return mDnsTlsDispatcher; }
+
+    // Answers DnsProxyListener has cached, which are dropped whenever the resolver's own cache
+    // for the network is flushed.
+    DnsCache& getDnsCache() { return mDnsCache; }
+
+private:
+    void dumpPrivateDns(DumpWriter& dw, unsigned netId);
+
+    DnsTlsDispatcher mDnsTlsDispatcher;
+    // Declared after mDnsTlsDispatcher, whose session cache validations use.
+    DnsTlsValidationScheduler mValidationScheduler;
+    DnsCache mDnsCache;
 };
 
 }  // namespace net
@@ -19,18 +19,23 @@
 #include <arpa/inet.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <inttypes.h>
 #include <linux/fib_rules.h>
 #include <net/if.h>
 #include <sys/stat.h>
 
 #include <private/android_filesystem_config.h>
 
+#include <functional>
 #include <map>
+#include <mutex>
 
 #include "DummyNetwork.h"
 #include "Fwmark.h"
+#include "InterfaceRegistry.h"
 #include "NetdConstants.h"
 #include "NetlinkCommands.h"
+#include "Stopwatch.h"
 #include "UidRanges.h"
 
 #include "android-base/file.h"
@@ -138,17 +143,172 @@ const char *familyName(uint8_t family) {
     }
 }
 
-// No locks needed because RouteController is accessed only from one thread (in CommandListener).
+// Collects the rule changes of one RouteController operation and sends them to the kernel in a
+// single NetlinkBatch. If any of them fails, the ones that succeeded are undone, so that the
+// operation either takes effect completely or not at all.
+//
+// Changes that are not rule changes, such as iptables rules, are made right away by the caller,
+// which registers a way to undo them with addUndo(). They are undone if the operation fails or is
+// abandoned before commit().
+class RouteTransaction {
+public:
+    explicit RouteTransaction(const char* operation) : mOperation(operation) {}
+    ~RouteTransaction();
+
+    // Queues a request that adds or deletes a rule or route. |iov| is laid out as for
+    // sendNetlinkRequest(). |description| is logged if the request fails.
+    void addRequest(uint16_t action, const iovec* iov, int iovlen, std::string description);
+
+    // Registers a function that undoes a change that was already made.
+    void addUndo(std::function<int()> undo) { mUndos.push_back(std::move(undo)); }
+
+    // Sends all queued requests. Returns 0 on success, or negative errno if any request failed,
+    // in which case all changes have been undone.
+    WARN_UNUSED_RESULT int commit();
+
+private:
+    struct Request {
+        uint16_t action;
+        std::string payload;
+        std::string description;
+    };
+
+    void undo();
+
+    const char* const mOperation;
+    const Stopwatch mStopwatch;
+    std::vector<Request> mRequests;
+    std::vector<std::function<int()>> mUndos;
+    bool mDone = false;
+};
+
+// Per-operation cost of RouteTransactions, for dumpsys.
+struct TransactionStats {
+    uint64_t count = 0;
+    uint64_t failures = 0;
+    uint64_t requests = 0;
+    float totalMs = 0;
+    float maxMs = 0;
+};
+
+std::mutex transactionStatsLock;
+std::map<std::string, TransactionStats> transactionStats;
+
+void recordTransaction(const char* operation, size_t requests, bool failed, float ms) {
+    std::lock_guard<std::mutex> guard(transactionStatsLock);
+    TransactionStats& stats = transactionStats[operation];
+    stats.count++;
+    stats.failures += failed;
+    stats.requests += requests;
+    stats.totalMs += ms;
+    stats.maxMs = std::max(stats.maxMs, ms);
+}
+
+uint16_t undoAction(uint16_t action) {
+    switch (action) {
+        case RTM_NEWRULE: return RTM_DELRULE;
+        case RTM_DELRULE: return RTM_NEWRULE;
+        case RTM_NEWROUTE: return RTM_DELROUTE;
+        case RTM_DELROUTE: return RTM_NEWROUTE;
+        default: return action;
+    }
+}
+
+uint16_t requestFlags(uint16_t action) {
+    return (action == RTM_NEWRULE || action == RTM_NEWROUTE) ? NETLINK_CREATE_REQUEST_FLAGS :
+                                                               NETLINK_REQUEST_FLAGS;
+}
+
+RouteTransaction::~RouteTransaction() {
+    if (!mDone) {
+        undo();
+        recordTransaction(mOperation, 0, true, mStopwatch.timeTaken());
+    }
+}
+
+void RouteTransaction::addRequest(uint16_t action, const iovec* iov, int iovlen,
+                                  std::string description) {
+    Request request = { .action = action, .description = std::move(description) };
+    for (int i = 1; i < iovlen; ++i) {
+        request.payload.append(static_cast<const char*>(iov[i].iov_base), iov[i].iov_len);
+    }
+    mRequests.push_back(std::move(request));
+}
+
+int RouteTransaction::commit() {
+    NetlinkBatch batch;
+    for (const Request& request : mRequests) {
+        iovec iov[] = {
+            { NULL,                                      0 },
+            { const_cast<char*>(request.payload.data()), request.payload.size() },
+        };
+        batch.add(request.action, requestFlags(request.action), iov, ARRAY_SIZE(iov));
+    }
+    const int ret = batch.send();
+    mDone = true;
+
+    std::vector<size_t> undone;
+    if (ret) {
+        // Undo the requests that succeeded, newest first.
+        NetlinkBatch undoBatch;
+        for (size_t i = mRequests.size(); i-- > 0;) {
+            const int result = batch.results()[i];
+            if (result) {
+                ALOGE("Error %s: %s", mRequests[i].description.c_str(), strerror(-result));
+                continue;
+            }
+            const std::string& payload = mRequests[i].payload;
+            iovec iov[] = {
+                { NULL,                              0 },
+                { const_cast<char*>(payload.data()), payload.size() },
+            };
+            const uint16_t action = undoAction(mRequests[i].action);
+            undoBatch.add(action, requestFlags(action), iov, ARRAY_SIZE(iov));
+            undone.push_back(i);
+        }
+        if (undoBatch.send()) {
+            for (size_t i = 0; i < undone.size(); i++) {
+                if (int result = undoBatch.results()[i]) {
+                    ALOGE("Error undoing %s: %s", mRequests[undone[i]].description.c_str(),
+                          strerror(-result));
+                }
+            }
+        }
+        undo();
+    }
+
+    const float ms = mStopwatch.timeTaken();
+    recordTransaction(mOperation, mRequests.size(), ret != 0, ms);
+    if (ret) {
+        ALOGE("%s failed after %.1f ms, undid %zu of %zu rule changes", mOperation, ms,
+              undone.size(), mRequests.size());
+    }
+    return ret;
+}
+
+void RouteTransaction::undo() {
+    for (auto it = mUndos.rbegin(); it != mUndos.rend(); ++it) {
+        if (int ret = (*it)()) {
+            ALOGE("%s: error undoing change: %s", mOperation, strerror(-ret));
+        }
+    }
+    mUndos.clear();
+}
+
+// Route changes come from CommandListener, which doesn't take a lock for them, and from other
+// threads that hold the NetworkController lock, so the table map needs its own lock.
+std::mutex interfaceToTableLock;
 std::map<std::string, uint32_t> interfaceToTable;
 
 uint32_t getRouteTableForInterface(const char* interface) {
-    uint32_t index = if_nametoindex(interface);
+    std::lock_guard<std::mutex> guard(interfaceToTableLock);
+    uint32_t index = gInterfaceRegistry.getIndex(interface);
     if (index) {
         index += RouteController::ROUTE_TABLE_OFFSET_FROM_INDEX;
         interfaceToTable[interface] = index;
         return index;
     }
-    // If the interface goes away if_nametoindex() will return 0 but we still need to know
+    // If the interface goes away getIndex() will return 0 but we still need to know
     // the index so we can remove the rules and routes.
     auto iter = interfaceToTable.find(interface);
     if (iter == interfaceToTable.end()) {
@@ -178,6 +338,7 @@ void updateTableNamesFile() {
     addTableName(ROUTE_TABLE_LEGACY_NETWORK, ROUTE_TABLE_NAME_LEGACY_NETWORK, &contents);
     addTableName(ROUTE_TABLE_LEGACY_SYSTEM,  ROUTE_TABLE_NAME_LEGACY_SYSTEM,  &contents);
 
+    std::lock_guard<std::mutex> guard(interfaceToTableLock);
     for (const auto& entry : interfaceToTable) {
         addTableName(entry.second, entry.first, &contents);
     }
@@ -214,10 +375,12 @@ int padInterfaceName(const char* input, char* name, size_t* length, uint16_t* pa
 // + If |oif| is non-NULL, the rule matches the specified outgoing interface.
 // + If |uidStart| and |uidEnd| are not INVALID_UID, the rule matches packets from UIDs in that
 //   range (inclusive). Otherwise, the rule matches packets from all UIDs.
+// + If |transaction| is non-NULL, the change is queued in it. Otherwise, it is made right away.
 //
 // Returns 0 on success or negative errno on failure.
-WARN_UNUSED_RESULT int modifyIpRule(uint16_t action, uint32_t priority, uint8_t ruleType,
-                                    uint32_t table, uint32_t fwmark, uint32_t mask, const char* iif,
+WARN_UNUSED_RESULT int modifyIpRule(RouteTransaction* transaction, uint16_t action,
+                                    uint32_t priority, uint8_t ruleType, uint32_t table,
+                                    uint32_t fwmark, uint32_t mask, const char* iif,
                                     const char* oif, uid_t uidStart, uid_t uidEnd) {
     // Ensure that if you set a bit in the fwmark, it's not being ignored by the mask.
     if (fwmark & ~mask) {
@@ -288,6 +451,13 @@ WARN_UNUSED_RESULT int modifyIpRule(uint16_t action, uint32_t priority, uint8_t
     uint16_t flags = (action == RTM_NEWRULE) ? NETLINK_CREATE_REQUEST_FLAGS : NETLINK_REQUEST_FLAGS;
     for (size_t i = 0; i < ARRAY_SIZE(AF_FAMILIES); ++i) {
         rule.family = AF_FAMILIES[i];
+        if (transaction) {
+            transaction->addRequest(action, iov, ARRAY_SIZE(iov),
+                                    StringPrintf("%s %s rule with priority %u",
+                                                 actionName(action), familyName(rule.family),
+                                                 priority));
+            continue;
+        }
         if (int ret = sendNetlinkRequest(action, flags, iov, ARRAY_SIZE(iov), nullptr)) {
             if (!(action == RTM_DELRULE && ret == -ENOENT && priority == RULE_PRIORITY_TETHERING)) {
                 // Don't log when deleting a tethering rule that's not there. This matches the
@@ -302,17 +472,38 @@ WARN_UNUSED_RESULT int modifyIpRule(uint16_t action, uint32_t priority, uint8_t
     return 0;
 }
 
+WARN_UNUSED_RESULT int modifyIpRule(uint16_t action, uint32_t priority, uint8_t ruleType,
+                                    uint32_t table, uint32_t fwmark, uint32_t mask, const char* iif,
+                                    const char* oif, uid_t uidStart, uid_t uidEnd) {
+    return modifyIpRule(nullptr, action, priority, ruleType, table, fwmark, mask, iif, oif,
+                        uidStart, uidEnd);
+}
+
+WARN_UNUSED_RESULT int modifyIpRule(RouteTransaction* transaction, uint16_t action,
+                                    uint32_t priority, uint32_t table, uint32_t fwmark,
+                                    uint32_t mask, const char* iif, const char* oif,
+                                    uid_t uidStart, uid_t uidEnd) {
+    return modifyIpRule(transaction, action, priority, FR_ACT_TO_TBL, table, fwmark, mask, iif,
+                        oif, uidStart, uidEnd);
+}
+
 WARN_UNUSED_RESULT int modifyIpRule(uint16_t action, uint32_t priority, uint32_t table,
                                     uint32_t fwmark, uint32_t mask, const char* iif,
                                     const char* oif, uid_t uidStart, uid_t uidEnd) {
-    return modifyIpRule(action, priority, FR_ACT_TO_TBL, table, fwmark, mask, iif, oif, uidStart,
+    return modifyIpRule(nullptr, action, priority, table, fwmark, mask, iif, oif, uidStart,
                         uidEnd);
 }
 
+WARN_UNUSED_RESULT int modifyIpRule(RouteTransaction* transaction, uint16_t action,
+                                    uint32_t priority, uint32_t table, uint32_t fwmark,
+                                    uint32_t mask) {
+    return modifyIpRule(transaction, action, priority, table, fwmark, mask, IIF_NONE, OIF_NONE,
+                        INVALID_UID, INVALID_UID);
+}
+
 WARN_UNUSED_RESULT int modifyIpRule(uint16_t action, uint32_t priority, uint32_t table,
                                     uint32_t fwmark, uint32_t mask) {
-    return modifyIpRule(action, priority, table, fwmark, mask, IIF_NONE, OIF_NONE, INVALID_UID,
-                        INVALID_UID);
+    return modifyIpRule(nullptr, action, priority, table, fwmark, mask);
 }
 
 // Adds or deletes an IPv4 or IPv6 route.
@@ -359,7 +550,7 @@ WARN_UNUSED_RESULT int modifyIpRoute(uint16_t action, uint32_t table, const char
     } else {
         // If an interface was specified, find the ifindex.
         if (interface != OIF_NONE) {
-            ifindex = if_nametoindex(interface);
+            ifindex = gInterfaceRegistry.getIndex(interface);
             if (!ifindex) {
                 ALOGE("cannot find interface %s", interface);
                 return -ENODEV;
@@ -439,10 +630,11 @@ WARN_UNUSED_RESULT int modifyIncomingPacketMark(unsigned netId, const char* inte
 //
 // When a VPN is in effect, packets from the local network to upstream networks are forwarded into
 // the VPN's tunnel interface. When the VPN forwards the responses, they emerge out of the tunnel.
-WARN_UNUSED_RESULT int modifyVpnOutputToLocalRule(const char* vpnInterface, bool add) {
-    return modifyIpRule(add ? RTM_NEWRULE : RTM_DELRULE, RULE_PRIORITY_VPN_OUTPUT_TO_LOCAL,
-                        ROUTE_TABLE_LOCAL_NETWORK, MARK_UNSET, MARK_UNSET, vpnInterface, OIF_NONE,
-                        INVALID_UID, INVALID_UID);
+WARN_UNUSED_RESULT int modifyVpnOutputToLocalRule(RouteTransaction* transaction,
+                                                  const char* vpnInterface, bool add) {
+    return modifyIpRule(transaction, add ? RTM_NEWRULE : RTM_DELRULE,
+                        RULE_PRIORITY_VPN_OUTPUT_TO_LOCAL, ROUTE_TABLE_LOCAL_NETWORK, MARK_UNSET,
+                        MARK_UNSET, vpnInterface, OIF_NONE, INVALID_UID, INVALID_UID);
 }
 
 // A rule to route all traffic from a given set of UIDs to go over the VPN.
@@ -450,8 +642,8 @@ WARN_UNUSED_RESULT int modifyVpnOutputToLocalRule(const char* vpnInterface, bool
 // Notice that this rule doesn't use the netId. I.e., no matter what netId the user's socket may
 // have, if they are subject to this VPN, their traffic has to go through it. Allows the traffic to
 // bypass the VPN if the protectedFromVpn bit is set.
-WARN_UNUSED_RESULT int modifyVpnUidRangeRule(uint32_t table, uid_t uidStart, uid_t uidEnd,
-                                             bool secure, bool add) {
+WARN_UNUSED_RESULT int modifyVpnUidRangeRule(RouteTransaction* transaction, uint32_t table,
+                                             uid_t uidStart, uid_t uidEnd, bool secure, bool add) {
     Fwmark fwmark;
     Fwmark mask;
 
@@ -469,8 +661,8 @@ WARN_UNUSED_RESULT int modifyVpnUidRangeRule(uint32_t table, uid_t uidStart, uid
         mask.explicitlySelected = true;
     }
 
-    return modifyIpRule(add ? RTM_NEWRULE : RTM_DELRULE, priority, table, fwmark.intValue,
-                        mask.intValue, IIF_LOOPBACK, OIF_NONE, uidStart, uidEnd);
+    return modifyIpRule(transaction, add ? RTM_NEWRULE : RTM_DELRULE, priority, table,
+                        fwmark.intValue, mask.intValue, IIF_LOOPBACK, OIF_NONE, uidStart, uidEnd);
 }
 
 // A rule to allow system apps to send traffic over this VPN even if they are not part of the target
@@ -478,7 +670,8 @@ WARN_UNUSED_RESULT int modifyVpnUidRangeRule(uint32_t table, uid_t uidStart, uid
 //
 // This is needed for DnsProxyListener to correctly resolve a request for a user who is in the
 // target set, but where the DnsProxyListener itself is not.
-WARN_UNUSED_RESULT int modifyVpnSystemPermissionRule(unsigned netId, uint32_t table, bool secure,
+WARN_UNUSED_RESULT int modifyVpnSystemPermissionRule(RouteTransaction* transaction,
+                                                     unsigned netId, uint32_t table, bool secure,
                                                      bool add) {
     Fwmark fwmark;
     Fwmark mask;
@@ -491,8 +684,8 @@ WARN_UNUSED_RESULT int modifyVpnSystemPermissionRule(unsigned netId, uint32_t ta
 
     uint32_t priority = secure ? RULE_PRIORITY_SECURE_VPN : RULE_PRIORITY_BYPASSABLE_VPN;
 
-    return modifyIpRule(add ? RTM_NEWRULE : RTM_DELRULE, priority, table, fwmark.intValue,
-                        mask.intValue);
+    return modifyIpRule(transaction, add ? RTM_NEWRULE : RTM_DELRULE, priority, table,
+                        fwmark.intValue, mask.intValue);
 }
 
 // A rule to route traffic based on an explicitly chosen network.
@@ -502,9 +695,9 @@ WARN_UNUSED_RESULT int modifyVpnSystemPermissionRule(unsigned netId, uint32_t ta
 // Even though we check permissions at the time we set a netId into the fwmark of a socket, we need
 // to check it again in the rules here, because a network's permissions may have been updated via
 // modifyNetworkPermission().
-WARN_UNUSED_RESULT int modifyExplicitNetworkRule(unsigned netId, uint32_t table,
-                                                 Permission permission, uid_t uidStart,
-                                                 uid_t uidEnd, bool add) {
+WARN_UNUSED_RESULT int modifyExplicitNetworkRule(RouteTransaction* transaction, unsigned netId,
+                                                 uint32_t table, Permission permission,
+                                                 uid_t uidStart, uid_t uidEnd, bool add) {
     Fwmark fwmark;
     Fwmark mask;
 
@@ -517,15 +710,17 @@ WARN_UNUSED_RESULT int modifyExplicitNetworkRule(unsigned netId, uint32_t table,
     fwmark.permission = permission;
     mask.permission = permission;
 
-    return modifyIpRule(add ? RTM_NEWRULE : RTM_DELRULE, RULE_PRIORITY_EXPLICIT_NETWORK, table,
-                        fwmark.intValue, mask.intValue, IIF_NONE, OIF_NONE, uidStart, uidEnd);
+    return modifyIpRule(transaction, add ? RTM_NEWRULE : RTM_DELRULE,
+                        RULE_PRIORITY_EXPLICIT_NETWORK, table, fwmark.intValue, mask.intValue,
+                        IIF_NONE, OIF_NONE, uidStart, uidEnd);
 }
 
 // A rule to route traffic based on a chosen outgoing interface.
 //
 // Supports apps that use SO_BINDTODEVICE or IP_PKTINFO options and the kernel that already knows
 // the outgoing interface (typically for link-local communications).
-WARN_UNUSED_RESULT int modifyOutputInterfaceRules(const char* interface, uint32_t table,
+WARN_UNUSED_RESULT int modifyOutputInterfaceRules(RouteTransaction* transaction,
+                                                  const char* interface, uint32_t table,
                                                   Permission permission, uid_t uidStart,
                                                   uid_t uidEnd, bool add) {
     Fwmark fwmark;
@@ -537,15 +732,16 @@ WARN_UNUSED_RESULT int modifyOutputInterfaceRules(const char* interface, uint32_
     // If this rule does not specify a UID range, then also add a corresponding high-priority rule
     // for UID. This covers forwarded packets and system daemons such as the tethering DHCP server.
     if (uidStart == INVALID_UID && uidEnd == INVALID_UID) {
-        if (int ret = modifyIpRule(add ? RTM_NEWRULE : RTM_DELRULE, RULE_PRIORITY_VPN_OVERRIDE_OIF,
-                                   table, fwmark.intValue, mask.intValue, IIF_NONE, interface,
-                                   UID_ROOT, UID_ROOT)) {
+        if (int ret = modifyIpRule(transaction, add ? RTM_NEWRULE : RTM_DELRULE,
+                                   RULE_PRIORITY_VPN_OVERRIDE_OIF, table, fwmark.intValue,
+                                   mask.intValue, IIF_NONE, interface, UID_ROOT, UID_ROOT)) {
             return ret;
         }
     }
 
-    return modifyIpRule(add ? RTM_NEWRULE : RTM_DELRULE, RULE_PRIORITY_OUTPUT_INTERFACE, table,
-                        fwmark.intValue, mask.intValue, IIF_NONE, interface, uidStart, uidEnd);
+    return modifyIpRule(transaction, add ? RTM_NEWRULE : RTM_DELRULE,
+                        RULE_PRIORITY_OUTPUT_INTERFACE, table, fwmark.intValue, mask.intValue,
+                        IIF_NONE, interface, uidStart, uidEnd);
 }
 
 // A rule to route traffic based on the chosen network.
@@ -553,8 +749,8 @@ WARN_UNUSED_RESULT int modifyOutputInterfaceRules(const char* interface, uint32_
 // This is for sockets that have not explicitly requested a particular network, but have been
 // bound to one when they called connect(). This ensures that sockets connected on a particular
 // network stay on that network even if the default network changes.
-WARN_UNUSED_RESULT int modifyImplicitNetworkRule(unsigned netId, uint32_t table,
-                                                 Permission permission, bool add) {
+WARN_UNUSED_RESULT int modifyImplicitNetworkRule(RouteTransaction* transaction, unsigned netId,
+                                                 uint32_t table, Permission permission, bool add) {
     Fwmark fwmark;
     Fwmark mask;
 
@@ -567,8 +763,8 @@ WARN_UNUSED_RESULT int modifyImplicitNetworkRule(unsigned netId, uint32_t table,
     fwmark.permission = permission;
     mask.permission = permission;
 
-    return modifyIpRule(add ? RTM_NEWRULE : RTM_DELRULE, RULE_PRIORITY_IMPLICIT_NETWORK, table,
-                        fwmark.intValue, mask.intValue);
+    return modifyIpRule(transaction, add ? RTM_NEWRULE : RTM_DELRULE,
+                        RULE_PRIORITY_IMPLICIT_NETWORK, table, fwmark.intValue, mask.intValue);
 }
 
 // A rule to enable split tunnel VPNs.
@@ -628,8 +824,9 @@ WARN_UNUSED_RESULT int addLegacyRouteRules() {
 
 // Add rules to lookup the local network when specified explicitly or otherwise.
 WARN_UNUSED_RESULT int addLocalNetworkRules(unsigned localNetId) {
-    if (int ret = modifyExplicitNetworkRule(localNetId, ROUTE_TABLE_LOCAL_NETWORK, PERMISSION_NONE,
-                                            INVALID_UID, INVALID_UID, ACTION_ADD)) {
+    if (int ret = modifyExplicitNetworkRule(nullptr, localNetId, ROUTE_TABLE_LOCAL_NETWORK,
+                                            PERMISSION_NONE, INVALID_UID, INVALID_UID,
+                                            ACTION_ADD)) {
         return ret;
     }
 
@@ -659,7 +856,7 @@ int configureDummyNetwork() {
         return -errno;
     }
 
-    if ((ret = modifyOutputInterfaceRules(interface, table, PERMISSION_NONE,
+    if ((ret = modifyOutputInterfaceRules(nullptr, interface, table, PERMISSION_NONE,
                                           INVALID_UID, INVALID_UID, ACTION_ADD))) {
         ALOGE("Can't create oif rules for %s: %s", interface, strerror(-ret));
         return ret;
@@ -701,33 +898,48 @@ WARN_UNUSED_RESULT int addUnreachableRule() {
                         MARK_UNSET, MARK_UNSET, IIF_NONE, OIF_NONE, INVALID_UID, INVALID_UID);
 }
 
-WARN_UNUSED_RESULT int modifyLocalNetwork(unsigned netId, const char* interface, bool add) {
-    if (int ret = modifyIncomingPacketMark(netId, interface, PERMISSION_NONE, add)) {
+// Like modifyIncomingPacketMark(), but undoes the change if |transaction| fails.
+WARN_UNUSED_RESULT int modifyIncomingPacketMark(RouteTransaction* transaction, unsigned netId,
+                                                const char* interface, Permission permission,
+                                                bool add) {
+    if (int ret = modifyIncomingPacketMark(netId, interface, permission, add)) {
         return ret;
     }
-    return modifyOutputInterfaceRules(interface, ROUTE_TABLE_LOCAL_NETWORK, PERMISSION_NONE,
-                                      INVALID_UID, INVALID_UID, add);
+    transaction->addUndo([netId, interface, permission, add] {
+        return modifyIncomingPacketMark(netId, interface, permission, !add);
+    });
+    return 0;
 }
 
-WARN_UNUSED_RESULT int modifyPhysicalNetwork(unsigned netId, const char* interface,
-                                             Permission permission, bool add) {
+WARN_UNUSED_RESULT int modifyLocalNetwork(RouteTransaction* transaction, unsigned netId,
+                                          const char* interface, bool add) {
+    if (int ret = modifyIncomingPacketMark(transaction, netId, interface, PERMISSION_NONE, add)) {
+        return ret;
+    }
+    return modifyOutputInterfaceRules(transaction, interface, ROUTE_TABLE_LOCAL_NETWORK,
+                                      PERMISSION_NONE, INVALID_UID, INVALID_UID, add);
+}
+
+WARN_UNUSED_RESULT int modifyPhysicalNetwork(RouteTransaction* transaction, unsigned netId,
+                                             const char* interface, Permission permission,
+                                             bool add) {
     uint32_t table = getRouteTableForInterface(interface);
     if (table == RT_TABLE_UNSPEC) {
         return -ESRCH;
     }
 
-    if (int ret = modifyIncomingPacketMark(netId, interface, permission, add)) {
+    if (int ret = modifyIncomingPacketMark(transaction, netId, interface, permission, add)) {
         return ret;
     }
-    if (int ret = modifyExplicitNetworkRule(netId, table, permission, INVALID_UID, INVALID_UID,
-                                            add)) {
+    if (int ret = modifyExplicitNetworkRule(transaction, netId, table, permission, INVALID_UID,
+                                            INVALID_UID, add)) {
         return ret;
     }
-    if (int ret = modifyOutputInterfaceRules(interface, table, permission, INVALID_UID, INVALID_UID,
-                                            add)) {
+    if (int ret = modifyOutputInterfaceRules(transaction, interface, table, permission,
+                                             INVALID_UID, INVALID_UID, add)) {
         return ret;
     }
-    return modifyImplicitNetworkRule(netId, table, permission, add);
+    return modifyImplicitNetworkRule(transaction, netId, table, permission, add);
 }
 
 WARN_UNUSED_RESULT int modifyRejectNonSecureNetworkRule(const UidRanges& uidRanges, bool add) {
@@ -748,40 +960,42 @@ WARN_UNUSED_RESULT int modifyRejectNonSecureNetworkRule(const UidRanges& uidRang
     return 0;
 }
 
-WARN_UNUSED_RESULT int modifyVirtualNetwork(unsigned netId, const char* interface,
-                                            const UidRanges& uidRanges, bool secure, bool add,
-                                            bool modifyNonUidBasedRules) {
+WARN_UNUSED_RESULT int modifyVirtualNetwork(RouteTransaction* transaction, unsigned netId,
+                                            const char* interface, const UidRanges& uidRanges,
+                                            bool secure, bool add, bool modifyNonUidBasedRules) {
     uint32_t table = getRouteTableForInterface(interface);
     if (table == RT_TABLE_UNSPEC) {
         return -ESRCH;
     }
 
     for (const UidRange& range : uidRanges.getRanges()) {
-        if (int ret = modifyVpnUidRangeRule(table, range.getStart(), range.getStop(), secure, add))
-                {
+        if (int ret = modifyVpnUidRangeRule(transaction, table, range.getStart(),
+                                            range.getStop(), secure, add)) {
             return ret;
         }
-        if (int ret = modifyExplicitNetworkRule(netId, table, PERMISSION_NONE, range.getStart(),
-                                                range.getStop(), add)) {
+        if (int ret = modifyExplicitNetworkRule(transaction, netId, table, PERMISSION_NONE,
+                                                range.getStart(), range.getStop(), add)) {
             return ret;
         }
-        if (int ret = modifyOutputInterfaceRules(interface, table, PERMISSION_NONE,
+        if (int ret = modifyOutputInterfaceRules(transaction, interface, table, PERMISSION_NONE,
                                                  range.getStart(), range.getStop(), add)) {
             return ret;
         }
     }
 
     if (modifyNonUidBasedRules) {
-        if (int ret = modifyIncomingPacketMark(netId, interface, PERMISSION_NONE, add)) {
+        if (int ret = modifyIncomingPacketMark(transaction, netId, interface, PERMISSION_NONE,
+                                               add)) {
             return ret;
         }
-        if (int ret = modifyVpnOutputToLocalRule(interface, add)) {
+        if (int ret = modifyVpnOutputToLocalRule(transaction, interface, add)) {
             return ret;
         }
-        if (int ret = modifyVpnSystemPermissionRule(netId, table, secure, add)) {
+        if (int ret = modifyVpnSystemPermissionRule(transaction, netId, table, secure, add)) {
             return ret;
         }
-        return modifyExplicitNetworkRule(netId, table, PERMISSION_NONE, UID_ROOT, UID_ROOT, add);
+        return modifyExplicitNetworkRule(transaction, netId, table, PERMISSION_NONE, UID_ROOT,
+                                         UID_ROOT, add);
     }
 
     return 0;
@@ -905,6 +1119,7 @@ WARN_UNUSED_RESULT int flushRoutes(const char* interface) {
     // If we failed to flush routes, the caller may elect to keep this interface around, so keep
     // track of its name.
     if (ret == 0) {
+        std::lock_guard<std::mutex> guard(interfaceToTableLock);
         interfaceToTable.erase(interface);
     }
 
@@ -935,16 +1150,28 @@ int RouteController::Init(unsigned localNetId) {
 }
 
 int RouteController::addInterfaceToLocalNetwork(unsigned netId, const char* interface) {
-    return modifyLocalNetwork(netId, interface, ACTION_ADD);
+    RouteTransaction transaction("addInterfaceToLocalNetwork");
+    if (int ret = modifyLocalNetwork(&transaction, netId, interface, ACTION_ADD)) {
+        return ret;
+    }
+    return transaction.commit();
 }
 
 int RouteController::removeInterfaceFromLocalNetwork(unsigned netId, const char* interface) {
-    return modifyLocalNetwork(netId, interface, ACTION_DEL);
+    RouteTransaction transaction("removeInterfaceFromLocalNetwork");
+    if (int ret = modifyLocalNetwork(&transaction, netId, interface, ACTION_DEL)) {
+        return ret;
+    }
+    return transaction.commit();
 }
 
 int RouteController::addInterfaceToPhysicalNetwork(unsigned netId, const char* interface,
                                                    Permission permission) {
-    if (int ret = modifyPhysicalNetwork(netId, interface, permission, ACTION_ADD)) {
+    RouteTransaction transaction("addInterfaceToPhysicalNetwork");
+    if (int ret = modifyPhysicalNetwork(&transaction, netId, interface, permission, ACTION_ADD)) {
+        return ret;
+    }
+    if (int ret = transaction.commit()) {
         return ret;
     }
     updateTableNamesFile();
@@ -953,7 +1180,11 @@ int RouteController::addInterfaceToPhysicalNetwork(unsigned netId, const char* i
 
 int RouteController::removeInterfaceFromPhysicalNetwork(unsigned netId, const char* interface,
                                                         Permission permission) {
-    if (int ret = modifyPhysicalNetwork(netId, interface, permission, ACTION_DEL)) {
+    RouteTransaction transaction("removeInterfaceFromPhysicalNetwork");
+    if (int ret = modifyPhysicalNetwork(&transaction, netId, interface, permission, ACTION_DEL)) {
+        return ret;
+    }
+    if (int ret = transaction.commit()) {
         return ret;
     }
     if (int ret = flushRoutes(interface)) {
@@ -968,8 +1199,12 @@ int RouteController::removeInterfaceFromPhysicalNetwork(unsigned netId, const ch
 
 int RouteController::addInterfaceToVirtualNetwork(unsigned netId, const char* interface,
                                                   bool secure, const UidRanges& uidRanges) {
-    if (int ret = modifyVirtualNetwork(netId, interface, uidRanges, secure, ACTION_ADD,
-                                       MODIFY_NON_UID_BASED_RULES)) {
+    RouteTransaction transaction("addInterfaceToVirtualNetwork");
+    if (int ret = modifyVirtualNetwork(&transaction, netId, interface, uidRanges, secure,
+                                       ACTION_ADD, MODIFY_NON_UID_BASED_RULES)) {
+        return ret;
+    }
+    if (int ret = transaction.commit()) {
         return ret;
     }
     updateTableNamesFile();
@@ -978,8 +1213,12 @@ int RouteController::addInterfaceToVirtualNetwork(unsigned netId, const char* in
 
 int RouteController::removeInterfaceFromVirtualNetwork(unsigned netId, const char* interface,
                                                        bool secure, const UidRanges& uidRanges) {
-    if (int ret = modifyVirtualNetwork(netId, interface, uidRanges, secure, ACTION_DEL,
-                                       MODIFY_NON_UID_BASED_RULES)) {
+    RouteTransaction transaction("removeInterfaceFromVirtualNetwork");
+    if (int ret = modifyVirtualNetwork(&transaction, netId, interface, uidRanges, secure,
+                                       ACTION_DEL, MODIFY_NON_UID_BASED_RULES)) {
+        return ret;
+    }
+    if (int ret = transaction.commit()) {
         return ret;
     }
     if (int ret = flushRoutes(interface)) {
@@ -992,11 +1231,18 @@ int RouteController::removeInterfaceFromVirtualNetwork(unsigned netId, const cha
 int RouteController::modifyPhysicalNetworkPermission(unsigned netId, const char* interface,
                                                      Permission oldPermission,
                                                      Permission newPermission) {
-    // Add the new rules before deleting the old ones, to avoid race conditions.
-    if (int ret = modifyPhysicalNetwork(netId, interface, newPermission, ACTION_ADD)) {
+    // Add the new rules before deleting the old ones, to avoid race conditions. The kernel applies
+    // the requests of a transaction in order.
+    RouteTransaction transaction("modifyPhysicalNetworkPermission");
+    if (int ret = modifyPhysicalNetwork(&transaction, netId, interface, newPermission,
+                                        ACTION_ADD)) {
+        return ret;
+    }
+    if (int ret = modifyPhysicalNetwork(&transaction, netId, interface, oldPermission,
+                                        ACTION_DEL)) {
         return ret;
     }
-    return modifyPhysicalNetwork(netId, interface, oldPermission, ACTION_DEL);
+    return transaction.commit();
 }
 
 int RouteController::addUsersToRejectNonSecureNetworkRule(const UidRanges& uidRanges) {
@@ -1009,14 +1255,22 @@ int RouteController::removeUsersFromRejectNonSecureNetworkRule(const UidRanges&
 
 int RouteController::addUsersToVirtualNetwork(unsigned netId, const char* interface, bool secure,
                                               const UidRanges& uidRanges) {
-    return modifyVirtualNetwork(netId, interface, uidRanges, secure, ACTION_ADD,
-                                !MODIFY_NON_UID_BASED_RULES);
+    RouteTransaction transaction("addUsersToVirtualNetwork");
+    if (int ret = modifyVirtualNetwork(&transaction, netId, interface, uidRanges, secure,
+                                       ACTION_ADD, !MODIFY_NON_UID_BASED_RULES)) {
+        return ret;
+    }
+    return transaction.commit();
 }
 
 int RouteController::removeUsersFromVirtualNetwork(unsigned netId, const char* interface,
                                                    bool secure, const UidRanges& uidRanges) {
-    return modifyVirtualNetwork(netId, interface, uidRanges, secure, ACTION_DEL,
-                                !MODIFY_NON_UID_BASED_RULES);
+    RouteTransaction transaction("removeUsersFromVirtualNetwork");
+    if (int ret = modifyVirtualNetwork(&transaction, netId, interface, uidRanges, secure,
+                                       ACTION_DEL, !MODIFY_NON_UID_BASED_RULES)) {
+        return ret;
+    }
+    return transaction.commit();
 }
 
 int RouteController::addInterfaceToDefaultNetwork(const char* interface, Permission permission) {
@@ -1057,5 +1311,26 @@ int RouteController::removeVirtualNetworkFallthrough(unsigned vpnNetId,
     return modifyVpnFallthroughRule(RTM_DELRULE, vpnNetId, physicalInterface, permission);
 }
 
+void RouteController::dump(DumpWriter& dw) {
+    std::lock_guard<std::mutex> guard(transactionStatsLock);
+
+    dw.incIndent();
+    dw.println("RouteController");
+
+    dw.incIndent();
+    dw.println("Transactions:");
+    dw.incIndent();
+    for (const auto& entry : transactionStats) {
+        const TransactionStats& stats = entry.second;
+        dw.println("%s: %" PRIu64 " calls, %" PRIu64 " failed, %" PRIu64 " rule changes, "
+                   "avg %.1f ms, max %.1f ms", entry.first.c_str(), stats.count, stats.failures,
+                   stats.requests, stats.totalMs / stats.count, stats.maxMs);
+    }
+    dw.decIndent();
+    dw.decIndent();
+
+    dw.decIndent();
+}
+
 }  // namespace net
 }  // namespace android
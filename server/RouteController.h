@@ -17,6 +17,7 @@
 #ifndef NETD_SERVER_ROUTE_CONTROLLER_H
 #define NETD_SERVER_ROUTE_CONTROLLER_H
 
+#include "DumpWriter.h"
 #include "NetdConstants.h"
 #include "Permission.h"
 
@@ -94,6 +95,9 @@ public:
     static int removeVirtualNetworkFallthrough(unsigned vpnNetId, const char* physicalInterface,
                                                Permission permission) WARN_UNUSED_RESULT;
 
+    // Prints how long each kind of operation has taken, and how often it has failed.
+    static void dump(DumpWriter& dw);
+
     // For testing.
     static int (*iptablesRestoreCommandFunction)(IptablesTarget, const std::string&,
                                                  const std::string&, std::string *);
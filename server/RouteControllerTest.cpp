@@ -16,6 +16,9 @@
  * RouteControllerTest.cpp - unit tests for RouteController.cpp
  */
 
+#include <linux/fib_rules.h>
+#include <net/if.h>
+
 #include <gtest/gtest.h>
 
 #include "IptablesBaseTest.h"
@@ -32,6 +35,24 @@ public:
     }
 };
 
+// Returns the number of IPv4 and IPv6 rules that point at |table|.
+int countRulesForTable(uint32_t table) {
+    int count = 0;
+    NetlinkDumpCallback callback = [table, &count] (const nlmsghdr *nlh) {
+        count += (getRtmU32Attribute(nlh, FRA_TABLE) == table);
+    };
+    for (int family : { AF_INET, AF_INET6 }) {
+        rtmsg rtm = { .rtm_family = static_cast<uint8_t>(family) };
+        iovec iov[] = {
+            { nullptr, 0           },
+            { &rtm,    sizeof(rtm) },
+        };
+        EXPECT_EQ(0, sendNetlinkRequest(RTM_GETRULE, NETLINK_DUMP_FLAGS,
+                                        iov, ARRAY_SIZE(iov), &callback));
+    }
+    return count;
+}
+
 TEST_F(RouteControllerTest, TestGetRulePriority) {
     // Expect a rule dump for these two families to contain at least the following priorities.
     for (int family : {AF_INET, AF_INET6 }) {
@@ -95,5 +116,41 @@ TEST_F(RouteControllerTest, TestModifyIncomingPacketMark) {
           "-t mangle -D routectrl_mangle_INPUT -i netdtest0 -j MARK --set-mark 0x3001e" });
 }
 
+TEST_F(RouteControllerTest, TestFailedTransactionIsUndone) {
+    static constexpr int TEST_NETID = 30;
+    // An explicit, an implicit and two output interface rules, for IPv4 and IPv6.
+    static constexpr int NUM_PHYSICAL_NETWORK_RULES = 8;
+    const uint32_t table = if_nametoindex("lo") + RouteController::ROUTE_TABLE_OFFSET_FROM_INDEX;
+    const int baseline = countRulesForTable(table);
+
+    EXPECT_EQ(0, RouteController::addInterfaceToPhysicalNetwork(TEST_NETID, "lo",
+                                                               PERMISSION_NONE));
+    EXPECT_EQ(baseline + NUM_PHYSICAL_NETWORK_RULES, countRulesForTable(table));
+    expectIptablesRestoreCommands({
+        "-t mangle -A routectrl_mangle_INPUT -i lo -j MARK --set-mark 0x3001e" });
+
+    // The old permission is wrong, so deleting its rules fails after the rules for the new
+    // permission have been added. They must be deleted again, and the incoming packet marks must
+    // be restored.
+    EXPECT_EQ(-ENOENT, RouteController::modifyPhysicalNetworkPermission(TEST_NETID, "lo",
+                                                                        PERMISSION_SYSTEM,
+                                                                        PERMISSION_NETWORK));
+    EXPECT_EQ(baseline + NUM_PHYSICAL_NETWORK_RULES, countRulesForTable(table));
+    expectIptablesRestoreCommands({
+        "-t mangle -A routectrl_mangle_INPUT -i lo -j MARK --set-mark 0x7001e",
+        "-t mangle -D routectrl_mangle_INPUT -i lo -j MARK --set-mark 0xf001e",
+        "-t mangle -A routectrl_mangle_INPUT -i lo -j MARK --set-mark 0xf001e",
+        "-t mangle -D routectrl_mangle_INPUT -i lo -j MARK --set-mark 0x7001e" });
+
+    EXPECT_EQ(0, RouteController::modifyPhysicalNetworkPermission(TEST_NETID, "lo",
+                                                                 PERMISSION_NONE,
+                                                                 PERMISSION_NETWORK));
+    EXPECT_EQ(baseline + NUM_PHYSICAL_NETWORK_RULES, countRulesForTable(table));
+
+    EXPECT_EQ(0, RouteController::removeInterfaceFromPhysicalNetwork(TEST_NETID, "lo",
+                                                                    PERMISSION_NETWORK));
+    EXPECT_EQ(baseline, countRulesForTable(table));
+}
+
 }  // namespace net
 }  // namespace android
@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NETD_SERVER_SNAPSHOT_PUBLISHER_H
+#define NETD_SERVER_SNAPSHOT_PUBLISHER_H
+
+#include <stdint.h>
+
+#include <atomic>
+#include <memory>
+#include <thread>
+
+namespace android {
+namespace net {
+
+/*
+ * Publishes immutable snapshots of some state, so that readers can look at the latest one without
+ * taking a lock.
+ *
+ * Readers announce themselves by incrementing one of two counters, chosen by the parity of the
+ * current epoch. Publishing a snapshot swaps it in, moves on to the next epoch, and then waits for
+ * the readers counted in the previous epoch to finish before deleting the old snapshot. Readers
+ * never wait; publishers wait only for readers that are already looking at the old snapshot.
+ *
+ * Calls to publish() must be serialized by the caller, and a thread must not call publish() while it
+ * holds a Reader.
+ */
+template <typename T>
+class SnapshotPublisher {
+public:
+    // Gives access to the latest snapshot for as long as it is in scope.
+    class Reader {
+    public:
+        ~Reader() {
+            if (mReaders) mReaders->fetch_sub(1);
+        }
+
+        Reader(Reader&& other) : mReaders(other.mReaders), mSnapshot(other.mSnapshot) {
+            other.mReaders = nullptr;
+        }
+        Reader(const Reader&) = delete;
+        Reader& operator=(const Reader&) = delete;
+
+        const T& operator*() const { return *mSnapshot; }
+        const T* operator->() const { return mSnapshot; }
+
+    private:
+        friend class SnapshotPublisher;
+        Reader(std::atomic<uint32_t>* readers, const T* snapshot) :
+                mReaders(readers), mSnapshot(snapshot) {}
+
+        std::atomic<uint32_t>* mReaders;
+        const T* mSnapshot;
+    };
+
+    explicit SnapshotPublisher(std::unique_ptr<const T> initial) : mSnapshot(initial.release()) {}
+
+    ~SnapshotPublisher() { delete mSnapshot.load(); }
+
+    SnapshotPublisher(const SnapshotPublisher&) = delete;
+    SnapshotPublisher& operator=(const SnapshotPublisher&) = delete;
+
+    Reader read() const {
+        for (;;) {
+            const uint64_t epoch = mEpoch.load();
+            std::atomic<uint32_t>* readers = &mReaders[epoch & 1];
+            readers->fetch_add(1);
+            // If a publisher moved on to the next epoch before we were counted, it may not wait for
+            // us, so start again.
+            if (mEpoch.load() == epoch) {
+                return Reader(readers, mSnapshot.load());
+            }
+            readers->fetch_sub(1);
+        }
+    }
+
+    void publish(std::unique_ptr<const T> snapshot) {
+        const T* old = mSnapshot.exchange(snapshot.release());
+        const uint64_t epoch = mEpoch.fetch_add(1);
+        while (mReaders[epoch & 1].load() != 0) {
+            std::this_thread::yield();
+        }
+        delete old;
+    }
+
+private:
+    std::atomic<const T*> mSnapshot;
+    std::atomic<uint64_t> mEpoch{0};
+    mutable std::atomic<uint32_t> mReaders[2] = {};
+};
+
+}  // namespace net
+}  // namespace android
+
+#endif  // NETD_SERVER_SNAPSHOT_PUBLISHER_H
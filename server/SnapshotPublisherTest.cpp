@@ -0,0 +1,99 @@
+/*
+ * Copyright 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SnapshotPublisherTest.cpp - unit tests for SnapshotPublisher.h
+ */
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "SnapshotPublisher.h"
+
+namespace android {
+namespace net {
+
+namespace {
+
+// Every snapshot holds the same value in all its fields, and clobbers them when it is deleted, so
+// readers can tell if they ever see a snapshot that is being deleted.
+struct TestSnapshot {
+    explicit TestSnapshot(uint64_t v) : values(16, v) {}
+    ~TestSnapshot() {
+        for (auto& value : values) value = ~0ULL;
+    }
+    std::vector<uint64_t> values;
+};
+
+}  // namespace
+
+TEST(SnapshotPublisherTest, ReadersSeeLatestSnapshot) {
+    SnapshotPublisher<TestSnapshot> publisher(
+            std::unique_ptr<TestSnapshot>(new TestSnapshot(0)));
+    EXPECT_EQ(0U, publisher.read()->values[0]);
+
+    publisher.publish(std::unique_ptr<TestSnapshot>(new TestSnapshot(1)));
+    std::thread publisherThread;
+    {
+        const auto reader = publisher.read();
+        EXPECT_EQ(1U, reader->values[0]);
+        // A reader that is in scope keeps its snapshot, but doesn't hide newer ones.
+        publisherThread = std::thread([&publisher] {
+            publisher.publish(std::unique_ptr<TestSnapshot>(new TestSnapshot(2)));
+        });
+        while (publisher.read()->values[0] != 2) {
+            std::this_thread::yield();
+        }
+        EXPECT_EQ(1U, reader->values[0]);
+    }
+    publisherThread.join();
+}
+
+TEST(SnapshotPublisherTest, SnapshotsOutliveTheirReaders) {
+    constexpr uint64_t kNumSnapshots = 200;
+    SnapshotPublisher<TestSnapshot> publisher(
+            std::unique_ptr<TestSnapshot>(new TestSnapshot(0)));
+
+    std::atomic_bool done(false);
+    std::vector<std::thread> readers;
+    for (int i = 0; i < 4; i++) {
+        readers.emplace_back([&] {
+            uint64_t last = 0;
+            while (!done) {
+                const auto snapshot = publisher.read();
+                const uint64_t value = snapshot->values[0];
+                for (uint64_t v : snapshot->values) {
+                    ASSERT_EQ(value, v);
+                }
+                // Snapshots are never older than ones this thread has already seen.
+                ASSERT_LE(last, value);
+                last = value;
+            }
+        });
+    }
+    for (uint64_t i = 1; i <= kNumSnapshots; i++) {
+        publisher.publish(std::unique_ptr<TestSnapshot>(new TestSnapshot(i)));
+    }
+    done = true;
+    for (auto& reader : readers) {
+        reader.join();
+    }
+    EXPECT_EQ(kNumSnapshots, publisher.read()->values[0]);
+}
+
+}  // namespace net
+}  // namespace android
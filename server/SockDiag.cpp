@@ -15,6 +15,7 @@
  */
 
 #include <errno.h>
+#include <inttypes.h>
 #include <netdb.h>
 #include <string.h>
 #include <netinet/in.h>
@@ -23,6 +24,7 @@
 #include <sys/uio.h>
 
 #include <linux/netlink.h>
+#include <linux/rtnetlink.h>
 #include <linux/sock_diag.h>
 #include <linux/inet_diag.h>
 
@@ -31,12 +33,14 @@
 #include <android-base/strings.h>
 #include <cutils/log.h>
 
+#include "DumpWriter.h"
 #include "Fwmark.h"
 #include "NetdConstants.h"
 #include "Permission.h"
 #include "SockDiag.h"
 #include "Stopwatch.h"
 
+#include <algorithm>
 #include <chrono>
 
 #ifndef SOCK_DESTROY
@@ -45,6 +49,10 @@
 
 #define INET_DIAG_BC_MARK_COND 10
 
+#ifndef INET_DIAG_MARK
+#define INET_DIAG_MARK 15
+#endif
+
 namespace android {
 namespace net {
 
@@ -71,6 +79,117 @@ int checkError(int fd) {
 
 }  // namespace
 
+std::atomic<bool> SockDiag::sKernelExcludesLoopback(true);
+
+void SockDiag::Bytecode::addRule(uint8_t code, const void *operands, size_t len, bool matching) {
+    const uint8_t *bytes = reinterpret_cast<const uint8_t *>(operands);
+    mRules.push_back({ code, std::vector<uint8_t>(bytes, bytes + len), matching });
+}
+
+void SockDiag::Bytecode::rejectMark(uint32_t mark, uint32_t mask, bool matching) {
+    struct {
+        // TODO: switch to inet_diag_markcond
+        __u32 mark;
+        __u32 mask;
+    } __attribute__((packed)) cond = { mark, mask };
+    addRule(INET_DIAG_BC_MARK_COND, &cond, sizeof(cond), matching);
+}
+
+void SockDiag::Bytecode::rejectHost(uint8_t code, uint8_t family, const void *addr,
+                                    uint8_t addrlen, uint8_t prefixlen) {
+    const inet_diag_hostcond cond = { family, prefixlen, -1 };
+    std::vector<uint8_t> operands(sizeof(cond) + addrlen);
+    memcpy(operands.data(), &cond, sizeof(cond));
+    memcpy(operands.data() + sizeof(cond), addr, addrlen);
+    addRule(code, operands.data(), operands.size(), true);
+}
+
+void SockDiag::Bytecode::rejectLoopback(uint8_t family) {
+    // Unlike isLoopbackSocket, this does not catch sockets whose source and destination addresses
+    // are the same, because the bytecode cannot compare them with each other.
+    for (const uint8_t code : { INET_DIAG_BC_S_COND, INET_DIAG_BC_D_COND }) {
+        if (family == AF_INET) {
+            const in_addr loopback = { htonl(INADDR_LOOPBACK) };
+            rejectHost(code, AF_INET, &loopback, sizeof(loopback), 8);
+        } else if (family == AF_INET6) {
+            const in6_addr mapped = {
+                .s6_addr32 = { 0, 0, htonl(0xffff), htonl(INADDR_LOOPBACK) }
+            };
+            rejectHost(code, AF_INET6, &in6addr_loopback, sizeof(in6addr_loopback), 128);
+            rejectHost(code, AF_INET6, &mapped, sizeof(mapped), 96 + 8);
+        }
+    }
+}
+
+std::vector<uint8_t> SockDiag::Bytecode::toAttribute() const {
+    if (mRules.empty()) {
+        return {};
+    }
+
+    // The length of the INET_DIAG_BC_JMP instruction.
+    constexpr size_t jmplen = sizeof(inet_diag_bc_op);
+    // Jump exactly this far past the end of the program to reject.
+    constexpr size_t rejectoffset = sizeof(inet_diag_bc_op);
+
+    size_t bytecodelen = 0;
+    for (const Rule& rule : mRules) {
+        bytecodelen += sizeof(inet_diag_bc_op) + rule.operands.size();
+        if (rule.matching) {
+            bytecodelen += jmplen;
+        }
+    }
+
+    const nlattr nla = {
+        .nla_len = static_cast<__u16>(sizeof(nlattr) + bytecodelen),
+        .nla_type = INET_DIAG_REQ_BYTECODE,
+    };
+    std::vector<uint8_t> attribute(sizeof(nla));
+    memcpy(attribute.data(), &nla, sizeof(nla));
+
+    auto append = [&attribute] (const void *data, size_t len) {
+        const uint8_t *bytes = reinterpret_cast<const uint8_t *>(data);
+        attribute.insert(attribute.end(), bytes, bytes + len);
+    };
+
+    for (const Rule& rule : mRules) {
+        // How far this rule is from the reject target, and how long its condition is.
+        const size_t reject = bytecodelen + rejectoffset - (attribute.size() - sizeof(nla));
+        const size_t condlen = sizeof(inet_diag_bc_op) + rule.operands.size();
+
+        if (rule.matching) {
+            // If the condition matches, go to the JMP below, which unconditionally rejects the
+            // socket. Otherwise, skip the JMP and carry on with the next rule. The JMP is
+            // necessary to keep the kernel bytecode verifier happy, because the target of every
+            // "no" jump must always be reachable by "yes" jumps.
+            const inet_diag_bc_op op = {
+                rule.code,
+                static_cast<uint8_t>(condlen),
+                static_cast<uint16_t>(condlen + jmplen),
+            };
+            const inet_diag_bc_op jmp = {
+                INET_DIAG_BC_JMP,
+                jmplen,
+                static_cast<uint16_t>(reject - condlen),
+            };
+            append(&op, sizeof(op));
+            append(rule.operands.data(), rule.operands.size());
+            append(&jmp, sizeof(jmp));
+        } else {
+            // If the condition matches, carry on with the next rule, otherwise reject.
+            const inet_diag_bc_op op = {
+                rule.code,
+                static_cast<uint8_t>(condlen),
+                static_cast<uint16_t>(reject),
+            };
+            append(&op, sizeof(op));
+            append(rule.operands.data(), rule.operands.size());
+        }
+    }
+
+    // Running off the end of the program accepts the socket.
+    return attribute;
+}
+
 bool SockDiag::open() {
     if (hasSocks()) {
         return false;
@@ -94,7 +213,7 @@ bool SockDiag::open() {
 }
 
 int SockDiag::sendDumpRequest(uint8_t proto, uint8_t family, uint32_t states,
-                              iovec *iov, int iovcnt) {
+                              iovec *iov, int iovcnt, uint8_t extensions) {
     struct {
         nlmsghdr nlh;
         inet_diag_req_v2 req;
@@ -106,6 +225,7 @@ int SockDiag::sendDumpRequest(uint8_t proto, uint8_t family, uint32_t states,
         .req = {
             .sdiag_family = family,
             .sdiag_protocol = proto,
+            .idiag_ext = extensions,
             .idiag_states = states,
         },
     };
@@ -132,6 +252,16 @@ int SockDiag::sendDumpRequest(uint8_t proto, uint8_t family, uint32_t states) {
     return sendDumpRequest(proto, family, states, iov, ARRAY_SIZE(iov));
 }
 
+int SockDiag::sendDumpRequest(uint8_t proto, uint8_t family, uint32_t states,
+                              const Bytecode& bytecode) {
+    std::vector<uint8_t> attribute = bytecode.toAttribute();
+    iovec iov[] = {
+        { nullptr,          0 },
+        { attribute.data(), attribute.size() },
+    };
+    return sendDumpRequest(proto, family, states, iov, ARRAY_SIZE(iov));
+}
+
 int SockDiag::sendDumpRequest(uint8_t proto, uint8_t family, const char *addrstr) {
     addrinfo hints = { .ai_flags = AI_NUMERICHOST };
     addrinfo *res;
@@ -214,6 +344,134 @@ int SockDiag::readDiagMsg(uint8_t proto, const SockDiag::DestroyFilter& shouldDe
     return processNetlinkDump(mSock, callback);
 }
 
+int SockDiag::dumpSockets(uint32_t states, const DumpCallback& callback) {
+    if (!hasSocks()) {
+        return -EBADFD;
+    }
+
+    const uint8_t proto = IPPROTO_TCP;
+    NetlinkDumpCallback parseSocket = [proto, &callback] (nlmsghdr *nlh) {
+        const inet_diag_msg *msg = reinterpret_cast<inet_diag_msg *>(NLMSG_DATA(nlh));
+        tcp_info tcpInfo;
+        bool hasTcpInfo = false;
+        uint32_t mark;
+        bool hasMark = false;
+
+        uint8_t *attrs = reinterpret_cast<uint8_t *>(NLMSG_DATA(nlh)) + NLMSG_ALIGN(sizeof(*msg));
+        int len = nlh->nlmsg_len - NLMSG_LENGTH(sizeof(*msg));
+        for (rtattr *rta = reinterpret_cast<rtattr *>(attrs); RTA_OK(rta, len);
+             rta = RTA_NEXT(rta, len)) {
+            switch (rta->rta_type) {
+                case INET_DIAG_INFO:
+                    // Older kernels have a shorter tcp_info. Leave the fields they lack at zero.
+                    memset(&tcpInfo, 0, sizeof(tcpInfo));
+                    memcpy(&tcpInfo, RTA_DATA(rta), std::min<size_t>(RTA_PAYLOAD(rta),
+                                                                    sizeof(tcpInfo)));
+                    hasTcpInfo = true;
+                    break;
+                case INET_DIAG_MARK:
+                    if (RTA_PAYLOAD(rta) >= sizeof(mark)) {
+                        memcpy(&mark, RTA_DATA(rta), sizeof(mark));
+                        hasMark = true;
+                    }
+                    break;
+            }
+        }
+        callback(proto, msg, hasTcpInfo ? &tcpInfo : nullptr, hasMark ? &mark : nullptr);
+    };
+
+    for (const int family : {AF_INET, AF_INET6}) {
+        iovec iov[] = {
+            { nullptr, 0 },
+        };
+        if (int ret = sendDumpRequest(proto, family, states, iov, ARRAY_SIZE(iov),
+                                      1 << (INET_DIAG_INFO - 1))) {
+            return ret;
+        }
+        if (int ret = processNetlinkDump(mSock, parseSocket)) {
+            return ret;
+        }
+    }
+
+    return 0;
+}
+
+void SockDiag::SocketStats::add(uint8_t state, const tcp_info *tcpInfo) {
+    switch (state) {
+        case TCP_ESTABLISHED:
+            established++;
+            break;
+        case TCP_SYN_SENT:
+        case TCP_SYN_RECV:
+        case TCP_NEW_SYN_RECV:
+            opening++;
+            break;
+        case TCP_LISTEN:
+            listening++;
+            break;
+        default:
+            closing++;
+            break;
+    }
+
+    if (tcpInfo == nullptr) {
+        return;
+    }
+    // Listening sockets, and sockets that have not yet completed a handshake, have no RTT.
+    if (tcpInfo->tcpi_rtt != 0) {
+        rttSamples++;
+        totalRttUs += tcpInfo->tcpi_rtt;
+        maxRttUs = std::max(maxRttUs, tcpInfo->tcpi_rtt);
+    }
+    retransmits += tcpInfo->tcpi_total_retrans;
+    bytesAcked += tcpInfo->tcpi_bytes_acked;
+    bytesReceived += tcpInfo->tcpi_bytes_received;
+}
+
+int SockDiag::getSocketStats(SocketStatsMap *stats) {
+    auto addSocket = [stats] (uint8_t, const inet_diag_msg *msg, const tcp_info *tcpInfo,
+                              const uint32_t *mark) {
+        Fwmark fwmark;
+        if (mark) {
+            fwmark.intValue = *mark;
+        }
+        const unsigned netId = fwmark.netId;
+        (*stats)[{ msg->idiag_uid, netId }].add(msg->idiag_state, tcpInfo);
+    };
+
+    // TIME_WAIT sockets no longer belong to any UID.
+    return dumpSockets(~(1 << TCP_TIME_WAIT), addSocket);
+}
+
+void SockDiag::dump(DumpWriter& dw) {
+    dw.incIndent();
+    dw.println("SockDiag");
+
+    dw.incIndent();
+    SockDiag sd;
+    SocketStatsMap stats;
+    int ret = sd.open() ? sd.getSocketStats(&stats) : -EBADFD;
+    if (ret) {
+        dw.println("Failed to dump sockets: %s", strerror(-ret));
+    } else {
+        dw.println("TCP sockets by UID and netId:");
+        dw.incIndent();
+        for (const auto& entry : stats) {
+            const SocketStats& s = entry.second;
+            const double meanRttMs = s.rttSamples ? s.totalRttUs / 1000.0 / s.rttSamples : 0;
+            dw.println("uid=%u netId=%u established=%u opening=%u closing=%u listening=%u "
+                       "rtt=%.1f/%.1fms retrans=%" PRIu64 " acked=%" PRIu64 " received=%" PRIu64,
+                       entry.first.first, entry.first.second, s.established, s.opening,
+                       s.closing, s.listening, meanRttMs, s.maxRttUs / 1000.0, s.retransmits,
+                       s.bytesAcked, s.bytesReceived);
+        }
+        dw.decIndent();
+    }
+    dw.decIndent();
+
+    dw.decIndent();
+}
+
 // Determines whether a socket is a loopback socket. Does not check socket state.
 bool SockDiag::isLoopbackSocket(const inet_diag_msg *msg) {
     switch (msg->idiag_family) {
@@ -300,14 +558,26 @@ int SockDiag::destroySockets(const char *addrstr) {
     return mSocketsDestroyed;
 }
 
-int SockDiag::destroyLiveSockets(DestroyFilter destroyFilter, const char *what,
-                                 iovec *iov, int iovcnt) {
-    int proto = IPPROTO_TCP;
-
+int SockDiag::destroyLiveSockets(uint8_t proto, DestroyFilter destroyFilter, const char *what,
+                                 const Bytecode& bytecode, bool excludeLoopback) {
     for (const int family : {AF_INET, AF_INET6}) {
         const char *familyName = (family == AF_INET) ? "IPv4" : "IPv6";
         uint32_t states = (1 << TCP_ESTABLISHED) | (1 << TCP_SYN_SENT) | (1 << TCP_SYN_RECV);
-        if (int ret = sendDumpRequest(proto, family, states, iov, iovcnt)) {
+        int ret;
+        if (excludeLoopback && sKernelExcludesLoopback) {
+            // Have the kernel leave out loopback sockets, so that they are never dumped at all.
+            Bytecode filter(bytecode);
+            filter.rejectLoopback(family);
+            ret = sendDumpRequest(proto, family, states, filter);
+            if (ret == -EINVAL) {
+                ALOGW("Kernel rejected loopback socket filter, filtering in userspace instead");
+                sKernelExcludesLoopback = false;
+                ret = sendDumpRequest(proto, family, states, bytecode);
+            }
+        } else {
+            ret = sendDumpRequest(proto, family, states, bytecode);
+        }
+        if (ret) {
             ALOGE("Failed to dump %s sockets for %s: %s", familyName, what, strerror(-ret));
             return ret;
         }
@@ -324,23 +594,17 @@ int SockDiag::destroySockets(uint8_t proto, const uid_t uid, bool excludeLoopbac
     mSocketsDestroyed = 0;
     Stopwatch s;
 
+    // The kernel has no bytecode to match UIDs, so that is done here. Loopback sockets are mostly
+    // left out by the kernel, but not if their source and destination addresses are the same, or
+    // if the kernel does not support filtering them.
     auto shouldDestroy = [uid, excludeLoopback] (uint8_t, const inet_diag_msg *msg) {
         return msg != nullptr &&
                msg->idiag_uid == uid &&
                !(excludeLoopback && isLoopbackSocket(msg));
     };
 
-    for (const int family : {AF_INET, AF_INET6}) {
-        const char *familyName = family == AF_INET ? "IPv4" : "IPv6";
-        uint32_t states = (1 << TCP_ESTABLISHED) | (1 << TCP_SYN_SENT) | (1 << TCP_SYN_RECV);
-        if (int ret = sendDumpRequest(proto, family, states)) {
-            ALOGE("Failed to dump %s sockets for UID: %s", familyName, strerror(-ret));
-            return ret;
-        }
-        if (int ret = readDiagMsg(proto, shouldDestroy)) {
-            ALOGE("Failed to destroy %s sockets for UID: %s", familyName, strerror(-ret));
-            return ret;
-        }
+    if (int ret = destroyLiveSockets(proto, shouldDestroy, "UID", Bytecode(), excludeLoopback)) {
+        return ret;
     }
 
     if (mSocketsDestroyed > 0) {
@@ -355,6 +619,7 @@ int SockDiag::destroySockets(const UidRanges& uidRanges, const std::set<uid_t>&
     mSocketsDestroyed = 0;
     Stopwatch s;
 
+    // As above, only loopback sockets can be left out by the kernel.
     auto shouldDestroy = [&] (uint8_t, const inet_diag_msg *msg) {
         return msg != nullptr &&
                uidRanges.hasUid(msg->idiag_uid) &&
@@ -362,11 +627,8 @@ int SockDiag::destroySockets(const UidRanges& uidRanges, const std::set<uid_t>&
                !(excludeLoopback && isLoopbackSocket(msg));
     };
 
-    iovec iov[] = {
-        { nullptr, 0 },
-    };
-
-    if (int ret = destroyLiveSockets(shouldDestroy, "UID", iov, ARRAY_SIZE(iov))) {
+    if (int ret = destroyLiveSockets(IPPROTO_TCP, shouldDestroy, "UID", Bytecode(),
+                                     excludeLoopback)) {
         return ret;
     }
 
@@ -396,14 +658,6 @@ int SockDiag::destroySockets(const UidRanges& uidRanges, const std::set<uid_t>&
 // that they are now sending and receiving traffic on a network that is now restricted.
 int SockDiag::destroySocketsLackingPermission(unsigned netId, Permission permission,
                                               bool excludeLoopback) {
-    struct markmatch {
-        inet_diag_bc_op op;
-        // TODO: switch to inet_diag_markcond
-        __u32 mark;
-        __u32 mask;
-    } __attribute__((packed));
-    constexpr uint8_t matchlen = sizeof(markmatch);
-
     Fwmark netIdMark, netIdMask;
     netIdMark.netId = netId;
     netIdMask.netId = 0xffff;
@@ -413,50 +667,12 @@ int SockDiag::destroySocketsLackingPermission(unsigned netId, Permission permiss
     controlMark.permission = permission;
 
     // A SOCK_DIAG bytecode program that accepts the sockets we intend to destroy.
-    struct bytecode {
-        markmatch netIdMatch;
-        markmatch controlMatch;
-        inet_diag_bc_op controlJump;
-    } __attribute__((packed)) bytecode;
-
-    // The length of the INET_DIAG_BC_JMP instruction.
-    constexpr uint8_t jmplen = sizeof(inet_diag_bc_op);
-    // Jump exactly this far past the end of the program to reject.
-    constexpr uint8_t rejectoffset = sizeof(inet_diag_bc_op);
-    // Total length of the program.
-    constexpr uint8_t bytecodelen = sizeof(bytecode);
-
-    bytecode = (struct bytecode) {
-        // If netId matches, continue, otherwise, reject (i.e., leave socket alone).
-        { { INET_DIAG_BC_MARK_COND, matchlen, bytecodelen + rejectoffset },
-          netIdMark.intValue, netIdMask.intValue },
-
-        // If explicit and permission bits match, go to the JMP below which rejects the socket
-        // (i.e., we leave it alone). Otherwise, jump to the end of the program, which accepts the
-        // socket (so we destroy it).
-        { { INET_DIAG_BC_MARK_COND, matchlen, matchlen + jmplen },
-          controlMark.intValue, controlMark.intValue },
-
-        // This JMP unconditionally rejects the packet by jumping to the reject target. It is
-        // necessary to keep the kernel bytecode verifier happy. If we don't have a JMP the bytecode
-        // is invalid because the target of every no jump must always be reachable by yes jumps.
-        // Without this JMP, the accept target is not reachable by yes jumps and the program will
-        // be rejected by the validator.
-        { INET_DIAG_BC_JMP, jmplen, jmplen + rejectoffset },
-
-        // We have reached the end of the program. Accept the socket, and destroy it below.
-    };
-
-    struct nlattr nla = {
-        .nla_type = INET_DIAG_REQ_BYTECODE,
-        .nla_len = sizeof(struct nlattr) + bytecodelen,
-    };
-
-    iovec iov[] = {
-        { nullptr,   0 },
-        { &nla,      sizeof(nla) },
-        { &bytecode, bytecodelen },
-    };
+    Bytecode bytecode;
+    // If netId doesn't match, reject (i.e., leave socket alone).
+    bytecode.rejectMark(netIdMark.intValue, netIdMask.intValue, false /* matching */);
+    // If explicit and permission bits match, reject. Otherwise, accept the socket (so we destroy
+    // it).
+    bytecode.rejectMark(controlMark.intValue, controlMark.intValue, true /* matching */);
 
     mSocketsDestroyed = 0;
     Stopwatch s;
@@ -465,7 +681,8 @@ int SockDiag::destroySocketsLackingPermission(unsigned netId, Permission permiss
         return msg != nullptr && !(excludeLoopback && isLoopbackSocket(msg));
     };
 
-    if (int ret = destroyLiveSockets(shouldDestroy, "permission change", iov, ARRAY_SIZE(iov))) {
+    if (int ret = destroyLiveSockets(IPPROTO_TCP, shouldDestroy, "permission change", bytecode,
+                                     excludeLoopback)) {
         return ret;
     }
 
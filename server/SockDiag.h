@@ -18,25 +18,38 @@
 #define _SOCK_DIAG_H
 
 #include <unistd.h>
+#include <netinet/tcp.h>
 #include <sys/socket.h>
 
 #include <linux/netlink.h>
 #include <linux/sock_diag.h>
 #include <linux/inet_diag.h>
 
+#include <atomic>
 #include <functional>
+#include <map>
 #include <set>
+#include <utility>
+#include <vector>
 
 #include "NetlinkCommands.h"
 #include "Permission.h"
 #include "UidRanges.h"
 
+// The state the kernel reports for a connection that has received a SYN but not yet completed the
+// handshake, on kernels since 4.4. Older headers do not have it.
+#ifndef TCP_NEW_SYN_RECV
+#define TCP_NEW_SYN_RECV 12
+#endif
+
 struct inet_diag_msg;
 class SockDiagTest;
 
 namespace android {
 namespace net {
 
+class DumpWriter;
+
 class SockDiag {
 
   public:
@@ -46,11 +59,65 @@ class SockDiag {
     // means destroy the socket.
     typedef std::function<bool(uint8_t proto, const inet_diag_msg *)> DestroyFilter;
 
+    // Callback function that is called once for every socket in a dump made by dumpSockets().
+    // |tcpInfo| is null if the kernel did not report one. |mark| is null if the kernel did not
+    // report the socket mark, which older kernels never do.
+    typedef std::function<void(uint8_t proto, const inet_diag_msg *, const tcp_info *tcpInfo,
+                               const uint32_t *mark)> DumpCallback;
+
+    // A summary of the TCP sockets that one UID has on one network.
+    struct SocketStats {
+        uint32_t established = 0;
+        uint32_t opening = 0;    // SYN_SENT, SYN_RECV or NEW_SYN_RECV.
+        uint32_t closing = 0;    // Any state past ESTABLISHED.
+        uint32_t listening = 0;
+        // Added up over all sockets that reported a tcp_info and, for RTT, have measured one.
+        uint32_t rttSamples = 0;
+        uint64_t totalRttUs = 0;
+        uint32_t maxRttUs = 0;
+        uint64_t retransmits = 0;
+        uint64_t bytesAcked = 0;
+        uint64_t bytesReceived = 0;
+
+        void add(uint8_t state, const tcp_info *tcpInfo);
+    };
+
+    // Map keys are (UID, netId) pairs. The netId is 0 if the kernel did not report the socket
+    // mark.
+    typedef std::map<std::pair<uid_t, unsigned>, SocketStats> SocketStatsMap;
+
     struct DestroyRequest {
         nlmsghdr nlh;
         inet_diag_req_v2 req;
     } __attribute__((__packed__));
 
+    // Builds a SOCK_DIAG bytecode program that the kernel runs on every socket before dumping it.
+    // The program accepts a socket unless one of its rules rejects it. Rules run in the order in
+    // which they were added.
+    class Bytecode {
+      public:
+        // Rejects sockets whose mark, masked with |mask|, is (or, if |matching| is false, is not)
+        // equal to |mark|.
+        void rejectMark(uint32_t mark, uint32_t mask, bool matching);
+        // Rejects sockets of the given family whose source or destination is a loopback address.
+        void rejectLoopback(uint8_t family);
+
+        bool empty() const { return mRules.empty(); }
+        // Returns the program as an INET_DIAG_REQ_BYTECODE attribute.
+        std::vector<uint8_t> toAttribute() const;
+
+      private:
+        struct Rule {
+            uint8_t code;
+            std::vector<uint8_t> operands;
+            bool matching;
+        };
+        void rejectHost(uint8_t code, uint8_t family, const void *addr, uint8_t addrlen,
+                        uint8_t prefixlen);
+        void addRule(uint8_t code, const void *operands, size_t len, bool matching);
+        std::vector<Rule> mRules;
+    };
+
     SockDiag() : mSock(-1), mWriteSock(-1), mSocketsDestroyed(0) {}
     bool open();
     virtual ~SockDiag() { closeSocks(); }
@@ -59,6 +126,14 @@ class SockDiag {
     int sendDumpRequest(uint8_t proto, uint8_t family, const char *addrstr);
     int readDiagMsg(uint8_t proto, const DestroyFilter& callback);
 
+    // Dumps the IPv4 and IPv6 TCP sockets in the given states, with their tcp_info and marks,
+    // without changing them.
+    int dumpSockets(uint32_t states, const DumpCallback& callback);
+    // Adds up all TCP sockets, except for TIME_WAIT sockets, by UID and netId.
+    int getSocketStats(SocketStatsMap *stats);
+    // Prints the output of getSocketStats().
+    static void dump(DumpWriter& dw);
+
     int sockDestroy(uint8_t proto, const inet_diag_msg *);
     // Destroys all sockets on the given IPv4 or IPv6 address.
     int destroySockets(const char *addrstr);
@@ -77,9 +152,15 @@ class SockDiag {
     int mSock;
     int mWriteSock;
     int mSocketsDestroyed;
-    int sendDumpRequest(uint8_t proto, uint8_t family, uint32_t states, iovec *iov, int iovcnt);
+    // Whether the kernel accepts the bytecode that leaves out loopback sockets. If it does not,
+    // loopback sockets are dumped and filtered out in userspace instead.
+    static std::atomic<bool> sKernelExcludesLoopback;
+    int sendDumpRequest(uint8_t proto, uint8_t family, uint32_t states, iovec *iov, int iovcnt,
+                        uint8_t extensions = 0);
+    int sendDumpRequest(uint8_t proto, uint8_t family, uint32_t states, const Bytecode& bytecode);
     int destroySockets(uint8_t proto, int family, const char *addrstr);
-    int destroyLiveSockets(DestroyFilter destroy, const char *what, iovec *iov, int iovcnt);
+    int destroyLiveSockets(uint8_t proto, DestroyFilter destroy, const char *what,
+                           const Bytecode& bytecode, bool excludeLoopback);
     bool hasSocks() { return mSock != -1 && mWriteSock != -1; }
     void closeSocks() { close(mSock); close(mWriteSock); mSock = mWriteSock = -1; }
     static bool isLoopbackSocket(const inet_diag_msg *msg);
@@ -38,6 +38,11 @@ protected:
     static bool isLoopbackSocket(const inet_diag_msg *msg) {
         return SockDiag::isLoopbackSocket(msg);
     };
+
+    static int sendDumpRequest(SockDiag *sd, uint8_t proto, uint8_t family, uint32_t states,
+                               const SockDiag::Bytecode& bytecode) {
+        return sd->sendDumpRequest(proto, family, states, bytecode);
+    }
 };
 
 uint16_t bindAndListen(int s) {
@@ -262,6 +267,130 @@ TEST_F(SockDiagTest, TestIsLoopbackSocket) {
     EXPECT_TRUE(isLoopbackSocket(&msg));
 }
 
+TEST_F(SockDiagTest, TestLoopbackBytecode) {
+    int listensocket = socket(AF_INET6, SOCK_STREAM, 0);
+    ASSERT_NE(-1, listensocket) << "Failed to open listen socket: " << strerror(errno);
+    uint16_t port = bindAndListen(listensocket);
+    ASSERT_NE(0, port) << "Can't bind to server port";
+
+    // An IPv4 connection, which the server sees as IPv4-mapped, and an IPv6 connection.
+    int v4socket = socket(AF_INET, SOCK_STREAM, 0);
+    int v6socket = socket(AF_INET6, SOCK_STREAM, 0);
+    sockaddr_in server4 = { .sin_family = AF_INET, .sin_port = htons(port) };
+    sockaddr_in6 server6 = { .sin6_family = AF_INET6, .sin6_port = htons(port) };
+    server4.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    server6.sin6_addr = in6addr_loopback;
+    ASSERT_EQ(0, connect(v4socket, (sockaddr *) &server4, sizeof(server4)))
+        << "IPv4 connect failed: " << strerror(errno);
+    ASSERT_EQ(0, connect(v6socket, (sockaddr *) &server6, sizeof(server6)))
+        << "IPv6 connect failed: " << strerror(errno);
+    int accepted4 = accept(listensocket, nullptr, nullptr);
+    int accepted6 = accept(listensocket, nullptr, nullptr);
+    ASSERT_NE(-1, accepted4);
+    ASSERT_NE(-1, accepted6);
+
+    SockDiag sd;
+    ASSERT_TRUE(sd.open()) << "Failed to open SOCK_DIAG socket";
+
+    int socketsSeen;
+    auto countSockets = [&] (uint8_t, const inet_diag_msg *msg) {
+        if (msg->id.idiag_sport == htons(port) || msg->id.idiag_dport == htons(port)) {
+            socketsSeen++;
+        }
+        return false;
+    };
+
+    const uint32_t states = 1 << TCP_ESTABLISHED;
+    for (const uint8_t family : { AF_INET, AF_INET6 }) {
+        SockDiag::Bytecode bytecode;
+        socketsSeen = 0;
+        int ret = sendDumpRequest(&sd, IPPROTO_TCP, family, states, bytecode);
+        ASSERT_EQ(0, ret) << "Failed to send dump request: " << strerror(-ret);
+        sd.readDiagMsg(IPPROTO_TCP, countSockets);
+        EXPECT_EQ((family == AF_INET) ? 1 : 3, socketsSeen);
+
+        bytecode.rejectLoopback(family);
+        socketsSeen = 0;
+        ret = sendDumpRequest(&sd, IPPROTO_TCP, family, states, bytecode);
+        ASSERT_EQ(0, ret) << "Kernel rejected loopback bytecode: " << strerror(-ret);
+        sd.readDiagMsg(IPPROTO_TCP, countSockets);
+        EXPECT_EQ(0, socketsSeen);
+    }
+
+    close(v4socket);
+    close(v6socket);
+    close(listensocket);
+    close(accepted4);
+    close(accepted6);
+}
+
+TEST_F(SockDiagTest, TestGetSocketStats) {
+    int listensocket = socket(AF_INET6, SOCK_STREAM, 0);
+    ASSERT_NE(-1, listensocket) << "Failed to open listen socket: " << strerror(errno);
+    uint16_t port = bindAndListen(listensocket);
+    ASSERT_NE(0, port) << "Can't bind to server port";
+
+    // A connection from a UID that nothing else on the device uses, on netId 42.
+    constexpr uid_t kUid = 8765;
+    constexpr unsigned kNetId = 42;
+    int clientsocket = socket(AF_INET6, SOCK_STREAM, 0);
+    ASSERT_EQ(0, fchown(clientsocket, kUid, -1));
+    Fwmark fwmark;
+    fwmark.netId = kNetId;
+    ASSERT_EQ(0, setsockopt(clientsocket, SOL_SOCKET, SO_MARK, &fwmark.intValue,
+                            sizeof(fwmark.intValue)));
+    sockaddr_in6 server = { .sin6_family = AF_INET6, .sin6_port = htons(port) };
+    server.sin6_addr = in6addr_loopback;
+    ASSERT_EQ(0, connect(clientsocket, (sockaddr *) &server, sizeof(server)))
+        << "Connect failed: " << strerror(errno);
+    int acceptedsocket = accept(listensocket, nullptr, nullptr);
+    ASSERT_NE(-1, acceptedsocket);
+
+    // Make sure the client has received some data by the time we dump.
+    const char data[] = "foo";
+    char buf[sizeof(data)];
+    ASSERT_EQ((ssize_t) sizeof(data), send(acceptedsocket, data, sizeof(data), 0));
+    ASSERT_EQ((ssize_t) sizeof(data), recv(clientsocket, buf, sizeof(buf), MSG_WAITALL));
+
+    SockDiag sd;
+    ASSERT_TRUE(sd.open()) << "Failed to open SOCK_DIAG socket";
+    SockDiag::SocketStatsMap stats;
+    ASSERT_EQ(0, sd.getSocketStats(&stats));
+
+    // Kernels that don't report marks put the socket on netId 0.
+    auto it = stats.find({ kUid, kNetId });
+    if (it == stats.end()) {
+        it = stats.find({ kUid, 0 });
+    }
+    ASSERT_NE(stats.end(), it) << "Socket of UID " << kUid << " not found";
+    const SockDiag::SocketStats& s = it->second;
+    EXPECT_EQ(1U, s.established);
+    EXPECT_EQ(0U, s.opening + s.closing + s.listening);
+    EXPECT_EQ(1U, s.rttSamples);
+    EXPECT_LE(s.totalRttUs, s.maxRttUs);
+    EXPECT_LE(sizeof(data), s.bytesReceived);
+
+    close(clientsocket);
+    close(acceptedsocket);
+    close(listensocket);
+}
+
+TEST_F(SockDiagTest, TestSocketStatsStates) {
+    const uint8_t states[] = {
+        TCP_ESTABLISHED, TCP_SYN_SENT, TCP_SYN_RECV, TCP_NEW_SYN_RECV,
+        TCP_LISTEN, TCP_FIN_WAIT1, TCP_CLOSE_WAIT, TCP_LAST_ACK,
+    };
+    SockDiag::SocketStats s;
+    for (const uint8_t state : states) {
+        s.add(state, nullptr);
+    }
+    EXPECT_EQ(1U, s.established);
+    EXPECT_EQ(3U, s.opening);
+    EXPECT_EQ(1U, s.listening);
+    EXPECT_EQ(3U, s.closing);
+    EXPECT_EQ(0U, s.rttSamples);
+}
+
 enum MicroBenchmarkTestType {
     ADDRESS,
     UID,
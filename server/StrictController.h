@@ -19,6 +19,8 @@
 
 #include <string>
 
+#include <utils/RWLock.h>
+
 #include "NetdConstants.h"
 
 enum StrictPenalty { INVALID, ACCEPT, LOG, REJECT };
@@ -31,6 +33,8 @@ class StrictController {
 public:
     StrictController();
 
+    android::RWLock lock;
+
     int enableStrict(void);
     int disableStrict(void);
 
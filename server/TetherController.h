@@ -23,6 +23,8 @@
 #include <set>
 #include <string>
 
+#include <utils/RWLock.h>
+
 namespace android {
 namespace net {
 
@@ -41,6 +43,8 @@ public:
     TetherController();
     virtual ~TetherController();
 
+    android::RWLock lock;
+
     bool enableForwarding(const char* requester);
     bool disableForwarding(const char* requester);
     size_t forwardingRequestCount();
@@ -0,0 +1,181 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <limits.h>
+
+#include <algorithm>
+
+#include "UidRangeIndex.h"
+
+namespace android {
+namespace net {
+
+namespace {
+
+// Rebuilding the segments covered by each changed range means looking at all the ranges that start
+// before it ends. Past this many changed ranges, it is cheaper to rebuild everything in one pass.
+const size_t kMaxSpansToRebuild = 16;
+
+bool isValid(const UidRange& range) {
+    return range.getStart() >= 0 && range.getStop() >= range.getStart();
+}
+
+}  // namespace
+
+void UidRangeIndex::addRanges(unsigned netId, const UidRanges& uidRanges) {
+    mRanges[netId].add(uidRanges);
+    rebuild(uidRanges);
+}
+
+void UidRangeIndex::removeRanges(unsigned netId, const UidRanges& uidRanges) {
+    auto iter = mRanges.find(netId);
+    if (iter == mRanges.end()) {
+        return;
+    }
+    iter->second.remove(uidRanges);
+    if (iter->second.getRanges().empty()) {
+        mRanges.erase(iter);
+    }
+    rebuild(uidRanges);
+}
+
+void UidRangeIndex::removeNetwork(unsigned netId) {
+    auto iter = mRanges.find(netId);
+    if (iter == mRanges.end()) {
+        return;
+    }
+    const UidRanges uidRanges = iter->second;
+    mRanges.erase(iter);
+    rebuild(uidRanges);
+}
+
+unsigned UidRangeIndex::getNetId(uid_t uid) const {
+    if (uid > INT32_MAX) {
+        return 0;
+    }
+    auto iter = std::partition_point(mSegments.begin(), mSegments.end(),
+                                     [uid](const Segment& segment) {
+                                         return segment.start <= uid;
+                                     });
+    if (iter == mSegments.begin()) {
+        return 0;
+    }
+    --iter;
+    return (iter->stop >= uid) ? iter->netId : 0;
+}
+
+bool UidRangeIndex::hasUid(unsigned netId, uid_t uid) const {
+    auto iter = mRanges.find(netId);
+    return iter != mRanges.end() && iter->second.hasUid(uid);
+}
+
+void UidRangeIndex::rebuild(const UidRanges& changed) {
+    const std::vector<UidRange>& ranges = changed.getRanges();
+    if (ranges.size() > kMaxSpansToRebuild) {
+        rebuildSpan(0, INT32_MAX);
+        return;
+    }
+    for (const UidRange& range : ranges) {
+        if (isValid(range)) {
+            rebuildSpan(range.getStart(), range.getStop());
+        }
+    }
+}
+
+void UidRangeIndex::rebuildSpan(uint32_t start, uint32_t stop) {
+    // Find where each network's ranges start and stop covering UIDs within the span.
+    struct Boundary {
+        uint32_t uid;
+        unsigned netId;
+        int delta;
+    };
+    std::vector<Boundary> boundaries;
+    for (const auto& entry : mRanges) {
+        for (const UidRange& range : entry.second.getRanges()) {
+            if (!isValid(range)) {
+                continue;
+            }
+            if (static_cast<uint32_t>(range.getStart()) > stop) {
+                break;
+            }
+            const uint32_t rangeStart = std::max<uint32_t>(range.getStart(), start);
+            const uint32_t rangeStop = std::min<uint32_t>(range.getStop(), stop);
+            if (rangeStart <= rangeStop) {
+                boundaries.push_back({rangeStart, entry.first, 1});
+                boundaries.push_back({rangeStop + 1, entry.first, -1});
+            }
+        }
+    }
+    std::sort(boundaries.begin(), boundaries.end(), [](const Boundary& a, const Boundary& b) {
+        return a.uid < b.uid;
+    });
+
+    // Replace the segments that overlap the span, and their neighbours, so that segments that end
+    // up next to each other with the same netId can be merged.
+    auto first = std::partition_point(mSegments.begin(), mSegments.end(),
+                                      [start](const Segment& segment) {
+                                          return segment.stop < start;
+                                      });
+    auto last = std::partition_point(first, mSegments.end(), [stop](const Segment& segment) {
+        return segment.start <= stop;
+    });
+    if (first != mSegments.begin()) --first;
+    if (last != mSegments.end()) ++last;
+
+    std::vector<Segment> replacement;
+    auto append = [&replacement](uint32_t segmentStart, uint32_t segmentStop, unsigned netId) {
+        if (!replacement.empty() && replacement.back().netId == netId &&
+                replacement.back().stop + 1 == segmentStart) {
+            replacement.back().stop = segmentStop;
+        } else {
+            replacement.push_back({segmentStart, segmentStop, netId});
+        }
+    };
+
+    for (auto iter = first; iter != last && iter->start < start; ++iter) {
+        append(iter->start, std::min(iter->stop, start - 1), iter->netId);
+    }
+
+    // Sweep across the span. Between two boundaries, the lowest netId with a range covering the
+    // UIDs gets them.
+    std::map<unsigned, int> covering;
+    for (size_t i = 0; i < boundaries.size();) {
+        const uint32_t uid = boundaries[i].uid;
+        for (; i < boundaries.size() && boundaries[i].uid == uid; i++) {
+            int& count = covering[boundaries[i].netId];
+            count += boundaries[i].delta;
+            if (count == 0) {
+                covering.erase(boundaries[i].netId);
+            }
+        }
+        if (!covering.empty() && i < boundaries.size()) {
+            append(uid, boundaries[i].uid - 1, covering.begin()->first);
+        }
+    }
+
+    for (auto iter = first; iter != last; ++iter) {
+        if (iter->stop > stop) {
+            append(std::max(iter->start, stop + 1), iter->stop, iter->netId);
+        }
+    }
+
+    const size_t index = first - mSegments.begin();
+    mSegments.erase(first, last);
+    mSegments.insert(mSegments.begin() + index, replacement.begin(), replacement.end());
+}
+
+}  // namespace net
+}  // namespace android
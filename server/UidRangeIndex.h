@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NETD_SERVER_UID_RANGE_INDEX_H
+#define NETD_SERVER_UID_RANGE_INDEX_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <map>
+#include <vector>
+
+#include "UidRanges.h"
+
+namespace android {
+namespace net {
+
+/*
+ * Maps UIDs to the networks whose UID ranges contain them, across all networks at once.
+ *
+ * The ranges of all networks are merged into one sorted list of disjoint segments, each of which
+ * belongs to the network with the lowest netId among those whose ranges cover it. Looking up a UID
+ * is a single binary search, however many networks and ranges there are. Adding or removing ranges
+ * only rebuilds the segments that those ranges cover.
+ */
+class UidRangeIndex {
+public:
+    void addRanges(unsigned netId, const UidRanges& uidRanges);
+    // Removes ranges that were previously added to |netId|, with the same semantics as
+    // UidRanges::remove().
+    void removeRanges(unsigned netId, const UidRanges& uidRanges);
+    void removeNetwork(unsigned netId);
+
+    // Returns the lowest netId whose ranges contain |uid|, or 0 if there is none.
+    unsigned getNetId(uid_t uid) const;
+
+    // Returns whether the ranges of |netId| contain |uid|.
+    bool hasUid(unsigned netId, uid_t uid) const;
+
+    size_t getSegmentCount() const { return mSegments.size(); }
+
+private:
+    struct Segment {
+        uint32_t start;
+        uint32_t stop;
+        unsigned netId;
+    };
+
+    void rebuild(const UidRanges& changed);
+    void rebuildSpan(uint32_t start, uint32_t stop);
+
+    std::map<unsigned, UidRanges> mRanges;  // Map keys are NetIds.
+    std::vector<Segment> mSegments;         // Sorted and disjoint.
+};
+
+}  // namespace net
+}  // namespace android
+
+#endif  // NETD_SERVER_UID_RANGE_INDEX_H
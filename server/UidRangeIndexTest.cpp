@@ -0,0 +1,156 @@
+/*
+ * Copyright 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * UidRangeIndexTest.cpp - unit tests for UidRangeIndex.cpp
+ */
+
+#include <stdlib.h>
+
+#include <map>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "UidRangeIndex.h"
+
+namespace android {
+namespace net {
+
+namespace {
+
+UidRanges makeRanges(const std::vector<std::pair<int32_t, int32_t>>& ranges) {
+    std::vector<UidRange> uidRanges;
+    for (const auto& range : ranges) {
+        uidRanges.push_back(UidRange(range.first, range.second));
+    }
+    return UidRanges(uidRanges);
+}
+
+}  // namespace
+
+TEST(UidRangeIndexTest, LowestNetIdWins) {
+    UidRangeIndex index;
+    EXPECT_EQ(0U, index.getNetId(10000));
+
+    index.addRanges(110, makeRanges({{10000, 19999}}));
+    index.addRanges(105, makeRanges({{15000, 15999}}));
+    EXPECT_EQ(3U, index.getSegmentCount());
+    EXPECT_EQ(0U, index.getNetId(9999));
+    EXPECT_EQ(110U, index.getNetId(10000));
+    EXPECT_EQ(110U, index.getNetId(14999));
+    EXPECT_EQ(105U, index.getNetId(15000));
+    EXPECT_EQ(105U, index.getNetId(15999));
+    EXPECT_EQ(110U, index.getNetId(16000));
+    EXPECT_EQ(110U, index.getNetId(19999));
+    EXPECT_EQ(0U, index.getNetId(20000));
+    EXPECT_EQ(0U, index.getNetId(0xffffffff));
+
+    // Both networks still contain the UIDs that they share.
+    EXPECT_TRUE(index.hasUid(110, 15500));
+    EXPECT_TRUE(index.hasUid(105, 15500));
+    EXPECT_FALSE(index.hasUid(105, 16000));
+
+    // Removing the lower netId merges the segments back together.
+    index.removeNetwork(105);
+    EXPECT_EQ(1U, index.getSegmentCount());
+    EXPECT_EQ(110U, index.getNetId(15500));
+}
+
+TEST(UidRangeIndexTest, AdjacentRangesAreMerged) {
+    UidRangeIndex index;
+    index.addRanges(100, makeRanges({{0, 99}, {200, 299}}));
+    EXPECT_EQ(2U, index.getSegmentCount());
+    index.addRanges(100, makeRanges({{100, 199}}));
+    EXPECT_EQ(1U, index.getSegmentCount());
+    EXPECT_EQ(100U, index.getNetId(150));
+
+    index.removeRanges(100, makeRanges({{100, 199}}));
+    EXPECT_EQ(2U, index.getSegmentCount());
+    EXPECT_EQ(0U, index.getNetId(150));
+    EXPECT_EQ(100U, index.getNetId(299));
+}
+
+TEST(UidRangeIndexTest, RemoveOnlyRemovesMatchingRanges) {
+    UidRangeIndex index;
+    index.addRanges(100, makeRanges({{1000, 1999}}));
+    index.addRanges(100, makeRanges({{1000, 1999}}));
+
+    // Like UidRanges::remove(), ranges that were not added are ignored, and ranges that were added
+    // twice must be removed twice.
+    index.removeRanges(100, makeRanges({{1000, 1499}}));
+    EXPECT_EQ(100U, index.getNetId(1000));
+    index.removeRanges(100, makeRanges({{1000, 1999}}));
+    EXPECT_EQ(100U, index.getNetId(1000));
+    index.removeRanges(100, makeRanges({{1000, 1999}}));
+    EXPECT_EQ(0U, index.getNetId(1000));
+    EXPECT_EQ(0U, index.getSegmentCount());
+    EXPECT_FALSE(index.hasUid(100, 1000));
+}
+
+TEST(UidRangeIndexTest, MatchesLinearSearch) {
+    constexpr int32_t kMaxUid = 2000;
+    constexpr unsigned kNumNetworks = 5;
+
+    UidRangeIndex index;
+    std::map<unsigned, UidRanges> networks;
+    unsigned seed = 42;
+    for (int i = 0; i < 500; i++) {
+        const unsigned netId = 100 + rand_r(&seed) % kNumNetworks;
+        std::vector<std::pair<int32_t, int32_t>> ranges;
+        // Sometimes change enough ranges at once to rebuild the whole index.
+        const int numRanges = (rand_r(&seed) % 10 == 0) ? 20 : 1 + rand_r(&seed) % 3;
+        for (int j = 0; j < numRanges; j++) {
+            const int32_t start = rand_r(&seed) % kMaxUid;
+            ranges.push_back({start, start + rand_r(&seed) % 100});
+        }
+        const UidRanges uidRanges = makeRanges(ranges);
+
+        const int op = rand_r(&seed) % 10;
+        if (op < 6) {
+            index.addRanges(netId, uidRanges);
+            networks[netId].add(uidRanges);
+        } else if (op < 9) {
+            // Remove some of the ranges that this network has, as the framework would.
+            UidRanges existing;
+            for (const UidRange& range : networks[netId].getRanges()) {
+                if (rand_r(&seed) % 2) existing.add(UidRanges({range}));
+            }
+            index.removeRanges(netId, existing);
+            networks[netId].remove(existing);
+        } else {
+            index.removeNetwork(netId);
+            networks.erase(netId);
+        }
+
+        for (uid_t uid = 0; uid < kMaxUid + 100; uid++) {
+            // Check every range, because UidRanges::hasUid() can miss UIDs in overlapping ranges.
+            unsigned expected = 0;
+            for (const auto& entry : networks) {
+                for (const UidRange& range : entry.second.getRanges()) {
+                    if (range.getStart() <= static_cast<int32_t>(uid) &&
+                            static_cast<int32_t>(uid) <= range.getStop()) {
+                        expected = entry.first;
+                        break;
+                    }
+                }
+                if (expected) break;
+            }
+            ASSERT_EQ(expected, index.getNetId(uid)) << "uid " << uid << " iteration " << i;
+        }
+    }
+}
+
+}  // namespace net
+}  // namespace android
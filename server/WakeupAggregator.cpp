@@ -0,0 +1,127 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <inttypes.h>
+
+#include <algorithm>
+
+#include "DumpWriter.h"
+#include "WakeupAggregator.h"
+
+namespace android {
+namespace net {
+
+namespace {
+
+// The most sources listed by dump().
+constexpr size_t kMaxDumpedKeys = 20;
+
+}  // namespace
+
+WakeupAggregator::WakeupAggregator(uint64_t bucketNs, size_t numBuckets, size_t maxKeysPerBucket)
+    : mBucketNs(std::max<uint64_t>(bucketNs, 1)),
+      mNumBuckets(std::max<size_t>(numBuckets, 1)),
+      mMaxKeysPerBucket(maxKeysPerBucket) {}
+
+bool WakeupAggregator::record(const Key& key, uint64_t boottimeNs, uint64_t realtimeNs) {
+    const uint64_t offsetNs = boottimeNs % mBucketNs;
+    const uint64_t startNs = boottimeNs - offsetNs;
+
+    std::lock_guard<std::mutex> guard(mLock);
+    if (mBuckets.empty() || startNs > mBuckets.back().startNs) {
+        const uint64_t realtimeStartNs = (realtimeNs > offsetNs) ? realtimeNs - offsetNs : 0;
+        mBuckets.push_back({startNs, realtimeStartNs, {}});
+        while (mBuckets.size() > mNumBuckets) {
+            mBuckets.pop_front();
+        }
+    }
+
+    // Wakeups recorded concurrently may arrive out of order, so some may belong to an earlier
+    // bucket than the last one. Wakeups older than every bucket go in the oldest one.
+    auto bucket = mBuckets.rbegin();
+    while (bucket->startNs > startNs && std::next(bucket) != mBuckets.rend()) {
+        ++bucket;
+    }
+
+    mTotal++;
+    auto it = bucket->counts.find(key);
+    if (it == bucket->counts.end()) {
+        if (bucket->counts.size() >= mMaxKeysPerBucket) {
+            mOverflowed++;
+            return bucket->counts[Key{"", static_cast<uid_t>(-1), 0, 0, 0}]++ == 0;
+        }
+        it = bucket->counts.emplace(key, 0).first;
+    }
+    return it->second++ == 0;
+}
+
+std::vector<WakeupAggregator::Row> WakeupAggregator::getStats(uint64_t sinceNs) const {
+    std::lock_guard<std::mutex> guard(mLock);
+    std::vector<Row> rows;
+    for (const Bucket& bucket : mBuckets) {
+        if (bucket.realtimeStartNs + mBucketNs <= sinceNs) {
+            continue;
+        }
+        for (const auto& entry : bucket.counts) {
+            rows.push_back({entry.first, bucket.realtimeStartNs, entry.second});
+        }
+    }
+    return rows;
+}
+
+void WakeupAggregator::dump(DumpWriter& dw) const {
+    std::map<Key, uint64_t> totals;
+    uint64_t total;
+    uint64_t overflowed;
+    size_t numBuckets;
+    {
+        std::lock_guard<std::mutex> guard(mLock);
+        for (const Bucket& bucket : mBuckets) {
+            for (const auto& entry : bucket.counts) {
+                totals[entry.first] += entry.second;
+            }
+        }
+        total = mTotal;
+        overflowed = mOverflowed;
+        numBuckets = mBuckets.size();
+    }
+
+    std::vector<std::pair<Key, uint64_t>> sorted(totals.begin(), totals.end());
+    std::stable_sort(sorted.begin(), sorted.end(), [](const auto& a, const auto& b) {
+        return a.second > b.second;
+    });
+    if (sorted.size() > kMaxDumpedKeys) {
+        sorted.resize(kMaxDumpedKeys);
+    }
+
+    dw.println("Wakeups: %" PRIu64 " total, %" PRIu64 " from sources that did not fit", total,
+               overflowed);
+    dw.incIndent();
+    dw.println("Top sources over the last %zu buckets of %" PRIu64 "s:", numBuckets,
+               mBucketNs / 1000000000ULL);
+    dw.incIndent();
+    for (const auto& entry : sorted) {
+        const Key& key = entry.first;
+        dw.println("%s uid %d ethertype 0x%04x proto %u port %u: %" PRIu64, key.prefix.c_str(),
+                   static_cast<int>(key.uid), key.ethertype, key.ipNextHeader, key.port,
+                   entry.second);
+    }
+    dw.decIndent();
+    dw.decIndent();
+}
+
+}  // namespace net
+}  // namespace android
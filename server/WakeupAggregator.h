@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NETD_SERVER_WAKEUP_AGGREGATOR_H
+#define NETD_SERVER_WAKEUP_AGGREGATOR_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <vector>
+
+namespace android {
+namespace net {
+
+class DumpWriter;
+
+/*
+ * Counts wakeup packets by source in fixed-length time buckets, so that the framework can fetch a
+ * summary of what woke the device up instead of being told about every packet.
+ *
+ * Buckets are laid out on CLOCK_BOOTTIME, which never goes backwards, so that stepping the wall
+ * clock neither merges wakeups into old buckets nor leaves gaps. Each bucket also remembers when it
+ * started on CLOCK_REALTIME, which is the timescale the framework asks for stats on.
+ *
+ * Only the most recent buckets are kept. Each bucket counts at most a fixed number of distinct
+ * sources; wakeups from sources beyond that are counted together under a source with an empty
+ * prefix, so that a storm of wakeups from many sources cannot use up memory.
+ */
+class WakeupAggregator {
+public:
+    // Where a wakeup packet came from. The prefix identifies the interface, as it was passed to
+    // WakeupController::addInterface().
+    struct Key {
+        std::string prefix;
+        uid_t uid;
+        uint16_t ethertype;
+        uint8_t ipNextHeader;
+        uint16_t port;
+
+        bool operator<(const Key& other) const {
+            return std::tie(prefix, uid, ethertype, ipNextHeader, port) <
+                   std::tie(other.prefix, other.uid, other.ethertype, other.ipNextHeader,
+                            other.port);
+        }
+    };
+
+    struct Row {
+        Key key;
+        uint64_t bucketStartNs;  // CLOCK_REALTIME.
+        uint64_t count;
+    };
+
+    static constexpr uint64_t kDefaultBucketNs = 60 * 1000000000ULL;
+    static constexpr size_t kDefaultNumBuckets = 60;
+    static constexpr size_t kDefaultMaxKeysPerBucket = 128;
+
+    WakeupAggregator(uint64_t bucketNs = kDefaultBucketNs, size_t numBuckets = kDefaultNumBuckets,
+                     size_t maxKeysPerBucket = kDefaultMaxKeysPerBucket);
+
+    // Counts a wakeup from |key| that happened at |boottimeNs| on CLOCK_BOOTTIME and |realtimeNs|
+    // on CLOCK_REALTIME. Returns true if it is the first wakeup counted under its key in its
+    // bucket.
+    bool record(const Key& key, uint64_t boottimeNs, uint64_t realtimeNs);
+
+    // Returns the counts of the buckets that end after |sinceNs| on CLOCK_REALTIME, oldest bucket
+    // first.
+    std::vector<Row> getStats(uint64_t sinceNs) const;
+
+    void dump(DumpWriter& dw) const;
+
+private:
+    struct Bucket {
+        uint64_t startNs;          // CLOCK_BOOTTIME.
+        uint64_t realtimeStartNs;  // CLOCK_REALTIME, as it was when the bucket was created.
+        std::map<Key, uint64_t> counts;
+    };
+
+    const uint64_t mBucketNs;
+    const size_t mNumBuckets;
+    const size_t mMaxKeysPerBucket;
+
+    mutable std::mutex mLock;
+    std::deque<Bucket> mBuckets;  // Oldest first. Guarded by mLock.
+    uint64_t mTotal = 0;          // Guarded by mLock.
+    uint64_t mOverflowed = 0;     // Guarded by mLock.
+};
+
+}  // namespace net
+}  // namespace android
+
+#endif  // NETD_SERVER_WAKEUP_AGGREGATOR_H
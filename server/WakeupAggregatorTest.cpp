@@ -0,0 +1,145 @@
+/*
+ * Copyright 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * WakeupAggregatorTest.cpp - unit tests for WakeupAggregator.cpp
+ */
+
+#include <netinet/in.h>
+
+#include <gtest/gtest.h>
+
+#include "WakeupAggregator.h"
+
+namespace android {
+namespace net {
+
+namespace {
+
+constexpr uint64_t kBucketNs = 1000;
+
+WakeupAggregator::Key makeKey(const std::string& prefix, uid_t uid, uint16_t port) {
+    return {prefix, uid, 0x86dd, IPPROTO_TCP, port};
+}
+
+}  // namespace
+
+TEST(WakeupAggregatorTest, CountsBySourceAndBucket) {
+    WakeupAggregator aggregator(kBucketNs, 10, 100);
+    const auto wlan = makeKey("iface:wlan0", 10001, 443);
+    const auto radio = makeKey("iface:rmnet0", 10001, 443);
+
+    // Only the first wakeup of each source in each bucket is worth reporting on its own.
+    EXPECT_TRUE(aggregator.record(wlan, 100, 100));
+    EXPECT_FALSE(aggregator.record(wlan, 200, 200));
+    EXPECT_TRUE(aggregator.record(radio, 300, 300));
+    EXPECT_FALSE(aggregator.record(wlan, 999, 999));
+    EXPECT_TRUE(aggregator.record(wlan, 1000, 1000));
+
+    const auto rows = aggregator.getStats(0);
+    ASSERT_EQ(3U, rows.size());
+    EXPECT_EQ("iface:rmnet0", rows[0].key.prefix);
+    EXPECT_EQ(0U, rows[0].bucketStartNs);
+    EXPECT_EQ(1U, rows[0].count);
+    EXPECT_EQ("iface:wlan0", rows[1].key.prefix);
+    EXPECT_EQ(0U, rows[1].bucketStartNs);
+    EXPECT_EQ(3U, rows[1].count);
+    EXPECT_EQ("iface:wlan0", rows[2].key.prefix);
+    EXPECT_EQ(1000U, rows[2].bucketStartNs);
+    EXPECT_EQ(1U, rows[2].count);
+
+    // Buckets that end at or before |sinceNs| are left out.
+    EXPECT_EQ(1U, aggregator.getStats(1000).size());
+    EXPECT_EQ(3U, aggregator.getStats(999).size());
+    EXPECT_EQ(0U, aggregator.getStats(2000).size());
+}
+
+TEST(WakeupAggregatorTest, KeepsRecentBuckets) {
+    WakeupAggregator aggregator(kBucketNs, 3, 100);
+    const auto key = makeKey("iface:wlan0", 10001, 443);
+    for (uint64_t t = 0; t < 10 * kBucketNs; t += kBucketNs / 2) {
+        aggregator.record(key, t, t);
+    }
+    const auto rows = aggregator.getStats(0);
+    ASSERT_EQ(3U, rows.size());
+    EXPECT_EQ(7 * kBucketNs, rows[0].bucketStartNs);
+    EXPECT_EQ(9 * kBucketNs, rows[2].bucketStartNs);
+    for (const auto& row : rows) {
+        EXPECT_EQ(2U, row.count);
+    }
+}
+
+TEST(WakeupAggregatorTest, LateWakeupsGoInTheirBucket) {
+    WakeupAggregator aggregator(kBucketNs, 3, 100);
+    const auto key = makeKey("iface:wlan0", 10001, 443);
+    EXPECT_TRUE(aggregator.record(key, 1500, 1500));
+    EXPECT_TRUE(aggregator.record(key, 2500, 2500));
+    // Belongs to the first bucket, which is still kept.
+    EXPECT_FALSE(aggregator.record(key, 1600, 1600));
+    // Older than every bucket.
+    EXPECT_FALSE(aggregator.record(key, 100, 100));
+
+    const auto rows = aggregator.getStats(0);
+    ASSERT_EQ(2U, rows.size());
+    EXPECT_EQ(1000U, rows[0].bucketStartNs);
+    EXPECT_EQ(3U, rows[0].count);
+    EXPECT_EQ(2000U, rows[1].bucketStartNs);
+    EXPECT_EQ(1U, rows[1].count);
+}
+
+TEST(WakeupAggregatorTest, WallClockSteppedBack) {
+    WakeupAggregator aggregator(kBucketNs, 10, 100);
+    const auto key = makeKey("iface:wlan0", 10001, 443);
+    EXPECT_TRUE(aggregator.record(key, 1500, 100500));
+    // The wall clock goes back by many buckets. Wakeups still start new buckets as boot time
+    // passes, and are reported once per bucket.
+    EXPECT_TRUE(aggregator.record(key, 2500, 50500));
+    EXPECT_FALSE(aggregator.record(key, 2600, 50600));
+    EXPECT_TRUE(aggregator.record(key, 3500, 51500));
+
+    // Buckets are reported with the wall clock time at which they started.
+    const auto rows = aggregator.getStats(0);
+    ASSERT_EQ(3U, rows.size());
+    EXPECT_EQ(100000U, rows[0].bucketStartNs);
+    EXPECT_EQ(1U, rows[0].count);
+    EXPECT_EQ(50000U, rows[1].bucketStartNs);
+    EXPECT_EQ(2U, rows[1].count);
+    EXPECT_EQ(51000U, rows[2].bucketStartNs);
+    EXPECT_EQ(1U, rows[2].count);
+
+    // Only the bucket from before the step ends after this.
+    EXPECT_EQ(1U, aggregator.getStats(60000).size());
+}
+
+TEST(WakeupAggregatorTest, LimitsSourcesPerBucket) {
+    WakeupAggregator aggregator(kBucketNs, 3, 4);
+    for (uint16_t port = 1; port <= 10; port++) {
+        aggregator.record(makeKey("iface:wlan0", 10001, port), 0, 0);
+    }
+    // Sources that already have a row keep counting in it.
+    aggregator.record(makeKey("iface:wlan0", 10001, 1), 0, 0);
+
+    const auto rows = aggregator.getStats(0);
+    ASSERT_EQ(5U, rows.size());
+    EXPECT_EQ("", rows[0].key.prefix);
+    EXPECT_EQ(6U, rows[0].count);
+    EXPECT_EQ(1, rows[1].key.port);
+    EXPECT_EQ(2U, rows[1].count);
+
+    // A new bucket has room for new sources.
+    EXPECT_TRUE(aggregator.record(makeKey("iface:wlan0", 10001, 10), kBucketNs, kBucketNs));
+}
+
+}  // namespace net
+}  // namespace android
@@ -17,8 +17,13 @@
 #define LOG_TAG "WakeupController"
 
 #include <endian.h>
+#include <linux/if_ether.h>
 #include <linux/netfilter/nfnetlink.h>
 #include <linux/netfilter/nfnetlink_log.h>
+#include <netinet/ip.h>
+#include <netinet/ip6.h>
+#include <time.h>
+#include <algorithm>
 #include <iostream>
 
 #include <android-base/stringprintf.h>
@@ -26,6 +31,7 @@
 #include <netdutils/Netfilter.h>
 #include <netdutils/Netlink.h>
 
+#include "DumpWriter.h"
 #include "IptablesRestoreController.h"
 #include "NetlinkManager.h"
 #include "WakeupController.h"
@@ -39,6 +45,95 @@ using netdutils::Status;
 
 const char WakeupController::LOCAL_MANGLE_INPUT[] = "wakeupctrl_mangle_INPUT";
 
+namespace {
+
+// Bytes of each wakeup packet to copy, starting at the network header. Enough for IPv6 with a few
+// extension headers, followed by the ports of the transport header.
+constexpr uint32_t kWakeupCopyRange = 128;
+
+struct PacketInfo {
+    uint16_t ethertype;
+    uint8_t ipNextHeader;
+    uint16_t port;
+};
+
+uint64_t nowNs(clockid_t clock) {
+    timespec now = {};
+    clock_gettime(clock, &now);
+    return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+uint8_t byteAt(const Slice packet, size_t offset) {
+    return packet.base()[offset];
+}
+
+// Decodes the transport protocol and the service port of an IPv4 or IPv6 packet, as far as the
+// copied bytes go. The service port is the lower of the source and destination ports: for replies
+// to connections that the device opened, that is the port of the remote service rather than an
+// ephemeral local port.
+PacketInfo decodePacket(uint16_t ethertype, const Slice packet) {
+    PacketInfo info = {ethertype, 0, 0};
+    if (packet.size() < 1) {
+        return info;
+    }
+    const uint8_t version = byteAt(packet, 0) >> 4;
+    if (info.ethertype == 0) {
+        // Loopback and some tunnel interfaces have no hardware header.
+        info.ethertype = (version == 4) ? ETH_P_IP : (version == 6) ? ETH_P_IPV6 : 0;
+    }
+
+    size_t offset;
+    uint8_t nextHeader;
+    if (info.ethertype == ETH_P_IP && version == 4) {
+        if (packet.size() < sizeof(iphdr)) return info;
+        const size_t headerLength = (byteAt(packet, 0) & 0x0f) * 4;
+        const uint16_t fragmentOffset =
+                ((byteAt(packet, 6) << 8) | byteAt(packet, 7)) & IP_OFFMASK;
+        info.ipNextHeader = byteAt(packet, offsetof(iphdr, protocol));
+        if (fragmentOffset != 0) return info;
+        offset = headerLength;
+        nextHeader = info.ipNextHeader;
+    } else if (info.ethertype == ETH_P_IPV6 && version == 6) {
+        if (packet.size() < sizeof(ip6_hdr)) return info;
+        offset = sizeof(ip6_hdr);
+        nextHeader = byteAt(packet, offsetof(ip6_hdr, ip6_nxt));
+        // Skip the extension headers that may come before the transport header.
+        while (true) {
+            if (nextHeader == IPPROTO_HOPOPTS || nextHeader == IPPROTO_ROUTING ||
+                    nextHeader == IPPROTO_DSTOPTS) {
+                if (packet.size() < offset + 2) break;
+                const size_t length = (byteAt(packet, offset + 1) + 1) * 8;
+                nextHeader = byteAt(packet, offset);
+                offset += length;
+            } else if (nextHeader == IPPROTO_FRAGMENT) {
+                if (packet.size() < offset + sizeof(ip6_frag)) break;
+                const uint16_t fragmentOffset =
+                        ((byteAt(packet, offset + 2) << 8) | byteAt(packet, offset + 3)) & ~7;
+                nextHeader = byteAt(packet, offset);
+                offset += sizeof(ip6_frag);
+                if (fragmentOffset != 0) {
+                    info.ipNextHeader = nextHeader;
+                    return info;
+                }
+            } else {
+                break;
+            }
+        }
+        info.ipNextHeader = nextHeader;
+    } else {
+        return info;
+    }
+
+    if ((nextHeader == IPPROTO_TCP || nextHeader == IPPROTO_UDP) && packet.size() >= offset + 4) {
+        const uint16_t srcPort = (byteAt(packet, offset) << 8) | byteAt(packet, offset + 1);
+        const uint16_t dstPort = (byteAt(packet, offset + 2) << 8) | byteAt(packet, offset + 3);
+        info.port = std::min(srcPort, dstPort);
+    }
+    return info;
+}
+
+}  // namespace
+
 WakeupController::~WakeupController() {
     expectOk(mListener->unsubscribe(NetlinkManager::NFLOG_WAKEUP_GROUP));
 }
@@ -50,8 +145,10 @@ netdutils::Status WakeupController::init(NFLogListenerInterface* listener) {
         uid_t uid = -1;
         gid_t gid = -1;
         uint64_t timestampNs = -1;
-        const auto attrHandler = [&prefix, &uid, &gid, &timestampNs](const nlattr attr,
-                                                                     const Slice payload) {
+        uint16_t ethertype = 0;
+        Slice packet;
+        const auto attrHandler = [&prefix, &uid, &gid, &timestampNs, &ethertype, &packet](
+                const nlattr attr, const Slice payload) {
             switch (attr.nla_type) {
                 case NFULA_TIMESTAMP: {
                     timespec timespec = {};
@@ -72,14 +169,35 @@ netdutils::Status WakeupController::init(NFLogListenerInterface* listener) {
                     extract(payload, gid);
                     gid = be32toh(gid);
                     break;
+                case NFULA_PACKET_HDR: {
+                    nfulnl_msg_packet_hdr hdr = {};
+                    extract(payload, hdr);
+                    ethertype = be16toh(hdr.hw_protocol);
+                    break;
+                }
+                case NFULA_PAYLOAD:
+                    packet = payload;
+                    break;
                 default:
                     break;
             }
         };
         forEachNetlinkAttribute(msg, attrHandler);
-        mReport(prefix, uid, gid, timestampNs);
+
+        const PacketInfo info = decodePacket(ethertype, packet);
+        // The NFLOG timestamp is on CLOCK_REALTIME, which can be stepped, so the wakeup is
+        // bucketed by when it is processed instead. NFLOG batches are delivered within a fraction
+        // of a bucket.
+        const uint64_t realtimeNs = (timestampNs != static_cast<uint64_t>(-1)) ?
+                timestampNs : nowNs(CLOCK_REALTIME);
+        // Only the first wakeup from each source in each time bucket is reported individually;
+        // the rest are only counted, so that wakeup storms do not turn into binder call storms.
+        if (mAggregator.record({prefix, uid, info.ethertype, info.ipNextHeader, info.port},
+                               nowNs(CLOCK_BOOTTIME), realtimeNs)) {
+            mReport(prefix, uid, gid, timestampNs);
+        }
     };
-    return mListener->subscribe(NetlinkManager::NFLOG_WAKEUP_GROUP, msgHandler);
+    return mListener->subscribe(NetlinkManager::NFLOG_WAKEUP_GROUP, kWakeupCopyRange, msgHandler);
 }
 
 Status WakeupController::addInterface(const std::string& ifName, const std::string& prefix,
@@ -115,5 +233,25 @@ Status WakeupController::execIptables(const std::string& action, const std::stri
     return netdutils::status::ok;
 }
 
+void WakeupController::dump(DumpWriter& dw) const {
+    dw.println("WakeupController");
+    if (mListener == nullptr) {
+        return;
+    }
+    const auto stats = mListener->getStats();
+    dw.incIndent();
+    dw.println("NFLOG wakeups: %llu, datagrams: %llu, messages: %llu, max batch: %llu",
+            static_cast<unsigned long long>(stats.wakeups),
+            static_cast<unsigned long long>(stats.datagrams),
+            static_cast<unsigned long long>(stats.messages),
+            static_cast<unsigned long long>(stats.maxBatch));
+    dw.println("NFLOG drops: ENOBUFS %llu, truncated %llu, unhandled %llu",
+            static_cast<unsigned long long>(stats.enobufs),
+            static_cast<unsigned long long>(stats.truncated),
+            static_cast<unsigned long long>(stats.unhandled));
+    mAggregator.dump(dw);
+    dw.decIndent();
+}
+
 }  // namespace net
 }  // namespace android
@@ -18,15 +18,19 @@
 #define WAKEUP_CONTROLLER_H
 
 #include <functional>
+#include <vector>
 
 #include <netdutils/Status.h>
 
 #include "IptablesRestoreController.h"
 #include "NFLogListener.h"
+#include "WakeupAggregator.h"
 
 namespace android {
 namespace net {
 
+class DumpWriter;
+
 class WakeupController {
   public:
     using ReportFn = std::function<void(const std::string&, uid_t, gid_t, uint64_t)>;
@@ -43,9 +47,10 @@ class WakeupController {
     netdutils::Status init(NFLogListenerInterface* listener);
 
     // Install iptables rules to match packets arriving on |ifName|
-    // which match |mark|/|mask|. Metadata from matching packets will
-    // be delivered along with the arbitrary string |prefix| to
-    // INetdEventListener::onWakeupEvent.
+    // which match |mark|/|mask|. Matching packets are counted by
+    // source along with the arbitrary string |prefix|. The first
+    // packet from each source in each time bucket is also delivered
+    // to INetdEventListener::onWakeupEvent.
     netdutils::Status addInterface(const std::string& ifName, const std::string& prefix,
                                    uint32_t mark, uint32_t mask);
 
@@ -54,13 +59,22 @@ class WakeupController {
     netdutils::Status delInterface(const std::string& ifName, const std::string& prefix,
                                    uint32_t mark, uint32_t mask);
 
+    // Returns the number of wakeup packets from each source, in time buckets that end after
+    // |sinceNs| on the CLOCK_REALTIME timescale.
+    std::vector<WakeupAggregator::Row> getStats(uint64_t sinceNs) const {
+        return mAggregator.getStats(sinceNs);
+    }
+
+    void dump(DumpWriter& dw) const;
+
   private:
     netdutils::Status execIptables(const std::string& action, const std::string& ifName,
                                    const std::string& prefix, uint32_t mark, uint32_t mask);
 
     ReportFn const mReport;
     IptablesRestoreInterface* const mIptables;
-    NFLogListenerInterface* mListener;
+    NFLogListenerInterface* mListener = nullptr;
+    WakeupAggregator mAggregator;
 };
 
 }  // namespace net
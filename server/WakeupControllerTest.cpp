@@ -14,7 +14,9 @@
  * limitations under the License.
  */
 
+#include <linux/if_ether.h>
 #include <linux/netfilter/nfnetlink_log.h>
+#include <netinet/in.h>
 
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
@@ -22,6 +24,7 @@
 #include "NetlinkManager.h"
 #include "WakeupController.h"
 
+using ::testing::Gt;
 using ::testing::StrictMock;
 using ::testing::Test;
 using ::testing::DoAll;
@@ -50,15 +53,17 @@ class MockIptablesRestore : public IptablesRestoreInterface {
 class MockNFLogListener : public NFLogListenerInterface {
   public:
     ~MockNFLogListener() override = default;
-    MOCK_METHOD2(subscribe, netdutils::Status(uint16_t nfLogGroup, const DispatchFn& fn));
+    MOCK_METHOD3(subscribe, netdutils::Status(uint16_t nfLogGroup, uint32_t copyRange,
+                                              const DispatchFn& fn));
     MOCK_METHOD1(unsubscribe, netdutils::Status(uint16_t nfLogGroup));
+    MOCK_CONST_METHOD0(getStats, NetlinkListenerInterface::Stats());
 };
 
 class WakeupControllerTest : public Test {
   protected:
     WakeupControllerTest() {
-        EXPECT_CALL(mListener, subscribe(NetlinkManager::NFLOG_WAKEUP_GROUP, _))
-            .WillOnce(DoAll(SaveArg<1>(&mMessageHandler), Return(ok)));
+        EXPECT_CALL(mListener, subscribe(NetlinkManager::NFLOG_WAKEUP_GROUP, Gt(0U), _))
+            .WillOnce(DoAll(SaveArg<2>(&mMessageHandler), Return(ok)));
         EXPECT_CALL(mListener, unsubscribe(NetlinkManager::NFLOG_WAKEUP_GROUP)).WillOnce(Return(ok));
         mController.init(&mListener);
     }
@@ -74,6 +79,59 @@ class WakeupControllerTest : public Test {
     NFLogListenerInterface::DispatchFn mMessageHandler;
 };
 
+namespace {
+
+void appendAttr(std::vector<uint8_t>* msg, uint16_t type, const void* data, size_t len) {
+    nlattr attr = {};
+    attr.nla_type = type;
+    attr.nla_len = NLA_HDRLEN + len;
+    const size_t offset = msg->size();
+    msg->resize(offset + NLA_ALIGN(attr.nla_len));
+    memcpy(msg->data() + offset, &attr, sizeof(attr));
+    memcpy(msg->data() + offset + NLA_HDRLEN, data, len);
+}
+
+// Builds the attributes of an NFLOG message for a wakeup packet with the given network header and
+// first bytes of transport header. |ethertype| is left out if it is 0.
+constexpr uint64_t kWakeupTsNs = 34 * 1000000000ULL + 9999;
+
+std::vector<uint8_t> makeWakeupMsg(const char* prefix, uid_t uid, uint16_t ethertype,
+                                   const std::vector<uint8_t>& packet) {
+    std::vector<uint8_t> msg;
+    appendAttr(&msg, NFULA_PREFIX, prefix, strlen(prefix) + 1);
+    timespec ts = {};
+    ts.tv_sec = htobe32(kWakeupTsNs / 1000000000ULL);
+    ts.tv_nsec = htobe32(kWakeupTsNs % 1000000000ULL);
+    appendAttr(&msg, NFULA_TIMESTAMP, &ts, sizeof(ts));
+    const uint32_t beUid = htobe32(uid);
+    appendAttr(&msg, NFULA_UID, &beUid, sizeof(beUid));
+    if (ethertype != 0) {
+        nfulnl_msg_packet_hdr hdr = {};
+        hdr.hw_protocol = htobe16(ethertype);
+        appendAttr(&msg, NFULA_PACKET_HDR, &hdr, sizeof(hdr));
+    }
+    appendAttr(&msg, NFULA_PAYLOAD, packet.data(), packet.size());
+    return msg;
+}
+
+// An IPv6 TCP packet from port 443 to port 40000, with a hop-by-hop options header.
+const std::vector<uint8_t> kIpv6TcpPacket = {
+    0x60, 0x00, 0x00, 0x00, 0x00, 0x20, IPPROTO_HOPOPTS, 0x40,
+    0x20, 0x01, 0x0d, 0xb8, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01,
+    0x20, 0x01, 0x0d, 0xb8, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02,
+    IPPROTO_TCP, 0x00, 0x01, 0x04, 0x00, 0x00, 0x00, 0x00,
+    0x01, 0xbb, 0x9c, 0x40, 0x00, 0x00, 0x00, 0x00,
+};
+
+// An IPv4 UDP packet from port 40001 to port 5353.
+const std::vector<uint8_t> kIpv4UdpPacket = {
+    0x45, 0x00, 0x00, 0x1c, 0x00, 0x00, 0x00, 0x00, 0x40, IPPROTO_UDP, 0x00, 0x00,
+    0xc0, 0x00, 0x02, 0x01, 0xc0, 0x00, 0x02, 0x02,
+    0x9c, 0x41, 0x14, 0xe9, 0x00, 0x08, 0x00, 0x00,
+};
+
+}  // namespace
+
 TEST_F(WakeupControllerTest, msgHandler) {
     const char kPrefix[] = "test:prefix";
     const uid_t kUid = 8734;
@@ -186,6 +244,55 @@ TEST_F(WakeupControllerTest, unterminatedString) {
     mMessageHandler(msg.nlmsg, msg.nfmsg, payload);
 }
 
+TEST_F(WakeupControllerTest, decodesPacketHeaders) {
+    const auto ipv6 = makeWakeupMsg("iface:wlan0", 10001, ETH_P_IPV6, kIpv6TcpPacket);
+    // Without a hardware header, the ethertype comes from the IP version.
+    const auto ipv4 = makeWakeupMsg("iface:rmnet0", 10002, 0, kIpv4UdpPacket);
+
+    EXPECT_CALL(mEventListener, onWakeupEvent("iface:wlan0", 10001, -1, kWakeupTsNs));
+    mMessageHandler({}, {}, netdutils::makeSlice(ipv6));
+    EXPECT_CALL(mEventListener, onWakeupEvent("iface:rmnet0", 10002, -1, kWakeupTsNs));
+    mMessageHandler({}, {}, netdutils::makeSlice(ipv4));
+
+    const auto rows = mController.getStats(0);
+    ASSERT_EQ(2U, rows.size());
+    EXPECT_EQ("iface:rmnet0", rows[0].key.prefix);
+    EXPECT_EQ(10002U, rows[0].key.uid);
+    EXPECT_EQ(ETH_P_IP, rows[0].key.ethertype);
+    EXPECT_EQ(IPPROTO_UDP, rows[0].key.ipNextHeader);
+    EXPECT_EQ(5353, rows[0].key.port);
+    EXPECT_EQ("iface:wlan0", rows[1].key.prefix);
+    EXPECT_EQ(10001U, rows[1].key.uid);
+    EXPECT_EQ(ETH_P_IPV6, rows[1].key.ethertype);
+    EXPECT_EQ(IPPROTO_TCP, rows[1].key.ipNextHeader);
+    EXPECT_EQ(443, rows[1].key.port);
+}
+
+TEST_F(WakeupControllerTest, truncatedPacket) {
+    // Too short to hold the ports.
+    const std::vector<uint8_t> packet(kIpv4UdpPacket.begin(), kIpv4UdpPacket.begin() + 22);
+    const auto msg = makeWakeupMsg("iface:wlan0", 10001, ETH_P_IP, packet);
+    EXPECT_CALL(mEventListener, onWakeupEvent("iface:wlan0", 10001, -1, kWakeupTsNs));
+    mMessageHandler({}, {}, netdutils::makeSlice(msg));
+
+    const auto rows = mController.getStats(0);
+    ASSERT_EQ(1U, rows.size());
+    EXPECT_EQ(IPPROTO_UDP, rows[0].key.ipNextHeader);
+    EXPECT_EQ(0, rows[0].key.port);
+}
+
+TEST_F(WakeupControllerTest, reportsFirstWakeupOfEachSource) {
+    const auto msg = makeWakeupMsg("iface:wlan0", 10001, ETH_P_IPV6, kIpv6TcpPacket);
+    EXPECT_CALL(mEventListener, onWakeupEvent("iface:wlan0", 10001, -1, kWakeupTsNs)).Times(1);
+    for (int i = 0; i < 5; i++) {
+        mMessageHandler({}, {}, netdutils::makeSlice(msg));
+    }
+
+    const auto rows = mController.getStats(0);
+    ASSERT_EQ(1U, rows.size());
+    EXPECT_EQ(5U, rows[0].count);
+}
+
 TEST_F(WakeupControllerTest, addInterface) {
     const char kPrefix[] = "test:prefix";
     const char kIfName[] = "wlan8";
@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "dns/DnsTlsDispatcher.h"
+
+#define LOG_TAG "DnsTlsDispatcher"
+#define DBG 0
+
+#include "log/log.h"
+
+namespace android {
+namespace net {
+
+namespace {
+
+// Transports unused for this long are destroyed. This is longer than the connection idle timeout,
+// so a destroyed transport has normally already closed its connection.
+constexpr std::chrono::milliseconds kTransportIdleTimeout(3 * DnsTlsSocket::kIdleTimeoutMs);
+
+}  // namespace
+
+DnsTlsDispatcher::Key DnsTlsDispatcher::makeKey(unsigned mark, const sockaddr_storage& server,
+        const std::set<std::vector<uint8_t>>& fingerprints) {
+    return Key(mark, DnsTlsSessionCache::makeKey(server, fingerprints));
+}
+
+std::shared_ptr<DnsTlsTransport> DnsTlsDispatcher::getTransport(unsigned mark,
+        const sockaddr_storage& server, const std::set<std::vector<uint8_t>>& fingerprints) {
+    const auto now = std::chrono::steady_clock::now();
+    std::vector<std::shared_ptr<DnsTlsTransport>> expired;
+    std::shared_ptr<DnsTlsTransport> transport;
+    {
+        std::lock_guard<std::mutex> guard(mLock);
+        for (auto it = mStore.begin(); it != mStore.end();) {
+            // A use count of 1 means no query is using the transport right now.
+            if (now - it->second.lastUsed > kTransportIdleTimeout &&
+                    it->second.transport.use_count() == 1) {
+                expired.push_back(std::move(it->second.transport));
+                it = mStore.erase(it);
+            } else {
+                ++it;
+            }
+        }
+
+        Entry& entry = mStore[makeKey(mark, server, fingerprints)];
+        if (entry.transport == nullptr) {
+            if (DBG) {
+                ALOGD("%u Creating DNS-over-TLS transport", mark);
+            }
+            entry.transport = std::make_shared<DnsTlsTransport>(mark, IPPROTO_TCP, server,
+                    fingerprints, &mSessionCache);
+        }
+        entry.lastUsed = now;
+        transport = entry.transport;
+    }
+    // |expired| is destroyed here, outside the lock, because tearing down a transport joins the
+    // I/O thread of its connection.
+    return transport;
+}
+
+DnsTlsTransport::Response DnsTlsDispatcher::query(unsigned mark, const sockaddr_storage& server,
+        const std::set<std::vector<uint8_t>>& fingerprints,
+        const uint8_t *query, size_t qlen, uint8_t *ans, size_t anssiz, int *resplen) {
+    const std::shared_ptr<DnsTlsTransport> transport = getTransport(mark, server, fingerprints);
+    return transport->doQuery(query, qlen, ans, anssiz, resplen);
+}
+
+size_t DnsTlsDispatcher::size() {
+    std::lock_guard<std::mutex> guard(mLock);
+    return mStore.size();
+}
+
+}  // namespace net
+}  // namespace android
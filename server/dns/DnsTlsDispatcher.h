@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _DNS_DNSTLSDISPATCHER_H
+#define _DNS_DNSTLSDISPATCHER_H
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "dns/DnsTlsSessionCache.h"
+#include "dns/DnsTlsTransport.h"
+
+namespace android {
+namespace net {
+
+// Hands out long-lived DnsTlsTransports, one per (socket mark, server, fingerprint set). The mark
+// encodes the netId, so servers shared by several networks get one connection per network.
+// Transports that have not been used for a while are destroyed on a later query.
+class DnsTlsDispatcher {
+public:
+    DnsTlsDispatcher() {}
+
+    // Sends |query| to |server| over a pooled connection, as DnsTlsTransport::doQuery does.
+    // Threadsafe.
+    DnsTlsTransport::Response query(unsigned mark, const sockaddr_storage& server,
+            const std::set<std::vector<uint8_t>>& fingerprints,
+            const uint8_t *query, size_t qlen, uint8_t *ans, size_t anssiz, int *resplen);
+
+    // Returns the number of transports currently held.
+    size_t size();
+
+    // TLS sessions shared by all transports, including those used for validation.
+    DnsTlsSessionCache& getSessionCache() { return mSessionCache; }
+
+private:
+    // mark, server.
+    typedef std::pair<unsigned, DnsTlsSessionCache::Key> Key;
+
+    struct Entry {
+        std::shared_ptr<DnsTlsTransport> transport;
+        std::chrono::steady_clock::time_point lastUsed;
+    };
+
+    static Key makeKey(unsigned mark, const sockaddr_storage& server,
+            const std::set<std::vector<uint8_t>>& fingerprints);
+
+    std::shared_ptr<DnsTlsTransport> getTransport(unsigned mark, const sockaddr_storage& server,
+            const std::set<std::vector<uint8_t>>& fingerprints);
+
+    // Declared first so that it outlives the transports that use it.
+    DnsTlsSessionCache mSessionCache;
+
+    std::mutex mLock;
+    std::map<Key, Entry> mStore;  // guarded by mLock
+};
+
+}  // namespace net
+}  // namespace android
+
+#endif  // _DNS_DNSTLSDISPATCHER_H
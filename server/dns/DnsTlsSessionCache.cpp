@@ -0,0 +1,147 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "dns/DnsTlsSessionCache.h"
+
+#define LOG_TAG "DnsTlsSessionCache"
+#define DBG 0
+
+#include "log/log.h"
+
+namespace android {
+namespace net {
+
+constexpr size_t DnsTlsSessionCache::kMaxEntries;
+
+DnsTlsSessionCache::DnsTlsSessionCache() : mSslCtx(SSL_CTX_new(TLS_method())) {
+    if (!SSL_CTX_set_max_proto_version(mSslCtx.get(), TLS1_3_VERSION) ||
+        !SSL_CTX_set_min_proto_version(mSslCtx.get(), TLS1_1_VERSION)) {
+        ALOGE("failed to min/max TLS versions");
+    }
+    // Sessions are stored only through newSessionCallback(), never in the internal cache, which
+    // is keyed by session ID and therefore useless to a client.
+    SSL_CTX_set_session_cache_mode(mSslCtx.get(),
+            SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL);
+    SSL_CTX_sess_set_new_cb(mSslCtx.get(), newSessionCallback);
+    SSL_CTX_set_app_data(mSslCtx.get(), this);
+}
+
+DnsTlsSessionCache::Key DnsTlsSessionCache::makeKey(const sockaddr_storage& server,
+        const std::set<std::vector<uint8_t>>& fingerprints) {
+    // Compare only the meaningful fields: callers do not necessarily zero the padding.
+    std::string addr;
+    in_port_t port = 0;
+    if (server.ss_family == AF_INET) {
+        const sockaddr_in& sin = reinterpret_cast<const sockaddr_in&>(server);
+        addr.assign(reinterpret_cast<const char*>(&sin.sin_addr), sizeof(sin.sin_addr));
+        port = sin.sin_port;
+    } else if (server.ss_family == AF_INET6) {
+        const sockaddr_in6& sin6 = reinterpret_cast<const sockaddr_in6&>(server);
+        addr.assign(reinterpret_cast<const char*>(&sin6.sin6_addr), sizeof(sin6.sin6_addr));
+        port = sin6.sin6_port;
+    }
+    return Key(server.ss_family, addr, port, fingerprints);
+}
+
+void DnsTlsSessionCache::prepareSsl(SSL* ssl, const Key& key) {
+    std::lock_guard<std::mutex> guard(mLock);
+    const auto it = mEntries.find(key);
+    if (it == mEntries.end() || it->second.session == nullptr) {
+        return;
+    }
+    Entry& entry = it->second;
+    if (!SSL_set_session(ssl, entry.session.get())) {
+        ALOGW("Failed to offer cached TLS session");
+        return;
+    }
+    ++entry.stats.offered;
+    // TLS 1.3 sessions should not be offered twice, so that connections cannot be correlated by
+    // a passive observer. The server issues a fresh one on every connection.
+    if (SSL_SESSION_should_be_single_use(entry.session.get())) {
+        entry.session.reset();
+    }
+}
+
+void DnsTlsSessionCache::onHandshakeVerified(SSL* ssl, const Key& key) {
+    // From now on, newSessionCallback() knows where sessions received on |ssl| belong.
+    SSL_set_app_data(ssl, const_cast<Key*>(&key));
+
+    std::lock_guard<std::mutex> guard(mLock);
+    Entry& entry = getEntryLocked(key);
+    ++entry.stats.handshakes;
+    if (SSL_session_reused(ssl)) {
+        ++entry.stats.resumed;
+        return;
+    }
+    // Before TLS 1.3, the session is established by the handshake itself, before the callback
+    // above is armed.
+    SSL_SESSION* session = SSL_get_session(ssl);
+    if (session != nullptr && SSL_SESSION_is_resumable(session)) {
+        entry.session.reset(SSL_get1_session(ssl));
+    }
+}
+
+int DnsTlsSessionCache::newSessionCallback(SSL* ssl, SSL_SESSION* session) {
+    const Key* key = static_cast<const Key*>(SSL_get_app_data(ssl));
+    if (key == nullptr) {
+        // The handshake has not been verified yet.
+        return 0;
+    }
+    auto* cache = static_cast<DnsTlsSessionCache*>(SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl)));
+    // Returning 1 transfers ownership of |session| to us.
+    cache->putSession(*key, bssl::UniquePtr<SSL_SESSION>(session));
+    return 1;
+}
+
+void DnsTlsSessionCache::putSession(const Key& key, bssl::UniquePtr<SSL_SESSION> session) {
+    if (DBG) {
+        ALOGD("Caching TLS session");
+    }
+    std::lock_guard<std::mutex> guard(mLock);
+    getEntryLocked(key).session = std::move(session);
+}
+
+DnsTlsSessionCache::Entry& DnsTlsSessionCache::getEntryLocked(const Key& key) {
+    auto it = mEntries.find(key);
+    if (it == mEntries.end()) {
+        if (mEntries.size() >= kMaxEntries) {
+            auto oldest = mEntries.begin();
+            for (auto i = mEntries.begin(); i != mEntries.end(); ++i) {
+                if (i->second.lastUsed < oldest->second.lastUsed) {
+                    oldest = i;
+                }
+            }
+            mEntries.erase(oldest);
+        }
+        it = mEntries.emplace(key, Entry()).first;
+    }
+    it->second.lastUsed = std::chrono::steady_clock::now();
+    return it->second;
+}
+
+DnsTlsSessionCache::Stats DnsTlsSessionCache::getStats(const Key& key) {
+    std::lock_guard<std::mutex> guard(mLock);
+    const auto it = mEntries.find(key);
+    return (it == mEntries.end()) ? Stats() : it->second.stats;
+}
+
+size_t DnsTlsSessionCache::size() {
+    std::lock_guard<std::mutex> guard(mLock);
+    return mEntries.size();
+}
+
+}  // namespace net
+}  // namespace android
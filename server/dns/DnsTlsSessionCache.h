@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _DNS_DNSTLSSESSIONCACHE_H
+#define _DNS_DNSTLSSESSIONCACHE_H
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include <openssl/ssl.h>
+
+namespace android {
+namespace net {
+
+// TLS client state shared by all DNS-over-TLS connections: a single SSL_CTX, and a bounded cache
+// of TLS sessions keyed by server address and fingerprint set. Offering a cached session lets
+// reconnects (after an idle timeout, a network change or revalidation) use an abbreviated
+// handshake.
+//
+// Sessions are only cached once the server has passed the fingerprint check, so a session can
+// never be used to skip that check. The fingerprint set is part of the key, so changing the pins
+// for a server starts from a full handshake.
+//
+// Threadsafe.
+class DnsTlsSessionCache {
+public:
+    // Maximum number of servers for which sessions and statistics are kept.
+    static constexpr size_t kMaxEntries = 32;
+
+    // address family, address bytes, port, fingerprints.
+    typedef std::tuple<int, std::string, in_port_t, std::set<std::vector<uint8_t>>> Key;
+
+    struct Stats {
+        uint64_t handshakes = 0;  // Completed and verified handshakes.
+        uint64_t offered = 0;     // Handshakes that offered a cached session.
+        uint64_t resumed = 0;     // Handshakes where the server accepted the cached session.
+    };
+
+    DnsTlsSessionCache();
+
+    static Key makeKey(const sockaddr_storage& server,
+            const std::set<std::vector<uint8_t>>& fingerprints);
+
+    // Returns the context from which all DNS-over-TLS connections are created.
+    SSL_CTX* getSslCtx() const { return mSslCtx.get(); }
+
+    // Offers the cached session for |key|, if any, on |ssl|. Must be called before the handshake.
+    void prepareSsl(SSL* ssl, const Key& key);
+
+    // Records a completed handshake on |ssl| that has passed any fingerprint check, and starts
+    // caching sessions received on it. |key| must outlive |ssl|.
+    void onHandshakeVerified(SSL* ssl, const Key& key);
+
+    Stats getStats(const Key& key);
+    size_t size();
+
+private:
+    struct Entry {
+        bssl::UniquePtr<SSL_SESSION> session;
+        Stats stats;
+        std::chrono::steady_clock::time_point lastUsed;
+    };
+
+    // Called by BoringSSL whenever the server issues a session, which for TLS 1.3 happens after
+    // the handshake.
+    static int newSessionCallback(SSL* ssl, SSL_SESSION* session);
+
+    void putSession(const Key& key, bssl::UniquePtr<SSL_SESSION> session);
+
+    // Returns the entry for |key|, creating it and evicting the least recently used entry if
+    // needed. Must be called with mLock held.
+    Entry& getEntryLocked(const Key& key);
+
+    bssl::UniquePtr<SSL_CTX> mSslCtx;
+
+    std::mutex mLock;
+    std::map<Key, Entry> mEntries;  // guarded by mLock
+};
+
+}  // namespace net
+}  // namespace android
+
+#endif  // _DNS_DNSTLSSESSIONCACHE_H
@@ -0,0 +1,483 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "dns/DnsTlsSocket.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <openssl/err.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/select.h>
+#include <unistd.h>
+
+#define LOG_TAG "DnsTlsSocket"
+#define DBG 0
+
+#include "log/log.h"
+#include "NetdConstants.h"
+
+namespace android {
+namespace net {
+
+constexpr int DnsTlsSocket::kIdleTimeoutMs;
+
+namespace {
+
+bool setNonBlocking(int fd, bool enabled) {
+    int flags = fcntl(fd, F_GETFL);
+    if (flags < 0) return false;
+
+    if (enabled) {
+        flags |= O_NONBLOCK;
+    } else {
+        flags &= ~O_NONBLOCK;
+    }
+    return (fcntl(fd, F_SETFL, flags) == 0);
+}
+
+int waitForReading(int fd, int timeoutMs) {
+    fd_set fds;
+    FD_ZERO(&fds);
+    FD_SET(fd, &fds);
+    timeval tv = { .tv_sec = timeoutMs / 1000, .tv_usec = (timeoutMs % 1000) * 1000 };
+    const int ret = TEMP_FAILURE_RETRY(select(fd + 1, &fds, nullptr, nullptr, &tv));
+    if (DBG && ret <= 0) {
+        ALOGD("select");
+    }
+    return ret;
+}
+
+int waitForWriting(int fd, int timeoutMs) {
+    fd_set fds;
+    FD_ZERO(&fds);
+    FD_SET(fd, &fds);
+    timeval tv = { .tv_sec = timeoutMs / 1000, .tv_usec = (timeoutMs % 1000) * 1000 };
+    const int ret = TEMP_FAILURE_RETRY(select(fd + 1, nullptr, &fds, nullptr, &tv));
+    if (DBG && ret <= 0) {
+        ALOGD("select");
+    }
+    return ret;
+}
+
+bool getSPKIDigest(const X509* cert, std::vector<uint8_t>* out) {
+    int spki_len = i2d_X509_PUBKEY(X509_get_X509_PUBKEY(cert), NULL);
+    unsigned char spki[spki_len];
+    unsigned char* temp = spki;
+    if (spki_len != i2d_X509_PUBKEY(X509_get_X509_PUBKEY(cert), &temp)) {
+        ALOGW("SPKI length mismatch");
+        return false;
+    }
+    out->resize(SHA256_SIZE);
+    unsigned int digest_len = 0;
+    int ret = EVP_Digest(spki, spki_len, out->data(), &digest_len, EVP_sha256(), NULL);
+    if (ret != 1) {
+        ALOGW("Server cert digest extraction failed");
+        return false;
+    }
+    if (digest_len != out->size()) {
+        ALOGW("Wrong digest length: %d", digest_len);
+        return false;
+    }
+    return true;
+}
+
+void wakeUp(int eventFd) {
+    const uint64_t value = 1;
+    if (write(eventFd, &value, sizeof(value)) != sizeof(value)) {
+        ALOGE("Failed to wake up DNS-over-TLS thread: %s", strerror(errno));
+    }
+}
+
+}  // namespace
+
+DnsTlsSocket::~DnsTlsSocket() {
+    if (mLoopThread.joinable()) {
+        stop();
+        mLoopThread.join();
+    }
+}
+
+void DnsTlsSocket::stop() {
+    {
+        std::lock_guard<std::mutex> guard(mLock);
+        mStopping = true;
+    }
+    wakeUp(mEventFd.get());
+    // Unblock the I/O thread in case it is in the middle of a blocking read or write.
+    shutdown(mSslFd.get(), SHUT_RDWR);
+}
+
+android::base::unique_fd DnsTlsSocket::makeConnectedSocket() const {
+    android::base::unique_fd fd;
+    int type = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    switch (mProtocol) {
+        case IPPROTO_TCP:
+            type |= SOCK_STREAM;
+            break;
+        default:
+            errno = EPROTONOSUPPORT;
+            return fd;
+    }
+
+    fd.reset(socket(mAddr.ss_family, type, mProtocol));
+    if (fd.get() == -1) {
+        return fd;
+    }
+
+    const socklen_t len = sizeof(mMark);
+    if (setsockopt(fd.get(), SOL_SOCKET, SO_MARK, &mMark, len) == -1) {
+        fd.reset();
+    } else if (connect(fd.get(),
+            reinterpret_cast<const struct sockaddr *>(&mAddr), sizeof(mAddr)) != 0
+        && errno != EINPROGRESS) {
+        fd.reset();
+    }
+
+    return fd;
+}
+
+bssl::UniquePtr<SSL> DnsTlsSocket::sslConnect(int fd) {
+    if (fd < 0) {
+        ALOGD("%u makeConnectedSocket() failed with: %s", mMark, strerror(errno));
+        return nullptr;
+    }
+
+    bssl::UniquePtr<SSL> ssl(SSL_new(mCache->getSslCtx()));
+    mCache->prepareSsl(ssl.get(), mSessionKey);
+    // The file descriptor is owned by mSslFd, not by the BIO.
+    bssl::UniquePtr<BIO> bio(BIO_new_socket(fd, BIO_NOCLOSE));
+    SSL_set_bio(ssl.get(), bio.get(), bio.get());
+    bio.release();
+
+    if (!setNonBlocking(fd, false)) {
+        ALOGE("Failed to disable nonblocking status on DNS-over-TLS fd");
+        return nullptr;
+    }
+
+    for (;;) {
+        if (DBG) {
+            ALOGD("%u Calling SSL_connect", mMark);
+        }
+        int ret = SSL_connect(ssl.get());
+        if (DBG) {
+            ALOGD("%u SSL_connect returned %d", mMark, ret);
+        }
+        if (ret == 1) break;  // SSL handshake complete;
+
+        const int ssl_err = SSL_get_error(ssl.get(), ret);
+        switch (ssl_err) {
+            case SSL_ERROR_WANT_READ:
+                if (waitForReading(fd, kIdleTimeoutMs) != 1) {
+                    ALOGW("SSL_connect read error");
+                    return nullptr;
+                }
+                break;
+            case SSL_ERROR_WANT_WRITE:
+                if (waitForWriting(fd, kIdleTimeoutMs) != 1) {
+                    ALOGW("SSL_connect write error");
+                    return nullptr;
+                }
+                break;
+            default:
+                ALOGW("SSL_connect error %d, errno=%d", ssl_err, errno);
+                return nullptr;
+        }
+    }
+
+    if (!mFingerprints.empty()) {
+        if (DBG) {
+            ALOGD("Checking DNS over TLS fingerprint");
+        }
+        // TODO: Follow the cert chain and check all the way up.
+        bssl::UniquePtr<X509> cert(SSL_get_peer_certificate(ssl.get()));
+        if (!cert) {
+            ALOGW("Server has null certificate");
+            return nullptr;
+        }
+        std::vector<uint8_t> digest;
+        if (!getSPKIDigest(cert.get(), &digest)) {
+            ALOGE("Digest computation failed");
+            return nullptr;
+        }
+
+        if (mFingerprints.count(digest) == 0) {
+            ALOGW("No matching fingerprint");
+            return nullptr;
+        }
+        if (DBG) {
+            ALOGD("DNS over TLS fingerprint is correct");
+        }
+    }
+
+    mCache->onHandshakeVerified(ssl.get(), mSessionKey);
+    if (DBG) {
+        ALOGD("%u handshake complete, session %s", mMark,
+                SSL_session_reused(ssl.get()) ? "resumed" : "new");
+    }
+    return ssl;
+}
+
+bool DnsTlsSocket::initialize() {
+    if (DBG) {
+        ALOGD("%u connecting TCP socket", mMark);
+    }
+    mSslFd = makeConnectedSocket();
+    if (DBG) {
+        ALOGD("%u connecting SSL", mMark);
+    }
+    mSsl = sslConnect(mSslFd.get());
+    if (mSsl == nullptr) {
+        if (DBG) {
+            ALOGW("%u SSL connection failed", mMark);
+        }
+        return false;
+    }
+
+    // The I/O thread only reads when poll() reports data, but that data may turn out to be a
+    // post-handshake message (such as a TLS 1.3 session ticket) rather than a response. Use a
+    // non-blocking socket so that such a wakeup cannot block the thread until a response arrives.
+    if (!setNonBlocking(mSslFd.get(), true)) {
+        ALOGE("Failed to enable nonblocking status on DNS-over-TLS fd");
+        return false;
+    }
+
+    mEventFd.reset(eventfd(0, EFD_CLOEXEC));
+    if (mEventFd.get() == -1) {
+        ALOGE("Failed to create eventfd: %s", strerror(errno));
+        return false;
+    }
+
+    mLoopThread = std::thread([this] { loop(); });
+    return true;
+}
+
+bool DnsTlsSocket::query(const uint8_t* query, size_t qlen) {
+    std::vector<uint8_t> buffer(qlen + 2);
+    buffer[0] = qlen >> 8;
+    buffer[1] = qlen;
+    memcpy(buffer.data() + 2, query, qlen);
+    {
+        std::lock_guard<std::mutex> guard(mLock);
+        if (mClosed || mStopping) {
+            return false;
+        }
+        mQueue.push_back(std::move(buffer));
+    }
+    wakeUp(mEventFd.get());
+    return true;
+}
+
+void DnsTlsSocket::loop() {
+    std::deque<std::vector<uint8_t>> queue;
+    while (true) {
+        pollfd fds[2] = {
+            { .fd = mSslFd.get(), .events = POLLIN },
+            { .fd = mEventFd.get(), .events = POLLIN },
+        };
+        const int ret = TEMP_FAILURE_RETRY(poll(fds, 2, kIdleTimeoutMs));
+        if (ret == 0) {
+            if (DBG) {
+                ALOGD("%u Closing idle connection", mMark);
+            }
+            break;
+        }
+        if (ret < 0) {
+            ALOGW("%u poll failed: %s", mMark, strerror(errno));
+            break;
+        }
+
+        if (fds[0].revents & (POLLIN | POLLERR | POLLHUP)) {
+            // Responses may already have been decrypted into the SSL object's buffer, where poll()
+            // cannot see them, so keep reading until no response data is left.
+            int available;
+            while ((available = responseAvailable()) > 0) {
+                if (!readResponse()) {
+                    available = -1;
+                    break;
+                }
+            }
+            if (available < 0) {
+                break;
+            }
+        }
+
+        if (fds[1].revents & POLLIN) {
+            uint64_t value;
+            if (read(mEventFd.get(), &value, sizeof(value)) != sizeof(value)) {
+                ALOGE("%u Failed to read eventfd: %s", mMark, strerror(errno));
+                break;
+            }
+            bool stopping;
+            {
+                std::lock_guard<std::mutex> guard(mLock);
+                stopping = mStopping;
+                queue.swap(mQueue);
+            }
+            if (stopping) {
+                break;
+            }
+            bool ok = true;
+            for (const auto& buffer : queue) {
+                if (!sslWrite(buffer.data(), buffer.size())) {
+                    ok = false;
+                    break;
+                }
+            }
+            queue.clear();
+            if (!ok) {
+                break;
+            }
+        }
+    }
+
+    // Send close_notify even if the server has already gone away. Freeing an SSL object that
+    // has not been shut down marks its session as not resumable, which would defeat the session
+    // cache whenever the server closes first.
+    SSL_shutdown(mSsl.get());
+    {
+        std::lock_guard<std::mutex> guard(mLock);
+        mClosed = true;
+        mQueue.clear();
+    }
+    mObserver->onClosed();
+}
+
+bool DnsTlsSocket::sslWrite(const uint8_t *buffer, int len) {
+    if (DBG) {
+        ALOGD("%u Writing %d bytes", mMark, len);
+    }
+    for (;;) {
+        int ret = SSL_write(mSsl.get(), buffer, len);
+        if (ret == len) break;  // SSL write complete;
+
+        if (ret < 1) {
+            const int ssl_err = SSL_get_error(mSsl.get(), ret);
+            switch (ssl_err) {
+                case SSL_ERROR_WANT_READ:
+                    if (waitForReading(mSslFd.get(), kIdleTimeoutMs) != 1) {
+                        if (DBG) {
+                            ALOGW("SSL_write error");
+                        }
+                        return false;
+                    }
+                    continue;
+                case SSL_ERROR_WANT_WRITE:
+                    if (waitForWriting(mSslFd.get(), kIdleTimeoutMs) != 1) {
+                        if (DBG) {
+                            ALOGW("SSL_write error");
+                        }
+                        return false;
+                    }
+                    continue;
+                case 0:
+                    break;  // SSL write complete;
+                default:
+                    if (DBG) {
+                        ALOGW("SSL_write error %d", ssl_err);
+                    }
+                    return false;
+            }
+        }
+    }
+    if (DBG) {
+        ALOGD("%u Wrote %d bytes", mMark, len);
+    }
+    return true;
+}
+
+// Read exactly len bytes into buffer or fail
+bool DnsTlsSocket::sslRead(uint8_t *buffer, int len) {
+    int remaining = len;
+    while (remaining > 0) {
+        int ret = SSL_read(mSsl.get(), buffer + (len - remaining), remaining);
+        if (ret == 0) {
+            // A server closing an idle connection between responses is expected.
+            if (remaining != len) {
+                ALOGE("SSL socket closed with %i of %i bytes remaining", remaining, len);
+            }
+            return false;
+        }
+
+        if (ret < 0) {
+            const int ssl_err = SSL_get_error(mSsl.get(), ret);
+            if (ssl_err == SSL_ERROR_WANT_READ) {
+                if (waitForReading(mSslFd.get(), kIdleTimeoutMs) != 1) {
+                    if (DBG) {
+                        ALOGW("SSL_read error");
+                    }
+                    return false;
+                }
+                continue;
+            } else {
+                if (DBG) {
+                    ALOGW("SSL_read error %d", ssl_err);
+                }
+                return false;
+            }
+        }
+
+        remaining -= ret;
+    }
+    return true;
+}
+
+int DnsTlsSocket::responseAvailable() {
+    uint8_t byte;
+    const int ret = SSL_peek(mSsl.get(), &byte, 1);
+    if (ret > 0) {
+        return 1;
+    }
+    if (ret < 0 && SSL_get_error(mSsl.get(), ret) == SSL_ERROR_WANT_READ) {
+        return 0;
+    }
+    // The server closed the connection, which is expected for idle connections.
+    if (DBG) {
+        ALOGD("%u SSL_peek returned %d", mMark, ret);
+    }
+    return -1;
+}
+
+bool DnsTlsSocket::readResponse() {
+    uint8_t responseHeader[2];
+    if (!sslRead(responseHeader, 2)) {
+        if (DBG) {
+            ALOGW("%u Failed to read 2-byte length header", mMark);
+        }
+        return false;
+    }
+    const uint16_t responseSize = (responseHeader[0] << 8) | responseHeader[1];
+    if (DBG) {
+        ALOGD("%u Expecting response of size %i", mMark, responseSize);
+    }
+    std::vector<uint8_t> response(responseSize);
+    if (!sslRead(response.data(), responseSize)) {
+        if (DBG) {
+            ALOGW("%u Failed to read %i bytes", mMark, responseSize);
+        }
+        return false;
+    }
+    if (DBG) {
+        ALOGD("%u SSL_read complete", mMark);
+    }
+    mObserver->onResponse(std::move(response));
+    return true;
+}
+
+}  // namespace net
+}  // namespace android
@@ -0,0 +1,130 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _DNS_DNSTLSSOCKET_H
+#define _DNS_DNSTLSSOCKET_H
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#include <deque>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include <openssl/ssl.h>
+
+#include "android-base/unique_fd.h"
+#include "dns/DnsTlsSessionCache.h"
+
+namespace android {
+namespace net {
+
+// A single TLS connection to a DNS-over-TLS server.
+//
+// After initialize() succeeds, the connection is serviced by its own I/O thread, which writes
+// queued queries and reads responses as they arrive. This lets several queries be outstanding on
+// the same connection at once, as permitted by RFC 7858. All SSL calls after the handshake are
+// made from the I/O thread, because an SSL object cannot be used by two threads at a time.
+//
+// The connection closes itself after kIdleTimeoutMs without any traffic, when the server closes
+// it, or when stop() is called. In all cases the observer's onClosed() is called, after which the socket can only be
+// destroyed.
+class DnsTlsSocket {
+public:
+    static constexpr int kIdleTimeoutMs = 20 * 1000;
+
+    class Observer {
+    public:
+        virtual ~Observer() {}
+        // Called on the I/O thread for each complete response, without its length prefix.
+        virtual void onResponse(std::vector<uint8_t> response) = 0;
+        // Called on the I/O thread exactly once, when the connection stops being usable.
+        virtual void onClosed() = 0;
+    };
+
+    DnsTlsSocket(unsigned mark, int protocol, const sockaddr_storage& ss,
+            const std::set<std::vector<uint8_t>>& fingerprints, DnsTlsSessionCache* cache,
+            Observer* observer)
+            : mMark(mark), mProtocol(protocol), mAddr(ss), mFingerprints(fingerprints),
+              mCache(cache), mSessionKey(DnsTlsSessionCache::makeKey(ss, fingerprints)),
+              mObserver(observer) {}
+    // Closes the connection and waits for the I/O thread to exit.
+    ~DnsTlsSocket();
+
+    // Connects to the server, performs the TLS handshake and checks the fingerprints, then starts
+    // the I/O thread. Blocking. Returns false on failure, in which case onClosed() is never called.
+    bool initialize();
+
+    // Queues a query (without length prefix) for sending. Returns false if the connection is
+    // already closed, in which case no response will ever be delivered for it.
+    bool query(const uint8_t* query, size_t qlen);
+
+    // Closes the connection, for example because the server has stopped answering on it. Does not
+    // block: the I/O thread exits and calls onClosed() shortly afterwards.
+    void stop();
+
+private:
+    // On success, returns a non-blocking socket connected to mAddr (the
+    // connection will likely be in progress if mProtocol is IPPROTO_TCP).
+    // On error, returns -1 with errno set appropriately.
+    android::base::unique_fd makeConnectedSocket() const;
+
+    bssl::UniquePtr<SSL> sslConnect(int fd);
+
+    void loop();
+
+    // Writes a buffer to the socket.
+    bool sslWrite(const uint8_t *buffer, int len);
+
+    // Returns 1 if response data can be read without blocking, 0 if not, or -1 if the connection
+    // has closed.
+    int responseAvailable();
+
+    // Reads exactly the specified number of bytes from the socket.  Blocking.
+    // Returns false if the socket closes before enough bytes can be read.
+    bool sslRead(uint8_t *buffer, int len);
+
+    // Reads one length-prefixed response and hands it to the observer.
+    bool readResponse();
+
+    const unsigned mMark;  // Socket mark
+    const int mProtocol;
+    const sockaddr_storage mAddr;
+    const std::set<std::vector<uint8_t>> mFingerprints;
+    DnsTlsSessionCache* const mCache;
+    // Referenced by mSsl, so it must be declared before it.
+    const DnsTlsSessionCache::Key mSessionKey;
+    Observer* const mObserver;
+
+    android::base::unique_fd mSslFd;
+    bssl::UniquePtr<SSL> mSsl;
+    // Written to wake up the I/O thread when there is something to send or it must exit.
+    android::base::unique_fd mEventFd;
+
+    std::mutex mLock;
+    std::deque<std::vector<uint8_t>> mQueue;  // guarded by mLock
+    bool mClosed = false;                     // guarded by mLock
+    bool mStopping = false;                   // guarded by mLock
+    std::thread mLoopThread;
+};
+
+}  // namespace net
+}  // namespace android
+
+#endif  // _DNS_DNSTLSSOCKET_H
@@ -19,9 +19,10 @@
 #include <arpa/inet.h>
 #include <arpa/nameser.h>
 #include <errno.h>
-#include <openssl/err.h>
-#include <openssl/ssl.h>
 #include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
 
 #define LOG_TAG "DnsTlsTransport"
 #define DBG 0
@@ -36,318 +37,202 @@
 namespace android {
 namespace net {
 
-namespace {
-
-bool setNonBlocking(int fd, bool enabled) {
-    int flags = fcntl(fd, F_GETFL);
-    if (flags < 0) return false;
-
-    if (enabled) {
-        flags |= O_NONBLOCK;
-    } else {
-        flags &= ~O_NONBLOCK;
-    }
-    return (fcntl(fd, F_SETFL, flags) == 0);
-}
-
-int waitForReading(int fd) {
-    fd_set fds;
-    FD_ZERO(&fds);
-    FD_SET(fd, &fds);
-    const int ret = TEMP_FAILURE_RETRY(select(fd + 1, &fds, nullptr, nullptr, nullptr));
-    if (DBG && ret <= 0) {
-        ALOGD("select");
-    }
-    return ret;
-}
-
-int waitForWriting(int fd) {
-    fd_set fds;
-    FD_ZERO(&fds);
-    FD_SET(fd, &fds);
-    const int ret = TEMP_FAILURE_RETRY(select(fd + 1, nullptr, &fds, nullptr, nullptr));
-    if (DBG && ret <= 0) {
-        ALOGD("select");
-    }
-    return ret;
-}
-
-}  // namespace
-
-android::base::unique_fd DnsTlsTransport::makeConnectedSocket() const {
-    android::base::unique_fd fd;
-    int type = SOCK_NONBLOCK | SOCK_CLOEXEC;
-    switch (mProtocol) {
-        case IPPROTO_TCP:
-            type |= SOCK_STREAM;
-            break;
-        default:
-            errno = EPROTONOSUPPORT;
-            return fd;
-    }
-
-    fd.reset(socket(mAddr.ss_family, type, mProtocol));
-    if (fd.get() == -1) {
-        return fd;
-    }
+constexpr int DnsTlsTransport::kQueryTimeoutMs;
+constexpr int DnsTlsTransport::kMaxConsecutiveTimeouts;
 
-    const socklen_t len = sizeof(mMark);
-    if (setsockopt(fd.get(), SOL_SOCKET, SO_MARK, &mMark, len) == -1) {
-        fd.reset();
-    } else if (connect(fd.get(),
-            reinterpret_cast<const struct sockaddr *>(&mAddr), sizeof(mAddr)) != 0
-        && errno != EINPROGRESS) {
-        fd.reset();
+DnsTlsTransport::~DnsTlsTransport() {
+    std::unique_ptr<DnsTlsSocket> socket;
+    {
+        std::lock_guard<std::mutex> guard(mLock);
+        socket = std::move(mSocket);
     }
-
-    return fd;
+    // Destroying the socket joins its I/O thread, which calls onClosed() and takes mLock.
+    socket.reset();
 }
 
-bool getSPKIDigest(const X509* cert, std::vector<uint8_t>* out) {
-    int spki_len = i2d_X509_PUBKEY(X509_get_X509_PUBKEY(cert), NULL);
-    unsigned char spki[spki_len];
-    unsigned char* temp = spki;
-    if (spki_len != i2d_X509_PUBKEY(X509_get_X509_PUBKEY(cert), &temp)) {
-        ALOGW("SPKI length mismatch");
-        return false;
-    }
-    out->resize(SHA256_SIZE);
-    unsigned int digest_len = 0;
-    int ret = EVP_Digest(spki, spki_len, out->data(), &digest_len, EVP_sha256(), NULL);
-    if (ret != 1) {
-        ALOGW("Server cert digest extraction failed");
-        return false;
-    }
-    if (digest_len != out->size()) {
-        ALOGW("Wrong digest length: %d", digest_len);
-        return false;
+bool DnsTlsTransport::allocateIdLocked(uint16_t* id) {
+    for (unsigned i = 0; i <= UINT16_MAX; ++i) {
+        const uint16_t candidate = mNextId++;
+        if (mQueries.count(candidate) == 0) {
+            *id = candidate;
+            return true;
+        }
     }
-    return true;
+    return false;
 }
 
-SSL* DnsTlsTransport::sslConnect(int fd) {
-    if (fd < 0) {
-        ALOGD("%u makeConnectedSocket() failed with: %s", mMark, strerror(errno));
-        return nullptr;
-    }
-
-    // Set up TLS context.
-    bssl::UniquePtr<SSL_CTX> ssl_ctx(SSL_CTX_new(TLS_method()));
-    if (!SSL_CTX_set_max_proto_version(ssl_ctx.get(), TLS1_3_VERSION) ||
-        !SSL_CTX_set_min_proto_version(ssl_ctx.get(), TLS1_1_VERSION)) {
-        ALOGD("failed to min/max TLS versions");
-        return nullptr;
-    }
-
-    bssl::UniquePtr<SSL> ssl(SSL_new(ssl_ctx.get()));
-    bssl::UniquePtr<BIO> bio(BIO_new_socket(fd, BIO_CLOSE));
-    SSL_set_bio(ssl.get(), bio.get(), bio.get());
-    bio.release();
-
-    if (!setNonBlocking(fd, false)) {
-        ALOGE("Failed to disable nonblocking status on DNS-over-TLS fd");
-        return nullptr;
-    }
-
-    for (;;) {
-        if (DBG) {
-            ALOGD("%u Calling SSL_connect", mMark);
-        }
-        int ret = SSL_connect(ssl.get());
-        if (DBG) {
-            ALOGD("%u SSL_connect returned %d", mMark, ret);
-        }
-        if (ret == 1) break;  // SSL handshake complete;
-
-        const int ssl_err = SSL_get_error(ssl.get(), ret);
-        switch (ssl_err) {
-            case SSL_ERROR_WANT_READ:
-                if (waitForReading(fd) != 1) {
-                    ALOGW("SSL_connect read error");
-                    return nullptr;
-                }
-                break;
-            case SSL_ERROR_WANT_WRITE:
-                if (waitForWriting(fd) != 1) {
-                    ALOGW("SSL_connect write error");
-                    return nullptr;
-                }
-                break;
-            default:
-                ALOGW("SSL_connect error %d, errno=%d", ssl_err, errno);
-                return nullptr;
-        }
+DnsTlsTransport::Response DnsTlsTransport::sendQuery(const uint8_t *query, size_t qlen,
+        std::chrono::steady_clock::time_point deadline, std::shared_ptr<Query>* out,
+        bool* reused) {
+    std::unique_lock<std::mutex> lock(mLock);
+    // Only one thread opens a connection at a time. The others wait and use it, but no longer than
+    // they would have waited for an answer.
+    if (!mCv.wait_until(lock, deadline, [this] { return !mConnecting; })) {
+        ALOGW("%u Timed out waiting for DNS-over-TLS connection", mMark);
+        return Response::network_error;
     }
-
-    if (!mFingerprints.empty()) {
-        if (DBG) {
-            ALOGD("Checking DNS over TLS fingerprint");
-        }
-        // TODO: Follow the cert chain and check all the way up.
-        bssl::UniquePtr<X509> cert(SSL_get_peer_certificate(ssl.get()));
-        if (!cert) {
-            ALOGW("Server has null certificate");
-            return nullptr;
-        }
-        std::vector<uint8_t> digest;
-        if (!getSPKIDigest(cert.get(), &digest)) {
-            ALOGE("Digest computation failed");
-            return nullptr;
-        }
-
-        if (mFingerprints.count(digest) == 0) {
-            ALOGW("No matching fingerprint");
-            return nullptr;
-        }
-        if (DBG) {
-            ALOGD("DNS over TLS fingerprint is correct");
+    if (mSocket == nullptr || mSocketClosed) {
+        std::unique_ptr<DnsTlsSocket> oldSocket = std::move(mSocket);
+        mConnecting = true;
+        lock.unlock();
+        // Neither of these may hold mLock: destroying the old socket joins its I/O thread, which
+        // calls onClosed(), and the handshake may block for as long as the server takes to answer.
+        // Meanwhile other threads can still time out their queries.
+        oldSocket.reset();
+        auto socket = std::make_unique<DnsTlsSocket>(mMark, mProtocol, mAddr, mFingerprints,
+                mCache, this);
+        const bool connected = socket->initialize();
+        lock.lock();
+        mConnecting = false;
+        mCv.notify_all();
+        if (!connected) {
+            if (DBG) {
+                ALOGW("%u SSL connection failed", mMark);
+            }
+            return Response::network_error;
         }
+        mSocket = std::move(socket);
+        mSocketClosed = false;
+        mSocketUsed = false;
+        mSocketAnswered = false;
+        mSocketGeneration++;
+        mSocketResponses = 0;
+        mConsecutiveTimeouts = 0;
+    }
+    *reused = mSocketUsed;
+    mSocketUsed = true;
+
+    uint16_t id;
+    if (!allocateIdLocked(&id)) {
+        ALOGE("%u Too many outstanding DNS-over-TLS queries", mMark);
+        return Response::limit_error;
     }
-
-    if (DBG) {
-        ALOGD("%u handshake complete", mMark);
-    }
-    return ssl.release();
+    auto pending = std::make_shared<Query>();
+    pending->id = id;
+    pending->originalId = (query[0] << 8) | query[1];
+    pending->socketGeneration = mSocketGeneration;
+    pending->responsesAtSend = mSocketResponses;
+    std::vector<uint8_t> rewritten(query, query + qlen);
+    rewritten[0] = id >> 8;
+    rewritten[1] = id;
+    mQueries[id] = pending;
+    // If this fails, the socket has just closed and onClosed() will fail the query as soon as
+    // we release mLock.
+    mSocket->query(rewritten.data(), rewritten.size());
+    *out = std::move(pending);
+    return Response::success;
 }
 
-bool DnsTlsTransport::sslWrite(int fd, SSL *ssl, const uint8_t *buffer, int len) {
-    if (DBG) {
-        ALOGD("%u Writing %d bytes", mMark, len);
-    }
-    for (;;) {
-        int ret = SSL_write(ssl, buffer, len);
-        if (ret == len) break;  // SSL write complete;
+DnsTlsTransport::Response DnsTlsTransport::doQuery(const uint8_t *query, size_t qlen,
+        uint8_t *response, size_t limit, int *resplen) {
+    *resplen = 0;  // Zero indicates an error.
 
-        if (ret < 1) {
-            const int ssl_err = SSL_get_error(ssl, ret);
-            switch (ssl_err) {
-                case SSL_ERROR_WANT_WRITE:
-                    if (waitForWriting(fd) != 1) {
-                        if (DBG) {
-                            ALOGW("SSL_write error");
-                        }
-                        return false;
-                    }
-                    continue;
-                case 0:
-                    break;  // SSL write complete;
-                default:
-                    if (DBG) {
-                        ALOGW("SSL_write error %d", ssl_err);
-                    }
-                    return false;
-            }
-        }
-    }
-    if (DBG) {
-        ALOGD("%u Wrote %d bytes", mMark, len);
+    if (qlen < 2) {
+        ALOGE("%u Query too short: %zu", mMark, qlen);
+        return Response::internal_error;
     }
-    return true;
-}
 
-// Read exactly len bytes into buffer or fail
-bool DnsTlsTransport::sslRead(int fd, SSL *ssl, uint8_t *buffer, int len) {
-    int remaining = len;
-    while (remaining > 0) {
-        int ret = SSL_read(ssl, buffer + (len - remaining), remaining);
-        if (ret == 0) {
-            ALOGE("SSL socket closed with %i of %i bytes remaining", remaining, len);
-            return false;
+    // Retries share one deadline, so a query never takes much longer than kQueryTimeoutMs.
+    const auto deadline = std::chrono::steady_clock::now() +
+            std::chrono::milliseconds(kQueryTimeoutMs);
+    for (int attempt = 0; ; ++attempt) {
+        std::shared_ptr<Query> pending;
+        bool reused = false;
+        const Response sent = sendQuery(query, qlen, deadline, &pending, &reused);
+        if (sent != Response::success) {
+            return sent;
         }
 
-        if (ret < 0) {
-            const int ssl_err = SSL_get_error(ssl, ret);
-            if (ssl_err == SSL_ERROR_WANT_READ) {
-                if (waitForReading(fd) != 1) {
-                    if (DBG) {
-                        ALOGW("SSL_read error");
-                    }
-                    return false;
-                }
-                continue;
-            } else {
+        std::unique_lock<std::mutex> lock(mLock);
+        const bool done = mCv.wait_until(lock, deadline, [&pending] { return pending->done; });
+        if (!done) {
+            ALOGW("%u DNS-over-TLS query timed out", mMark);
+            mQueries.erase(pending->id);
+            onTimeoutLocked(*pending);
+            return Response::network_error;
+        }
+        if (pending->closed) {
+            // The server may have closed an idle connection just as we wrote to it, or it may
+            // close connections after answering a limited number of queries. In the latter case
+            // every retry is preceded by some query being answered, so retrying makes progress.
+            if ((reused && attempt == 0) || pending->answeredBeforeClose) {
                 if (DBG) {
-                    ALOGW("SSL_read error %d", ssl_err);
+                    ALOGD("%u Connection closed, retrying on a new one", mMark);
                 }
-                return false;
+                continue;
             }
+            return Response::network_error;
         }
+        lock.unlock();
 
-        remaining -= ret;
-    }
-    return true;
-}
-
-DnsTlsTransport::Response DnsTlsTransport::doQuery(const uint8_t *query, size_t qlen,
-        uint8_t *response, size_t limit, int *resplen) {
-    *resplen = 0;  // Zero indicates an error.
-
-    if (DBG) {
-        ALOGD("%u connecting TCP socket", mMark);
-    }
-    android::base::unique_fd fd(makeConnectedSocket());
-    if (DBG) {
-        ALOGD("%u connecting SSL", mMark);
-    }
-    bssl::UniquePtr<SSL> ssl(sslConnect(fd));
-    if (ssl == nullptr) {
-        if (DBG) {
-            ALOGW("%u SSL connection failed", mMark);
+        const size_t responseSize = pending->response.size();
+        if (responseSize > limit) {
+            ALOGE("%u Response doesn't fit in output buffer: %zu", mMark, responseSize);
+            return Response::limit_error;
         }
-        return Response::network_error;
+        memcpy(response, pending->response.data(), responseSize);
+        *resplen = responseSize;
+        return Response::success;
     }
+}
 
-    uint8_t queryHeader[2];
-    queryHeader[0] = qlen >> 8;
-    queryHeader[1] = qlen;
-    if (!sslWrite(fd.get(), ssl.get(), queryHeader, 2)) {
-        return Response::network_error;
-    }
-    if (!sslWrite(fd.get(), ssl.get(), query, qlen)) {
-        return Response::network_error;
-    }
-    if (DBG) {
-        ALOGD("%u SSL_write complete", mMark);
-    }
+void DnsTlsTransport::onTimeoutLocked(const Query& pending) {
+    if (mSocket == nullptr || mSocketClosed || pending.socketGeneration != mSocketGeneration) {
+        return;
+    }
+    // If other queries were answered meanwhile, the server is still there and only this query
+    // was lost. Closing the connection would fail all the others that are still in flight.
+    mConsecutiveTimeouts++;
+    const bool idle = (mSocketResponses == pending.responsesAtSend);
+    if (!idle && mConsecutiveTimeouts < kMaxConsecutiveTimeouts) {
+        return;
+    }
+    // The server has stopped answering on this connection. Close it, so that the next query opens
+    // a new one instead of waiting on this one too.
+    ALOGW("%u Closing unresponsive DNS-over-TLS connection", mMark);
+    mSocketClosed = true;
+    mSocket->stop();
+}
 
-    uint8_t responseHeader[2];
-    if (!sslRead(fd.get(), ssl.get(), responseHeader, 2)) {
-        if (DBG) {
-            ALOGW("%u Failed to read 2-byte length header", mMark);
-        }
-        return Response::network_error;
-    }
-    const uint16_t responseSize = (responseHeader[0] << 8) | responseHeader[1];
-    if (DBG) {
-        ALOGD("%u Expecting response of size %i", mMark, responseSize);
-    }
-    if (responseSize > limit) {
-        ALOGE("%u Response doesn't fit in output buffer: %i", mMark, responseSize);
-        return Response::limit_error;
-    }
-    if (!sslRead(fd.get(), ssl.get(), response, responseSize)) {
-        if (DBG) {
-            ALOGW("%u Failed to read %i bytes", mMark, responseSize);
-        }
-        return Response::network_error;
-    }
-    if (DBG) {
-        ALOGD("%u SSL_read complete", mMark);
-    }
+void DnsTlsTransport::onResponse(std::vector<uint8_t> response) {
+    if (response.size() < 2) {
+        ALOGW("%u Response too short: %zu", mMark, response.size());
+        return;
+    }
+    const uint16_t id = (response[0] << 8) | response[1];
+    std::lock_guard<std::mutex> guard(mLock);
+    const auto it = mQueries.find(id);
+    if (it == mQueries.end()) {
+        // Most likely a late response to a query that has already timed out.
+        ALOGW("%u Unexpected response ID %u", mMark, id);
+        return;
+    }
+    std::shared_ptr<Query> pending = it->second;
+    mQueries.erase(it);
+    mSocketAnswered = true;
+    mSocketResponses++;
+    mConsecutiveTimeouts = 0;
+    response[0] = pending->originalId >> 8;
+    response[1] = pending->originalId;
+    pending->response = std::move(response);
+    pending->done = true;
+    mCv.notify_all();
+}
 
-    if (response[0] != query[0] || response[1] != query[1]) {
-        ALOGE("reply query ID != query ID");
-        return Response::internal_error;
+void DnsTlsTransport::onClosed() {
+    std::lock_guard<std::mutex> guard(mLock);
+    mSocketClosed = true;
+    for (const auto& query : mQueries) {
+        query.second->closed = true;
+        query.second->answeredBeforeClose = mSocketAnswered;
+        query.second->done = true;
     }
-
-    SSL_shutdown(ssl.get());
-
-    *resplen = responseSize;
-    return Response::success;
+    mQueries.clear();
+    mCv.notify_all();
 }
 
 bool validateDnsTlsServer(unsigned netid, const struct sockaddr_storage& ss,
-        const std::set<std::vector<uint8_t>>& fingerprints) {
+        const std::set<std::vector<uint8_t>>& fingerprints, DnsTlsSessionCache* cache) {
     if (DBG) {
         ALOGD("Beginning validation on %u", netid);
     }
@@ -392,7 +277,7 @@ bool validateDnsTlsServer(unsigned netid, const struct sockaddr_storage& ss,
     fwmark.protectedFromVpn = true;
     fwmark.netId = netid;
     unsigned mark = fwmark.intValue;
-    DnsTlsTransport xport(mark, IPPROTO_TCP, ss, fingerprints);
+    DnsTlsTransport xport(mark, IPPROTO_TCP, ss, fingerprints, cache);
     int replylen = 0;
     xport.doQuery(query, qlen, recvbuf, kRecvBufSize, &replylen);
     if (replylen == 0) {
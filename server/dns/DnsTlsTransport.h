@@ -18,26 +18,45 @@
 #define _DNS_DNSTLSTRANSPORT_H
 
 #include <netinet/in.h>
-#include <set>
 #include <sys/socket.h>
 #include <sys/types.h>
-#include <vector>
 
-#include "android-base/unique_fd.h"
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <vector>
 
-// Forward declaration.
-typedef struct ssl_st SSL;
+#include "dns/DnsTlsSocket.h"
 
 namespace android {
 namespace net {
 
-class DnsTlsTransport {
+// A persistent DNS-over-TLS transport to one server, using one socket mark.
+//
+// The transport keeps a single TLS connection open between queries and sends concurrent queries
+// over it without waiting for earlier responses. Because different callers may pick the same DNS
+// ID, each query is given an ID that is unique on the connection before it is sent, and the
+// caller's ID is restored in the response. If the connection turns out to have been closed by the
+// server (typically after an idle timeout, or after a per-connection query limit), queries that
+// were sent on it are transparently retried on a new connection.
+//
+// A query that times out is given up on alone, and the others on its connection carry on. The
+// connection is only closed, so that later queries do not wait on a server that has stopped
+// answering, if nothing at all was read from it while the query was waiting, or if several queries
+// in a row have timed out.
+class DnsTlsTransport : public DnsTlsSocket::Observer {
 public:
+    static constexpr int kQueryTimeoutMs = 20 * 1000;
+    static constexpr int kMaxConsecutiveTimeouts = 3;
+
     DnsTlsTransport(unsigned mark, int protocol, const sockaddr_storage &ss,
-            const std::set<std::vector<uint8_t>>& fingerprints)
-            : mMark(mark), mProtocol(protocol), mAddr(ss), mFingerprints(fingerprints)
-            {}
-    ~DnsTlsTransport() {}
+            const std::set<std::vector<uint8_t>>& fingerprints, DnsTlsSessionCache* cache)
+            : mMark(mark), mProtocol(protocol), mAddr(ss), mFingerprints(fingerprints),
+              mCache(cache) {}
+    ~DnsTlsTransport();
 
     enum class Response : uint8_t { success, network_error, limit_error, internal_error };
 
@@ -45,34 +64,66 @@ public:
     // response into |ans|, which can accept up to |anssiz| bytes.  Indicates
     // the number of bytes written in |resplen|.  If |resplen| is zero, an
     // error has occurred.
+    // Threadsafe. May be called concurrently from many threads.
     Response doQuery(const uint8_t *query, size_t qlen, uint8_t *ans, size_t anssiz, int *resplen);
 
-private:
-    // On success, returns a non-blocking socket connected to mAddr (the
-    // connection will likely be in progress if mProtocol is IPPROTO_TCP).
-    // On error, returns -1 with errno set appropriately.
-    android::base::unique_fd makeConnectedSocket() const;
-
-    SSL* sslConnect(int fd);
+    // DnsTlsSocket::Observer.
+    void onResponse(std::vector<uint8_t> response) override;
+    void onClosed() override;
 
-    // Writes a buffer to the socket.
-    bool sslWrite(int fd, SSL *ssl, const uint8_t *buffer, int len);
-
-    // Reads exactly the specified number of bytes from the socket.  Blocking.
-    // Returns false if the socket closes before enough bytes can be read.
-    bool sslRead(int fd, SSL *ssl, uint8_t *buffer, int len);
+private:
+    struct Query {
+        uint16_t id;          // The ID used on the wire.
+        uint16_t originalId;  // The ID chosen by the caller.
+        bool done = false;
+        bool closed = false;  // The connection closed before a response arrived.
+        bool answeredBeforeClose = false;  // That connection had answered other queries.
+        uint64_t socketGeneration = 0;  // The connection the query was sent on.
+        uint64_t responsesAtSend = 0;   // The number of responses read from it before the query.
+        std::vector<uint8_t> response;
+    };
+
+    // Sends the query over the current connection, opening one if necessary, or waiting until
+    // |deadline| for another thread to open one. On success, sets |*reused| to whether the
+    // connection had already carried earlier queries.
+    Response sendQuery(const uint8_t *query, size_t qlen,
+            std::chrono::steady_clock::time_point deadline, std::shared_ptr<Query>* out,
+            bool* reused);
+
+    // Called when |pending| has timed out. Closes the connection if the server seems to have
+    // stopped answering on it. Must be called with mLock held.
+    void onTimeoutLocked(const Query& pending);
+
+    // Returns an ID not used by any outstanding query. Must be called with mLock held.
+    bool allocateIdLocked(uint16_t* id);
 
     const unsigned mMark;  // Socket mark
     const int mProtocol;
     const sockaddr_storage mAddr;
     const std::set<std::vector<uint8_t>> mFingerprints;
+    DnsTlsSessionCache* const mCache;
+
+    std::mutex mLock;
+    std::condition_variable mCv;
+    std::unique_ptr<DnsTlsSocket> mSocket;                // guarded by mLock
+    bool mConnecting = false;                             // guarded by mLock
+    // mSocket has closed, or is closing, and must be replaced before the next query.
+    bool mSocketClosed = false;                           // guarded by mLock
+    bool mSocketUsed = false;                             // guarded by mLock
+    bool mSocketAnswered = false;                         // guarded by mLock
+    uint64_t mSocketGeneration = 0;                       // guarded by mLock
+    uint64_t mSocketResponses = 0;                        // guarded by mLock
+    int mConsecutiveTimeouts = 0;                         // guarded by mLock
+    std::map<uint16_t, std::shared_ptr<Query>> mQueries;  // guarded by mLock
+    uint16_t mNextId = 0;                                 // guarded by mLock
 };
 
 // Check that a given TLS server (ss) is fully working on the specified netid, and has a
 // provided SHA-256 fingerprint (if nonempty).  This function is used in ResolverController
 // to ensure that we don't enable DNS over TLS on networks where it doesn't actually work.
+// A successful validation leaves a session in |cache| for later connections to resume.
 bool validateDnsTlsServer(unsigned netid, const sockaddr_storage& ss,
-        const std::set<std::vector<uint8_t>>& fingerprints);
+        const std::set<std::vector<uint8_t>>& fingerprints, DnsTlsSessionCache* cache);
 
 }  // namespace net
 }  // namespace android
@@ -0,0 +1,216 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "dns/DnsTlsValidationScheduler.h"
+
+#include <algorithm>
+
+#define LOG_TAG "DnsTlsValidationScheduler"
+#define DBG 0
+
+#include "log/log.h"
+
+namespace android {
+namespace net {
+
+constexpr int DnsTlsValidationScheduler::kMaxConcurrent;
+constexpr std::chrono::seconds DnsTlsValidationScheduler::kInitialBackoff;
+constexpr std::chrono::seconds DnsTlsValidationScheduler::kMaxBackoff;
+
+DnsTlsValidationScheduler::DnsTlsValidationScheduler(Validator validator,
+        ResultCallback callback, int maxConcurrent, Duration initialBackoff, Duration maxBackoff)
+        : mValidator(std::move(validator)), mCallback(std::move(callback)),
+          mMaxConcurrent(maxConcurrent), mInitialBackoff(initialBackoff),
+          mMaxBackoff(maxBackoff) {}
+
+DnsTlsValidationScheduler::~DnsTlsValidationScheduler() {
+    std::vector<std::thread> threads;
+    {
+        std::lock_guard<std::mutex> guard(mLock);
+        mStopping = true;
+        threads.swap(mThreads);
+    }
+    mCv.notify_all();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+DnsTlsValidationScheduler::ServerKey DnsTlsValidationScheduler::makeServerKey(
+        const sockaddr_storage& server) {
+    std::string addr;
+    if (server.ss_family == AF_INET) {
+        const sockaddr_in& sin = reinterpret_cast<const sockaddr_in&>(server);
+        addr.assign(reinterpret_cast<const char*>(&sin.sin_addr), sizeof(sin.sin_addr));
+    } else if (server.ss_family == AF_INET6) {
+        const sockaddr_in6& sin6 = reinterpret_cast<const sockaddr_in6&>(server);
+        addr.assign(reinterpret_cast<const char*>(&sin6.sin6_addr), sizeof(sin6.sin6_addr));
+    }
+    return ServerKey(server.ss_family, addr);
+}
+
+void DnsTlsValidationScheduler::schedule(unsigned netId, const sockaddr_storage& server,
+        const std::set<std::vector<uint8_t>>& fingerprints) {
+    std::lock_guard<std::mutex> guard(mLock);
+    const JobKey key(netId, makeServerKey(server));
+    const auto it = mJobs.find(key);
+    if (it != mJobs.end()) {
+        // Already pending or running. Pick up new fingerprints for the next attempt, and undo a
+        // cancellation that raced with the server being configured again.
+        it->second.fingerprints = fingerprints;
+        it->second.cancelled = false;
+        return;
+    }
+    Job& job = mJobs[key];
+    job.server = server;
+    job.fingerprints = fingerprints;
+    job.due = std::chrono::steady_clock::now();
+    job.backoff = mInitialBackoff;
+    startLocked();
+    mCv.notify_one();
+}
+
+void DnsTlsValidationScheduler::revalidate(unsigned netId) {
+    std::lock_guard<std::mutex> guard(mLock);
+    const auto now = std::chrono::steady_clock::now();
+    for (auto& entry : mJobs) {
+        if (entry.first.first == netId && !entry.second.running) {
+            entry.second.due = now;
+            entry.second.backoff = mInitialBackoff;
+        }
+    }
+    mCv.notify_all();
+}
+
+void DnsTlsValidationScheduler::cancelNetwork(unsigned netId) {
+    std::lock_guard<std::mutex> guard(mLock);
+    for (auto it = mJobs.begin(); it != mJobs.end();) {
+        auto current = it++;
+        if (current->first.first == netId) {
+            cancelLocked(current);
+        }
+    }
+}
+
+void DnsTlsValidationScheduler::cancelServer(const sockaddr_storage& server) {
+    std::lock_guard<std::mutex> guard(mLock);
+    const ServerKey serverKey = makeServerKey(server);
+    for (auto it = mJobs.begin(); it != mJobs.end();) {
+        auto current = it++;
+        if (current->first.second == serverKey) {
+            cancelLocked(current);
+        }
+    }
+}
+
+void DnsTlsValidationScheduler::cancel(unsigned netId, const sockaddr_storage& server) {
+    std::lock_guard<std::mutex> guard(mLock);
+    const auto it = mJobs.find(JobKey(netId, makeServerKey(server)));
+    if (it != mJobs.end()) {
+        cancelLocked(it);
+    }
+}
+
+void DnsTlsValidationScheduler::cancelLocked(std::map<JobKey, Job>::iterator it) {
+    if (it->second.running) {
+        // The running thread erases the job when the validation completes.
+        it->second.cancelled = true;
+    } else {
+        mJobs.erase(it);
+    }
+}
+
+size_t DnsTlsValidationScheduler::size() {
+    std::lock_guard<std::mutex> guard(mLock);
+    return mJobs.size();
+}
+
+void DnsTlsValidationScheduler::startLocked() {
+    if (!mThreads.empty()) {
+        return;
+    }
+    for (int i = 0; i < mMaxConcurrent; ++i) {
+        mThreads.emplace_back(&DnsTlsValidationScheduler::run, this);
+    }
+}
+
+std::map<DnsTlsValidationScheduler::JobKey, DnsTlsValidationScheduler::Job>::iterator
+DnsTlsValidationScheduler::nextJobLocked(std::chrono::steady_clock::time_point* wakeup) {
+    const auto now = std::chrono::steady_clock::now();
+    *wakeup = std::chrono::steady_clock::time_point::max();
+    for (auto it = mJobs.begin(); it != mJobs.end(); ++it) {
+        const Job& job = it->second;
+        // A job whose server is busy is woken up by the notification sent on completion.
+        if (job.running || mRunningServers.count(it->first.second) != 0) {
+            continue;
+        }
+        if (job.due <= now) {
+            return it;
+        }
+        *wakeup = std::min(*wakeup, job.due);
+    }
+    return mJobs.end();
+}
+
+void DnsTlsValidationScheduler::run() {
+    std::unique_lock<std::mutex> lock(mLock);
+    while (!mStopping) {
+        std::chrono::steady_clock::time_point wakeup;
+        const auto it = nextJobLocked(&wakeup);
+        if (it == mJobs.end()) {
+            if (wakeup == std::chrono::steady_clock::time_point::max()) {
+                mCv.wait(lock);
+            } else {
+                mCv.wait_until(lock, wakeup);
+            }
+            continue;
+        }
+
+        // Running jobs are never erased by other threads, so |it| stays valid.
+        const unsigned netId = it->first.first;
+        Job& job = it->second;
+        job.running = true;
+        mRunningServers.insert(it->first.second);
+        const sockaddr_storage server = job.server;
+        const std::set<std::vector<uint8_t>> fingerprints = job.fingerprints;
+        lock.unlock();
+
+        // validateDnsTlsServer() is a blocking call that performs network operations.
+        // It can take milliseconds to minutes, up to the SYN retry limit.
+        const bool success = mValidator(netId, server, fingerprints);
+        const bool retry = mCallback(netId, server, success) && !success;
+
+        lock.lock();
+        mRunningServers.erase(it->first.second);
+        if (!retry || job.cancelled) {
+            mJobs.erase(it);
+        } else {
+            if (DBG) {
+                ALOGD("Validation failed on netId %u, retrying in %lld ms", netId,
+                        static_cast<long long>(std::chrono::duration_cast<
+                                std::chrono::milliseconds>(job.backoff).count()));
+            }
+            job.running = false;
+            job.due = std::chrono::steady_clock::now() + job.backoff;
+            job.backoff = std::min(job.backoff * 2, mMaxBackoff);
+        }
+        // Another thread may have been waiting for this server to become free.
+        mCv.notify_all();
+    }
+}
+
+}  // namespace net
+}  // namespace android
@@ -0,0 +1,124 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _DNS_DNSTLSVALIDATIONSCHEDULER_H
+#define _DNS_DNSTLSVALIDATIONSCHEDULER_H
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+namespace android {
+namespace net {
+
+// Runs private DNS server validations on a small, fixed set of threads.
+//
+// Each (netId, server address) pair has at most one pending or running validation; scheduling it
+// again is a no-op. Validations of the same server on different networks never run at the same
+// time, so a server shared by many networks is not hit by a burst of handshakes, and later
+// validations can resume the TLS session established by the first one. When a validation fails
+// and the result callback asks for a retry, the pair is retried with exponential backoff until it
+// succeeds or is cancelled.
+class DnsTlsValidationScheduler {
+public:
+    typedef std::chrono::steady_clock::duration Duration;
+    typedef std::function<bool(unsigned netId, const sockaddr_storage& server,
+            const std::set<std::vector<uint8_t>>& fingerprints)> Validator;
+    // Called with the outcome of each validation. Returns true if a failed validation should be
+    // retried later.
+    typedef std::function<bool(unsigned netId, const sockaddr_storage& server, bool success)>
+            ResultCallback;
+
+    static constexpr int kMaxConcurrent = 4;
+    static constexpr std::chrono::seconds kInitialBackoff{10};
+    static constexpr std::chrono::seconds kMaxBackoff{60 * 60};
+
+    DnsTlsValidationScheduler(Validator validator, ResultCallback callback,
+            int maxConcurrent = kMaxConcurrent, Duration initialBackoff = kInitialBackoff,
+            Duration maxBackoff = kMaxBackoff);
+    // Waits for running validations to finish. Pending ones are dropped.
+    ~DnsTlsValidationScheduler();
+
+    // Schedules a validation of |server| on |netId| as soon as possible, unless one is already
+    // pending, backing off or running. The callbacks are never called synchronously, so this can
+    // be called with locks held that the callbacks take.
+    void schedule(unsigned netId, const sockaddr_storage& server,
+            const std::set<std::vector<uint8_t>>& fingerprints);
+
+    // Makes all of |netId|'s validations that are backing off due now, with their backoff reset.
+    // Used when the network has just become usable, e.g. after a captive portal login.
+    void revalidate(unsigned netId);
+
+    // Drops the validations of |netId|, of |server| on all networks, or of |server| on |netId|
+    // only. A validation that is already running completes, but its failure is not retried.
+    void cancelNetwork(unsigned netId);
+    void cancelServer(const sockaddr_storage& server);
+    void cancel(unsigned netId, const sockaddr_storage& server);
+
+    // Number of validations that are pending, backing off or running.
+    size_t size();
+
+private:
+    // address family, address bytes. Ports and fingerprints are ignored, as in ResolverController.
+    typedef std::pair<int, std::string> ServerKey;
+    typedef std::pair<unsigned, ServerKey> JobKey;
+
+    struct Job {
+        sockaddr_storage server;
+        std::set<std::vector<uint8_t>> fingerprints;
+        std::chrono::steady_clock::time_point due;
+        Duration backoff;
+        bool running = false;
+        bool cancelled = false;  // Only meaningful while running.
+    };
+
+    static ServerKey makeServerKey(const sockaddr_storage& server);
+
+    void startLocked();
+    void run();
+    // Returns the next job that can run now, or mJobs.end() after setting |*wakeup| to the next
+    // time a job becomes due (or time_point::max()). Must be called with mLock held.
+    std::map<JobKey, Job>::iterator nextJobLocked(std::chrono::steady_clock::time_point* wakeup);
+    void cancelLocked(std::map<JobKey, Job>::iterator it);
+
+    const Validator mValidator;
+    const ResultCallback mCallback;
+    const int mMaxConcurrent;
+    const Duration mInitialBackoff;
+    const Duration mMaxBackoff;
+
+    std::mutex mLock;
+    std::condition_variable mCv;
+    std::map<JobKey, Job> mJobs;          // guarded by mLock
+    std::set<ServerKey> mRunningServers;  // guarded by mLock
+    bool mStopping = false;               // guarded by mLock
+    std::vector<std::thread> mThreads;    // guarded by mLock
+};
+
+}  // namespace net
+}  // namespace android
+
+#endif  // _DNS_DNSTLSVALIDATIONSCHEDULER_H
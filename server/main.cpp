@@ -29,7 +29,6 @@
 #define LOG_TAG "Netd"
 
 #include "cutils/log.h"
-#include "utils/RWLock.h"
 
 #include <binder/IPCThreadState.h>
 #include <binder/IServiceManager.h>
@@ -68,8 +67,6 @@ const char* const PID_FILE_PATH = "/data/misc/net/netd_pid";
 const int PID_FILE_FLAGS = O_CREAT | O_TRUNC | O_WRONLY | O_NOFOLLOW | O_CLOEXEC;
 const mode_t PID_FILE_MODE = S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH;  // mode 0644, rw-r--r--
 
-android::RWLock android::net::gBigNetdLock;
-
 int main() {
     using android::net::gCtls;
     Stopwatch s;
@@ -120,7 +117,8 @@ int main() {
     // Set local DNS mode, to prevent bionic from proxying
     // back to this service, recursively.
     setenv("ANDROID_DNS_MODE", "local", 1);
-    DnsProxyListener dpl(&gCtls->netCtrl, &gCtls->eventReporter);
+    DnsProxyListener dpl(&gCtls->netCtrl, &gCtls->eventReporter, &gCtls->dnsWorkerPool,
+                         &gCtls->resolverCtrl.getDnsCache());
     if (dpl.startListener()) {
         ALOGE("Unable to start DnsProxyListener (%s)", strerror(errno));
         exit(1);
@@ -24,7 +24,7 @@ LOCAL_CFLAGS := -Wall -Werror -Wunused-parameter
 LOCAL_CFLAGS += -Wno-varargs
 
 EXTRA_LDLIBS := -lpthread
-LOCAL_SHARED_LIBRARIES += libbase libbinder liblog libnetd_client
+LOCAL_SHARED_LIBRARIES += libbase libbinder libcutils liblog libnetd_client
 LOCAL_STATIC_LIBRARIES += libnetd_test_dnsresponder libutils
 
 LOCAL_AIDL_INCLUDES := system/netd/server/binder
@@ -38,6 +38,14 @@ LOCAL_C_INCLUDES += system/netd/include \
 LOCAL_SRC_FILES := main.cpp \
                    connect_benchmark.cpp \
                    dns_benchmark.cpp \
+                   event_reporter_benchmark.cpp \
+                   mdns_benchmark.cpp \
+                   uid_range_benchmark.cpp \
+                   ../../server/DumpWriter.cpp \
+                   ../../server/EventReporter.cpp \
+                   ../../server/UidRangeIndex.cpp \
+                   ../../server/UidRanges.cpp \
+                   ../../server/binder/android/net/UidRange.cpp \
                    ../../server/binder/android/net/metrics/INetdEventListener.aidl
 
 LOCAL_MODULE_TAGS := eng tests
@@ -19,8 +19,8 @@
 /*
  * See README.md for general notes.
  *
- * This set of benchmarks measures the throughput of connect() calls on a single thread for IPv4 and
- * IPv6 under the following scenarios:
+ * This set of benchmarks measures the throughput of connect() calls on a single thread (or, for the
+ * *_contended tests, on many threads) for IPv4 and IPv6 under the following scenarios:
  *
  *  - FWmark disabled (::ANDROID_NO_USE_FWMARK_CLIENT).
  *
@@ -40,8 +40,10 @@
  *      The default mode starting from 7.1.2. As well as the normal connect() reporting, extra
  *      fields are filled in to log the IP and port of the connection.
  *
- *      A second synchronous message is sent to fwmarkserver after the connection completes, to
- *      record latency. This message is forwarded to the system server over a oneway binder call.
+ *      A second message is sent to fwmarkserver after the connection completes, to record
+ *      latency. This message is forwarded to the system server over a oneway binder call. The
+ *      client does not wait for fwmarkserver to process it, so connect() only waits for the
+ *      round trip of the first message.
  *
  * Realtime timed tests
  * ====================
@@ -53,6 +55,12 @@
  *   - iterations: the number of times the test was run within the timelimit --- approximately
  *                 MinTime / real_time
  *
+ * The tests named *_contended do the same from many threads at once, so that netd queues connect
+ * events as fast as it can while its reporter thread delivers them to the listener. Compared to
+ * the *_high_load tests, they show whether queueing events adds contention inside netd. They do
+ * not exercise fetching the listener: only the reporter thread does that, and only once while the
+ * listener is alive.
+ *
  * Manually timed tests
  * ====================
  *
@@ -285,6 +293,7 @@ static void run_at_reporting_level(decltype(ipv4_loopback) benchmarkFunction,
 
 constexpr int MIN_THREADS = 1;
 constexpr int MAX_THREADS = 1;
+constexpr int CONTENDED_THREADS = 8;
 constexpr double MIN_TIME = 0.5 /* seconds */;
 
 static void ipv4_metrics_reporting_no_fwmark(::benchmark::State& state) {
@@ -317,6 +326,12 @@ static void ipv4_full_reporting_high_load(::benchmark::State& state) {
 BENCHMARK(ipv4_full_reporting_high_load)
     ->ThreadRange(MIN_THREADS, MAX_THREADS)->MinTime(MIN_TIME)->UseRealTime();
 
+static void ipv4_full_reporting_contended(::benchmark::State& state) {
+    run_at_reporting_level(ipv4_loopback, state, INetdEventListener::REPORTING_LEVEL_FULL, false);
+}
+BENCHMARK(ipv4_full_reporting_contended)
+    ->Threads(CONTENDED_THREADS)->MinTime(MIN_TIME)->UseRealTime();
+
 // IPv6 raw connect() without using fwmark
 static void ipv6_metrics_reporting_no_fwmark(::benchmark::State& state) {
     run_at_reporting_level(ipv6_loopback, state, INetdEventListener::REPORTING_LEVEL_NONE, true);
@@ -347,3 +362,9 @@ static void ipv6_full_reporting_high_load(::benchmark::State& state) {
 }
 BENCHMARK(ipv6_full_reporting_high_load)
     ->ThreadRange(MIN_THREADS, MAX_THREADS)->MinTime(MIN_TIME)->UseRealTime();
+
+static void ipv6_full_reporting_contended(::benchmark::State& state) {
+    run_at_reporting_level(ipv6_loopback, state, INetdEventListener::REPORTING_LEVEL_FULL, false);
+}
+BENCHMARK(ipv6_full_reporting_contended)
+    ->Threads(CONTENDED_THREADS)->MinTime(MIN_TIME)->UseRealTime();
@@ -47,6 +47,14 @@
  *      DNS Logging, in full HD, includes extra non-metrics fields such as hostname, a truncated
  *      list of resolved addresses, total resolved address count, and originating UID.
  *
+ * A further set of tests, getaddrinfo_burst, fires lookups from many more client threads than
+ * netd has DNS worker threads, to mimic an app startup storm. These are manually timed: each
+ * iteration is one successful lookup, real_time is their mean latency and the label holds the
+ * 90th-percentile latency over all threads in microseconds, together with the number of lookups
+ * that netd refused because its DNS worker queue was full. Refused lookups are retried, and are
+ * not part of real_time. Comparing these against a build that spawns a thread per lookup shows
+ * the cost of thread creation under load.
+ *
  * Useful measurements
  * ===================
  *
@@ -57,6 +65,8 @@
  *  - iterations: total number of runs finished within the time limit. Higher is better. This is
  *                roughly proportional to MinTime * nThreads / real_time.
  *
+ *  - label: (getaddrinfo_burst only) 90th-percentile lookup latency and rejected lookup count.
+ *
  */
 
 #include <netdb.h>
@@ -64,6 +74,11 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
 #include <android-base/stringprintf.h>
 #include <benchmark/benchmark.h>
 #include <utils/String16.h>
@@ -71,6 +86,7 @@
 
 #include "dns_responder_client.h"
 #include "NetdClient.h"
+#include "Stopwatch.h"
 #include "android/net/metrics/INetdEventListener.h"
 
 using android::base::StringPrintf;
@@ -79,6 +95,12 @@ using android::net::metrics::INetdEventListener;
 constexpr int MIN_THREADS = 1;
 constexpr int MAX_THREADS = 32;
 
+// More client threads than netd has DNS worker threads (DnsWorkerPool::kDefaultNumThreads).
+constexpr int MIN_BURST_THREADS = 64;
+constexpr int MAX_BURST_THREADS = 256;
+// Consecutive rejected lookups after which a burst thread gives up.
+constexpr int MAX_BURST_ATTEMPTS = 1000;
+
 class DnsFixture : public ::benchmark::Fixture {
 protected:
     static constexpr unsigned num_hosts = 1000;
@@ -134,6 +156,57 @@ public:
         }
     }
 
+    void getaddrinfo_burst_until_done(benchmark::State &state) {
+        // Shared by all the threads of a run, so that the percentile covers every lookup.
+        static std::mutex latenciesLock;
+        static std::vector<uint64_t> latencies;
+        static std::atomic<uint64_t> rejected;
+        static std::atomic<int> finishedThreads;
+        if (state.thread_index == 0) {
+            latencies.clear();
+            rejected = 0;
+            finishedThreads = 0;
+        }
+        while (state.KeepRunning()) {
+            // Each iteration is one successful lookup. Lookups refused by an overloaded netd are
+            // expected under this much load; count them and retry, rather than aborting the run or
+            // letting them drag down real_time.
+            bool succeeded = false;
+            uint64_t latencyUs = 0;
+            for (int attempt = 0; attempt < MAX_BURST_ATTEMPTS; attempt++) {
+                const uint32_t ofs = arc4random_uniform(getMappings().size());
+                const auto& mapping = getMappings()[ofs];
+                addrinfo* result = nullptr;
+                const Stopwatch stopwatch;
+                const int rv = getaddrinfo(mapping.host.c_str(), nullptr, nullptr, &result);
+                if (rv == 0) {
+                    latencyUs = stopwatch.timeTaken() * 1e3L;
+                    succeeded = true;
+                    freeaddrinfo(result);
+                    break;
+                }
+                rejected++;
+            }
+            if (!succeeded) {
+                state.SkipWithError("getaddrinfo kept failing");
+                break;
+            }
+            state.SetIterationTime(latencyUs / 1e6L);
+            std::lock_guard<std::mutex> guard(latenciesLock);
+            latencies.push_back(latencyUs);
+        }
+        // The last thread to finish reports on the whole run.
+        if (++finishedThreads == state.threads) {
+            std::lock_guard<std::mutex> guard(latenciesLock);
+            if (!latencies.empty()) {
+                std::sort(latencies.begin(), latencies.end());
+                state.SetLabel(StringPrintf("p90=%lluus rejected=%llu",
+                        (unsigned long long) latencies[latencies.size() * 9 / 10],
+                        (unsigned long long) rejected.load()));
+            }
+        }
+    }
+
     void benchmark_at_reporting_level(benchmark::State &state, int metricsLevel) {
         const bool isMaster = (state.thread_index == 0);
         int oldMetricsLevel;
@@ -192,3 +265,27 @@ BENCHMARK_DEFINE_F(DnsFixture, getaddrinfo_log_everything)(benchmark::State& sta
 BENCHMARK_REGISTER_F(DnsFixture, getaddrinfo_log_everything)
     ->ThreadRange(MIN_THREADS, MAX_THREADS)
     ->UseRealTime();
+
+// Lookups from many concurrent clients with reporting off, to isolate netd's request dispatch cost.
+BENCHMARK_DEFINE_F(DnsFixture, getaddrinfo_burst)(benchmark::State& state) {
+    const bool isMaster = (state.thread_index == 0);
+    int oldMetricsLevel;
+    if (isMaster) {
+        auto rv = getNetd()->getMetricsReportingLevel(&oldMetricsLevel);
+        if (!rv.isOk()) {
+            state.SkipWithError(StringPrintf("Failed saving metrics reporting level: %s",
+                    rv.toString8().string()).c_str());
+            return;
+        }
+        getNetd()->setMetricsReportingLevel(INetdEventListener::REPORTING_LEVEL_NONE);
+    }
+
+    getaddrinfo_burst_until_done(state);
+
+    if (isMaster) {
+        getNetd()->setMetricsReportingLevel(oldMetricsLevel);
+    }
+}
+BENCHMARK_REGISTER_F(DnsFixture, getaddrinfo_burst)
+    ->ThreadRange(MIN_BURST_THREADS, MAX_BURST_THREADS)
+    ->UseManualTime();
@@ -0,0 +1,173 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "event_reporter_benchmark"
+
+/*
+ * See README.md for general notes.
+ *
+ * This set of benchmarks measures how long it takes to get the netd event listener, which every
+ * DNS lookup and every connect() does to report its event. Like uid_range_benchmark, these run
+ * in-process against the server code, with a fake listener, and do not need netd to be running.
+ * Each one runs on between 1 and 32 threads at once.
+ *
+ *  - event_listener_mutex
+ *
+ *      The control case. Copies the listener reference under a mutex, as EventReporter did before
+ *      it published the listener with a SnapshotPublisher.
+ *
+ *  - event_listener_get
+ *
+ *      Calls EventReporter::getNetdEventListener().
+ *
+ *  - event_listener_get_while_replacing
+ *
+ *      The same, while another thread replaces the listener every millisecond, as happens when the
+ *      system server restarts.
+ *
+ * Useful measurements
+ * ===================
+ *
+ *  - real_time: the average time taken to get the listener, on each thread. Since no thread ever
+ *               waits for another, this should stay flat as threads are added, until there are
+ *               more threads than CPUs.
+ *
+ */
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "EventReporter.h"
+#include "android/net/metrics/BnNetdEventListener.h"
+
+using android::sp;
+using android::String16;
+using android::binder::Status;
+using android::net::metrics::BnNetdEventListener;
+using android::net::metrics::INetdEventListener;
+
+namespace {
+
+constexpr int kMinThreads = 1;
+constexpr int kMaxThreads = 32;
+
+// Drops every event.
+class NullNetdEventListener : public BnNetdEventListener {
+public:
+    Status onDnsEvent(int32_t, int32_t, int32_t, int32_t, const String16&,
+                      const std::vector<String16>&, int32_t, int32_t) override {
+        return Status::ok();
+    }
+
+    Status onConnectEvent(int32_t, int32_t, int32_t, const String16&, int32_t,
+                          int32_t) override {
+        return Status::ok();
+    }
+
+    Status onWakeupEvent(const String16&, int32_t, int32_t, int64_t) override {
+        return Status::ok();
+    }
+
+    Status onDnsEvents(const std::vector<int32_t>&, const std::vector<int32_t>&,
+                       const std::vector<int32_t>&, const std::vector<int32_t>&,
+                       const std::vector<String16>&, const std::vector<String16>&,
+                       const std::vector<int32_t>&, const std::vector<int32_t>&,
+                       const std::vector<int32_t>&) override {
+        return Status::ok();
+    }
+
+    Status onConnectEvents(const std::vector<int32_t>&, const std::vector<int32_t>&,
+                           const std::vector<int32_t>&, const std::vector<String16>&,
+                           const std::vector<int32_t>&, const std::vector<int32_t>&) override {
+        return Status::ok();
+    }
+};
+
+// Set up by the first thread of each run, and shared by all of its threads.
+EventReporter* sReporter;
+std::thread sReplacer;
+std::atomic<bool> sStopReplacing;
+
+std::mutex sListenerLock;
+sp<INetdEventListener> sListener;
+
+}  // namespace
+
+static void event_listener_mutex(benchmark::State& state) {
+    if (state.thread_index == 0) {
+        sListener = new NullNetdEventListener();
+    }
+    while (state.KeepRunning()) {
+        sp<INetdEventListener> listener;
+        {
+            std::lock_guard<std::mutex> guard(sListenerLock);
+            listener = sListener;
+        }
+        benchmark::DoNotOptimize(listener.get());
+    }
+    if (state.thread_index == 0) {
+        sListener.clear();
+    }
+}
+BENCHMARK(event_listener_mutex)->ThreadRange(kMinThreads, kMaxThreads)->UseRealTime();
+
+static void event_listener_get(benchmark::State& state) {
+    if (state.thread_index == 0) {
+        sReporter = new EventReporter();
+        sReporter->setNetdEventListener(new NullNetdEventListener());
+    }
+    while (state.KeepRunning()) {
+        benchmark::DoNotOptimize(sReporter->getNetdEventListener().get());
+    }
+    if (state.thread_index == 0) {
+        delete sReporter;
+        sReporter = nullptr;
+    }
+}
+BENCHMARK(event_listener_get)->ThreadRange(kMinThreads, kMaxThreads)->UseRealTime();
+
+static void event_listener_get_while_replacing(benchmark::State& state) {
+    if (state.thread_index == 0) {
+        sReporter = new EventReporter();
+        sReporter->setNetdEventListener(new NullNetdEventListener());
+        sStopReplacing = false;
+        sReplacer = std::thread([] {
+            const sp<INetdEventListener> listeners[] = {
+                new NullNetdEventListener(), new NullNetdEventListener(),
+            };
+            for (int i = 0; !sStopReplacing; i++) {
+                sReporter->setNetdEventListener(listeners[i % 2]);
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        });
+    }
+    while (state.KeepRunning()) {
+        benchmark::DoNotOptimize(sReporter->getNetdEventListener().get());
+    }
+    if (state.thread_index == 0) {
+        sStopReplacing = true;
+        sReplacer.join();
+        delete sReporter;
+        sReporter = nullptr;
+    }
+}
+BENCHMARK(event_listener_get_while_replacing)->ThreadRange(kMinThreads, kMaxThreads)
+    ->UseRealTime();
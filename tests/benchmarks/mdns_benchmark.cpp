@@ -0,0 +1,189 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "mdns_benchmark"
+
+/*
+ * See README.md for general notes.
+ *
+ * This set of benchmarks measures how long netd's mdnssd command takes to start and stop service
+ * discoveries when many are outstanding, as happens when apps discover aggressively. They talk to
+ * the running netd over its mdns socket, and start mdnsd if it is not already running.
+ *
+ *  - mdns_discover_teardown
+ *
+ *      Starts between 64 and 4096 discoveries, then stops them all in the order they were started.
+ *
+ *  - mdns_discover_churn
+ *
+ *      Starts between 64 and 4096 discoveries and keeps them running while it starts and stops one
+ *      more, over and over. Before the monitor kept its refs in a hash table, each of these cost
+ *      time proportional to the number of discoveries already running.
+ *
+ * Useful measurements
+ * ===================
+ *
+ *  - real_time: the time taken by one iteration: all the discoveries for mdns_discover_teardown,
+ *               a single one for mdns_discover_churn.
+ *
+ *  - items_per_second: discover and stop-discover commands answered per second.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <string>
+
+#include <android-base/stringprintf.h>
+#include <benchmark/benchmark.h>
+#include <cutils/sockets.h>
+
+#include "ResponseCode.h"
+
+using android::base::StringPrintf;
+
+namespace {
+
+constexpr const char* kMdnsSocket = "mdns";
+constexpr const char* kServiceType = "_netdbenchmark._tcp";
+// Far above the request ids handed out by NsdService, which share the same table in netd.
+constexpr int kFirstRequestId = 0x40000000;
+constexpr int kMinDiscoveries = 64;
+constexpr int kMaxDiscoveries = 4096;
+// Unsolicited broadcasts, such as discovery results, carry 6xx codes and no command number.
+constexpr int kFirstBroadcastCode = 600;
+
+// A connection to netd's mdns socket. Commands are numbered, so that their replies can be told
+// apart from the discovery results netd broadcasts on the same connection.
+class MdnsClient {
+public:
+    MdnsClient() : mSock(socket_local_client(kMdnsSocket, ANDROID_SOCKET_NAMESPACE_RESERVED,
+                                             SOCK_STREAM)) {}
+    ~MdnsClient() { if (mSock >= 0) close(mSock); }
+
+    bool connected() const { return mSock >= 0; }
+
+    // Sends |command| and returns the response code of its reply, or -1 on error.
+    int command(const std::string& command) {
+        const int cmdNum = mNextCmdNum++;
+        // FrameworkListener expects the whole command, including its terminator, in one read.
+        const std::string request = StringPrintf("%d mdnssd %s", cmdNum, command.c_str());
+        if (write(mSock, request.c_str(), request.size() + 1) < 0) return -1;
+
+        std::string reply;
+        while (readMessage(&reply)) {
+            char* end;
+            const int code = strtol(reply.c_str(), &end, 10);
+            if (code >= kFirstBroadcastCode) continue;
+            if (strtol(end, nullptr, 10) == cmdNum) return code;
+        }
+        return -1;
+    }
+
+private:
+    // Reads the next NUL-terminated message from the socket into |message|.
+    bool readMessage(std::string* message) {
+        size_t end;
+        while ((end = mBuffer.find('\0')) == std::string::npos) {
+            char buf[4096];
+            const ssize_t bytes = read(mSock, buf, sizeof(buf));
+            if (bytes <= 0) return false;
+            mBuffer.append(buf, bytes);
+        }
+        message->assign(mBuffer, 0, end);
+        mBuffer.erase(0, end + 1);
+        return true;
+    }
+
+    const int mSock;
+    int mNextCmdNum = 1;
+    std::string mBuffer;
+};
+
+bool startDiscovery(MdnsClient* client, int id) {
+    return client->command(StringPrintf("discover %d %s", id, kServiceType)) ==
+            ResponseCode::CommandOkay;
+}
+
+bool stopDiscovery(MdnsClient* client, int id) {
+    return client->command(StringPrintf("stop-discover %d", id)) == ResponseCode::CommandOkay;
+}
+
+// Starts mdnsd unless it is already running. Either way the reply is not an error.
+bool startService(MdnsClient* client) {
+    const int code = client->command("start-service");
+    return code == ResponseCode::CommandOkay || code == ResponseCode::ServiceStartFailed;
+}
+
+}  // namespace
+
+static void mdns_discover_teardown(benchmark::State& state) {
+    const int numDiscoveries = state.range(0);
+    MdnsClient client;
+    if (!client.connected() || !startService(&client)) {
+        state.SkipWithError("Could not connect to netd or start mdnsd");
+        return;
+    }
+
+    while (state.KeepRunning()) {
+        for (int i = 0; i < numDiscoveries; i++) {
+            if (!startDiscovery(&client, kFirstRequestId + i)) {
+                state.SkipWithError("discover failed");
+                break;
+            }
+        }
+        for (int i = 0; i < numDiscoveries; i++) {
+            if (!stopDiscovery(&client, kFirstRequestId + i)) {
+                state.SkipWithError("stop-discover failed");
+                break;
+            }
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * numDiscoveries * 2);
+    client.command("stop-service");
+}
+BENCHMARK(mdns_discover_teardown)->Range(kMinDiscoveries, kMaxDiscoveries)->UseRealTime();
+
+static void mdns_discover_churn(benchmark::State& state) {
+    const int numDiscoveries = state.range(0);
+    MdnsClient client;
+    if (!client.connected() || !startService(&client)) {
+        state.SkipWithError("Could not connect to netd or start mdnsd");
+        return;
+    }
+
+    for (int i = 0; i < numDiscoveries; i++) {
+        if (!startDiscovery(&client, kFirstRequestId + i)) {
+            state.SkipWithError("discover failed");
+            break;
+        }
+    }
+    const int churnId = kFirstRequestId + numDiscoveries;
+    while (state.KeepRunning()) {
+        if (!startDiscovery(&client, churnId) || !stopDiscovery(&client, churnId)) {
+            state.SkipWithError("discover or stop-discover failed");
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * 2);
+
+    for (int i = 0; i < numDiscoveries; i++) {
+        stopDiscovery(&client, kFirstRequestId + i);
+    }
+    client.command("stop-service");
+}
+BENCHMARK(mdns_discover_churn)->Range(kMinDiscoveries, kMaxDiscoveries)->UseRealTime();
@@ -0,0 +1,144 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "uid_range_benchmark"
+
+/*
+ * See README.md for general notes.
+ *
+ * This set of benchmarks measures how long it takes netd to find the VPN that applies to a UID,
+ * which it does for every DNS lookup and every connect(). Unlike the other benchmarks here, these
+ * run in-process against the server code and do not need netd to be running.
+ *
+ * Each benchmark sets up kNumVpns VPNs that together hold between 64 and 8192 UID ranges, spread
+ * over the application UID space of many users.
+ *
+ *  - uid_range_linear_lookup
+ *
+ *      The control case. Asks each VPN in netId order whether its UidRanges contain the UID, as
+ *      NetworkController did before UidRangeIndex.
+ *
+ *  - uid_range_index_lookup
+ *
+ *      Looks the UID up in a UidRangeIndex holding the ranges of all the VPNs.
+ *
+ *  - uid_range_index_update
+ *
+ *      Adds a range to, and then removes it from, one VPN in a UidRangeIndex, as happens when an
+ *      app is installed or removed while the VPN is up.
+ *
+ * Useful measurements
+ * ===================
+ *
+ *  - real_time: the average time taken to look up (or add and remove) a single UID range.
+ *
+ *  - label: the number of segments in the index once all the ranges have been added.
+ *
+ */
+
+#include <stdlib.h>
+
+#include <vector>
+
+#include <android-base/stringprintf.h>
+#include <benchmark/benchmark.h>
+
+#include "UidRangeIndex.h"
+#include "UidRanges.h"
+
+using android::base::StringPrintf;
+using android::net::UidRange;
+using android::net::UidRangeIndex;
+using android::net::UidRanges;
+
+namespace {
+
+constexpr unsigned kNumVpns = 4;
+constexpr unsigned kFirstVpnNetId = 100;
+constexpr int32_t kPerUserRange = 100000;
+constexpr int kMinRanges = 64;
+constexpr int kMaxRanges = 8192;
+
+// Gives each VPN |numRanges| / kNumVpns ranges, 100 per user, taking turns. Most ranges hold 50
+// UIDs and leave a gap before the next one, but every seventh overlaps the next two.
+std::vector<UidRanges> makeVpnRanges(int numRanges) {
+    std::vector<std::vector<UidRange>> ranges(kNumVpns);
+    for (int i = 0; i < numRanges; i++) {
+        const int32_t start = (i / 100) * kPerUserRange + 10000 + (i % 100) * 100;
+        const int32_t length = (i % 7 == 0) ? 250 : 50;
+        ranges[i % kNumVpns].push_back(UidRange(start, start + length - 1));
+    }
+    std::vector<UidRanges> vpnRanges;
+    for (const auto& vpn : ranges) {
+        vpnRanges.push_back(UidRanges(vpn));
+    }
+    return vpnRanges;
+}
+
+uid_t randomUid(unsigned* seed, int numRanges) {
+    const int32_t users = numRanges / 100 + 1;
+    return (rand_r(seed) % users) * kPerUserRange + 10000 + rand_r(seed) % 10000;
+}
+
+}  // namespace
+
+static void uid_range_linear_lookup(benchmark::State& state) {
+    const std::vector<UidRanges> vpnRanges = makeVpnRanges(state.range(0));
+    unsigned seed = 1;
+    while (state.KeepRunning()) {
+        const uid_t uid = randomUid(&seed, state.range(0));
+        unsigned netId = 0;
+        for (unsigned i = 0; i < kNumVpns; i++) {
+            if (vpnRanges[i].hasUid(uid)) {
+                netId = kFirstVpnNetId + i;
+                break;
+            }
+        }
+        benchmark::DoNotOptimize(netId);
+    }
+}
+BENCHMARK(uid_range_linear_lookup)->Range(kMinRanges, kMaxRanges);
+
+static void uid_range_index_lookup(benchmark::State& state) {
+    const std::vector<UidRanges> vpnRanges = makeVpnRanges(state.range(0));
+    UidRangeIndex index;
+    for (unsigned i = 0; i < kNumVpns; i++) {
+        index.addRanges(kFirstVpnNetId + i, vpnRanges[i]);
+    }
+    unsigned seed = 1;
+    while (state.KeepRunning()) {
+        benchmark::DoNotOptimize(index.getNetId(randomUid(&seed, state.range(0))));
+    }
+    state.SetLabel(StringPrintf("%zu", index.getSegmentCount()));
+}
+BENCHMARK(uid_range_index_lookup)->Range(kMinRanges, kMaxRanges);
+
+static void uid_range_index_update(benchmark::State& state) {
+    const std::vector<UidRanges> vpnRanges = makeVpnRanges(state.range(0));
+    UidRangeIndex index;
+    for (unsigned i = 0; i < kNumVpns; i++) {
+        index.addRanges(kFirstVpnNetId + i, vpnRanges[i]);
+    }
+    unsigned seed = 1;
+    while (state.KeepRunning()) {
+        const int32_t start = randomUid(&seed, state.range(0));
+        const UidRanges app({UidRange(start, start)});
+        index.addRanges(kFirstVpnNetId, app);
+        index.removeRanges(kFirstVpnNetId, app);
+    }
+    state.SetLabel(StringPrintf("%zu", index.getSegmentCount()));
+}
+BENCHMARK(uid_range_index_update)->Range(kMinRanges, kMaxRanges);
@@ -16,6 +16,7 @@
  * binder_test.cpp - unit tests for netd binder RPCs.
  */
 
+#include <algorithm>
 #include <cerrno>
 #include <cinttypes>
 #include <cstdint>
@@ -201,6 +202,63 @@ TEST_F(BinderTest, TestFirewallReplaceUidChain) {
     EXPECT_EQ(false, ret);
 }
 
+static bool iptablesChainHasUid(const char *binary, const char *chainName, int32_t uid) {
+    const std::string match = StringPrintf("owner UID match %d ", uid);
+    for (const auto& line : listIptablesRule(binary, chainName)) {
+        if (line.find(match) != std::string::npos) return true;
+    }
+    return false;
+}
+
+TEST_F(BinderTest, TestFirewallSetUidRules) {
+    const int kNumUids = 100;
+    std::vector<int32_t> chains(kNumUids, INetd::FIREWALL_CHAIN_STANDBY);
+    std::vector<int32_t> uids(kNumUids);
+    std::vector<int32_t> rules(kNumUids, INetd::FIREWALL_RULE_DENY);
+    for (int i = 0; i < kNumUids; i++) {
+        uids[i] = randomUid();
+    }
+
+    binder::Status status = mNetd->firewallSetUidRules({}, {}, {});
+    EXPECT_TRUE(status.isOk()) << status.exceptionMessage();
+
+    status = mNetd->firewallSetUidRules(chains, uids, {});
+    EXPECT_FALSE(status.isOk());
+    EXPECT_EQ(EINVAL, status.serviceSpecificErrorCode());
+
+    status = mNetd->firewallSetUidRules({ 42 }, { uids[0] }, { INetd::FIREWALL_RULE_DENY });
+    EXPECT_FALSE(status.isOk());
+    EXPECT_EQ(EINVAL, status.serviceSpecificErrorCode());
+
+    {
+        TimedOperation op(StringPrintf("Denying %d UIDs in the standby chain", kNumUids));
+        status = mNetd->firewallSetUidRules(chains, uids, rules);
+    }
+    EXPECT_TRUE(status.isOk()) << status.exceptionMessage();
+    EXPECT_TRUE(iptablesChainHasUid(IPTABLES_PATH, "fw_standby", uids[0]));
+    EXPECT_TRUE(iptablesChainHasUid(IP6TABLES_PATH, "fw_standby", uids[kNumUids - 1]));
+
+    // Allowing a UID that is not denied fails, and leaves the other rules in the batch unapplied.
+    const int32_t notDenied = randomUid();
+    status = mNetd->firewallSetUidRules(
+            { INetd::FIREWALL_CHAIN_STANDBY, INetd::FIREWALL_CHAIN_STANDBY },
+            { uids[0], notDenied },
+            { INetd::FIREWALL_RULE_ALLOW, INetd::FIREWALL_RULE_ALLOW });
+    EXPECT_FALSE(status.isOk());
+    EXPECT_EQ(EREMOTEIO, status.serviceSpecificErrorCode());
+    EXPECT_TRUE(iptablesChainHasUid(IPTABLES_PATH, "fw_standby", uids[0]));
+    EXPECT_TRUE(iptablesChainHasUid(IP6TABLES_PATH, "fw_standby", uids[0]));
+
+    std::fill(rules.begin(), rules.end(), INetd::FIREWALL_RULE_ALLOW);
+    {
+        TimedOperation op(StringPrintf("Allowing %d UIDs in the standby chain", kNumUids));
+        status = mNetd->firewallSetUidRules(chains, uids, rules);
+    }
+    EXPECT_TRUE(status.isOk()) << status.exceptionMessage();
+    EXPECT_FALSE(iptablesChainHasUid(IPTABLES_PATH, "fw_standby", uids[0]));
+    EXPECT_FALSE(iptablesChainHasUid(IP6TABLES_PATH, "fw_standby", uids[kNumUids - 1]));
+}
+
 static int bandwidthDataSaverEnabled(const char *binary) {
     std::vector<std::string> lines = listIptablesRule(binary, "bw_data_saver");
 
@@ -261,6 +319,60 @@ TEST_F(BinderTest, TestBandwidthEnableDataSaver) {
     }
 }
 
+TEST_F(BinderTest, TestTetherGetStats) {
+    std::vector<std::string> ifacePairs;
+    std::vector<int64_t> stats;
+    binder::Status status = mNetd->tetherGetStats(&ifacePairs, &stats);
+    ASSERT_TRUE(status.isOk()) << status.exceptionMessage();
+
+    // Each interface pair has a full set of stats, none of which are missing.
+    ASSERT_EQ(0U, ifacePairs.size() % 2);
+    EXPECT_EQ(ifacePairs.size() / 2 * INetd::TETHER_STATS_ARRAY_SIZE, stats.size());
+    for (int64_t stat : stats) {
+        EXPECT_LE(0, stat);
+    }
+}
+
+static int64_t iptablesRestoreCommands(const sp<INetd>& netd, const std::string& caller) {
+    std::vector<std::string> callers;
+    std::vector<int64_t> stats, processStats;
+    binder::Status status = netd->iptablesRestoreGetStats(&callers, &stats, &processStats);
+    EXPECT_TRUE(status.isOk()) << status.exceptionMessage();
+    EXPECT_EQ(callers.size() * INetd::IPTABLES_RESTORE_STATS_ARRAY_SIZE, stats.size());
+    EXPECT_EQ(2U * INetd::IPTABLES_RESTORE_PROCESS_STATS_ARRAY_SIZE, processStats.size());
+
+    int64_t commands = 0;
+    for (size_t i = 0; i < callers.size(); i++) {
+        const int64_t* row = &stats[i * INetd::IPTABLES_RESTORE_STATS_ARRAY_SIZE];
+        int64_t histogramTotal = 0;
+        for (int j = 0; j < INetd::IPTABLES_RESTORE_STATS_LATENCY_BUCKETS; j++) {
+            histogramTotal += row[INetd::IPTABLES_RESTORE_STATS_LATENCY_HISTOGRAM + j];
+        }
+        EXPECT_EQ(row[INetd::IPTABLES_RESTORE_STATS_COMMANDS], histogramTotal);
+        EXPECT_LE(row[INetd::IPTABLES_RESTORE_STATS_FAILURES],
+                  row[INetd::IPTABLES_RESTORE_STATS_COMMANDS]);
+        if (callers[i] == caller) {
+            commands += row[INetd::IPTABLES_RESTORE_STATS_COMMANDS];
+        }
+    }
+    return commands;
+}
+
+TEST_F(BinderTest, TestIptablesRestoreGetStats) {
+    const int64_t before = iptablesRestoreCommands(mNetd, "fw");
+
+    // Each batch is one command per IP version.
+    const int32_t uid = randomUid();
+    for (int32_t rule : { INetd::FIREWALL_RULE_DENY, INetd::FIREWALL_RULE_ALLOW }) {
+        binder::Status status = mNetd->firewallSetUidRules(
+                { INetd::FIREWALL_CHAIN_STANDBY }, { uid }, { rule });
+        EXPECT_TRUE(status.isOk()) << status.exceptionMessage();
+    }
+
+    // The framework may be changing firewall rules at the same time.
+    EXPECT_LE(before + 4, iptablesRestoreCommands(mNetd, "fw"));
+}
+
 static bool ipRuleExistsForRange(const uint32_t priority, const UidRange& range,
         const std::string& action, const char* ipVersion) {
     // Output looks like this:
@@ -415,6 +527,60 @@ TEST_F(BinderTest, TestSocketDestroy) {
     close(acceptedSocket);
 }
 
+TEST_F(BinderTest, TestSocketGetStats) {
+    int clientSocket, serverSocket, acceptedSocket;
+    ASSERT_NO_FATAL_FAILURE(fakeRemoteSocketPair(&clientSocket, &serverSocket, &acceptedSocket));
+
+    constexpr int baseUid = AID_APP - 2000;
+    int uid = baseUid + 500 + arc4random_uniform(1000);
+    EXPECT_EQ(0, fchown(clientSocket, uid, -1));
+    checkSocketpairOpen(clientSocket, acceptedSocket);
+
+    std::vector<int64_t> stats;
+    binder::Status status = mNetd->socketGetStats(&stats);
+    ASSERT_TRUE(status.isOk()) << status.exceptionMessage();
+    ASSERT_EQ(0U, stats.size() % INetd::SOCKET_STATS_ARRAY_SIZE);
+
+    int64_t established = 0;
+    for (size_t i = 0; i < stats.size(); i += INetd::SOCKET_STATS_ARRAY_SIZE) {
+        const int64_t* row = &stats[i];
+        for (int j = 0; j < INetd::SOCKET_STATS_ARRAY_SIZE; j++) {
+            EXPECT_LE(0, row[j]);
+        }
+        EXPECT_LE(row[INetd::SOCKET_STATS_MEAN_RTT_US], row[INetd::SOCKET_STATS_MAX_RTT_US]);
+        if (row[INetd::SOCKET_STATS_UID] == uid) {
+            established += row[INetd::SOCKET_STATS_ESTABLISHED];
+        }
+    }
+    EXPECT_EQ(1, established);
+
+    close(clientSocket);
+    close(serverSocket);
+    close(acceptedSocket);
+}
+
+TEST_F(BinderTest, TestWakeupGetStats) {
+    std::vector<std::string> prefixes;
+    std::vector<int64_t> stats;
+    binder::Status status = mNetd->wakeupGetStats(0, &prefixes, &stats);
+    ASSERT_TRUE(status.isOk()) << status.exceptionMessage();
+    ASSERT_EQ(prefixes.size() * INetd::WAKEUP_STATS_ARRAY_SIZE, stats.size());
+
+    for (size_t i = 0; i < stats.size(); i += INetd::WAKEUP_STATS_ARRAY_SIZE) {
+        const int64_t* row = &stats[i];
+        EXPECT_LT(0, row[INetd::WAKEUP_STATS_COUNT]);
+        EXPECT_LE(0, row[INetd::WAKEUP_STATS_PORT]);
+        EXPECT_GT(65536, row[INetd::WAKEUP_STATS_PORT]);
+    }
+
+    // Only buckets that end after sinceNs are returned.
+    const int64_t future = (static_cast<int64_t>(time(nullptr)) + 3600) * 1000000000LL;
+    status = mNetd->wakeupGetStats(future, &prefixes, &stats);
+    ASSERT_TRUE(status.isOk()) << status.exceptionMessage();
+    EXPECT_TRUE(prefixes.empty());
+    EXPECT_TRUE(stats.empty());
+}
+
 namespace {
 
 int netmaskToPrefixLength(const uint8_t *buf, size_t buflen) {
@@ -693,3 +859,9 @@ TEST_F(BinderTest, TestRemovePrivateDnsServer) {
         EXPECT_EQ(td.expectedReturnCode, status.serviceSpecificErrorCode());
     }
 }
+
+TEST_F(BinderTest, TestRevalidatePrivateDnsServers) {
+    // Revalidating a network with no private DNS servers is a no-op, and always succeeds.
+    EXPECT_TRUE(mNetd->revalidatePrivateDnsServers(0).isOk());
+    EXPECT_TRUE(mNetd->revalidatePrivateDnsServers(12345).isOk());
+}
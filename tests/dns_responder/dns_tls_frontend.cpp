@@ -23,6 +23,7 @@
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <arpa/inet.h>
+#include <algorithm>
 #include <openssl/err.h>
 #include <openssl/evp.h>
 #include <openssl/ssl.h>
@@ -279,61 +280,84 @@ void DnsTlsFrontend::requestHandler() {
         SSL_set_fd(ssl, client);
 
         ALOGD("Doing SSL handshake");
-        bool success = false;
+        int answered = 0;
         if (SSL_accept(ssl) <= 0) {
             ALOGI("SSL negotiation failure");
+        } else if (hang_on_queries_) {
+            ALOGD("SSL handshake complete, not answering");
+            hung_connections_.emplace_back(ssl, client);
+            continue;
         } else {
             ALOGD("SSL handshake complete");
-            success = handleOneRequest(ssl);
+            ++connections_;
+            const int limit = queries_per_connection_;
+            for (int done = 0; done < limit && !terminate_; ) {
+                const int count = std::min<int>(batch_size_, limit - done);
+                if (!handleRequests(ssl, count)) {
+                    break;
+                }
+                // The connection stays open, so count the queries answered before this batch.
+                queries_ += answered;
+                answered = count;
+                done += count;
+            }
         }
 
+        // Close cleanly, like a real server. Some TLS libraries refuse to resume sessions from
+        // connections that were not shut down.
+        SSL_shutdown(ssl);
         SSL_free(ssl);
         close(client);
 
-        if (success) {
-            // Increment queries_ as late as possible, because it represents
-            // a query that is fully processed, and the response returned to the
-            // client, including cleanup actions.
-            ++queries_;
-        }
+        // Increment queries_ as late as possible, because it represents
+        // a query that is fully processed, and the response returned to the
+        // client, including cleanup actions.
+        queries_ += answered;
     }
     ALOGD("Request handler terminating");
 }
 
-bool DnsTlsFrontend::handleOneRequest(SSL* ssl) {
-    uint8_t queryHeader[2];
-    if (SSL_read(ssl, &queryHeader, 2) != 2) {
-        ALOGI("Not enough header bytes");
-        return false;
-    }
-    const uint16_t qlen = (queryHeader[0] << 8) | queryHeader[1];
-    uint8_t query[qlen];
-    if (SSL_read(ssl, &query, qlen) != qlen) {
-        ALOGI("Not enough query bytes");
-        return false;
-    }
-    int sent = send(backend_socket_, query, qlen, 0);
-    if (sent != qlen) {
-        ALOGI("Failed to send query");
-        return false;
-    }
-    const int max_size = 4096;
-    uint8_t recv_buffer[max_size];
-    int rlen = recv(backend_socket_, recv_buffer, max_size, 0);
-    if (rlen <= 0) {
-        ALOGI("Failed to receive response");
-        return false;
-    }
-    uint8_t responseHeader[2];
-    responseHeader[0] = rlen >> 8;
-    responseHeader[1] = rlen;
-    if (SSL_write(ssl, responseHeader, 2) != 2) {
-        ALOGI("Failed to write response header");
-        return false;
-    }
-    if (SSL_write(ssl, recv_buffer, rlen) != rlen) {
-        ALOGI("Failed to write response body");
-        return false;
+bool DnsTlsFrontend::handleRequests(SSL* ssl, int count) {
+    std::vector<std::vector<uint8_t>> queries;
+    for (int i = 0; i < count; ++i) {
+        uint8_t queryHeader[2];
+        if (SSL_read(ssl, &queryHeader, 2) != 2) {
+            ALOGI("Not enough header bytes");
+            return false;
+        }
+        const uint16_t qlen = (queryHeader[0] << 8) | queryHeader[1];
+        std::vector<uint8_t> query(qlen);
+        if (SSL_read(ssl, query.data(), qlen) != qlen) {
+            ALOGI("Not enough query bytes");
+            return false;
+        }
+        queries.push_back(std::move(query));
+    }
+    for (auto query = queries.rbegin(); query != queries.rend(); ++query) {
+        const int qlen = query->size();
+        int sent = send(backend_socket_, query->data(), qlen, 0);
+        if (sent != qlen) {
+            ALOGI("Failed to send query");
+            return false;
+        }
+        const int max_size = 4096;
+        uint8_t recv_buffer[max_size];
+        int rlen = recv(backend_socket_, recv_buffer, max_size, 0);
+        if (rlen <= 0) {
+            ALOGI("Failed to receive response");
+            return false;
+        }
+        uint8_t responseHeader[2];
+        responseHeader[0] = rlen >> 8;
+        responseHeader[1] = rlen;
+        if (SSL_write(ssl, responseHeader, 2) != 2) {
+            ALOGI("Failed to write response header");
+            return false;
+        }
+        if (SSL_write(ssl, recv_buffer, rlen) != rlen) {
+            ALOGI("Failed to write response body");
+            return false;
+        }
     }
     return true;
 }
@@ -351,6 +375,11 @@ bool DnsTlsFrontend::stopServer() {
     ALOGI("stopping frontend");
     terminate_ = true;
     handler_thread_.join();
+    for (const auto& connection : hung_connections_) {
+        SSL_free(connection.first);
+        close(connection.second);
+    }
+    hung_connections_.clear();
     close(socket_);
     close(backend_socket_);
     terminate_ = false;
@@ -25,6 +25,7 @@
 #include <string>
 #include <thread>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
 #include <android-base/thread_annotations.h>
@@ -38,7 +39,7 @@ namespace test {
 
 /*
  * Simple DNS over TLS reverse proxy that forwards to a UDP backend.
- * Only handles a single request at a time.
+ * Only handles a single connection at a time.
  */
 class DnsTlsFrontend {
 public:
@@ -46,7 +47,7 @@ public:
             const std::string& backend_address, const std::string& backend_service) :
             listen_address_(listen_address), listen_service_(listen_service),
             backend_address_(backend_address), backend_service_(backend_service),
-            queries_(0), terminate_(false) { }
+            queries_(0), connections_(0), terminate_(false) { }
     ~DnsTlsFrontend() {
         stopServer();
     }
@@ -62,12 +63,23 @@ public:
     bool startServer();
     bool stopServer();
     int queries() const { return queries_; }
+    int connections() const { return connections_; }
     bool waitForQueries(int number, int timeoutMs) const;
     const std::vector<uint8_t>& fingerprint() const { return fingerprint_; }
+    // While set, new connections complete the handshake but are never answered. They are kept
+    // open until the server stops, like those of a server that has stopped responding.
+    void setHangOnQueries(bool hang) { hang_on_queries_ = hang; }
+    // The number of queries answered on a connection before the server closes it. Defaults to 1.
+    void setQueriesPerConnection(int queries) { queries_per_connection_ = queries; }
+    // The number of queries read from a connection before any of them is answered. They are then
+    // answered in reverse order, so only a client that pipelines its queries and matches
+    // responses by ID gets answers. Defaults to 1.
+    void setBatchSize(int queries) { batch_size_ = queries; }
 
 private:
     void requestHandler();
-    bool handleOneRequest(SSL* ssl);
+    // Reads |count| queries from |ssl|, then answers them in reverse order.
+    bool handleRequests(SSL* ssl, int count);
 
     std::string listen_address_;
     std::string listen_service_;
@@ -77,6 +89,12 @@ private:
     int socket_ = -1;
     int backend_socket_ = -1;
     std::atomic<int> queries_;
+    std::atomic<int> connections_;
+    std::atomic<bool> hang_on_queries_{false};
+    std::atomic<int> queries_per_connection_{1};
+    std::atomic<int> batch_size_{1};
+    // Only accessed by the handler thread, and by stopServer() once it has exited.
+    std::vector<std::pair<SSL*, int>> hung_connections_;
     std::atomic<bool> terminate_ GUARDED_BY(update_mutex_);
     std::thread handler_thread_ GUARDED_BY(update_mutex_);
     std::mutex update_mutex_;
@@ -829,6 +829,84 @@ TEST_F(ResolverTest, GetHostByName_Tls) {
     dns.stopServer();
 }
 
+TEST_F(ResolverTest, GetHostByName_TlsServerStopsAnswering) {
+    const char* listen_addr = "127.0.0.3";
+    const char* listen_udp = "53";
+    const char* listen_tls = "853";
+    const char* host_name1 = "tlshang1.example.com.";
+    const char* host_name2 = "tlshang2.example.com.";
+    test::DNSResponder dns(listen_addr, listen_udp, 250, ns_rcode::ns_r_servfail, 1.0);
+    dns.addMapping(host_name1, ns_type::ns_t_a, "1.2.3.1");
+    dns.addMapping(host_name2, ns_type::ns_t_a, "1.2.3.2");
+    ASSERT_TRUE(dns.startServer());
+    std::vector<std::string> servers = { listen_addr };
+
+    test::DnsTlsFrontend tls(listen_addr, listen_tls, listen_addr, listen_udp);
+    ASSERT_TRUE(tls.startServer());
+    auto rv = mNetdSrv->addPrivateDnsServer(listen_addr, 853, "", {});
+    ASSERT_TRUE(SetResolversForNetwork(mDefaultSearchDomains, servers, mDefaultParams));
+
+    // Wait for validation to complete.
+    EXPECT_TRUE(tls.waitForQueries(1, 5000));
+
+    // The server accepts the connection but never answers, so the query times out.
+    tls.setHangOnQueries(true);
+    const hostent* result = gethostbyname("tlshang1");
+    EXPECT_TRUE(result == nullptr);
+
+    // Once the server answers again, queries must not keep waiting on the connection on which
+    // the previous query timed out.
+    tls.setHangOnQueries(false);
+    result = gethostbyname("tlshang2");
+    ASSERT_FALSE(result == nullptr);
+    EXPECT_EQ("1.2.3.2", ToString(result));
+    EXPECT_TRUE(tls.waitForQueries(2, 5000));
+
+    rv = mNetdSrv->removePrivateDnsServer(listen_addr);
+    tls.stopServer();
+    dns.stopServer();
+}
+
+TEST_F(ResolverTest, GetHostByName_TlsServerRemovedFromNetwork) {
+    const char* listen_addr1 = "127.0.0.3";
+    const char* listen_addr2 = "127.0.0.4";
+    const char* listen_udp = "53";
+    const char* listen_tls = "853";
+    const char* host_name = "tlsremoved.example.com.";
+    test::DNSResponder dns1(listen_addr1, listen_udp, 250, ns_rcode::ns_r_servfail, 1.0);
+    test::DNSResponder dns2(listen_addr2, listen_udp, 250, ns_rcode::ns_r_servfail, 1.0);
+    dns1.addMapping(host_name, ns_type::ns_t_a, "1.2.3.1");
+    dns2.addMapping(host_name, ns_type::ns_t_a, "1.2.3.2");
+    ASSERT_TRUE(dns1.startServer());
+    ASSERT_TRUE(dns2.startServer());
+    std::vector<std::string> servers1 = { listen_addr1 };
+    std::vector<std::string> servers2 = { listen_addr2 };
+
+    test::DnsTlsFrontend tls(listen_addr1, listen_tls, listen_addr1, listen_udp);
+    ASSERT_TRUE(tls.startServer());
+    auto rv = mNetdSrv->addPrivateDnsServer(listen_addr1, 853, "", {});
+    ASSERT_TRUE(SetResolversForNetwork(mDefaultSearchDomains, servers1, mDefaultParams));
+
+    // Wait for validation to complete.
+    EXPECT_TRUE(tls.waitForQueries(1, 5000));
+
+    // Switch the network to another server and back. The earlier validation no longer counts,
+    // so the server is validated again before it is used.
+    ASSERT_TRUE(SetResolversForNetwork(mDefaultSearchDomains, servers2, mDefaultParams));
+    ASSERT_TRUE(SetResolversForNetwork(mDefaultSearchDomains, servers1, mDefaultParams));
+    EXPECT_TRUE(tls.waitForQueries(2, 5000));
+
+    const hostent* result = gethostbyname("tlsremoved");
+    ASSERT_FALSE(result == nullptr);
+    EXPECT_EQ("1.2.3.1", ToString(result));
+    EXPECT_TRUE(tls.waitForQueries(3, 5000));
+
+    rv = mNetdSrv->removePrivateDnsServer(listen_addr1);
+    tls.stopServer();
+    dns1.stopServer();
+    dns2.stopServer();
+}
+
 TEST_F(ResolverTest, GetHostByName_TlsFingerprint) {
     const char* listen_addr = "127.0.0.3";
     const char* listen_udp = "53";